@@ -14,6 +14,7 @@
 #include "global.hpp"
 
 #include "actions.hpp"
+#include "attack_prediction.hpp"
 #include "checksum.hpp"
 #include "display.hpp"
 #include "events.hpp"
@@ -33,6 +34,7 @@
 #include "replay.hpp"
 #include "sound.hpp"
 #include "statistics.hpp"
+#include "thread.hpp"
 #include "unit_display.hpp"
 #include "util.hpp"
 #include "video.hpp"
@@ -44,6 +46,7 @@
 #include "widgets/menu.hpp"
 
 #include <cmath>
+#include <map>
 #include <set>
 #include <string>
 #include <sstream>
@@ -104,13 +107,13 @@ bool can_recruit_on(const gamemap& map, const gamemap::location& leader, const g
 }
 
 std::string recruit_unit(const gamemap& map, int side,
-       std::map<gamemap::location,unit>& units, unit& new_unit,
+       unit_map& units, unit& new_unit,
        gamemap::location& recruit_location, display* disp, bool need_castle, bool full_movement)
 {
 	const command_disabler disable_commands;
 
 	LOG_NG << "recruiting unit for side " << side << "\n";
-	typedef std::map<gamemap::location,unit> units_map;
+	typedef unit_map units_map;
 
 	//find the unit that can recruit
 	units_map::const_iterator u = units.begin();
@@ -216,7 +219,7 @@ void validate_recruit_unit()
 
 }
 
-gamemap::location under_leadership(const std::map<gamemap::location,unit>& units,
+gamemap::location under_leadership(const unit_map& units,
                                    const gamemap::location& loc, int* bonus)
 {
 	gamemap::location adjacent[6];
@@ -257,63 +260,14 @@ static int compute_damage(int base_damage, int bonus, int divisor)
 	return maximum<int>(1, (base_damage * bonus + rounding) / divisor);
 }
 
-double pr_atleast(int m, double p, int n, int d)
-{
-	// calculate Pr[A does damage in [m,...)], where
-	// p probability to hit, n swings, d damage/swing
-	double P = 0.0;
-	// 0 damage can happen when unit has no attack of this type
-	if(d == 0)
-		return (m <= 0) ? 1.0 : P;
-	for(int k = (m + d - 1)/d; k <= n; ++k) {
-		double r = 1.0;
-		const int k2 = (k > n - k) ? (n - k) : k;
-		for(int i = 0; i < k2; ++i) { r *= (n-i); r /= (k2-i); }
-		P += r * pow(p, k) * pow(1-p, n-k);
-	}
-	return P;
-}
-
-double pr_between(int mn, int mx, double p, int n, int d)
-{
-	// calculate Pr[A does damage in [mn,mx)], where
-	// p probability to hit, n swings, d damage/swing
-	return pr_atleast(mn, p, n, d) - pr_atleast(mx, p, n, d);
-}
-
-int reduce(int i, int u, int v)
-{
-	// i-th swingpair, but reduce since u < v
-	if(i == 0)
-	    return i;
-	else
-	    return ((i-1) / v)*u + minimum<int>(u, ((i-1) % v) + 1);
-}
-
-double pr_kills_during(const int hpa, const int dmga, const double pa,
-	const int swa, const int hpb, const int dmgb, const double pb,
-	const int swb, const int n, const bool second)
-{
-	if ((swa < swb) && (swa < (n-1) % swb + 1)) // not our move
-		return 0.0;
-	// A kills B during swing n, and is it second?
-	// take into account where one unit doesn't get all n swings
-	const double t1 = pr_between(hpb - dmga, hpb, pa,
-		(swa<swb) ? reduce(n-1, swa, swb) : (n-1), dmga);
-	const int n2 = second ? n : (n - 1);
-	const double t2 = 1.0 - pr_atleast(hpa, pb,
-		(swa>swb) ? reduce(n2, swb, swa) : n2, dmgb);
-	return t1 * pa * t2;
-}
-
-battle_stats evaluate_battle_stats(const gamemap& map,
-                                   const gamemap::location& attacker,
-                                   const gamemap::location& defender,
-                                   int attack_with,
-                                   std::map<gamemap::location,unit>& units,
-                                   const gamestatus& state,
-                                   gamemap::TERRAIN attacker_terrain_override,
-                                   battle_stats_strings *strings)
+static battle_stats compute_battle_stats(const gamemap& map,
+                                        const gamemap::location& attacker,
+                                        const gamemap::location& defender,
+                                        int attack_with,
+                                        unit_map& units,
+                                        const gamestatus& state,
+                                        gamemap::TERRAIN attacker_terrain_override,
+                                        battle_stats_strings *strings)
 {
 	battle_stats res;
 
@@ -322,8 +276,8 @@ battle_stats evaluate_battle_stats(const gamemap& map,
 	if (strings)
 		strings->defend_name = _("none");
 
-	const std::map<gamemap::location,unit>::iterator a = units.find(attacker);
-	const std::map<gamemap::location,unit>::iterator d = units.find(defender);
+	const unit_map::iterator a = units.find(attacker);
+	const unit_map::iterator d = units.find(defender);
 
 	wassert(a != units.end());
 	wassert(d != units.end());
@@ -363,7 +317,7 @@ battle_stats evaluate_battle_stats(const gamemap& map,
 		}
 
 		if(i != 6) {
-			const std::map<gamemap::location,unit>::const_iterator u =
+			const unit_map::const_iterator u =
 			                    units.find(adj[(i+3)%6]);
 			if(u != units.end() && u->second.side() == a->second.side()) {
 				backstab = true;
@@ -649,35 +603,18 @@ battle_stats evaluate_battle_stats(const gamemap& map,
 	if(d->second.has_flag(slowed_string) && res.ndefends > 1)
 		--res.ndefends;
 
-	// FIXME: doesn't take into account berserk+slow or drain
-	if (strings && res.amount_attacker_drains == 0 &&
-		res.amount_defender_drains == 0 &&
-		!(res.to_the_death &&
-			(res.attacker_slows || res.defender_slows)))
-	{
-		const int maxrounds = (res.to_the_death ? 30 : 1);
-		const int hpa = a->second.hitpoints();
-		const int hpb = d->second.hitpoints();
-		const int dmga = res.damage_defender_takes;
-		const int dmgb = res.damage_attacker_takes;
-		const double pa = res.chance_to_hit_defender/100.0;
-		const double pb = res.chance_to_hit_attacker/100.0;
-		const int swa = res.nattacks;
-		const int swb = res.ndefends;
-		double P1 = 0;
-
-		for(int n = 1; n <= maxrounds*maximum<int>(swa,swb); ++n)
-			P1 += pr_kills_during(hpa, dmga, pa, swa,
-			hpb, dmgb, pb, swb, n, res.defender_strikes_first);
-		const double P3 = (1.0 - pr_atleast(hpb,pa,maxrounds*swa,dmga))
-			* (1.0 - pr_atleast(hpa,pb,maxrounds*swb,dmgb));
+	if(strings) {
+		const battle_prediction prediction = predict_battle(res, battle_unit(a->second), battle_unit(d->second));
+		const double P1 = prediction.defender_killed();
+		const double P2 = prediction.attacker_killed();
+		const double P3 = 1.0 - P1 - P2;
 		std::stringstream str;
 		if (P3 > 0.99) {
 			str << _("(both should survive)") << EMPTY_COLUMN;
 		} else {
 			str << _("% Pr[kills/killed by/both survive]")
 			    << EMPTY_COLUMN << (int)(P1*100+0.5)
-			    << '/' << (int)((1-P1-P3)*100+0.5)
+			    << '/' << (int)(P2*100+0.5)
 			    << '/' << (int)(P3*100+0.5);
 		}
 		strings->attack_calculations.push_back(str.str());
@@ -686,6 +623,115 @@ battle_stats evaluate_battle_stats(const gamemap& map,
 	return res;
 }
 
+namespace {
+
+//the battles evaluate_battle_stats has been asked about, other than the
+//state of the units and the time of day, which the whole cache is for
+struct battle_stats_key
+{
+	battle_stats_key(const gamemap::location& attacker, const gamemap::location& defender, int attack_with,
+	                 gamemap::TERRAIN attacker_terrain, gamemap::TERRAIN defender_terrain)
+		: attacker(attacker), defender(defender), attack_with(attack_with),
+		  attacker_terrain(attacker_terrain), defender_terrain(defender_terrain)
+	{}
+
+	bool operator<(const battle_stats_key& o) const {
+		if(attacker != o.attacker) {
+			return attacker < o.attacker;
+		}
+
+		if(defender != o.defender) {
+			return defender < o.defender;
+		}
+
+		if(attack_with != o.attack_with) {
+			return attack_with < o.attack_with;
+		}
+
+		if(attacker_terrain != o.attacker_terrain) {
+			return attacker_terrain < o.attacker_terrain;
+		}
+
+		return defender_terrain < o.defender_terrain;
+	}
+
+	gamemap::location attacker, defender;
+	int attack_with;
+	gamemap::TERRAIN attacker_terrain, defender_terrain;
+};
+
+//the cache is emptied when it grows this large
+const size_t max_cached_battle_stats = 10000;
+
+threading::mutex battle_stats_mutex;
+std::map<battle_stats_key,battle_stats> battle_stats_cache;
+
+//what the cached statistics were computed from. Leadership, backstab and
+//illumination depend on where units are, so any change to the units empties
+//the cache.
+const unit_map* battle_stats_units = NULL;
+size_t battle_stats_generation = 0;
+size_t battle_stats_turn = 0;
+
+battle_stats_cache_counters battle_stats_counters = { 0, 0 };
+
+}
+
+battle_stats evaluate_battle_stats(const gamemap& map,
+                                   const gamemap::location& attacker,
+                                   const gamemap::location& defender,
+                                   int attack_with,
+                                   unit_map& units,
+                                   const gamestatus& state,
+                                   gamemap::TERRAIN attacker_terrain_override,
+                                   battle_stats_strings *strings)
+{
+	//the strings are only wanted for the attack dialog, so they aren't cached
+	if(strings != NULL) {
+		return compute_battle_stats(map, attacker, defender, attack_with, units, state,
+		                            attacker_terrain_override, strings);
+	}
+
+	const gamemap::TERRAIN attacker_terrain = attacker_terrain_override ?
+	                 attacker_terrain_override : map[attacker.x][attacker.y];
+	const battle_stats_key key(attacker, defender, attack_with, attacker_terrain, map[defender.x][defender.y]);
+
+	{
+		const threading::lock lock(battle_stats_mutex);
+		if(battle_stats_units != &units || battle_stats_generation != unit_state_generation() ||
+		   battle_stats_turn != state.turn() || battle_stats_cache.size() >= max_cached_battle_stats) {
+			battle_stats_cache.clear();
+			battle_stats_units = &units;
+			battle_stats_generation = unit_state_generation();
+			battle_stats_turn = state.turn();
+		}
+
+		const std::map<battle_stats_key,battle_stats>::const_iterator i = battle_stats_cache.find(key);
+		if(i != battle_stats_cache.end()) {
+			++battle_stats_counters.hits;
+			return i->second;
+		}
+
+		++battle_stats_counters.misses;
+	}
+
+	const battle_stats res = compute_battle_stats(map, attacker, defender, attack_with, units, state,
+	                                              attacker_terrain, NULL);
+
+	const threading::lock lock(battle_stats_mutex);
+	if(battle_stats_units == &units && battle_stats_generation == unit_state_generation()) {
+		battle_stats_cache.insert(std::make_pair(key, res));
+	}
+
+	return res;
+}
+
+battle_stats_cache_counters battle_stats_cache_usage()
+{
+	const threading::lock lock(battle_stats_mutex);
+	return battle_stats_counters;
+}
+
 static std::string unit_dump(std::pair< gamemap::location, unit > const &u)
 {
 	std::stringstream s;
@@ -698,15 +744,15 @@ void attack(display& gui, const gamemap& map,
             gamemap::location attacker,
             gamemap::location defender,
             int attack_with,
-            std::map<gamemap::location,unit>& units,
+            unit_map& units,
             const gamestatus& state,
             const game_data& info)
 {
 	//stop the user from issuing any commands while the units are fighting
 	const command_disabler disable_commands;
 
-	std::map<gamemap::location,unit>::iterator a = units.find(attacker);
-	std::map<gamemap::location,unit>::iterator d = units.find(defender);
+	unit_map::iterator a = units.find(attacker);
+	unit_map::iterator d = units.find(defender);
 
 	if(a == units.end() || d == units.end()) {
 		return;
@@ -724,8 +770,9 @@ void attack(display& gui, const gamemap& map,
 	static const std::string night_invisible("nightstalk");
 	a->second.remove_flag(night_invisible);
 
-	battle_stats stats = evaluate_battle_stats(map, attacker, defender,
-	                                           attack_with, units, state);
+	//the statistics the fight is decided by are never taken from the cache
+	battle_stats stats = compute_battle_stats(map, attacker, defender,
+	                                          attack_with, units, state, 0, NULL);
 
 	statistics::attack_context attack_stats(a->second,d->second,stats);
 
@@ -1215,7 +1262,7 @@ bool will_heal(const gamemap::location& loc, int side, const std::vector<team>&
 }
 
 void calculate_healing(display& disp, const gamestatus& status, const gamemap& map,
-                       std::map<gamemap::location,unit>& units, int side,
+                       unit_map& units, int side,
 					   const std::vector<team>& teams)
 {
 	std::map<gamemap::location,int> healed_units, max_healing;
@@ -1223,7 +1270,7 @@ void calculate_healing(display& disp, const gamestatus& status, const gamemap& m
 	//a map of healed units to their healers
 	std::multimap<gamemap::location,gamemap::location> healers;
 
-	std::map<gamemap::location,unit>::iterator i;
+	unit_map::iterator i;
 	int amount_healed;
 	for(i = units.begin(); i != units.end(); ++i) {
 		amount_healed = 0;
@@ -1272,7 +1319,7 @@ void calculate_healing(display& disp, const gamestatus& status, const gamemap& m
 			int nhealed = 0;
 			int j;
 			for(j = 0; j != 6; ++j) {
-				const std::map<gamemap::location,unit>::const_iterator adj =
+				const unit_map::const_iterator adj =
 				                                   units.find(adjacent[j]);
 				if(adj != units.end() &&
 				   adj->second.hitpoints() < adj->second.max_hitpoints() &&
@@ -1488,11 +1535,11 @@ void calculate_healing(display& disp, const gamestatus& status, const gamemap& m
 }
 
 unit get_advanced_unit(const game_data& info,
-                  std::map<gamemap::location,unit>& units,
+                  unit_map& units,
                   const gamemap::location& loc, const std::string& advance_to)
 {
 	const std::map<std::string,unit_type>::const_iterator new_type = info.unit_types.find(advance_to);
-	const std::map<gamemap::location,unit>::iterator un = units.find(loc);
+	const unit_map::iterator un = units.find(loc);
 	if(new_type != info.unit_types.end() && un != units.end()) {
 		return unit(&(new_type->second),un->second);
 	} else {
@@ -1502,7 +1549,7 @@ unit get_advanced_unit(const game_data& info,
 }
 
 void advance_unit(const game_data& info,
-                  std::map<gamemap::location,unit>& units,
+                  unit_map& units,
                   gamemap::location loc, const std::string& advance_to)
 {
 	if(units.count(loc) == 0) {
@@ -1520,11 +1567,11 @@ void advance_unit(const game_data& info,
 	units.insert(std::pair<gamemap::location,unit>(loc,new_unit));
 }
 
-void check_victory(std::map<gamemap::location,unit>& units,
+void check_victory(unit_map& units,
                    std::vector<team>& teams)
 {
 	std::vector<int> seen_leaders;
-	for(std::map<gamemap::location,unit>::const_iterator i = units.begin();
+	for(unit_map::const_iterator i = units.begin();
 	    i != units.end(); ++i) {
 		if(i->second.can_recruit()) {
 			LOG_NG << "seen leader for side " << i->second.side() << "\n";
@@ -1604,7 +1651,7 @@ const time_of_day& timeofday_at(const gamestatus& status,const unit_map& units,c
 }
 
 int combat_modifier(const gamestatus& status,
-                    const std::map<gamemap::location,unit>& units,
+                    const unit_map& units,
 					const gamemap::location& loc,
 					unit_type::ALIGNMENT alignment)
 {
@@ -1835,7 +1882,7 @@ size_t move_unit(display* disp, const game_data& gamedata,
 			if(adjacent[i] == ui->first)
 				continue;
 
-			const std::map<gamemap::location,unit>::const_iterator it = units.find(adjacent[i]);
+			const unit_map::const_iterator it = units.find(adjacent[i]);
 			if(it != units.end() && teams[u.side()-1].is_enemy(it->second.side()) &&
 			   it->second.invisible(map.underlying_terrain(map[it->first.x][it->first.y]),
 			   status.get_time_of_day().lawful_bonus,it->first,units,teams)) {
@@ -89,18 +89,28 @@ battle_stats evaluate_battle_stats(const gamemap& map,
                                    const gamemap::location& attacker,
                                    const gamemap::location& defender,
                                    int attack_with,
-                                   std::map<gamemap::location,unit>& units,
+                                   unit_map& units,
                                    const gamestatus& state,
                                    gamemap::TERRAIN attacker_terrain_override = 0,
                                    battle_stats_strings *strings = NULL);
 
+//the number of times evaluate_battle_stats found the statistics it was
+//asked for in its cache, and the number of times it had to compute them.
+//The cache holds statistics for as long as the units and the turn stay the same.
+struct battle_stats_cache_counters
+{
+	int hits, misses;
+};
+
+battle_stats_cache_counters battle_stats_cache_usage();
+
 //attack: executes an attack.
 void attack(display& gui, const gamemap& map,
             std::vector<team>& teams,
             gamemap::location attacker,
             gamemap::location defender,
             int attack_with,
-            std::map<gamemap::location,unit>& units,
+            unit_map& units,
             const gamestatus& state,
             const game_data& info);
 
@@ -122,14 +132,14 @@ unit_map::const_iterator find_leader(const unit_map& units, int side);
 //calculates healing for all units for the given side. Should be called
 //at the beginning of a side's turn.
 void calculate_healing(display& disp, const gamestatus& status, const gamemap& map,
-                       std::map<gamemap::location,unit>& units, int side,
+                       unit_map& units, int side,
 					   const std::vector<team>& teams);
 
 //function which, given the location of a unit that is advancing, and the
 //name of the unit it is advancing to, will return the advanced version of
 //this unit. (with traits and items retained).
 unit get_advanced_unit(const game_data& info,
-                  std::map<gamemap::location,unit>& units,
+                  unit_map& units,
                   const gamemap::location& loc, const std::string& advance_to);
 
 //function which will advance the unit at loc to 'advance_to'.
@@ -137,7 +147,7 @@ unit get_advanced_unit(const game_data& info,
 //safely pass in a reference to the item in the map that we're going to delete,
 //since deletion would invalidate the reference.
 void advance_unit(const game_data& info,
-                  std::map<gamemap::location,unit>& units,
+                  unit_map& units,
                   gamemap::location loc, const std::string& advance_to);
 
 //function which tests if the unit at loc is currently affected
@@ -145,25 +155,25 @@ void advance_unit(const game_data& info,
 //if it does, then the location of the leader unit will be returned, otherwise
 //gamemap::location::null_location will be returned
 //if 'bonus' is not NULL, the % bonus will be stored in it
-gamemap::location under_leadership(const std::map<gamemap::location,unit>& units,
+gamemap::location under_leadership(const unit_map& units,
                                    const gamemap::location& loc, int* bonus=NULL);
 
 //checks to see if a side has won, and will throw an end_level_exception
 //if one has. Will also remove control of villages from sides  with dead leaders
-void check_victory(std::map<gamemap::location,unit>& units,
+void check_victory(unit_map& units,
                    std::vector<team>& teams);
 
 //gets the time of day at a certain tile. Certain tiles may have a time of
 //day that differs from 'the' time of day, if a unit that illuminates is
 //in that tile or adjacent.
 const time_of_day&  timeofday_at(const gamestatus& status,
-                              const std::map<gamemap::location,unit>& units,
+                              const unit_map& units,
                               const gamemap::location& loc);
 
 //returns the amount that a unit's damage should be multiplied by due to
 //the current time of day.
 int combat_modifier(const gamestatus& status,
-                    const std::map<gamemap::location,unit>& units,
+                    const unit_map& units,
 					const gamemap::location& loc,
 					unit_type::ALIGNMENT alignment);
 
@@ -207,7 +207,8 @@ ai::ai(ai_interface::info& info)
 	   : ai_interface(info), threats_found_(false), disp_(info.disp),
 	     map_(info.map), gameinfo_(info.gameinfo), units_(info.units),
 	     teams_(info.teams), team_num_(info.team_num),
-	     state_(info.state), consider_combat_(true), attack_depth_(0)
+	     state_(info.state), consider_combat_(true), attack_depth_(0),
+	     attack_analysis_threads_(0)
 {}
 
 bool ai::recruit_usage(const std::string& usage)
@@ -625,7 +626,11 @@ void ai::attack_enemy(const location& attacking_unit, const location& target, in
 
 void ai_interface::calculate_possible_moves(std::map<location,paths>& res, move_map& srcdst, move_map& dstsrc, bool enemy, bool assume_full_movement, const std::set<gamemap::location>* remove_destinations)
 {
-	for(std::map<gamemap::location,unit>::iterator un_it = info_.units.begin(); un_it != info_.units.end(); ++un_it) {
+	//units don't move during the calculation, so units of the same side can
+	//share the grid of the units and zones of control they have to avoid
+	std::map<int,threat_grid> threats;
+
+	for(unit_map::iterator un_it = info_.units.begin(); un_it != info_.units.end(); ++un_it) {
 		//if we are looking for the movement of enemies, then this unit must be an enemy unit
 		//if we are looking for movement of our own units, it must be on our side.
 		//if we are assuming full movement, then it may be a unit on our side, or allied
@@ -656,11 +661,19 @@ void ai_interface::calculate_possible_moves(std::map<location,paths>& res, move_
 			dstsrc.insert(trivial_mv);
 		}
 
+		const int side = un_it->second.side();
+		std::map<int,threat_grid>::iterator grid = threats.find(side);
+		if(grid == threats.end()) {
+			grid = threats.insert(std::pair<int,threat_grid>(side,
+			           threat_grid(info_.map,info_.state,info_.units,info_.teams,
+			                       info_.teams[side-1],side))).first;
+		}
+
 		const bool ignore_zocs = un_it->second.type().is_skirmisher();
 		const bool teleports = un_it->second.type().teleports();
 		res.insert(std::pair<gamemap::location,paths>(
 		                un_it->first,paths(info_.map,info_.state,info_.gameinfo,info_.units,
-		                un_it->first,info_.teams,ignore_zocs,teleports)));
+		                un_it->first,info_.teams,ignore_zocs,teleports,0,&grid->second)));
 	}
 
 	for(std::map<location,paths>::iterator m = res.begin(); m != res.end(); ++m) {
@@ -1936,9 +1949,12 @@ const ai::defensive_position& ai::best_defensive_position(const gamemap::locatio
 		return pos;
 	}
 
-	const std::map<location,defensive_position>::const_iterator position = defensive_position_cache_.find(loc);
-	if(position != defensive_position_cache_.end()) {
-		return position->second;
+	{
+		const threading::lock lock(analysis_mutex_);
+		const std::map<location,defensive_position>::const_iterator position = defensive_position_cache_.find(loc);
+		if(position != defensive_position_cache_.end()) {
+			return position->second;
+		}
 	}
 
 	defensive_position pos;
@@ -1965,8 +1981,10 @@ const ai::defensive_position& ai::best_defensive_position(const gamemap::locatio
 		}
 	}
 
-	defensive_position_cache_.insert(std::pair<location,defensive_position>(loc,pos));
-	return defensive_position_cache_[loc];
+	//another thread may have found the position meanwhile, in which case
+	//insert keeps the one found first
+	const threading::lock lock(analysis_mutex_);
+	return defensive_position_cache_.insert(std::pair<location,defensive_position>(loc,pos)).first->second;
 }
 
 void ai::invalidate_defensive_position_cache()
@@ -2063,3 +2081,14 @@ int ai::attack_depth() const
 	attack_depth_ = maximum<int>(1,lexical_cast_default<int>(parms["attack_depth"],5));
 	return attack_depth_;
 }
+
+int ai::attack_analysis_threads() const
+{
+	if(attack_analysis_threads_ > 0) {
+		return attack_analysis_threads_;
+	}
+
+	const config& parms = current_team().ai_parameters();
+	attack_analysis_threads_ = maximum<int>(1,lexical_cast_default<int>(parms["attack_analysis_threads"],1));
+	return attack_analysis_threads_;
+}
@@ -15,6 +15,7 @@
 
 #include "actions.hpp"
 #include "ai_interface.hpp"
+#include "thread.hpp"
 
 class ai : public ai_interface {
 public:
@@ -104,11 +105,13 @@ protected:
 
 	struct attack_analysis
 	{
-		void analyze(const gamemap& map, std::map<location,unit>& units, int sims,
+		void analyze(const gamemap& map, unit_map& units,
 		             class ai& ai_obj, const move_map& dstsrc, const move_map& srcdst,
 		             const move_map& enemy_dstsrc, const move_map& enemy_srcdst);
 
-		double rating(double aggression, class ai& ai_obj) const;
+		//interactive is false when rating from an analysis thread, which
+		//must not send messages to the display
+		double rating(double aggression, class ai& ai_obj, bool interactive=true) const;
 
 		gamemap::location target;
 		std::vector<std::pair<gamemap::location,gamemap::location> > movements;
@@ -157,6 +160,27 @@ protected:
 		bool uses_leader;
 	};
 
+	//the state of an analysis of attacks. On a single thread, all the targets
+	//share one context and one list of results, so that the limit on the
+	//number of positions and the best ratings found apply to all the targets
+	//together. On several threads each target has its own, so that targets are
+	//analyzed independently of each other; the limits then apply per target,
+	//and more attacks may be considered than on a single thread.
+	struct attack_analysis_context
+	{
+		explicit attack_analysis_context(bool interactive) : interactive(interactive)
+		{
+			std::fill(best_results, best_results + 6, 0.0);
+		}
+
+		//the best rating found so far for each number of attackers
+		double best_results[6];
+
+		//true if the analysis runs on the main thread, which may
+		//interact with the user
+		bool interactive;
+	};
+
 	virtual void do_attack_analysis(
 	                 const location& loc,
 	                 const move_map& srcdst, const move_map& dstsrc,
@@ -165,9 +189,30 @@ protected:
 					 const location* tiles, bool* used_locations,
 	                 std::vector<location>& units,
 	                 std::vector<attack_analysis>& result,
-					 attack_analysis& cur_analysis
+					 attack_analysis& cur_analysis,
+					 attack_analysis_context& context
 	                );
 
+	//finds all the attacks on the enemy unit at 'target' worth considering,
+	//using the units at 'units', and adds them to 'result'
+	void analyze_target(const location& target,
+	                    const move_map& srcdst, const move_map& dstsrc,
+	                    const move_map& fullmove_srcdst, const move_map& fullmove_dstsrc,
+	                    const move_map& enemy_srcdst, const move_map& enemy_dstsrc,
+	                    std::vector<location> units,
+	                    std::vector<attack_analysis>& result, attack_analysis_context& context);
+
+	//fills the caches which the attack analysis would otherwise fill lazily,
+	//so that analysis threads only read them
+	void prepare_attack_analysis_threads();
+
+	struct attack_analysis_job;
+	static int run_attack_analysis_job(void* data);
+
+	//serializes the access of analysis threads to the weapon choice and
+	//defensive position caches. It is only held to look into and add to them.
+	mutable threading::mutex analysis_mutex_;
+
 
 	//function which finds how much 'power' a side can attack a certain location with. This is basically
 	//the maximum hp of damage that can be inflicted upon a unit on loc by full-health units, multiplied by
@@ -262,6 +307,10 @@ protected:
 
 	int attack_depth() const;
 	mutable int attack_depth_;
+
+	//the number of threads analyze_targets uses
+	int attack_analysis_threads() const;
+	mutable int attack_analysis_threads_;
 };
 
 #endif
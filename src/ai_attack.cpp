@@ -15,6 +15,7 @@
 
 #include "actions.hpp"
 #include "ai.hpp"
+#include "attack_prediction.hpp"
 #include "game_config.hpp"
 #include "gamestatus.hpp"
 #include "log.hpp"
@@ -25,12 +26,45 @@
 #include <algorithm>
 #include <cstdlib>
 #include <iostream>
+#include <map>
 #include <set>
 
 #define LOG_AI LOG_STREAM(info, ai)
 
 const int max_positions = 10000;
 
+namespace {
+
+//the state of the target of an attack between two of the attacking units
+struct target_state
+{
+	target_state(int hitpoints, bool slowed, int experience)
+		: hitpoints(hitpoints), slowed(slowed), experience(experience)
+	{}
+
+	int hitpoints;
+
+	//true if the target got slowed by one of the previous attackers
+	bool slowed;
+
+	//the experience the target got from the previous attackers
+	int experience;
+
+	bool operator<(const target_state& o) const {
+		if(hitpoints != o.hitpoints) {
+			return hitpoints < o.hitpoints;
+		}
+
+		if(slowed != o.slowed) {
+			return slowed < o.slowed;
+		}
+
+		return experience < o.experience;
+	}
+};
+
+}
+
 //analyze possibility of attacking target on 'loc'
 void ai::do_attack_analysis(
 	                 const location& loc,
@@ -40,36 +74,38 @@ void ai::do_attack_analysis(
 					 const location* tiles, bool* used_locations,
 	                 std::vector<location>& units,
 	                 std::vector<attack_analysis>& result,
-					 attack_analysis& cur_analysis
+					 attack_analysis& cur_analysis,
+					 attack_analysis_context& context
 	                )
 {
 	//this function is called fairly frequently, so interact with the user here.
-	user_interact();
+	if(context.interactive) {
+		user_interact();
+	}
 
 	if(cur_analysis.movements.size() >= size_t(attack_depth()))
 		return;
 
-	static double best_results[6];
 	if(result.empty()) {
-		for(int i = 0; i != 6; ++i) {
-			best_results[i] = 0.0;
-		}
+		std::fill(context.best_results, context.best_results + 6, 0.0);
 	}
 
 	const size_t max_positions = 1000;
 	if(result.size() > max_positions && !cur_analysis.movements.empty()) {
-		LOG_AI << "cut analysis short with number of positions\n";
+		if(context.interactive) {
+			LOG_AI << "cut analysis short with number of positions\n";
+		}
 		return;
 	}
 
 	const double cur_rating = cur_analysis.movements.empty() ? -1.0 :
-	                          cur_analysis.rating(current_team().aggression(),*this);
+	                          cur_analysis.rating(current_team().aggression(),*this,context.interactive);
 
 	double rating_to_beat = cur_rating;
 
 	if(!cur_analysis.movements.empty()) {
 		wassert(cur_analysis.movements.size() < 6);
-		double& best_res = best_results[cur_analysis.movements.size()-1];
+		double& best_res = context.best_results[cur_analysis.movements.size()-1];
 		rating_to_beat = best_res = maximum(best_res,cur_rating);
 	}
 
@@ -182,15 +218,15 @@ void ai::do_attack_analysis(
 
 			cur_analysis.support += best_support;
 
-			cur_analysis.analyze(map_, units_, 50, *this, dstsrc, srcdst, enemy_dstsrc, enemy_srcdst);
+			cur_analysis.analyze(map_, units_, *this, dstsrc, srcdst, enemy_dstsrc, enemy_srcdst);
 
-			if(cur_analysis.rating(current_team().aggression(),*this) > rating_to_beat) {
+			if(cur_analysis.rating(current_team().aggression(),*this,context.interactive) > rating_to_beat) {
 
 				result.push_back(cur_analysis);
 				used_locations[cur_position] = true;
 				do_attack_analysis(loc,srcdst,dstsrc,fullmove_srcdst,fullmove_dstsrc,enemy_srcdst,enemy_dstsrc,
 				                   tiles,used_locations,
-				                   units,result,cur_analysis);
+				                   units,result,cur_analysis,context);
 				used_locations[cur_position] = false;
 			}
 
@@ -233,43 +269,45 @@ bool operator==(const battle_type& a, const battle_type& b)
 }
 
 std::set<battle_type> weapon_choice_cache;
+int weapon_choice_cache_hits = 0;
+int weapon_choice_cache_misses = 0;
 
 int ai::choose_weapon(const location& att, const location& def,
 					  battle_stats& cur_stats, gamemap::TERRAIN terrain, bool use_cache)
 {
-	const std::map<location,unit>::const_iterator itor = units_.find(att);
+	const unit_map::const_iterator itor = units_.find(att);
 	if(itor == units_.end())
 		return -1;
 
-	static int cache_hits = 0;
-	static int cache_misses = 0;
+	battle_type battle(att,def,terrain);
 
-	if(use_cache == false) {
-		weapon_choice_cache.clear();
-	}
+	//the cache is only locked to look the battle up and to add it, so that
+	//analysis threads choose their weapons at the same time
+	{
+		const threading::lock lock(analysis_mutex_);
 
-	battle_type battle(att,def,terrain);
-	const std::set<battle_type>::const_iterator cache_itor = weapon_choice_cache.find(battle);
+		if(use_cache == false) {
+			weapon_choice_cache.clear();
+		}
 
-	if(cache_itor != weapon_choice_cache.end()) {
-		wassert(*cache_itor == battle);
+		const std::set<battle_type>::const_iterator cache_itor = weapon_choice_cache.find(battle);
 
-		++cache_hits;
-		cur_stats = cache_itor->stats;
+		if(cache_itor != weapon_choice_cache.end()) {
+			wassert(*cache_itor == battle);
 
-		if(!(size_t(cache_itor->weapon) < itor->second.attacks().size())) {
-			LOG_STREAM(err, ai) << "cached illegal weapon: " << cache_itor->weapon
-			          << "/" << itor->second.attacks().size() << "\n";
-		}
+			++weapon_choice_cache_hits;
+			cur_stats = cache_itor->stats;
 
-		wassert(size_t(cache_itor->weapon) < itor->second.attacks().size());
-		return cache_itor->weapon;
-	}
+			if(!(size_t(cache_itor->weapon) < itor->second.attacks().size())) {
+				LOG_STREAM(err, ai) << "cached illegal weapon: " << cache_itor->weapon
+				          << "/" << itor->second.attacks().size() << "\n";
+			}
 
-	++cache_misses;
+			wassert(size_t(cache_itor->weapon) < itor->second.attacks().size());
+			return cache_itor->weapon;
+		}
 
-	if((cache_misses%100) == 0) {
-		LOG_AI << "cache_stats: " << cache_hits << ":" << cache_misses << " " << weapon_choice_cache.size() << "\n";
+		++weapon_choice_cache_misses;
 	}
 
 	int current_choice = -1;
@@ -302,12 +340,14 @@ int ai::choose_weapon(const location& att, const location& def,
 
 	battle.stats = cur_stats;
 	battle.weapon = current_choice;
+
+	const threading::lock lock(analysis_mutex_);
 	weapon_choice_cache.insert(battle);
 
 	return current_choice;
 }
 
-void ai::attack_analysis::analyze(const gamemap& map, unit_map& units, int num_sims, ai& ai_obj,
+void ai::attack_analysis::analyze(const gamemap& map, unit_map& units, ai& ai_obj,
                                   const ai::move_map& dstsrc, const ai::move_map& srcdst,
                                   const ai::move_map& enemy_dstsrc, const ai::move_map& enemy_srcdst)
 {
@@ -343,11 +383,9 @@ void ai::attack_analysis::analyze(const gamemap& map, unit_map& units, int num_s
 
 	const int target_max_hp = defend_it->second.max_hitpoints();
 	const int target_hp = defend_it->second.hitpoints();
-	static std::vector<int> hitpoints;
-	static std::vector<battle_stats> stats;
+	const battle_unit target_unit(defend_it->second);
+	std::vector<battle_stats> stats;
 
-	hitpoints.clear();
-	stats.clear();
 	weapons.clear();
 
 	std::vector<std::pair<location,location> >::const_iterator m;
@@ -359,156 +397,139 @@ void ai::attack_analysis::analyze(const gamemap& map, unit_map& units, int num_s
 		weapons.push_back(weapon);
 
 		stats.push_back(bat_stats);
-		hitpoints.push_back(units.find(m->first)->second.hitpoints());
 	}
 
-	for(int j = 0; j != num_sims; ++j) {
+	//the probability of each state the target may be in before each attack.
+	//Targets which get killed don't face the remaining attackers.
+	typedef std::map<target_state,double> target_state_map;
+	target_state_map states, next_states, killed;
+	states.insert(std::make_pair(target_state(target_hp,false,0),1.0));
 
-		int defenderxp = 0;
+	for(size_t i = 0; i != movements.size() && !states.empty(); ++i) {
+		const battle_stats& stat = stats[i];
 
-		bool defender_slowed = false;
+		unit_map::const_iterator att = units.find(movements[i].first);
+		const battle_unit attacker(att->second);
+		double cost = att->second.type().cost();
 
-		int defhp = target_hp;
-		for(size_t i = 0; i != movements.size() && defhp; ++i) {
-			const battle_stats& stat = stats[i];
-			int atthp = hitpoints[i];
-
-			int attacks = stat.nattacks;
-			int defends = stat.ndefends;
+		if(att->second.can_recruit()) {
+			uses_leader = true;
+		}
 
-			if(defender_slowed && defends > 1) {
-				--defends;
+		const bool on_village = map.is_village(movements[i].second);
 
-				//give an extra bonus based on slowing here
-				avg_damage_taken -= stat.damage_defender_takes;
-			}
+		//up to double the value of a unit based on experience
+		cost += (double(att->second.experience())/
+		         double(att->second.max_experience()))*cost;
 
-			unit_map::const_iterator att = units.find(movements[i].first);
-			double cost = att->second.type().cost();
+		double reached = 0.0;
+		for(target_state_map::const_iterator s = states.begin(); s != states.end(); ++s) {
+			reached += s->second;
+		}
 
-			if(att->second.can_recruit()) {
-				uses_leader = true;
-			}
+		terrain_quality += reached*(double(stat.chance_to_hit_attacker)/100.0)*cost * (on_village ? 0.5 : 1.0);
+		resources_used += reached*cost;
 
-			const bool on_village = map.is_village(movements[i].second);
+		const int xp_for_advance = att->second.max_experience() - att->second.experience();
 
-			//up to double the value of a unit based on experience
-			cost += (double(att->second.experience())/
-			         double(att->second.max_experience()))*cost;
+		next_states.clear();
+		for(target_state_map::const_iterator s = states.begin(); s != states.end(); ++s) {
+			battle_stats target_stat = stat;
+			if(s->first.slowed && target_stat.ndefends > 1) {
+				--target_stat.ndefends;
 
-			terrain_quality += (double(stat.chance_to_hit_attacker)/100.0)*cost * (on_village ? 0.5 : 1.0);
-			resources_used += cost;
+				//give an extra bonus based on slowing here
+				avg_damage_taken -= s->second*stat.damage_defender_takes;
+			}
 
-			bool defender_strikes_first = stat.defender_strikes_first;
+			const battle_unit defender(s->first.hitpoints,target_max_hp,
+			                           target_unit.slowed || s->first.slowed,target_unit.poisonable);
+			const battle_prediction prediction = predict_battle(target_stat,attacker,defender);
 
-			while(attacks || defends) {
-				if(attacks && !defender_strikes_first) {
-					const int roll = rand()%100;
-					if(roll < stat.chance_to_hit_defender) {
-						defhp -= stat.damage_defender_takes;
-						if(defhp <= 0) {
-							defhp = 0;
-							break;
-						}
+			std::vector<battle_outcome>::const_iterator o;
+			for(o = prediction.outcomes.begin(); o != prediction.outcomes.end(); ++o) {
+				const double p = s->second*o->probability;
+				const int defhp = o->defender_hp;
+				int atthp = o->attacker_hp;
 
-						atthp += stat.amount_attacker_drains;
-						if(atthp > hitpoints[i]) {
-							atthp = hitpoints[i];
-						}
+				//penalty for allowing plague is a 'negative' kill
+				if(atthp == 0 && stat.defender_plague) {
+					chance_to_kill -= p;
+				}
 
-						if(stat.attacker_slows && !defender_slowed && defend_it->second.has_flag("slowed") == false) {
-							defender_slowed = true;
-						}
+				const int xp = defend_it->second.type().level() * (defhp <= 0 ? game_config::kill_experience : 1);
+
+				//the reward for advancing a unit is to get a 'negative' loss of that unit
+				if(att->second.type().advances_to().empty() == false) {
+					if(xp >= xp_for_advance) {
+						avg_losses -= p*att->second.type().cost();
+
+						//ignore any damage done to this unit
+						atthp = attacker.hitpoints;
+					} else {
+						//the reward for getting a unit closer to advancement is to get
+						//the proportion of remaining experience needed, and multiply
+						//it by a quarter of the unit cost. This will cause the AI
+						//to heavily favor getting xp for close-to-advance units.
+						avg_losses -= p*((att->second.type().cost()*xp)/(xp_for_advance*4));
 					}
-
-					--attacks;
 				}
 
-				defender_strikes_first = false;
-
-				if(defends) {
-					const int roll = rand()%100;
-					if(roll < stat.chance_to_hit_attacker) {
-						atthp -= stat.damage_attacker_takes;
-						if(atthp <= 0) {
-							atthp = 0;
-
-							//penalty for allowing plague is a 'negative' kill
-							if(stat.defender_plague) {
-								chance_to_kill -= 1.0;
-							}
-							break;
-						}
-
-						defhp += stat.amount_defender_drains;
-						if(defhp > target_max_hp) {
-							defhp = target_max_hp;
-						}
+				if(defhp <= 0) {
+					//the reward for killing with a unit that
+					//plagues is to get a 'negative' loss of that unit
+					if(stat.attacker_plague) {
+						avg_losses -= p*att->second.type().cost();
 					}
 
-					--defends;
+					killed[target_state(0,false,s->first.experience)] += p;
+					continue;
+				} else if(atthp == 0) {
+					avg_losses += p*cost;
 				}
-			}
-
-			const int xp = defend_it->second.type().level() * (defhp <= 0 ? game_config::kill_experience : 1);
-
-			const int xp_for_advance = att->second.max_experience() - att->second.experience();
 
-			//the reward for advancing a unit is to get a 'negative' loss of that unit
-			if(att->second.type().advances_to().empty() == false) {
-				if(xp >= xp_for_advance) {
-					avg_losses -= att->second.type().cost();
-
-					//ignore any damage done to this unit
-					atthp = hitpoints[i];
-				} else {
-					//the reward for getting a unit closer to advancement is to get
-					//the proportion of remaining experience needed, and multiply
-					//it by a quarter of the unit cost. This will cause the AI
-					//to heavily favor getting xp for close-to-advance units.
-					avg_losses -= (att->second.type().cost()*xp)/(xp_for_advance*4);
+				//if the attacker moved onto a village, reward it for doing so
+				else if(on_village) {
+					atthp += game_config::cure_amount*2; //double reward to emphasize getting onto villages
 				}
-			}
 
-			if(defhp <= 0) {
-				//the reward for killing with a unit that
-				//plagues is to get a 'negative' loss of that unit
-				if(stat.attacker_plague) {
-					avg_losses -= att->second.type().cost();
-				}
+				const int defenderxp = s->first.experience +
+				        (atthp == 0 ? game_config::kill_experience:1)*att->second.type().level();
 
-				break;
-			} else if(atthp == 0) {
-				avg_losses += cost;
-			}
+				avg_damage_taken += p*(attacker.hitpoints - atthp);
 
-			//if the attacker moved onto a village, reward it for doing so
-			else if(on_village) {
-				atthp += game_config::cure_amount*2; //double reward to emphasize getting onto villages
+				next_states[target_state(defhp,s->first.slowed || o->defender_slowed,defenderxp)] += p;
 			}
+		}
 
-			defenderxp += (atthp == 0 ? game_config::kill_experience:1)*att->second.type().level();
+		states.swap(next_states);
+	}
 
-			avg_damage_taken += hitpoints[i] - atthp;
-		}
+	for(target_state_map::const_iterator k = killed.begin(); k != killed.end(); ++k) {
+		states[k->first] += k->second;
+	}
+
+	for(target_state_map::const_iterator s = states.begin(); s != states.end(); ++s) {
+		const double p = s->second;
+		int defhp = s->first.hitpoints;
 
 		//penalty for allowing advancement is a 'negative' kill, and
 		//defender's hitpoints get restored to maximum
 		if(defend_it->second.type().advances_to().empty() == false &&
 		   defend_it->second.experience() < defend_it->second.max_experience() &&
-		   defend_it->second.experience() + defenderxp >=
+		   defend_it->second.experience() + s->first.experience >=
 		   defend_it->second.max_experience()) {
-			chance_to_kill -= 1.0;
+			chance_to_kill -= p;
 			defhp = defend_it->second.hitpoints();
 		} else if(defhp == 0) {
-			chance_to_kill += 1.0;
+			chance_to_kill += p;
 		} else if(map.is_village(defend_it->first)) {
 			defhp += game_config::cure_amount;
 			if(defhp > target_hp)
 				defhp = target_hp;
 		}
 
-		avg_damage_inflicted += target_hp - defhp;
+		avg_damage_inflicted += p*(target_hp - defhp);
 	}
 
 	//calculate the 'alternative_terrain_quality' -- the best possible defensive values
@@ -527,19 +548,14 @@ void ai::attack_analysis::analyze(const gamemap& map, unit_map& units, int num_s
 
 	alternative_terrain_quality /= cost_sum*100;
 
-	chance_to_kill /= num_sims;
-	avg_damage_inflicted /= num_sims;
-	avg_damage_taken /= num_sims;
 	terrain_quality /= resources_used;
-	resources_used /= num_sims;
-	avg_losses /= num_sims;
 
 	if(uses_leader) {
 		leader_threat = false;
 	}
 }
 
-double ai::attack_analysis::rating(double aggression, ai& ai_obj) const
+double ai::attack_analysis::rating(double aggression, ai& ai_obj, bool interactive) const
 {
 	if(leader_threat) {
 		aggression = 1.0;
@@ -548,7 +564,9 @@ double ai::attack_analysis::rating(double aggression, ai& ai_obj) const
 	//only use the leader if we do a serious amount of damage
 	//compared to how much they do to us.
 	if(uses_leader && aggression > -4.0) {
-		LOG_AI << "uses leader..\n";
+		if(interactive) {
+			LOG_AI << "uses leader..\n";
+		}
 		aggression = -4.0;
 	}
 
@@ -561,9 +579,12 @@ double ai::attack_analysis::rating(double aggression, ai& ai_obj) const
 
 		const double exposure_mod = uses_leader ? 2.0 : ai_obj.current_team().caution();
 		const double exposure = exposure_mod*resources_used*(terrain_quality - alternative_terrain_quality)*vulnerability/maximum<double>(0.01,support);
-		LOG_AI << "attack option has base value " << value << " with exposure " << exposure << ": "
-			<< vulnerability << "/" << support << " = " << (vulnerability/maximum<double>(support,0.1)) << "\n";
-		if(uses_leader) {
+		if(interactive) {
+			LOG_AI << "attack option has base value " << value << " with exposure " << exposure << ": "
+				<< vulnerability << "/" << support << " = " << (vulnerability/maximum<double>(support,0.1)) << "\n";
+		}
+
+		if(uses_leader && interactive) {
 			ai_obj.log_message("attack option has value " + str_cast(value) + " with exposure " + str_cast(exposure) + ": " + str_cast(vulnerability) + "/" + str_cast(support));
 		}
 
@@ -595,15 +616,123 @@ double ai::attack_analysis::rating(double aggression, ai& ai_obj) const
 		value *= 5.0;
 	}
 
-	LOG_AI << "attack on " << target << ": attackers: " << movements.size()
-		<< " value: " << value << " chance to kill: " << chance_to_kill << " damage inflicted: "
-		<< avg_damage_inflicted << " damage taken: " << avg_damage_taken << " vulnerability: "
-		<< vulnerability << " support: " << support << " quality: " << terrain_quality
-		<< " alternative quality: " << alternative_terrain_quality << "\n";
+	if(interactive) {
+		LOG_AI << "attack on " << target << ": attackers: " << movements.size()
+			<< " value: " << value << " chance to kill: " << chance_to_kill << " damage inflicted: "
+			<< avg_damage_inflicted << " damage taken: " << avg_damage_taken << " vulnerability: "
+			<< vulnerability << " support: " << support << " quality: " << terrain_quality
+			<< " alternative quality: " << alternative_terrain_quality << "\n";
+	}
 
 	return value;
 }
 
+struct ai::attack_analysis_job
+{
+	attack_analysis_job(ai& ai_obj, const move_map& srcdst, const move_map& dstsrc,
+	                    const move_map& fullmove_srcdst, const move_map& fullmove_dstsrc,
+	                    const move_map& enemy_srcdst, const move_map& enemy_dstsrc,
+	                    const std::vector<location>& units, const std::vector<location>& targets)
+		: ai_obj(ai_obj), srcdst(srcdst), dstsrc(dstsrc),
+		  fullmove_srcdst(fullmove_srcdst), fullmove_dstsrc(fullmove_dstsrc),
+		  enemy_srcdst(enemy_srcdst), enemy_dstsrc(enemy_dstsrc),
+		  units(units), targets(targets), results(targets.size()),
+		  next_target(0), aborted(false)
+	{}
+
+	//analyzes targets until there are none left. The main thread takes part
+	//too, as the only interactive one.
+	void run(bool interactive);
+
+	ai& ai_obj;
+	const move_map &srcdst, &dstsrc, &fullmove_srcdst, &fullmove_dstsrc, &enemy_srcdst, &enemy_dstsrc;
+	const std::vector<location>& units;
+	const std::vector<location>& targets;
+
+	//the attacks found on each target, merged in the order of the targets
+	std::vector<std::vector<attack_analysis> > results;
+
+	threading::mutex mutex;
+	size_t next_target;
+	bool aborted;
+};
+
+void ai::attack_analysis_job::run(bool interactive)
+{
+	for(;;) {
+		size_t target;
+		{
+			const threading::lock lock(mutex);
+			if(aborted || next_target == targets.size()) {
+				return;
+			}
+
+			target = next_target++;
+		}
+
+		attack_analysis_context context(interactive);
+		ai_obj.analyze_target(targets[target],srcdst,dstsrc,fullmove_srcdst,fullmove_dstsrc,
+		                      enemy_srcdst,enemy_dstsrc,units,results[target],context);
+	}
+}
+
+int ai::run_attack_analysis_job(void* data)
+{
+	reinterpret_cast<attack_analysis_job*>(data)->run(false);
+	return 0;
+}
+
+void ai::analyze_target(const location& target,
+                        const move_map& srcdst, const move_map& dstsrc,
+                        const move_map& fullmove_srcdst, const move_map& fullmove_dstsrc,
+                        const move_map& enemy_srcdst, const move_map& enemy_dstsrc,
+                        std::vector<location> units,
+                        std::vector<attack_analysis>& result, attack_analysis_context& context)
+{
+	location adjacent[6];
+	get_adjacent_tiles(target,adjacent);
+
+	bool used_locations[6];
+	std::fill(used_locations,used_locations+6,false);
+
+	attack_analysis analysis;
+	analysis.target = target;
+	analysis.vulnerability = 0.0;
+	analysis.support = 0.0;
+
+	do_attack_analysis(target,srcdst,dstsrc,fullmove_srcdst,fullmove_dstsrc,enemy_srcdst,enemy_dstsrc,
+	            adjacent,used_locations,units,result,analysis,context);
+}
+
+void ai::prepare_attack_analysis_threads()
+{
+	//the teams learn who their enemies are on first use
+	for(std::vector<team>::const_iterator t = teams_.begin(); t != teams_.end(); ++t) {
+		t->is_enemy(teams_.size());
+	}
+
+	//unit movement types learn their costs and defense on each terrain on first use
+	std::set<gamemap::TERRAIN> terrains;
+	for(int x = 0; x != map_.x(); ++x) {
+		for(int y = 0; y != map_.y(); ++y) {
+			terrains.insert(map_[x][y]);
+		}
+	}
+
+	for(unit_map::const_iterator u = units_.begin(); u != units_.end(); ++u) {
+		u->second.type().id();
+		for(std::set<gamemap::TERRAIN>::const_iterator t = terrains.begin(); t != terrains.end(); ++t) {
+			u->second.movement_cost(map_,*t);
+			u->second.defense_modifier(map_,*t);
+		}
+	}
+
+	keeps();
+
+	//the parameters of the AI are read on first use
+	attack_depth();
+}
+
 std::vector<ai::attack_analysis> ai::analyze_targets(
 	             const move_map& srcdst, const move_map& dstsrc,
 	             const move_map& enemy_srcdst, const move_map& enemy_dstsrc
@@ -622,13 +751,11 @@ std::vector<ai::attack_analysis> ai::analyze_targets(
 		}
 	}
 
-	bool used_locations[6];
-	std::fill(used_locations,used_locations+6,false);
-
 	std::map<location,paths> dummy_moves;
 	move_map fullmove_srcdst, fullmove_dstsrc;
 	calculate_possible_moves(dummy_moves,fullmove_srcdst,fullmove_dstsrc,false,true);
 
+	std::vector<location> targets;
 	for(unit_map::const_iterator j = units_.begin(); j != units_.end(); ++j) {
 
 		//attack anyone who is on the enemy side, and who is not invisible or turned to stone
@@ -636,35 +763,57 @@ std::vector<ai::attack_analysis> ai::analyze_targets(
 		   j->second.invisible(map_.underlying_terrain(map_[j->first.x][j->first.y]),
 				state_.get_time_of_day().lawful_bonus,j->first,
 				units_,teams_) == false) {
-			location adjacent[6];
-			get_adjacent_tiles(j->first,adjacent);
-			attack_analysis analysis;
-			analysis.target = j->first;
-			analysis.vulnerability = 0.0;
-			analysis.support = 0.0;
-
-			const int ticks = SDL_GetTicks();
-
-			do_attack_analysis(j->first,srcdst,dstsrc,fullmove_srcdst,fullmove_dstsrc,enemy_srcdst,enemy_dstsrc,
-			            adjacent,used_locations,unit_locs,res,analysis);
-
-			const int time_taken = SDL_GetTicks() - ticks;
-			static int max_time = 0;
-			if(time_taken > max_time)
-				max_time = time_taken;
+			targets.push_back(j->first);
 		}
 	}
 
+	const size_t nthreads = minimum<size_t>(attack_analysis_threads(),targets.size());
+	if(nthreads <= 1) {
+		//the targets share their results, so that the limit on the number
+		//of positions and the ratings to beat apply to all of them
+		attack_analysis_context context(true);
+		for(std::vector<location>::const_iterator t = targets.begin(); t != targets.end(); ++t) {
+			analyze_target(*t,srcdst,dstsrc,fullmove_srcdst,fullmove_dstsrc,
+			               enemy_srcdst,enemy_dstsrc,unit_locs,res,context);
+		}
+	} else {
+		attack_analysis_job job(*this,srcdst,dstsrc,fullmove_srcdst,fullmove_dstsrc,
+		                        enemy_srcdst,enemy_dstsrc,unit_locs,targets);
+
+		{
+			threading::thread_pool pool(job.aborted,job.mutex);
+
+			prepare_attack_analysis_threads();
+			for(size_t n = 1; n < nthreads; ++n) {
+				pool.add_thread(run_attack_analysis_job,&job);
+			}
+
+			job.run(true);
+		}
+
+		for(std::vector<std::vector<attack_analysis> >::const_iterator r = job.results.begin();
+		    r != job.results.end(); ++r) {
+			res.insert(res.end(),r->begin(),r->end());
+		}
+	}
+
+	LOG_AI << "weapon choice cache: " << weapon_choice_cache_hits << " hits, "
+	       << weapon_choice_cache_misses << " misses, " << weapon_choice_cache.size() << " battles\n";
+
+	const battle_stats_cache_counters battle_stats_usage = battle_stats_cache_usage();
+	LOG_AI << "battle stats cache: " << battle_stats_usage.hits << " hits, "
+	       << battle_stats_usage.misses << " misses\n";
+
 	return res;
 }
 
 double ai::power_projection(const gamemap::location& loc, const move_map& srcdst, const move_map& dstsrc, bool use_terrain) const
 {
-	static gamemap::location used_locs[6];
-	static double ratings[6];
+	gamemap::location used_locs[6];
+	double ratings[6];
 	int num_used_locs = 0;
 
-	static gamemap::location locs[6];
+	gamemap::location locs[6];
 	get_adjacent_tiles(loc,locs);
 
 	const int lawful_bonus = state_.get_time_of_day().lawful_bonus;
@@ -0,0 +1,346 @@
+/* $Id$ */
+/*
+   Copyright (C) 2003 by David White <davidnwhite@verizon.net>
+   Part of the Battle for Wesnoth Project http://www.wesnoth.org/
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License.
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY.
+
+   See the COPYING file for more details.
+*/
+
+#include "global.hpp"
+
+#include "attack_prediction.hpp"
+#include "thread.hpp"
+#include "unit.hpp"
+#include "util.hpp"
+
+#include <algorithm>
+#include <map>
+
+battle_unit::battle_unit(const unit& u)
+	: hitpoints(u.hitpoints()), max_hitpoints(u.max_hitpoints()),
+	  slowed(u.has_flag("slowed")),
+	  poisonable(!u.has_flag("poisoned") && !u.type().not_living())
+{}
+
+battle_unit::battle_unit(int hitpoints, int max_hitpoints, bool slowed, bool poisonable)
+	: hitpoints(hitpoints), max_hitpoints(max_hitpoints), slowed(slowed), poisonable(poisonable)
+{}
+
+namespace {
+
+//the state of a battle between two strikes. The members mirror the
+//variables attack() keeps while resolving a battle.
+struct fight_state
+{
+	int attacker_hp, defender_hp;
+	int nattacks, ndefends, orig_attacks, orig_defends, rounds;
+	bool defender_strikes_first;
+
+	//true if the unit has been hit at least once
+	bool attacker_hit, defender_hit;
+
+	bool operator<(const fight_state& o) const {
+		const int a[] = { attacker_hp, defender_hp, nattacks, ndefends, orig_attacks, orig_defends,
+		                  rounds, defender_strikes_first, attacker_hit, defender_hit };
+		const int b[] = { o.attacker_hp, o.defender_hp, o.nattacks, o.ndefends, o.orig_attacks, o.orig_defends,
+		                  o.rounds, o.defender_strikes_first, o.attacker_hit, o.defender_hit };
+		return std::lexicographical_compare(a, a + sizeof(a)/sizeof(*a), b, b + sizeof(b)/sizeof(*b));
+	}
+};
+
+typedef std::map<fight_state,double> state_map;
+
+const std::string poison_string("poison");
+const std::string stone_string("stone");
+
+class fight
+{
+public:
+	fight(const battle_stats& stats, const battle_unit& attacker, const battle_unit& defender);
+
+	void predict(battle_prediction& res);
+
+private:
+	//the two halves of an iteration of the loop in attack(), followed
+	//by the check for another round of a fight to the death
+	void attacker_strikes(fight_state s, double p, state_map& next);
+	void defender_strikes(fight_state s, double p, state_map& next);
+	void end_iteration(fight_state s, double p, state_map& next);
+
+	//records that the battle ends in state 's' with probability 'p'
+	void end_battle(const fight_state& s, double p);
+
+	const battle_stats& stats_;
+	const battle_unit &attacker_, &defender_;
+	const double attacker_cth_, defender_cth_;
+	const bool attacker_poisons_, defender_poisons_, attacker_stones_, defender_stones_;
+
+	//the probability of each end state, with the fields which don't matter
+	//once the battle is over zeroed, so that equivalent states are merged
+	state_map ends_;
+};
+
+fight::fight(const battle_stats& stats, const battle_unit& attacker, const battle_unit& defender)
+	: stats_(stats), attacker_(attacker), defender_(defender),
+	  attacker_cth_(stats.chance_to_hit_defender/100.0),
+	  defender_cth_(stats.chance_to_hit_attacker/100.0),
+	  attacker_poisons_(stats.attacker_special == poison_string),
+	  defender_poisons_(stats.defender_special == poison_string),
+	  attacker_stones_(stats.attacker_special == stone_string),
+	  defender_stones_(stats.defender_special == stone_string)
+{}
+
+void fight::attacker_strikes(fight_state s, double p, state_map& next)
+{
+	if(s.nattacks <= 0 || s.defender_strikes_first) {
+		defender_strikes(s, p, next);
+		return;
+	}
+
+	if(attacker_cth_ > 0.0) {
+		fight_state hit = s;
+		hit.defender_hp -= stats_.damage_defender_takes;
+		if(hit.defender_hp <= 0) {
+			hit.defender_hp = 0;
+			end_battle(hit, p*attacker_cth_);
+		} else {
+			if(hit.attacker_hp < attacker_.max_hitpoints) {
+				hit.attacker_hp = minimum<int>(attacker_.max_hitpoints,
+				                               hit.attacker_hp + stats_.amount_attacker_drains);
+			}
+
+			if(stats_.attacker_slows && !defender_.slowed && !hit.defender_hit && hit.orig_defends > 1) {
+				if(hit.ndefends > 0) {
+					--hit.ndefends;
+				}
+
+				--hit.orig_defends;
+			}
+
+			hit.defender_hit = true;
+
+			if(attacker_stones_) {
+				hit.nattacks = 0;
+				hit.ndefends = 0;
+			}
+
+			--hit.nattacks;
+			defender_strikes(hit, p*attacker_cth_, next);
+		}
+	}
+
+	if(attacker_cth_ < 1.0) {
+		--s.nattacks;
+		defender_strikes(s, p*(1.0 - attacker_cth_), next);
+	}
+}
+
+void fight::defender_strikes(fight_state s, double p, state_map& next)
+{
+	s.defender_strikes_first = false;
+
+	if(s.ndefends <= 0) {
+		end_iteration(s, p, next);
+		return;
+	}
+
+	if(defender_cth_ > 0.0) {
+		fight_state hit = s;
+		hit.attacker_hp -= stats_.damage_attacker_takes;
+		if(hit.attacker_hp <= 0) {
+			hit.attacker_hp = 0;
+			end_battle(hit, p*defender_cth_);
+		} else {
+			if(hit.defender_hp < defender_.max_hitpoints) {
+				hit.defender_hp = minimum<int>(defender_.max_hitpoints,
+				                               hit.defender_hp + stats_.amount_defender_drains);
+			}
+
+			if(stats_.defender_slows && !attacker_.slowed && !hit.attacker_hit && hit.orig_attacks > 1) {
+				if(hit.nattacks > 0) {
+					--hit.nattacks;
+				}
+
+				--hit.orig_attacks;
+			}
+
+			hit.attacker_hit = true;
+
+			if(defender_stones_) {
+				hit.nattacks = 0;
+				hit.ndefends = 0;
+			}
+
+			--hit.ndefends;
+			end_iteration(hit, p*defender_cth_, next);
+		}
+	}
+
+	if(defender_cth_ < 1.0) {
+		--s.ndefends;
+		end_iteration(s, p*(1.0 - defender_cth_), next);
+	}
+}
+
+void fight::end_iteration(fight_state s, double p, state_map& next)
+{
+	if(s.rounds > 0 && s.nattacks == 0 && s.ndefends == 0) {
+		s.nattacks = s.orig_attacks;
+		s.ndefends = s.orig_defends;
+		--s.rounds;
+	}
+
+	if(s.nattacks > 0 || s.ndefends > 0) {
+		next[s] += p;
+	} else {
+		end_battle(s, p);
+	}
+}
+
+void fight::end_battle(const fight_state& s, double p)
+{
+	fight_state end = s;
+	end.nattacks = end.ndefends = end.orig_attacks = end.orig_defends = end.rounds = 0;
+	end.defender_strikes_first = false;
+	ends_[end] += p;
+}
+
+void fight::predict(battle_prediction& res)
+{
+	fight_state start;
+	start.attacker_hp = attacker_.hitpoints;
+	start.defender_hp = defender_.hitpoints;
+	start.nattacks = start.orig_attacks = stats_.nattacks;
+	start.ndefends = start.orig_defends = stats_.ndefends;
+	start.rounds = stats_.to_the_death ? 30 : 0;
+	start.defender_strikes_first = stats_.defender_strikes_first;
+	start.attacker_hit = start.defender_hit = false;
+
+	//advance all the states of the battle by one iteration at a time, so
+	//that equivalent states reached by different strikes are merged
+	state_map states, next;
+	states[start] = 1.0;
+	while(!states.empty()) {
+		for(state_map::const_iterator i = states.begin(); i != states.end(); ++i) {
+			attacker_strikes(i->first, i->second, next);
+		}
+
+		states.swap(next);
+		next.clear();
+	}
+
+	res.outcomes.clear();
+	res.attacker_hp.assign(maximum<int>(attacker_.hitpoints,attacker_.max_hitpoints) + 1, 0.0);
+	res.defender_hp.assign(maximum<int>(defender_.hitpoints,defender_.max_hitpoints) + 1, 0.0);
+	res.attacker_slowed = res.defender_slowed = 0.0;
+	res.attacker_poisoned = res.defender_poisoned = 0.0;
+
+	for(state_map::const_iterator e = ends_.begin(); e != ends_.end(); ++e) {
+		const fight_state& s = e->first;
+
+		battle_outcome outcome;
+		outcome.attacker_hp = s.attacker_hp;
+		outcome.defender_hp = s.defender_hp;
+		outcome.attacker_slowed = stats_.defender_slows && !attacker_.slowed && s.attacker_hit && s.attacker_hp > 0;
+		outcome.defender_slowed = stats_.attacker_slows && !defender_.slowed && s.defender_hit && s.defender_hp > 0;
+		outcome.attacker_poisoned = defender_poisons_ && attacker_.poisonable && s.attacker_hit && s.attacker_hp > 0;
+		outcome.defender_poisoned = attacker_poisons_ && defender_.poisonable && s.defender_hit && s.defender_hp > 0;
+		outcome.probability = e->second;
+		res.outcomes.push_back(outcome);
+
+		res.attacker_hp[outcome.attacker_hp] += outcome.probability;
+		res.defender_hp[outcome.defender_hp] += outcome.probability;
+		if(outcome.attacker_slowed) {
+			res.attacker_slowed += outcome.probability;
+		}
+
+		if(outcome.defender_slowed) {
+			res.defender_slowed += outcome.probability;
+		}
+
+		if(outcome.attacker_poisoned) {
+			res.attacker_poisoned += outcome.probability;
+		}
+
+		if(outcome.defender_poisoned) {
+			res.defender_poisoned += outcome.probability;
+		}
+	}
+}
+
+//everything about a battle which predict_battle takes into account
+struct prediction_key
+{
+	prediction_key(const battle_stats& stats, const battle_unit& attacker, const battle_unit& defender)
+	{
+		int* v = values;
+		*v++ = stats.chance_to_hit_attacker;
+		*v++ = stats.chance_to_hit_defender;
+		*v++ = stats.damage_attacker_takes;
+		*v++ = stats.damage_defender_takes;
+		*v++ = stats.amount_attacker_drains;
+		*v++ = stats.amount_defender_drains;
+		*v++ = stats.nattacks;
+		*v++ = stats.ndefends;
+		*v++ = stats.attacker_slows;
+		*v++ = stats.defender_slows;
+		*v++ = stats.to_the_death;
+		*v++ = stats.defender_strikes_first;
+		*v++ = stats.attacker_special == poison_string ? 1 : (stats.attacker_special == stone_string ? 2 : 0);
+		*v++ = stats.defender_special == poison_string ? 1 : (stats.defender_special == stone_string ? 2 : 0);
+		*v++ = attacker.hitpoints;
+		*v++ = attacker.max_hitpoints;
+		*v++ = attacker.slowed;
+		*v++ = attacker.poisonable;
+		*v++ = defender.hitpoints;
+		*v++ = defender.max_hitpoints;
+		*v++ = defender.slowed;
+		*v++ = defender.poisonable;
+	}
+
+	bool operator<(const prediction_key& o) const {
+		return std::lexicographical_compare(values, values + nvalues, o.values, o.values + nvalues);
+	}
+
+	enum { nvalues = 22 };
+	int values[nvalues];
+};
+
+//the cache is emptied when it grows this large, like the AI's caches are
+//emptied every turn
+const size_t max_cached_predictions = 10000;
+
+threading::mutex prediction_mutex;
+std::map<prediction_key,battle_prediction> prediction_cache;
+
+}
+
+battle_prediction predict_battle(const battle_stats& stats,
+                                 const battle_unit& attacker, const battle_unit& defender)
+{
+	const prediction_key key(stats, attacker, defender);
+
+	{
+		const threading::lock lock(prediction_mutex);
+		const std::map<prediction_key,battle_prediction>::const_iterator i = prediction_cache.find(key);
+		if(i != prediction_cache.end()) {
+			return i->second;
+		}
+	}
+
+	battle_prediction res;
+	fight(stats, attacker, defender).predict(res);
+
+	const threading::lock lock(prediction_mutex);
+	if(prediction_cache.size() >= max_cached_predictions) {
+		prediction_cache.clear();
+	}
+
+	prediction_cache.insert(std::make_pair(key, res));
+	return res;
+}
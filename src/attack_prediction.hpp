@@ -0,0 +1,79 @@
+/* $Id$ */
+/*
+   Copyright (C) 2003 by David White <davidnwhite@verizon.net>
+   Part of the Battle for Wesnoth Project http://www.wesnoth.org/
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License.
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY.
+
+   See the COPYING file for more details.
+*/
+
+#ifndef ATTACK_PREDICTION_HPP_INCLUDED
+#define ATTACK_PREDICTION_HPP_INCLUDED
+
+#include "actions.hpp"
+
+#include <vector>
+
+class unit;
+
+//the state of one of the units taking part in a battle, as far as the
+//outcome of the battle is concerned
+struct battle_unit
+{
+	explicit battle_unit(const unit& u);
+	battle_unit(int hitpoints, int max_hitpoints, bool slowed, bool poisonable);
+
+	int hitpoints, max_hitpoints;
+
+	//true if the unit is already slowed, and so can't be slowed again
+	bool slowed;
+
+	//true if the unit can be poisoned: it is living, and not already poisoned
+	bool poisonable;
+};
+
+//one of the ways a battle may end
+struct battle_outcome
+{
+	int attacker_hp, defender_hp;
+
+	//true if the unit got slowed or poisoned during the battle, and survived it
+	bool attacker_slowed, defender_slowed;
+	bool attacker_poisoned, defender_poisoned;
+
+	double probability;
+};
+
+//the exact probability distribution of the ways a battle may end
+struct battle_prediction
+{
+	//all the distinct ways the battle may end. Their probabilities sum to 1.
+	std::vector<battle_outcome> outcomes;
+
+	//the probability of each unit being left with each number of hitpoints.
+	//Element 0 is the probability of the unit being killed.
+	std::vector<double> attacker_hp, defender_hp;
+
+	//the probability of each unit getting slowed or poisoned during the battle
+	double attacker_slowed, defender_slowed;
+	double attacker_poisoned, defender_poisoned;
+
+	double attacker_killed() const { return attacker_hp.front(); }
+	double defender_killed() const { return defender_hp.front(); }
+};
+
+//predict_battle: computes the outcome of the battle described by 'stats'
+//between 'attacker' and 'defender', strike by strike, in the same way
+//attack() resolves it. This takes into account drain, slow, poison, stone,
+//and fights to the death.
+//
+//predictions are cached, so that predicting the same battle again is cheap.
+//This function may be called from several threads at once.
+battle_prediction predict_battle(const battle_stats& stats,
+                                 const battle_unit& attacker, const battle_unit& defender);
+
+#endif
@@ -18,11 +18,14 @@
 #include "config.hpp"
 #include "log.hpp"
 #include "pathutils.hpp"
+#include "preferences.hpp"
 #include "terrain.hpp"
+#include "thread.hpp"
 #include "util.hpp"
 #include "wassert.hpp"
 #include "serialization/string_utils.hpp"
 
+#include <algorithm>
 #include <climits>
 
 #define ERR_NG LOG_STREAM(err, engine)
@@ -150,6 +153,7 @@ terrain_builder::terrain_builder(const config& cfg, const config& level, const g
 {
 	parse_config(cfg);
 	parse_config(level);
+	index_rules();
 	build_terrains();
 	//rebuild_terrain(gamemap::location(0,0));
 }
@@ -219,15 +223,58 @@ void terrain_builder::rebuild_terrain(const gamemap::location &loc)
 		animated<image::locator> img_loc("terrain/" + filename + ".png");
 		img_loc.start_animation(0, animated<image::locator>::INFINITE_CYCLES);
 		btile.images_background.push_back(img_loc);
+		quick_rebuilt_.insert(loc);
 	}
 }
 
 void terrain_builder::rebuild_all()
 {
-	tile_map_.reset();
-	terrain_by_type_.clear();
-	terrain_by_type_border_.clear();
-	build_terrains();
+	std::set<gamemap::location> changed = quick_rebuilt_;
+	quick_rebuilt_.clear();
+
+	//the neighbours of a changed tile are rebuilt too, as rules may be
+	//tried at a tile depending on whether it is a border tile
+	for(int x = -1; x <= map_.x(); ++x) {
+		for(int y = -1; y <= map_.y(); ++y) {
+			const gamemap::location loc(x,y);
+			const gamemap::TERRAIN *adjacents = tile_map_[loc].adjacents;
+
+			gamemap::location adj[6];
+			get_adjacent_tiles(loc, adj);
+
+			bool same = adjacents[0] == map_.get_terrain(loc);
+			for(int i = 0; same && i < 6; ++i) {
+				same = adjacents[i+1] == map_.get_terrain(adj[i]);
+			}
+
+			if(!same) {
+				changed.insert(loc);
+			}
+		}
+	}
+
+	if(changed.empty()) {
+		return;
+	}
+
+	index_terrains();
+
+	//when much of the map changed, rebuilding it all is quicker. It is
+	//needed when a rule would now be tried at the tiles of another
+	//constraint, as the order in which it is applied changes.
+	bool rebuild = changed.size() > size_t((map_.x()+2)*(map_.y()+2)/4);
+	for(size_t rule = 0; !rebuild && rule != rules_.size(); ++rule) {
+		if(rule_indices_[rule] != -1 && find_rule_anchor(*rules_[rule]) != rule_anchors_[rule])
+			rebuild = true;
+	}
+
+	if(rebuild) {
+		tile_map_.reset();
+		build_terrains();
+		return;
+	}
+
+	rebuild_terrains(changed);
 }
 
 bool terrain_builder::rule_valid(const building_rule &rule)
@@ -546,8 +593,10 @@ void terrain_builder::add_constraints(
 		constraints[loc] = terrain_constraint(loc);
 	}
 
-	if(!type.empty())
+	if(!type.empty()) {
 		constraints[loc].terrain_types = type;
+		constraints[loc].terrain_letters = compile_terrains(type);
+	}
 
 	int x = loc.x * rule_image::TILEWIDTH * 3 / 4;
 	int y = loc.y * rule_image::TILEWIDTH + (loc.x % 2) *
@@ -801,7 +850,55 @@ bool terrain_builder::terrain_matches(gamemap::TERRAIN letter, const std::string
 	return !negative;
 }
 
-bool terrain_builder::rule_matches(const terrain_builder::building_rule &rule, const gamemap::location &loc, int rule_index, bool check_loc)
+terrain_builder::terrain_set terrain_builder::compile_terrains(const std::string &terrains)
+{
+	terrain_set res;
+	if(terrains.empty())
+		return res.set();
+
+	//each letter is decided by the first '*' or occurence of the letter in
+	//the list, as in terrain_matches. The letters which are in neither case
+	//match if the list contains a '!'.
+	terrain_set decided;
+	bool negative = false;
+	for(std::string::const_iterator itor = terrains.begin(); itor != terrains.end(); ++itor) {
+		if(*itor == '*')
+			return res |= ~decided;
+		if(*itor == '!') {
+			negative = true;
+			continue;
+		}
+
+		const unsigned char letter = static_cast<unsigned char>(*itor);
+		if(!decided.test(letter)) {
+			decided.set(letter);
+			res.set(letter, !negative);
+		}
+	}
+
+	if(negative)
+		res |= ~decided;
+
+	return res;
+}
+
+namespace {
+
+//the pseudo-random number, from 0 to 99, which decides whether a rule with
+//a probability matches at a given location
+unsigned int rule_random(const gamemap::location &loc, int rule_index)
+{
+	unsigned int a = (loc.x + 92872973) ^ 918273;
+	unsigned int b = (loc.y + 1672517) ^ 128123;
+	unsigned int c = (rule_index + 127390) ^ 13923787;
+	unsigned int random = a*b*c + a*b + b*c + a*c + a + b + c;
+
+	return random % 100;
+}
+
+}
+
+bool terrain_builder::rule_matches(const terrain_builder::building_rule &rule, const gamemap::location &loc, int rule_index, bool check_loc) const
 {
 	if(rule.location_constraints.valid() && rule.location_constraints != loc)
 		return false;
@@ -817,23 +914,21 @@ bool terrain_builder::rule_matches(const terrain_builder::building_rule &rule, c
 			if(!tile_map_.on_map(tloc))
 				return false;
 
-			if(!terrain_matches(map_.get_terrain(tloc), cons->second.terrain_types))
+			//the terrain of the tile is read from the tile, not from the
+			//map, which caches the terrain of border tiles as it is asked
+			if(!terrain_matches(tile_map_[tloc].adjacents[0], cons->second.terrain_letters))
 				return false;
 		}
 	}
 
-	if(rule.probability != -1) {
-		unsigned int a = (loc.x + 92872973) ^ 918273;
-		unsigned int b = (loc.y + 1672517) ^ 128123;
-		unsigned int c = (rule_index + 127390) ^ 13923787;
-		unsigned int random = a*b*c + a*b + b*c + a*c + a + b + c;
-
-		random %= 100;
+	if(rule.probability != -1 && rule_random(loc, rule_index) > (unsigned int)rule.probability)
+		return false;
 
-		if(random > rule.probability)
-			return false;
-	}
+	return true;
+}
 
+bool terrain_builder::flags_match(const terrain_builder::building_rule &rule, const gamemap::location &loc) const
+{
 	for(constraint_set::const_iterator cons = rule.constraints.begin();
 			cons != rule.constraints.end(); ++cons) {
 
@@ -860,7 +955,60 @@ bool terrain_builder::rule_matches(const terrain_builder::building_rule &rule, c
 	return true;
 }
 
-void terrain_builder::apply_rule(const terrain_builder::building_rule &rule, const gamemap::location &loc)
+bool terrain_builder::rule_matches_before(const terrain_builder::building_rule &rule, const gamemap::location &loc,
+		int rule_index, const rule_application &app, const std::map<gamemap::location, tile>* old_tiles)
+{
+	if(rule.location_constraints.valid() && rule.location_constraints != loc)
+		return false;
+
+	std::vector<const tile*> tiles;
+	for(constraint_set::const_iterator cons = rule.constraints.begin();
+			cons != rule.constraints.end(); ++cons) {
+
+		const gamemap::location tloc = loc + cons->second.loc;
+		if(!tile_map_.on_map(tloc))
+			return false;
+
+		const tile* btile = &tile_map_[tloc];
+		gamemap::TERRAIN terrain = map_.get_terrain(tloc);
+		if(old_tiles != NULL) {
+			const std::map<gamemap::location, tile>::const_iterator old = old_tiles->find(tloc);
+			if(old != old_tiles->end())
+				btile = &old->second;
+			terrain = btile->adjacents[0];
+		}
+
+		if(!terrain_matches(terrain, cons->second.terrain_letters))
+			return false;
+
+		tiles.push_back(btile);
+	}
+
+	if(rule.probability != -1 && rule_random(loc, rule_index) > (unsigned int)rule.probability)
+		return false;
+
+	std::vector<const tile*>::const_iterator btile = tiles.begin();
+	for(constraint_set::const_iterator cons = rule.constraints.begin();
+			cons != rule.constraints.end(); ++cons, ++btile) {
+
+		std::vector<std::string>::const_iterator itor;
+		for(itor = cons->second.no_flag.begin(); itor != cons->second.no_flag.end(); ++itor) {
+			const std::map<std::string, rule_application>::const_iterator flag = (*btile)->flags.find(*itor);
+			if(flag != (*btile)->flags.end() && flag->second < app)
+				return false;
+		}
+		for(itor = cons->second.has_flag.begin(); itor != cons->second.has_flag.end(); ++itor) {
+			const std::map<std::string, rule_application>::const_iterator flag = (*btile)->flags.find(*itor);
+			if(flag == (*btile)->flags.end() || !(flag->second < app))
+				return false;
+		}
+	}
+
+	return true;
+}
+
+void terrain_builder::apply_rule(const terrain_builder::building_rule &rule, const gamemap::location &loc,
+		const rule_application &app, const std::set<gamemap::location>* only)
 {
 	for(constraint_set::const_iterator constraint = rule.constraints.begin();
 			constraint != rule.constraints.end(); ++constraint) {
@@ -870,6 +1018,9 @@ void terrain_builder::apply_rule(const terrain_builder::building_rule &rule, con
 		if(!tile_map_.on_map(tloc))
 			return;
 
+		if(only != NULL && only->find(tloc) == only->end())
+			continue;
+
 		tile& btile = tile_map_[tloc];
 
 		for(img = constraint->second.images.begin(); img != constraint->second.images.end(); ++img) {
@@ -886,13 +1037,13 @@ void terrain_builder::apply_rule(const terrain_builder::building_rule &rule, con
 		// Sets flags
 		for(std::vector<std::string>::const_iterator itor = constraint->second.set_flag.begin();
 				itor != constraint->second.set_flag.end(); itor++) {
-			btile.flags.insert(*itor);
+			btile.flags.insert(std::make_pair(*itor, app));
 		}
 
 	}
 }
 
-int terrain_builder::get_constraint_adjacents(const building_rule& rule, const gamemap::location& loc)
+int terrain_builder::get_constraint_adjacents(const building_rule& rule, const gamemap::location& loc) const
 {
 	int res = 0;
 
@@ -910,7 +1061,7 @@ int terrain_builder::get_constraint_adjacents(const building_rule& rule, const g
 
 //returns the "size" of a constraint: that is, the number of map tiles on which
 //this constraint may possibly match. INT_MAX means "I don't know / all of them".
-int terrain_builder::get_constraint_size(const building_rule& rule, const terrain_constraint& constraint, bool& border)
+int terrain_builder::get_constraint_size(const building_rule& rule, const terrain_constraint& constraint, bool& border) const
 {
 	const std::string &types = constraint.terrain_types;
 
@@ -931,7 +1082,7 @@ int terrain_builder::get_constraint_size(const building_rule& rule, const terrai
 	//the "border" flag can be set.
 	for(i = 0; i < 6; ++i) {
 		if(rule.constraints.find(adj[i]) != rule.constraints.end()) {
-			const std::string& atypes = rule.constraints.find(adj[i])->second.terrain_types;
+			const terrain_set& atypes = rule.constraints.find(adj[i])->second.terrain_letters;
 			for(std::string::const_iterator itor = types.begin();
 					itor != types.end(); ++itor) {
 				if(!terrain_matches(*itor, atypes)) {
@@ -949,21 +1100,115 @@ int terrain_builder::get_constraint_size(const building_rule& rule, const terrai
 
 	for(std::string::const_iterator itor = types.begin();
 			itor != types.end(); ++itor) {
-		if(border) {
-			constraint_size += terrain_by_type_border_[*itor].size();
-		} else {
-			constraint_size += terrain_by_type_[*itor].size();
-		}
+		constraint_size += locations_of_type(*itor, border).size();
 	}
 
 	return constraint_size;
 }
 
+struct terrain_builder::rule_matching_job
+{
+	rule_matching_job(terrain_builder& builder) :
+		builder(builder), matches(builder.rules_.size()), next_rule(0), aborted(false)
+	{}
+
+	//finds where rules match until there are none left. The main thread
+	//takes part too.
+	void run();
+
+	terrain_builder& builder;
+
+	//the applications of each rule where it matches the terrain, in the
+	//order they are tried in
+	std::vector<std::vector<rule_application> > matches;
+
+	threading::mutex mutex;
+	size_t next_rule;
+	bool aborted;
+};
+
+void terrain_builder::rule_matching_job::run()
+{
+	for(;;) {
+		size_t rule;
+		{
+			const threading::lock lock(mutex);
+			if(aborted || next_rule == matches.size())
+				return;
+
+			rule = next_rule++;
+		}
+
+		if(builder.rule_indices_[rule] != -1) {
+			builder.find_rule_matches(int(rule), matches[rule]);
+		}
+	}
+}
+
+int terrain_builder::run_rule_matching_job(void* data)
+{
+	reinterpret_cast<rule_matching_job*>(data)->run();
+	return 0;
+}
+
 void terrain_builder::build_terrains()
 {
 	log_scope("terrain_builder::build_terrains");
 
 	//builds the terrain_by_type_ cache
+	index_terrains();
+
+	for(int x = -1; x <= map_.x(); ++x) {
+		for(int y = -1; y <= map_.y(); ++y) {
+			update_adjacents(gamemap::location(x,y));
+		}
+	}
+
+	rule_anchors_.clear();
+	for(size_t rule = 0; rule != rules_.size(); ++rule) {
+		rule_anchors_.push_back(rule_indices_[rule] != -1 ? find_rule_anchor(*rules_[rule]) : rule_anchor());
+	}
+
+	//where rules match the terrain doesn't depend on the other rules, so
+	//it is found for all rules first, possibly on several threads. Flags
+	//are then checked and rules applied in order.
+	rule_matching_job job(*this);
+
+	{
+		threading::thread_pool pool(job.aborted, job.mutex);
+
+		const size_t nthreads = minimum<size_t>(preferences::terrain_builder_threads(), rules_.size());
+		for(size_t n = 1; n < nthreads; ++n) {
+			pool.add_thread(run_rule_matching_job, &job);
+		}
+
+		job.run();
+	}
+
+	for(size_t rule = 0; rule != rules_.size(); ++rule) {
+		const building_rule& brule = *rules_[rule];
+
+		if(brule.location_constraints.valid()) {
+			apply_rule(brule, brule.location_constraints,
+					rule_application(int(rule), brule.location_constraints));
+			continue;
+		}
+
+		const std::vector<rule_application>& matches = job.matches[rule];
+		for(std::vector<rule_application>::const_iterator app = matches.begin();
+				app != matches.end(); ++app) {
+			if(flags_match(brule, app->loc)) {
+				apply_rule(brule, app->loc, *app);
+			}
+		}
+	}
+}
+
+void terrain_builder::index_terrains()
+{
+	terrain_by_type_.clear();
+	terrain_by_type_border_.clear();
+
 	for(int x = -1; x <= map_.x(); ++x) {
 		for(int y = -1; y <= map_.y(); ++y) {
 			const gamemap::location loc(x,y);
@@ -977,11 +1222,7 @@ void terrain_builder::build_terrains()
 
 			get_adjacent_tiles(loc, adj);
 
-			tile_map_[loc].adjacents[0] = t;
 			for(i = 0; i < 6; ++i) {
-				//updates the list of adjacents for this tile
-				tile_map_[loc].adjacents[i+1] = map_.get_terrain(adj[i]);
-
 				//determines if this tile is a border tile
 				if(map_.get_terrain(adj[i]) != t)
 					border = true;
@@ -990,110 +1231,392 @@ void terrain_builder::build_terrains()
 				terrain_by_type_border_[t].push_back(loc);
 		}
 	}
+}
 
-	int rule_index = 0;
-	building_ruleset::const_iterator rule;
+terrain_builder::rule_anchor terrain_builder::find_rule_anchor(const building_rule &rule) const
+{
+	rule_anchor res;
 
-	for(rule = building_rules_.begin(); rule != building_rules_.end(); ++rule) {
+	//find the constraint that contains the less terrain of all terrain rules.
+	int smallest_constraint_size = INT_MAX;
 
-		if (rule->second.location_constraints.valid()) {
-			apply_rule(rule->second, rule->second.location_constraints);
-			continue;
+	for(constraint_set::const_iterator constraint = rule.constraints.begin();
+	    constraint != rule.constraints.end(); ++constraint) {
+
+		bool border;
+
+		int size = get_constraint_size(rule, constraint->second, border);
+		if(size < smallest_constraint_size) {
+			smallest_constraint_size = size;
+			res.constraint = &constraint->second;
+			res.border = border;
 		}
+	}
 
-		constraint_set::const_iterator constraint;
+	return res;
+}
 
-		//find the constraint that contains the less terrain of all terrain rules.
-		constraint_set::const_iterator smallest_constraint;
-		constraint_set::const_iterator constraint_most_adjacents;
-		int smallest_constraint_size = INT_MAX;
-		int biggest_constraint_adjacent = -1;
-		bool smallest_constraint_border = false;
+void terrain_builder::find_rule_matches(int rule, std::vector<rule_application> &res) const
+{
+	const building_rule& brule = *rules_[rule];
+	const int rule_index = rule_indices_[rule];
+	const rule_anchor& anchor = rule_anchors_[rule];
 
-		for(constraint = rule->second.constraints.begin();
-		    constraint != rule->second.constraints.end(); ++constraint) {
+	constraint_set::const_iterator constraint;
+	constraint_set::const_iterator constraint_most_adjacents;
+	int biggest_constraint_adjacent = -1;
 
-			bool border;
+	for(constraint = brule.constraints.begin();
+	    constraint != brule.constraints.end(); ++constraint) {
 
-			int size = get_constraint_size(rule->second, constraint->second, border);
-			if(size < smallest_constraint_size) {
-				smallest_constraint_size = size;
-				smallest_constraint = constraint;
-				smallest_constraint_border = border;
-			}
+		int nadjacents = get_constraint_adjacents(brule, constraint->second.loc);
+		if(nadjacents > biggest_constraint_adjacent) {
+			biggest_constraint_adjacent = nadjacents;
+			constraint_most_adjacents = constraint;
+		}
+	}
 
-			int nadjacents = get_constraint_adjacents(rule->second, constraint->second.loc);
-			if(nadjacents > biggest_constraint_adjacent) {
-				biggest_constraint_adjacent = nadjacents;
-				constraint_most_adjacents = constraint;
+	util::array<terrain_set,7> adjacent_types;
+
+	if(biggest_constraint_adjacent > 0) {
+		gamemap::location loc[7];
+		loc[0] = constraint_most_adjacents->second.loc;
+		get_adjacent_tiles(loc[0], loc+1);
+		for(int i = 0; i < 7; ++i) {
+			constraint_set::const_iterator cons = brule.constraints.find(loc[i]) ;
+			if(cons != brule.constraints.end()) {
+				adjacent_types[i] = cons->second.terrain_letters;
+			} else {
+				adjacent_types[i].set();
 			}
 		}
 
-		util::array<std::string,7> adjacent_types;
-
-		if(biggest_constraint_adjacent > 0) {
-			gamemap::location loc[7];
-			loc[0] = constraint_most_adjacents->second.loc;
-			get_adjacent_tiles(loc[0], loc+1);
-			for(int i = 0; i < 7; ++i) {
-				constraint_set::const_iterator cons = rule->second.constraints.find(loc[i]) ;
-				if(cons != rule->second.constraints.end()) {
-					adjacent_types[i] = cons->second.terrain_types;
-				} else {
-					adjacent_types[i] = "";
-				}
-			}
+	}
 
-		}
-		if(smallest_constraint_size != INT_MAX) {
-			const std::string &types = smallest_constraint->second.terrain_types;
-			const gamemap::location loc = smallest_constraint->second.loc;
-			const gamemap::location aloc = constraint_most_adjacents->second.loc;
-
-			for(std::string::const_iterator c = types.begin(); c != types.end(); ++c) {
-				const std::vector<gamemap::location>* locations;
-				if(smallest_constraint_border) {
-					locations = &terrain_by_type_border_[*c];
-				} else {
-					locations = &terrain_by_type_[*c];
-				}
+	if(anchor.constraint != NULL) {
+		const bool check_loc = size_t(biggest_constraint_adjacent + 1) != brule.constraints.size();
+
+		const std::string &types = anchor.constraint->terrain_types;
+		const gamemap::location loc = anchor.constraint->loc;
+		const gamemap::location aloc = constraint_most_adjacents->second.loc;
+
+		for(size_t pass = 0; pass != types.size(); ++pass) {
+			const std::vector<gamemap::location>& locations =
+				locations_of_type(types[pass], anchor.border);
 
-				for(std::vector<gamemap::location>::const_iterator itor = locations->begin();
-						itor != locations->end(); ++itor) {
+			for(std::vector<gamemap::location>::const_iterator itor = locations.begin();
+					itor != locations.end(); ++itor) {
 
-					if(biggest_constraint_adjacent > 0) {
-						const gamemap::location pos = (*itor - loc) + aloc;
-						if(!tile_map_.on_map(pos))
-							continue;
+				if(biggest_constraint_adjacent > 0) {
+					const gamemap::location pos = (*itor - loc) + aloc;
+					if(!tile_map_.on_map(pos))
+						continue;
 
-						const gamemap::TERRAIN *adjacents = tile_map_[pos].adjacents;
-						int i;
+					const gamemap::TERRAIN *adjacents = tile_map_[pos].adjacents;
+					int i;
 
-						for(i = 0; i < 7; ++i) {
-							if(!terrain_matches(adjacents[i], adjacent_types[i])) {
-								break;
-							}
+					for(i = 0; i < 7; ++i) {
+						if(!terrain_matches(adjacents[i], adjacent_types[i])) {
+							break;
 						}
-						// propagates the break
-						if (i < 7)
-							continue;
 					}
+					// propagates the break
+					if (i < 7)
+						continue;
+				}
 
-					if(rule_matches(rule->second, *itor - loc, rule_index, (biggest_constraint_adjacent + 1) != rule->second.constraints.size())) {
-						apply_rule(rule->second, *itor - loc);
-					}
+				if(rule_matches(brule, *itor - loc, rule_index, check_loc)) {
+					res.push_back(rule_application(rule, *itor - loc, int(pass)));
 				}
 			}
-		} else {
-			for(int x = -1; x <= map_.x(); ++x) {
-				for(int y = -1; y <= map_.y(); ++y) {
-					const gamemap::location loc(x,y);
-					if(rule_matches(rule->second, loc, rule_index, true))
-						apply_rule(rule->second, loc);
+		}
+	} else {
+		for(int x = -1; x <= map_.x(); ++x) {
+			for(int y = -1; y <= map_.y(); ++y) {
+				const gamemap::location loc(x,y);
+				if(rule_matches(brule, loc, rule_index, true))
+					res.push_back(rule_application(rule, loc));
+			}
+		}
+	}
+}
+
+bool terrain_builder::anchor_matches(const rule_anchor &anchor, const gamemap::location &loc,
+		const std::map<gamemap::location, tile> &old_tiles) const
+{
+	if(anchor.constraint == NULL)
+		return true;
+
+	const gamemap::location aloc = loc + anchor.constraint->loc;
+	if(!tile_map_.on_map(aloc))
+		return false;
+
+	if(terrain_matches(tile_map_[aloc].adjacents[0], anchor.constraint->terrain_letters))
+		return true;
+
+	const std::map<gamemap::location, tile>::const_iterator old = old_tiles.find(aloc);
+	return old != old_tiles.end() &&
+		terrain_matches(old->second.adjacents[0], anchor.constraint->terrain_letters);
+}
+
+void terrain_builder::rule_passes(const rule_anchor &anchor, const gamemap::location &loc,
+		const std::map<gamemap::location, tile>* old_tiles, std::vector<int> &res) const
+{
+	res.clear();
+
+	if(anchor.constraint == NULL) {
+		if(tile_map_.on_map(loc))
+			res.push_back(0);
+		return;
+	}
+
+	const gamemap::location aloc = loc + anchor.constraint->loc;
+	if(!tile_map_.on_map(aloc))
+		return;
+
+	const tile* btile = &tile_map_[aloc];
+	if(old_tiles != NULL) {
+		const std::map<gamemap::location, tile>::const_iterator old = old_tiles->find(aloc);
+		if(old != old_tiles->end())
+			btile = &old->second;
+	}
+
+	const gamemap::TERRAIN *adjacents = btile->adjacents;
+	if(anchor.border && std::count(adjacents + 1, adjacents + 7, adjacents[0]) == 6)
+		return;
+
+	const std::string &types = anchor.constraint->terrain_types;
+	for(size_t pass = 0; pass != types.size(); ++pass) {
+		if(types[pass] == adjacents[0])
+			res.push_back(int(pass));
+	}
+}
+
+const std::vector<gamemap::location>& terrain_builder::locations_of_type(unsigned char t, bool border) const
+{
+	static const std::vector<gamemap::location> empty;
+
+	const terrain_by_type_map& locations = border ? terrain_by_type_border_ : terrain_by_type_;
+	const terrain_by_type_map::const_iterator itor = locations.find(t);
+	if(itor == locations.end())
+		return empty;
+
+	return itor->second;
+}
+
+void terrain_builder::index_rules()
+{
+	rules_.clear();
+	rule_indices_.clear();
+	constraints_by_terrain_.clear();
+
+	std::set<std::pair<int, int> > reach[2];
+
+	int rule_index = 0;
+	for(building_ruleset::const_iterator rule = building_rules_.begin();
+			rule != building_rules_.end(); ++rule) {
+
+		rules_.push_back(&rule->second);
+
+		if(rule->second.location_constraints.valid()) {
+			rule_indices_.push_back(-1);
+			continue;
+		}
+
+		rule_indices_.push_back(rule_index++);
+
+		//a tile is reached by all the constraints of the rules which may
+		//match it through one of their constraints. The offsets of the
+		//reached tiles only depend on the parity of the tile's column.
+		const constraint_set& constraints = rule->second.constraints;
+		for(constraint_set::const_iterator from = constraints.begin(); from != constraints.end(); ++from) {
+			for(constraint_set::const_iterator to = constraints.begin(); to != constraints.end(); ++to) {
+				for(int parity = 0; parity != 2; ++parity) {
+					const gamemap::location tile(parity, 0);
+					const gamemap::location reached = (tile - from->second.loc) + to->second.loc;
+					reach[parity].insert(std::make_pair(reached.x - tile.x, reached.y - tile.y));
 				}
 			}
 		}
+	}
+
+	for(int parity = 0; parity != 2; ++parity) {
+		reach_[parity].assign(reach[parity].begin(), reach[parity].end());
+	}
+}
+
+const std::vector<std::pair<int, gamemap::location> >& terrain_builder::constraints_matching(gamemap::TERRAIN t)
+{
+	const std::map<gamemap::TERRAIN, std::vector<std::pair<int, gamemap::location> > >::const_iterator
+		cached = constraints_by_terrain_.find(t);
+	if(cached != constraints_by_terrain_.end())
+		return cached->second;
+
+	std::vector<std::pair<int, gamemap::location> >& res = constraints_by_terrain_[t];
+	for(size_t rule = 0; rule != rules_.size(); ++rule) {
+		if(rules_[rule]->location_constraints.valid())
+			continue;
+
+		const constraint_set& constraints = rules_[rule]->constraints;
+		for(constraint_set::const_iterator cons = constraints.begin(); cons != constraints.end(); ++cons) {
+			if(terrain_matches(t, cons->second.terrain_letters)) {
+				res.push_back(std::make_pair(int(rule), cons->second.loc));
+			}
+		}
+	}
+
+	return res;
+}
+
+void terrain_builder::update_adjacents(const gamemap::location &loc)
+{
+	gamemap::location adj[6];
+	get_adjacent_tiles(loc, adj);
+
+	tile& btile = tile_map_[loc];
+	btile.adjacents[0] = map_.get_terrain(loc);
+	for(int i = 0; i < 6; ++i) {
+		btile.adjacents[i+1] = map_.get_terrain(adj[i]);
+	}
+}
+
+void terrain_builder::rebuild_terrains(const std::set<gamemap::location> &changed)
+{
+	log_scope("terrain_builder::rebuild_terrains");
+
+	std::set<gamemap::location> tiles;
+	for(std::set<gamemap::location>::const_iterator loc = changed.begin(); loc != changed.end(); ++loc) {
+		tiles.insert(*loc);
+
+		const std::vector<std::pair<int, int> >& reach = reach_[loc->x & 1];
+		for(std::vector<std::pair<int, int> >::const_iterator offset = reach.begin(); offset != reach.end(); ++offset) {
+			const gamemap::location tloc(loc->x + offset->first, loc->y + offset->second);
+			if(tile_map_.on_map(tloc))
+				tiles.insert(tloc);
+		}
+	}
+
+	std::map<gamemap::location, tile> old_tiles;
+	do {
+		for(std::set<gamemap::location>::const_iterator loc = tiles.begin(); loc != tiles.end(); ++loc) {
+			if(old_tiles.find(*loc) == old_tiles.end())
+				old_tiles.insert(std::make_pair(*loc, tile_map_[*loc]));
+
+			tile_map_[*loc].clear();
+			update_adjacents(*loc);
+		}
+	} while(!rebuild_tiles(tiles, old_tiles));
+}
+
+bool terrain_builder::rebuild_tiles(std::set<gamemap::location> &tiles,
+		const std::map<gamemap::location, tile> &old_tiles)
+{
+	//the locations where rules may be applied so that they touch the
+	//tiles, found from the constraints which their old or new terrain
+	//matches
+	std::vector<rule_application> candidates;
+
+	for(std::set<gamemap::location>::const_iterator loc = tiles.begin(); loc != tiles.end(); ++loc) {
+		const gamemap::TERRAIN terrain = map_.get_terrain(*loc);
+		const gamemap::TERRAIN old_terrain = old_tiles.find(*loc)->second.adjacents[0];
+
+		for(int n = 0; n != (terrain == old_terrain ? 1 : 2); ++n) {
+			const std::vector<std::pair<int, gamemap::location> >& constraints =
+				constraints_matching(n == 0 ? terrain : old_terrain);
+
+			for(std::vector<std::pair<int, gamemap::location> >::const_iterator cons = constraints.begin();
+					cons != constraints.end(); ++cons) {
+				//a complete build only tries the rule where the terrain
+				//of its anchor constraint matches
+				const gamemap::location rloc = *loc - cons->second;
+				if(anchor_matches(rule_anchors_[cons->first], rloc, old_tiles))
+					candidates.push_back(rule_application(cons->first, rloc));
+			}
+		}
+	}
 
-		rule_index++;
+	for(size_t rule = 0; rule != rules_.size(); ++rule) {
+		const gamemap::location& loc = rules_[rule]->location_constraints;
+		if(!loc.valid())
+			continue;
+
+		const constraint_set& constraints = rules_[rule]->constraints;
+		for(constraint_set::const_iterator cons = constraints.begin(); cons != constraints.end(); ++cons) {
+			if(tiles.find(loc + cons->second.loc) != tiles.end()) {
+				candidates.push_back(rule_application(int(rule), loc));
+				break;
+			}
+		}
 	}
+
+	std::sort(candidates.begin(), candidates.end());
+	candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+	//the applications of the rules at those locations, each with whether
+	//a complete build tries it now (1) and tried it before (2)
+	std::vector<std::pair<rule_application, int> > applications;
+	std::vector<int> passes, old_passes;
+
+	for(std::vector<rule_application>::const_iterator cand = candidates.begin();
+			cand != candidates.end(); ++cand) {
+
+		if(rule_indices_[cand->rule] == -1) {
+			applications.push_back(std::make_pair(*cand, 3));
+			continue;
+		}
+
+		rule_passes(rule_anchors_[cand->rule], cand->loc, NULL, passes);
+		rule_passes(rule_anchors_[cand->rule], cand->loc, &old_tiles, old_passes);
+
+		std::vector<int>::const_iterator pass;
+		for(pass = passes.begin(); pass != passes.end(); ++pass) {
+			const bool before = std::find(old_passes.begin(), old_passes.end(), *pass) != old_passes.end();
+			applications.push_back(std::make_pair(rule_application(cand->rule, cand->loc, *pass), before ? 3 : 1));
+		}
+		for(pass = old_passes.begin(); pass != old_passes.end(); ++pass) {
+			if(std::find(passes.begin(), passes.end(), *pass) == passes.end())
+				applications.push_back(std::make_pair(rule_application(cand->rule, cand->loc, *pass), 2));
+		}
+	}
+
+	std::sort(applications.begin(), applications.end());
+
+	std::set<gamemap::location> reached;
+
+	for(std::vector<std::pair<rule_application, int> >::const_iterator itor = applications.begin();
+			itor != applications.end(); ++itor) {
+
+		const rule_application& app = itor->first;
+		const building_rule& rule = *rules_[app.rule];
+
+		if(rule.location_constraints.valid()) {
+			apply_rule(rule, app.loc, app, &tiles);
+			continue;
+		}
+
+		const int rule_index = rule_indices_[app.rule];
+		const bool matches = (itor->second & 1) != 0 &&
+			rule_matches_before(rule, app.loc, rule_index, app, NULL);
+		const bool matched = (itor->second & 2) != 0 &&
+			rule_matches_before(rule, app.loc, rule_index, app, &old_tiles);
+
+		//the tiles of a rule application which changed must be rebuilt
+		if(matches != matched) {
+			for(constraint_set::const_iterator cons = rule.constraints.begin();
+					cons != rule.constraints.end(); ++cons) {
+				const gamemap::location tloc = app.loc + cons->second.loc;
+				if(tile_map_.on_map(tloc) && tiles.find(tloc) == tiles.end())
+					reached.insert(tloc);
+			}
+		}
+
+		if(matches)
+			apply_rule(rule, app.loc, app, &tiles);
+	}
+
+	if(reached.empty())
+		return true;
+
+	tiles.insert(reached.begin(), reached.end());
+	return false;
 }
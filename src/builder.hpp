@@ -18,9 +18,11 @@
 #include "map.hpp"
 #include "SDL.h"
 
+#include <bitset>
 #include <map>
 #include <set>
 #include <string>
+#include <vector>
 
 class config;
 
@@ -97,9 +99,13 @@ public:
 	 */
 	void rebuild_terrain(const gamemap::location &loc);
 
-	/** Performs a complete rebuild of the list of terrain graphics
-	 * attached to a map. Should be called when a terrain is changed in the
-	 * map.
+	/** Rebuilds the list of terrain graphics attached to a map. Should be
+	 * called when a terrain is changed in the map.
+	 *
+	 * Only the tiles whose terrain changed since the last rebuild, the
+	 * tiles which got a "quick-rebuild", and the tiles around them which
+	 * rules may reach, are rebuilt. The result is the same as that of a
+	 * complete rebuild.
 	 */
 	void rebuild_all();
 
@@ -198,18 +204,25 @@ public:
 	 */
 	typedef std::vector<rule_image> rule_imagelist;
 
+	/**
+	 * A set of terrain letters, indexed by the value of the letter.
+	 */
+	typedef std::bitset<gamemap::NB_TERRAIN> terrain_set;
+
 	/**
 	 * The in-memory representation of a [tile] WML rule inside of a
 	 * [terrain_graphics] WML rule.
 	 */
 	struct terrain_constraint
 	{
-		terrain_constraint() : loc() {};
+		terrain_constraint() : loc() { terrain_letters.set(); };
 
-		terrain_constraint(gamemap::location loc) : loc(loc) {};
+		terrain_constraint(gamemap::location loc) : loc(loc) { terrain_letters.set(); };
 
 		gamemap::location loc;
 		std::string terrain_types;
+		/** The terrain letters which match terrain_types */
+		terrain_set terrain_letters;
 		std::vector<std::string> set_flag;
 		std::vector<std::string> no_flag;
 		std::vector<std::string> has_flag;
@@ -217,6 +230,59 @@ public:
 		rule_imagelist images;
 	};
 
+	/**
+	 * Identifies the application of a rule at a given location. Rules are
+	 * applied in the order of the ruleset. A rule is tried at the tiles of
+	 * each letter of its anchor constraint in turn, in increasing order of
+	 * location, so that a rule only sees the flags set by the rule
+	 * applications before it.
+	 */
+	struct rule_application
+	{
+		rule_application(int rule, const gamemap::location& loc, int pass = 0) :
+			rule(rule), pass(pass), loc(loc) {};
+
+		bool operator<(const rule_application& a) const
+			{ return rule < a.rule || (rule == a.rule && (pass < a.pass || (pass == a.pass && loc < a.loc))); }
+		bool operator==(const rule_application& a) const
+			{ return rule == a.rule && pass == a.pass && loc == a.loc; }
+
+		/** The position of the rule in the ruleset */
+		int rule;
+		/** The position, in the terrain types of the anchor constraint of
+		 * the rule, of the letter whose tiles the rule was tried at; 0
+		 * for rules without an anchor constraint. A letter repeated in
+		 * the terrain types tries the rule once for each time.
+		 */
+		int pass;
+		/** The location to which the rule is applied */
+		gamemap::location loc;
+	};
+
+	/**
+	 * The constraint of a rule whose tiles the rule is tried at: the one
+	 * which the fewest tiles of the map may match. Which one it is depends
+	 * on the map.
+	 */
+	struct rule_anchor
+	{
+		rule_anchor() : constraint(NULL), border(false) {};
+
+		bool operator==(const rule_anchor& a) const
+			{ return constraint == a.constraint && border == a.border; }
+		bool operator!=(const rule_anchor& a) const
+			{ return !operator==(a); }
+
+		/** The anchor constraint, or NULL if the rule is tried at
+		 * every tile of the map
+		 */
+		const terrain_constraint* constraint;
+		/** Whether the rule is only tried at tiles which have a
+		 * neighbour of another terrain
+		 */
+		bool border;
+	};
+
 	/**
 	 * Represents a tile of the game map, with all associated
 	 * builder-specific parameters: flags, images attached to this tile,
@@ -253,8 +319,10 @@ public:
 		/** Clears all data in this tile, and resets the cache */
 		void clear();
 
-		/** The list of flags present in this tile */
-		std::set<std::string> flags;
+		/** The list of flags present in this tile, each with the
+		 * first rule application which set it
+		 */
+		std::map<std::string, rule_application> flags;
 
 		/** The list of images associated to this tile which have the
 		 * "position=horizontal" parameter set, ordered by their layer.
@@ -619,7 +687,22 @@ private:
 	bool terrain_matches(gamemap::TERRAIN letter, const std::string &terrains);
 
 	/**
-	 * Checks whether a rule matches a given location in the map.
+	 * Checks whether a terrain letter is in a set of terrain letters
+	 * compiled by compile_terrains.
+	 */
+	bool terrain_matches(gamemap::TERRAIN letter, const terrain_set &terrains) const
+		{ return terrains.test(static_cast<unsigned char>(letter)); }
+
+	/**
+	 * Compiles a list of terrain letters, as accepted by terrain_matches,
+	 * into the set of terrain letters which match it.
+	 */
+	static terrain_set compile_terrains(const std::string &terrains);
+
+	/**
+	 * Checks whether a rule matches the terrain of a given location in
+	 * the map. The flags are checked separately, by flags_match, as they
+	 * depend on the rules applied before.
 	 *
 	 * @param rule      The rule to check.
 	 * @param loc       The location in the map where we want to check
@@ -631,11 +714,41 @@ private:
 	 * @param check_loc If this parameter is set to false, the "location"
 	 *                  of the rule (ie, wheter all constraints's terrain
 	 *                  types do actually match) will be assumed to be
-	 *                  already checked, only flags and probability will be
+	 *                  already checked, only probability will be
 	 *                  checked.
 	 */
 	bool rule_matches(const building_rule &rule, const gamemap::location &loc,
-			int rule_index, bool check_loc);
+			int rule_index, bool check_loc) const;
+
+	/**
+	 * Checks whether the flags of the tiles at a given location in the
+	 * map allow a rule to match there.
+	 *
+	 * @param rule      The rule to check.
+	 * @param loc       The location in the map where we want to check
+	 *                  whether the rule matches.
+	 */
+	bool flags_match(const building_rule &rule, const gamemap::location &loc) const;
+
+	/**
+	 * Checks whether a rule matches, or matched before the last change
+	 * of terrain, a given location in the map, as seen by a given rule
+	 * application: only the flags set by rule applications before it are
+	 * taken into account.
+	 *
+	 * @param rule      The rule to check.
+	 * @param loc       The location in the map where we want to check
+	 *                  whether the rule matches.
+	 * @param rule_index The index of the rule, as in rule_matches.
+	 * @param app       The rule application which checks the rule.
+	 * @param old_tiles If not NULL, the state of the tiles being rebuilt
+	 *                  before they were cleared. The rule is then checked
+	 *                  against the terrains and flags the map had before
+	 *                  the change.
+	 */
+	bool rule_matches_before(const building_rule &rule, const gamemap::location &loc,
+			int rule_index, const rule_application &app,
+			const std::map<gamemap::location, tile>* old_tiles);
 
 	/**
 	 * Applies a rule at a given location: applies the result of a matching
@@ -644,8 +757,14 @@ private:
 	 *
 	 * @param rule      The rule to apply
 	 * @param loc       The location to which to apply the rule.
+	 * @param app       The application of the rule, recorded with the
+	 *                  flags it sets.
+	 * @param only      If not NULL, the rule is only applied to those of
+	 *                  its tiles which are in this set.
 	 */
-	void apply_rule(const building_rule &rule, const gamemap::location &loc);
+	void apply_rule(const building_rule &rule, const gamemap::location &loc,
+			const rule_application &app,
+			const std::set<gamemap::location>* only = NULL);
 
 	/**
 	 * Returns the number of constraints adjacent to a given constraint in
@@ -663,7 +782,7 @@ private:
 	 *
 	 * @return the number of constraints adjacent to the location loc
 	 */
-	int get_constraint_adjacents(const building_rule& rule, const gamemap::location& loc);
+	int get_constraint_adjacents(const building_rule& rule, const gamemap::location& loc) const;
 
 	/**
 	 * Returns the "size" of a constraint, that is, the number of tiles, in
@@ -683,14 +802,129 @@ private:
 	 *         to determine"
 	 */
 	int get_constraint_size(const building_rule& rule, const terrain_constraint& constraint,
-			bool& border);
+			bool& border) const;
+
+	/**
+	 * Returns the locations of the tiles of a given terrain, from
+	 * terrain_by_type_border_ if border is true, or from terrain_by_type_
+	 * otherwise.
+	 */
+	const std::vector<gamemap::location>& locations_of_type(unsigned char t, bool border) const;
+
+	/**
+	 * Fills terrain_by_type_ and terrain_by_type_border_ from the gamemap.
+	 */
+	void index_terrains();
+
+	/**
+	 * Finds the anchor constraint of a rule, from the terrain_by_type_
+	 * and terrain_by_type_border_ arrays.
+	 */
+	rule_anchor find_rule_anchor(const building_rule &rule) const;
+
+	/**
+	 * Checks whether the terrain of the anchor tile of a rule tried at a
+	 * given location matches the anchor constraint, now or before the
+	 * tiles being rebuilt were cleared. A complete build doesn't try the
+	 * rule there otherwise.
+	 *
+	 * @param anchor    The anchor of the rule.
+	 * @param loc       The location the rule is tried at.
+	 * @param old_tiles The state of the tiles being rebuilt before they
+	 *                  were cleared.
+	 */
+	bool anchor_matches(const rule_anchor &anchor, const gamemap::location &loc,
+			const std::map<gamemap::location, tile> &old_tiles) const;
+
+	/**
+	 * Finds the passes in which a complete build tries a rule with the
+	 * given anchor at a given location: the positions, in the terrain
+	 * types of the anchor constraint, of the letter of the anchor tile.
+	 *
+	 * @param anchor    The anchor of the rule.
+	 * @param loc       The location the rule is tried at.
+	 * @param old_tiles If not NULL, the state of the tiles being rebuilt
+	 *                  before they were cleared, as in
+	 *                  rule_matches_before.
+	 * @param res       (out) The passes, none if the rule isn't tried
+	 *                  at the location.
+	 */
+	void rule_passes(const rule_anchor &anchor, const gamemap::location &loc,
+			const std::map<gamemap::location, tile>* old_tiles, std::vector<int> &res) const;
 
 	/**
 	 * Calculates the list of terrains, and fills the tile_map_ member,
 	 * from the gamemap and the building_rules_.
+	 *
+	 * Where each rule matches the terrain is found on as many threads as
+	 * preferences::terrain_builder_threads() asks for. The rules are then
+	 * applied in order on the main thread, so the result doesn't depend on
+	 * the number of threads.
 	 */
 	void build_terrains();
 
+	/**
+	 * Finds the locations where a rule matches the terrain of the map,
+	 * regardless of flags. The terrain_by_type_border_ and
+	 * terrain_by_type_ arrays, and rule_anchors_, must be initialized
+	 * before this method is called. This method may be called from
+	 * several threads at once.
+	 *
+	 * @param rule       The position of the rule in rules_.
+	 * @param res        (out) The applications of the rule where it
+	 *                   matches, in the order they are tried in.
+	 */
+	void find_rule_matches(int rule, std::vector<rule_application> &res) const;
+
+	/**
+	 * Finds where the rules match for build_terrains.
+	 */
+	struct rule_matching_job;
+	static int run_rule_matching_job(void* data);
+
+	/**
+	 * Fills rules_, rule_indices_ and reach_ from building_rules_.
+	 */
+	void index_rules();
+
+	/**
+	 * Returns the constraints, from all rules without location
+	 * constraints, which a given terrain matches, as pairs of the position
+	 * of their rule in the ruleset and their location in the rule.
+	 */
+	const std::vector<std::pair<int, gamemap::location> >& constraints_matching(gamemap::TERRAIN t);
+
+	/**
+	 * Updates the terrains of a tile and of its neighbours, kept in its
+	 * adjacents member.
+	 */
+	void update_adjacents(const gamemap::location &loc);
+
+	/**
+	 * Rebuilds the terrain graphics of the tiles around the given
+	 * locations, as far as rules may reach, and of any further tiles the
+	 * change of matching rules reaches.
+	 *
+	 * @param changed The locations whose terrain, or the terrain of one
+	 *                of whose neighbours, changed.
+	 */
+	void rebuild_terrains(const std::set<gamemap::location> &changed);
+
+	/**
+	 * Applies, in order, all the rule applications which touch a set of
+	 * cleared tiles. If a rule application whose tiles are not all in the
+	 * set now matches when it didn't before, or the reverse, those tiles
+	 * are added to the set, and the tiles must be cleared and rebuilt
+	 * again.
+	 *
+	 * @param tiles     The tiles to rebuild.
+	 * @param old_tiles The state of those tiles before they were cleared.
+	 *
+	 * @return false if tiles were added to the set.
+	 */
+	bool rebuild_tiles(std::set<gamemap::location> &tiles,
+			const std::map<gamemap::location, tile> &old_tiles);
+
 	/**
 	 * A reference to the gamemap class used in the current level.
 	 */
@@ -719,6 +953,39 @@ private:
 
 	building_ruleset building_rules_;
 
+	/**
+	 * The rules of building_rules_, in order.
+	 */
+	std::vector<const building_rule*> rules_;
+	/**
+	 * The index of each rule of rules_, as used by rule_matches, or -1
+	 * for rules with a location constraint.
+	 */
+	std::vector<int> rule_indices_;
+
+	/**
+	 * The anchor of each rule of rules_, as found by the last complete
+	 * build. A rebuild of only some tiles gives the same result as a
+	 * complete one as long as they stay the same.
+	 */
+	std::vector<rule_anchor> rule_anchors_;
+
+	/**
+	 * A cache of constraints_matching.
+	 */
+	std::map<gamemap::TERRAIN, std::vector<std::pair<int, gamemap::location> > > constraints_by_terrain_;
+
+	/**
+	 * The offsets, from a tile, of all the tiles which a rule matching
+	 * this tile may reach, for tiles in even (0) and odd (1) columns.
+	 */
+	std::vector<std::pair<int, int> > reach_[2];
+
+	/**
+	 * The tiles which got a "quick-rebuild" since the last rebuild.
+	 */
+	std::set<gamemap::location> quick_rebuilt_;
+
 };
 
 #endif
@@ -94,9 +94,8 @@ void campaign_server::run()
 			while((sock = network::receive_data(data)) != network::null_connection) {
 				if(data.child("request_campaign_list") != NULL) {
 					config campaign_list = campaigns();
-					config::child_list cmps = campaign_list.get_children("campaign");
-					for(config::child_list::iterator i = cmps.begin(); i != cmps.end(); ++i) {
-						(**i)["passphrase"] = "";
+					for(config::child_itors i = campaign_list.child_range("campaign"); i.first != i.second; ++i.first) {
+						(**i.first)["passphrase"] = "";
 					}
 
 					config response;
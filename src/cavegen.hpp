@@ -37,7 +37,7 @@ private:
 	struct chamber {
 		gamemap::location center;
 		std::set<gamemap::location> locs;
-		config* items;
+		const config* items;
 	};
 
 	struct passage {
@@ -18,15 +18,442 @@
 #include <sstream>
 #include "config.hpp"
 #include "log.hpp"
+#include "scoped_resource.hpp"
+#include "thread.hpp"
 #include "wassert.hpp"
 #include "gettext.hpp"
 #include "util.hpp"
 
 #include <iostream>
+#include <map>
+#include <new>
 
 #define ERR_CF LOG_STREAM(err, config)
 
-config::config(const config& cfg)
+namespace {
+
+//the keys of all the attributes of all nodes, with the number of attributes
+//which have each one. A pointer to a key stays valid as long as an attribute
+//has it.
+struct key_table {
+	threading::mutex mutex;
+	std::map<std::string,size_t> keys;
+};
+
+key_table& get_key_table()
+{
+	//the table is never destroyed, since nodes may be destroyed after it
+	//would be
+	static key_table* const table = new key_table;
+	return *table;
+}
+
+//the lock taken to count the references to shared nodes, and to free the
+//arenas of nodes, since the trees sharing nodes may be used on several
+//threads. It is never destroyed, as the key table isn't.
+threading::mutex& get_share_mutex()
+{
+	static threading::mutex* const mutex = new threading::mutex;
+	return *mutex;
+}
+
+//the first attribute in [begin,end) which isn't before the key
+template<typename Itor>
+Itor find_attribute(Itor begin, Itor end, unsigned long prefix, const std::string& key)
+{
+	size_t count = end - begin;
+	while(count > 0) {
+		const size_t half = count/2;
+		const Itor middle = begin + half;
+		if(middle->prefix < prefix || (middle->prefix == prefix && middle->key->first < key)) {
+			begin = middle + 1;
+			count -= half + 1;
+		} else {
+			count = half;
+		}
+	}
+
+	return begin;
+}
+
+}
+
+config::attribute_map::attribute_map(const attribute_map& m) : attributes_(m.attributes_)
+{
+	for(attribute_list::iterator i = attributes_.begin(); i != attributes_.end(); ++i) {
+		i->value = new t_string(*i->value);
+	}
+
+	if(attributes_.empty() == false) {
+		const threading::lock lock(get_key_table().mutex);
+		for(attribute_list::iterator i = attributes_.begin(); i != attributes_.end(); ++i) {
+			++i->key->second;
+		}
+	}
+}
+
+config::attribute_map& config::attribute_map::operator=(const attribute_map& m)
+{
+	attribute_map copy(m);
+	swap(copy);
+	return *this;
+}
+
+void config::attribute_map::clear()
+{
+	if(attributes_.empty()) {
+		return;
+	}
+
+	{
+		const threading::lock lock(get_key_table().mutex);
+		for(attribute_list::iterator i = attributes_.begin(); i != attributes_.end(); ++i) {
+			release(i->key);
+		}
+	}
+
+	for(attribute_list::iterator i = attributes_.begin(); i != attributes_.end(); ++i) {
+		delete i->value;
+	}
+
+	attributes_.clear();
+}
+
+config::attribute_map::shared_key* config::attribute_map::intern(const std::string& key)
+{
+	key_table& table = get_key_table();
+	const threading::lock lock(table.mutex);
+	std::map<std::string,size_t>::iterator i = table.keys.lower_bound(key);
+	if(i == table.keys.end() || i->first != key) {
+		i = table.keys.insert(i, std::pair<const std::string,size_t>(key, 0));
+	}
+
+	++i->second;
+	return &*i;
+}
+
+void config::attribute_map::release(shared_key* key)
+{
+	if(--key->second == 0) {
+		std::map<std::string,size_t>& keys = get_key_table().keys;
+		keys.erase(keys.find(key->first));
+	}
+}
+
+config::attribute_map::key_prefix config::attribute_map::prefix_of(const std::string& key)
+{
+	//keys which are shorter than the prefix are padded with zeroes, so that
+	//they are ordered before the longer keys which start as they do
+	const size_t size = minimum<size_t>(key.size(), sizeof(key_prefix));
+	if(size == 0) {
+		return 0;
+	}
+
+	key_prefix res = 0;
+	for(size_t n = 0; n != size; ++n) {
+		res = (res << 8) | static_cast<unsigned char>(key[n]);
+	}
+
+	return res << 8*(sizeof(key_prefix) - size);
+}
+
+config::attribute_map::attribute_list::iterator config::attribute_map::lower_bound(key_prefix prefix, const std::string& key)
+{
+	return find_attribute(attributes_.begin(), attributes_.end(), prefix, key);
+}
+
+config::attribute_map::attribute_list::const_iterator config::attribute_map::lower_bound(key_prefix prefix, const std::string& key) const
+{
+	return find_attribute(attributes_.begin(), attributes_.end(), prefix, key);
+}
+
+config::attribute_map::iterator config::attribute_map::find(const std::string& key)
+{
+	const key_prefix prefix = prefix_of(key);
+	const attribute_list::iterator i = lower_bound(prefix, key);
+	if(i != attributes_.end() && i->prefix == prefix && i->key->first == key) {
+		return iterator(i);
+	} else {
+		return end();
+	}
+}
+
+config::attribute_map::const_iterator config::attribute_map::find(const std::string& key) const
+{
+	const key_prefix prefix = prefix_of(key);
+	const attribute_list::const_iterator i = lower_bound(prefix, key);
+	if(i != attributes_.end() && i->prefix == prefix && i->key->first == key) {
+		return const_iterator(i);
+	} else {
+		return end();
+	}
+}
+
+t_string& config::attribute_map::operator[](const std::string& key)
+{
+	const key_prefix prefix = prefix_of(key);
+	attribute_list::iterator i = lower_bound(prefix, key);
+	if(i == attributes_.end() || i->prefix != prefix || i->key->first != key) {
+		i = attributes_.insert(i, attribute(prefix, intern(key), new t_string()));
+	}
+
+	return *i->value;
+}
+
+std::pair<config::attribute_map::iterator,bool> config::attribute_map::insert(const std::pair<std::string,t_string>& value)
+{
+	const key_prefix prefix = prefix_of(value.first);
+	attribute_list::iterator i = lower_bound(prefix, value.first);
+	if(i != attributes_.end() && i->prefix == prefix && i->key->first == value.first) {
+		return std::make_pair(iterator(i), false);
+	}
+
+	i = attributes_.insert(i, attribute(prefix, intern(value.first), new t_string(value.second)));
+	return std::make_pair(iterator(i), true);
+}
+
+size_t config::attribute_map::erase(const std::string& key)
+{
+	const key_prefix prefix = prefix_of(key);
+	const attribute_list::iterator i = lower_bound(prefix, key);
+	if(i != attributes_.end() && i->prefix == prefix && i->key->first == key) {
+		erase(iterator(i));
+		return 1;
+	} else {
+		return 0;
+	}
+}
+
+void config::attribute_map::erase(iterator i)
+{
+	{
+		const threading::lock lock(get_key_table().mutex);
+		release(i.i_->key);
+	}
+
+	delete i.i_->value;
+	attributes_.erase(i.i_);
+}
+
+bool config::attribute_map::operator==(const attribute_map& m) const
+{
+	if(attributes_.size() != m.attributes_.size()) {
+		return false;
+	}
+
+	//keys are shared, so equal keys are the same object
+	for(attribute_list::const_iterator i = attributes_.begin(), j = m.attributes_.begin(); i != attributes_.end(); ++i, ++j) {
+		if(i->key != j->key || *i->value != *j->value) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+//the nodes allocated in an arena_scope. The first nodes are allocated along
+//with the arena, as most trees read from the network are small, and the next
+//ones in chunks, each twice as large as the last. The memory is freed once
+//the scope is over and all the nodes have been destroyed. The nodes may be
+//shared with trees on other threads by then, so once one of them has been
+//shared they are released under the share lock.
+class config::arena
+{
+public:
+	arena() : next_(first_chunk_.nodes), end_(first_chunk_.nodes + sizeof(first_chunk_.nodes)),
+	          chunk_nodes_(first_chunk_nodes), live_(0), open_(true), shared_(false)
+	{}
+
+	~arena()
+	{
+		for(std::vector<char*>::iterator i = chunks_.begin(); i != chunks_.end(); ++i) {
+			::operator delete(*i);
+		}
+	}
+
+	//returns NULL once the scope is over
+	void* allocate()
+	{
+		if(open_ == false) {
+			return NULL;
+		}
+
+		if(next_ == end_) {
+			if(chunk_nodes_ < max_chunk_nodes) {
+				chunk_nodes_ *= 2;
+			}
+
+			chunks_.push_back(static_cast<char*>(::operator new(chunk_nodes_*sizeof(config))));
+			next_ = chunks_.back();
+			end_ = next_ + chunk_nodes_*sizeof(config);
+		}
+
+		void* const res = next_;
+		next_ += sizeof(config);
+		++live_;
+		return res;
+	}
+
+	//the nodes of an arena which was never shared all belong to the tree
+	//being read, and are released by the thread using it without the lock
+	void release()
+	{
+		if(shared_) {
+			const threading::lock lock(get_share_mutex());
+			--live_;
+			destroy_if_unused();
+		} else {
+			--live_;
+			destroy_if_unused();
+		}
+	}
+
+	void close()
+	{
+		if(shared_) {
+			const threading::lock lock(get_share_mutex());
+			open_ = false;
+			destroy_if_unused();
+		} else {
+			open_ = false;
+			destroy_if_unused();
+		}
+	}
+
+	//called under the share lock once a node of the arena is shared
+	void share() { shared_ = true; }
+
+	//nodes added while the scope isn't over are only referred to by the reader
+	bool is_open() const { return open_; }
+
+private:
+	arena(const arena&);
+	void operator=(const arena&);
+
+	void destroy_if_unused()
+	{
+		if(live_ == 0 && open_ == false) {
+			delete this;
+		}
+	}
+
+	enum { first_chunk_nodes = 4, max_chunk_nodes = 256 };
+
+	union {
+		char nodes[first_chunk_nodes*sizeof(config)];
+		void* align_pointer;
+		size_t align_size;
+	} first_chunk_;
+
+	std::vector<char*> chunks_;
+	char* next_;
+	char* end_;
+	size_t chunk_nodes_;
+	size_t live_;
+	bool open_;
+	bool shared_;
+};
+
+config::arena_scope::arena_scope(config& cfg) : cfg_(cfg), previous_(cfg.arena_)
+{
+	cfg_.arena_ = new arena;
+}
+
+config::arena_scope::~arena_scope()
+{
+	cfg_.arena_->close();
+	cfg_.arena_ = previous_;
+}
+
+config* config::new_child(const config* val)
+{
+	void* const mem = arena_ != NULL ? arena_->allocate() : NULL;
+	config* const res = new(mem != NULL ? mem : ::operator new(sizeof(config))) config;
+	if(mem != NULL) {
+		res->arena_ = arena_;
+	}
+
+	if(val != NULL) {
+		try {
+			res->append(*val);
+		} catch(...) {
+			delete_child(res);
+			throw;
+		}
+	}
+
+	return res;
+}
+
+void config::delete_child(config* cfg)
+{
+	arena* const a = cfg->arena_;
+	cfg->~config();
+	if(a != NULL) {
+		a->release();
+	} else {
+		::operator delete(cfg);
+	}
+}
+
+config* config::share_child(const config* cfg)
+{
+	if(cfg->shareable_ == false) {
+		return new_child(cfg);
+	}
+
+	config* const res = const_cast<config*>(cfg);
+	const threading::lock lock(get_share_mutex());
+	++res->refs_;
+	if(res->arena_ != NULL) {
+		res->arena_->share();
+	}
+
+	return res;
+}
+
+void config::release_child(const config* cfg)
+{
+	config* const node = const_cast<config*>(cfg);
+
+	//a node which only has this reference can't be shared meanwhile, since
+	//that would need another reference to its parent
+	if(node->refs_ > 1) {
+		const threading::lock lock(get_share_mutex());
+		if(--node->refs_ > 0) {
+			return;
+		}
+	}
+
+	delete_child(node);
+}
+
+config& config::own_child(const config*& slot)
+{
+	config* res = const_cast<config*>(slot);
+	if(res->refs_ > 1) {
+		config* const copy = new_child(res);
+		release_child(res);
+		slot = res = copy;
+	}
+
+	//the nodes a reader adds are still shareable once it is done with them
+	if(res->arena_ == NULL || res->arena_->is_open() == false) {
+		res->shareable_ = false;
+	}
+
+	return *res;
+}
+
+const config*& config::push_child(const std::string& key, config* cfg)
+{
+	child_list& v = children[key];
+	v.push_back(cfg);
+	ordered_children.push_back(child_pos(children.find(key),v.size()-1));
+	return v.back();
+}
+
+config::config(const config& cfg) : child_source_(NULL), arena_(NULL), refs_(1), shareable_(true)
 {
 	append(cfg);
 }
@@ -53,10 +480,15 @@ void config::append(const config& cfg)
 {
 	for(all_children_iterator i = cfg.ordered_begin(); i != cfg.ordered_end(); ++i) {
 		const std::pair<const std::string*,const config*>& value = *i;
-		add_child(*value.first,*value.second);
+		push_child(*value.first,share_child(value.second));
+	}
+
+	if(values.empty()) {
+		values = cfg.values;
+		return;
 	}
 
-	for(string_map::const_iterator j = cfg.values.begin(); j != cfg.values.end(); ++j) {
+	for(attribute_map::const_iterator j = cfg.values.begin(); j != cfg.values.end(); ++j) {
 		values[j->first] = j->second;
 	}
 }
@@ -74,33 +506,41 @@ void config::merge_children(const std::string& key)
 	}
 
 	clear_children(key);
-	add_child(key,merged_children);
+	push_child(key,new_child(&merged_children));
 }
 
 config::child_itors config::child_range(const std::string& key)
 {
+	load_children();
 	child_map::iterator i = children.find(key);
-	if(i != children.end()) {
-		return child_itors(i->second.begin(),i->second.end());
-	} else {
-		static std::vector<config*> dummy;
-		return child_itors(dummy.begin(),dummy.end());
+	if(i == children.end() || i->second.empty()) {
+		return child_itors(NULL,NULL);
 	}
+
+	child_list& v = i->second;
+	for(child_list::iterator j = v.begin(); j != v.end(); ++j) {
+		own_child(*j);
+	}
+
+	config** const begin = const_cast<config**>(&v.front());
+	return child_itors(begin,begin + v.size());
 }
 
 config::const_child_itors config::child_range(const std::string& key) const
 {
+	load_children();
 	child_map::const_iterator i = children.find(key);
 	if(i != children.end()) {
 		return const_child_itors(i->second.begin(),i->second.end());
 	} else {
-		static const std::vector<config*> dummy;
+		static const child_list dummy;
 		return const_child_itors(dummy.begin(),dummy.end());
 	}
 }
 
 const config::child_list& config::get_children(const std::string& key) const
 {
+	load_children();
 	const child_map::const_iterator i = children.find(key);
 	if(i != children.end()) {
 		return i->second;
@@ -110,20 +550,34 @@ const config::child_list& config::get_children(const std::string& key) const
 	}
 }
 
-const config::child_map& config::all_children() const { return children; }
+const config::child_map& config::all_children() const
+{
+	load_children();
+	return children;
+}
 
 config* config::child(const std::string& key)
 {
-	const child_map::const_iterator i = children.find(key);
+	load_children();
+	const child_map::iterator i = children.find(key);
 	if(i != children.end() && i->second.empty() == false) {
-		return i->second.front();
+		return &own_child(i->second.front());
 	} else {
 		return NULL;
 	}
 }
 
+config& config::child_at(const std::string& key, size_t index)
+{
+	load_children();
+	const child_map::iterator i = children.find(key);
+	wassert(i != children.end() && index < i->second.size());
+	return own_child(i->second[index]);
+}
+
 const config* config::child(const std::string& key) const
 {
+	load_children();
 	const child_map::const_iterator i = children.find(key);
 	if(i != children.end() && i->second.empty() == false) {
 		return i->second.front();
@@ -134,28 +588,25 @@ const config* config::child(const std::string& key) const
 
 config& config::add_child(const std::string& key)
 {
-	std::vector<config*>& v = children[key];
-	v.push_back(new config());
-	ordered_children.push_back(child_pos(children.find(key),v.size()-1));
-	return *v.back();
+	load_children();
+	return own_child(push_child(key,new_child(NULL)));
 }
 
 config& config::add_child(const std::string& key, const config& val)
 {
-	std::vector<config*>& v = children[key];
-	v.push_back(new config(val));
-	ordered_children.push_back(child_pos(children.find(key),v.size()-1));
-	return *v.back();
+	load_children();
+	return own_child(push_child(key,new_child(&val)));
 }
 
 config& config::add_child_at(const std::string& key, const config& val, size_t index)
 {
+	load_children();
 	child_list& v = children[key];
 	if(index > v.size()) {
 		throw error("illegal index to add child at");
 	}
 
-	v.insert(v.begin()+index,new config(val));
+	v.insert(v.begin()+index,new_child(&val));
 
 	bool inserted = false;
 
@@ -175,7 +626,7 @@ config& config::add_child_at(const std::string& key, const config& val, size_t i
 		ordered_children.push_back(value);
 	}
 
-	return *v[index];
+	return own_child(v[index]);
 }
 
 namespace {
@@ -192,12 +643,22 @@ private:
 
 void config::clear_children(const std::string& key)
 {
+	load_children();
 	ordered_children.erase(std::remove_if(ordered_children.begin(),ordered_children.end(),remove_ordered(key)),ordered_children.end());
-	children.erase(key);
+
+	const child_map::iterator i = children.find(key);
+	if(i != children.end()) {
+		for(child_list::iterator j = i->second.begin(); j != i->second.end(); ++j) {
+			release_child(*j);
+		}
+
+		children.erase(i);
+	}
 }
 
 void config::remove_child(const std::string& key, size_t index)
 {
+	load_children();
 	//remove from the ordering
 	const child_pos pos(children.find(key),index);
 	ordered_children.erase(std::remove(ordered_children.begin(),ordered_children.end(),pos),ordered_children.end());
@@ -218,9 +679,9 @@ void config::remove_child(const std::string& key, size_t index)
 			<< key << "[" << index << "]\n";
 		return;
 	}
-	config* const res = v[index];
+	const config* const res = v[index];
 	v.erase(v.begin()+index);
-	delete res;
+	release_child(res);
 }
 
 t_string& config::operator[](const std::string& key)
@@ -244,7 +705,7 @@ const t_string& config::operator[](const std::string& key) const
 
 const t_string& config::get_attribute(const std::string& key) const
 {
-	const string_map::const_iterator i = values.find(key);
+	const attribute_map::const_iterator i = values.find(key);
 	if(i != values.end()) {
 		return i->second;
 	} else {
@@ -272,6 +733,7 @@ config* config::find_child(const std::string& key,
                            const std::string& name,
                            const t_string& value)
 {
+	load_children();
 	const child_map::iterator i = children.find(key);
 	if(i == children.end())
 		return NULL;
@@ -280,7 +742,7 @@ config* config::find_child(const std::string& key,
 	                                            i->second.end(),
 	                                            config_has_value(name,value));
 	if(j != i->second.end())
-		return *j;
+		return &own_child(*j);
 	else
 		return NULL;
 }
@@ -289,6 +751,7 @@ const config* config::find_child(const std::string& key,
                                  const std::string& name,
                                  const t_string& value) const
 {
+	load_children();
 	const child_map::const_iterator i = children.find(key);
 	if(i == children.end())
 		return NULL;
@@ -305,10 +768,13 @@ const config* config::find_child(const std::string& key,
 
 void config::clear()
 {
-	for(std::map<std::string,std::vector<config*> >::iterator i = children.begin(); i != children.end(); ++i) {
-		std::vector<config*>& v = i->second;
-		for(std::vector<config*>::iterator j = v.begin(); j != v.end(); ++j)
-			delete *j;
+	delete child_source_;
+	child_source_ = NULL;
+
+	for(child_map::iterator i = children.begin(); i != children.end(); ++i) {
+		child_list& v = i->second;
+		for(child_list::iterator j = v.begin(); j != v.end(); ++j)
+			release_child(*j);
 	}
 
 	children.clear();
@@ -316,8 +782,37 @@ void config::clear()
 	ordered_children.clear();
 }
 
+void config::set_child_source(child_source* source)
+{
+	wassert(children.empty() && child_source_ == NULL);
+	child_source_ = source;
+}
+
+void config::read_child_source() const
+{
+	//only nodes which are not const themselves are given a source, so
+	//reading the children into them doesn't modify a const object
+	config& cfg = const_cast<config&>(*this);
+
+	const util::scoped_ptr<child_source> source(child_source_);
+	cfg.child_source_ = NULL;
+	source->read_children(cfg);
+}
+
+void config::load_all_children() const
+{
+	load_children();
+
+	for(child_map::const_iterator i = children.begin(); i != children.end(); ++i) {
+		const child_list& v = i->second;
+		for(child_list::const_iterator j = v.begin(); j != v.end(); ++j)
+			(*j)->load_all_children();
+	}
+}
+
 bool config::empty() const
 {
+	load_children();
 	return children.empty() && values.empty();
 }
 
@@ -354,23 +849,28 @@ bool config::all_children_iterator::operator!=(all_children_iterator i) const
 
 config::all_children_iterator config::ordered_begin() const
 {
+	load_children();
 	return all_children_iterator(ordered_children.begin());
 }
 
 config::all_children_iterator config::ordered_end() const
 {
+	load_children();
 	return all_children_iterator(ordered_children.end());
 }
 
 config config::get_diff(const config& c) const
 {
+	load_children();
+	c.load_children();
+
 	config res;
 
 	config* inserts = NULL;
 
-	string_map::const_iterator i;
+	attribute_map::const_iterator i;
 	for(i = values.begin(); i != values.end(); ++i) {
-		const string_map::const_iterator j = c.values.find(i->first);
+		const attribute_map::const_iterator j = c.values.find(i->first);
 		if(j == c.values.end() || i->second != j->second && i->second != "") {
 			if(inserts == NULL) {
 				inserts = &res.add_child("insert");
@@ -383,7 +883,7 @@ config config::get_diff(const config& c) const
 	config* deletes = NULL;
 
 	for(i = c.values.begin(); i != c.values.end(); ++i) {
-		const string_map::const_iterator itor = values.find(i->first);
+		const attribute_map::const_iterator itor = values.find(i->first);
 		if(itor == values.end() || itor->second == "") {
 			if(deletes == NULL) {
 				deletes = &res.add_child("delete");
@@ -473,16 +973,18 @@ config config::get_diff(const config& c) const
 
 void config::apply_diff(const config& diff)
 {
+	load_children();
+
 	const config* const inserts = diff.child("insert");
 	if(inserts != NULL) {
-		for(string_map::const_iterator i = inserts->values.begin(); i != inserts->values.end(); ++i) {
+		for(attribute_map::const_iterator i = inserts->values.begin(); i != inserts->values.end(); ++i) {
 			values[i->first] = i->second;
 		}
 	}
 
 	const config* const deletes = diff.child("delete");
 	if(deletes != NULL) {
-		for(string_map::const_iterator i = deletes->values.begin(); i != deletes->values.end(); ++i) {
+		for(attribute_map::const_iterator i = deletes->values.begin(); i != deletes->values.end(); ++i) {
 			values.erase(i->first);
 		}
 	}
@@ -503,7 +1005,7 @@ void config::apply_diff(const config& diff)
 				throw error("error in diff: could not find element '" + *item.first + "'");
 			}
 
-			itor->second[index]->apply_diff(*item.second);
+			own_child(itor->second[index]).apply_diff(*item.second);
 		}
 	}
 
@@ -529,7 +1031,8 @@ void config::apply_diff(const config& diff)
 
 void config::reset_translation() const
 {
-	for(string_map::const_iterator val = values.begin(); val != values.end(); ++val) {
+	//children which have not been read yet have no translations to reset
+	for(attribute_map::const_iterator val = values.begin(); val != values.end(); ++val) {
 		val->second.reset_translation();
 	}
 
@@ -543,6 +1046,10 @@ void config::reset_translation() const
 
 bool operator==(const config& a, const config& b)
 {
+	//a child shared by both nodes is compared with itself
+	if (&a == &b)
+		return true;
+
 	if (a.values != b.values)
 		return false;
 
@@ -36,18 +36,145 @@ class config
 {
 public:
 	//create an empty node.
-	config() {}
+	config() : child_source_(NULL), arena_(NULL), refs_(1), shareable_(true) {}
 
 	config(const config& cfg);
 	~config();
 
 	config& operator=(const config& cfg);
 
-	typedef std::vector<config*> child_list;
+	//the attributes of a node. They are kept in a single vector, sorted by
+	//key, and the keys are shared by all nodes, so that each key is stored
+	//only once however many nodes have it. A key is freed with the last
+	//attribute which has it, so that the keys of data read from the network
+	//don't pile up. The interface is that of the
+	//std::map<std::string,t_string> it replaces: the attributes are iterated
+	//in the order of their keys, i->first and i->second are the key and the
+	//value of the attribute at i, and a reference to a value stays valid
+	//until its attribute is removed.
+	class attribute_map
+	{
+		//the first bytes of a key, as a number which orders keys as the keys
+		//themselves are ordered. Most keys are told apart by it, without
+		//reading the shared key.
+		typedef unsigned long key_prefix;
+
+		//a key, along with the number of attributes which have it
+		typedef std::pair<const std::string,size_t> shared_key;
+
+		//the value is owned by the attribute. It is kept apart from the
+		//vector so that it doesn't move when attributes are added.
+		struct attribute {
+			attribute(key_prefix p, shared_key* k, t_string* v) : prefix(p), key(k), value(v) {}
+			key_prefix prefix;
+			shared_key* key;
+			t_string* value;
+		};
+		typedef std::vector<attribute> attribute_list;
+
+		//what an iterator points to, in place of a std::pair
+		template<typename T>
+		struct reference_pair {
+			reference_pair(const std::string& k, T& v) : first(k), second(v) {}
+			const std::string& first;
+			T& second;
+
+			const reference_pair* operator->() const { return this; }
+		};
+
+		template<typename Itor, typename T>
+		class basic_iterator {
+		public:
+			basic_iterator() {}
+			explicit basic_iterator(Itor i) : i_(i) {}
+
+			//an iterator converts to a const_iterator
+			template<typename Itor2, typename T2>
+			basic_iterator(const basic_iterator<Itor2,T2>& i) : i_(i.i_) {}
+
+			reference_pair<T> operator*() const { return reference_pair<T>(i_->key->first, *i_->value); }
+			reference_pair<T> operator->() const { return operator*(); }
+
+			basic_iterator& operator++() { ++i_; return *this; }
+			basic_iterator operator++(int) { basic_iterator res = *this; ++i_; return res; }
+
+			bool operator==(const basic_iterator& i) const { return i_ == i.i_; }
+			bool operator!=(const basic_iterator& i) const { return i_ != i.i_; }
+
+		private:
+			template<typename Itor2, typename T2> friend class basic_iterator;
+			friend class attribute_map;
+			Itor i_;
+		};
+
+	public:
+		attribute_map() {}
+		attribute_map(const attribute_map& m);
+		~attribute_map() { clear(); }
+
+		attribute_map& operator=(const attribute_map& m);
+
+		typedef basic_iterator<attribute_list::iterator,t_string> iterator;
+		typedef basic_iterator<attribute_list::const_iterator,const t_string> const_iterator;
+
+		iterator begin() { return iterator(attributes_.begin()); }
+		iterator end() { return iterator(attributes_.end()); }
+		const_iterator begin() const { return const_iterator(attributes_.begin()); }
+		const_iterator end() const { return const_iterator(attributes_.end()); }
+
+		iterator find(const std::string& key);
+		const_iterator find(const std::string& key) const;
+		size_t count(const std::string& key) const { return find(key) != end() ? 1 : 0; }
+
+		//returns the value of 'key', adding it with an empty value if it
+		//is not there yet
+		t_string& operator[](const std::string& key);
+
+		//adds the attribute, unless there already is one with that key
+		std::pair<iterator,bool> insert(const std::pair<std::string,t_string>& value);
+
+		size_t erase(const std::string& key);
+		void erase(iterator i);
+
+		size_t size() const { return attributes_.size(); }
+		bool empty() const { return attributes_.empty(); }
+		void clear();
+		void swap(attribute_map& m) { attributes_.swap(m.attributes_); }
+
+		bool operator==(const attribute_map& m) const;
+		bool operator!=(const attribute_map& m) const { return !operator==(m); }
+
+	private:
+		static key_prefix prefix_of(const std::string& key);
+
+		attribute_list::iterator lower_bound(key_prefix prefix, const std::string& key);
+		attribute_list::const_iterator lower_bound(key_prefix prefix, const std::string& key) const;
+
+		//returns the copy of 'key' shared by all nodes, counting one more
+		//attribute which has it
+		static shared_key* intern(const std::string& key);
+
+		//counts one attribute less which has the key, freeing it if it was
+		//the last one. Must be called with the key table locked.
+		static void release(shared_key* key);
+
+		attribute_list attributes_;
+	};
+
+	//the children of a node are shared by the copies of the node, and are
+	//only copied once one of the copies is to be modified. Because of that,
+	//the children are only given out as config* or config& by the functions
+	//of a node which isn't const. Such a child is copied first if it is
+	//shared, and it is never shared again afterwards, since it may be
+	//modified through the pointer at any time. The functions of a const node
+	//give out const config*, which must not be cast back to config*, and
+	//which may no longer point into this node once it has been modified.
+	typedef std::vector<const config*> child_list;
 	typedef std::map<std::string,child_list> child_map;
 
-	typedef std::vector<config*>::iterator child_iterator;
-	typedef std::vector<config*>::const_iterator const_child_iterator;
+	//the children of a node which isn't const are iterated as config*
+	typedef config** child_iterator;
+	typedef child_list::const_iterator const_child_iterator;
 
 	typedef std::pair<child_iterator,child_iterator> child_itors;
 	typedef std::pair<const_child_iterator,const_child_iterator> const_child_itors;
@@ -60,6 +187,10 @@ public:
 
 	config* child(const std::string& key);
 	const config* child(const std::string& key) const;
+
+	//returns the child 'key' at 'index', which must exist, so that it can
+	//be modified. Unlike child_range(), the other children are left shared.
+	config& child_at(const std::string& key, size_t index);
 	config& add_child(const std::string& key);
 	config& add_child(const std::string& key, const config& val);
 	config& add_child_at(const std::string& key, const config& val, size_t index);
@@ -131,14 +262,103 @@ public:
 	//resets the translated values of all strings contained in this object
 	void reset_translation() const;
 
+	//a source from which the children of a node are read when they are
+	//first accessed, such as the game config cache
+	class child_source
+	{
+	public:
+		virtual ~child_source() {}
+
+		//adds the children to 'cfg', which has none yet
+		virtual void read_children(config& cfg) const = 0;
+	};
+
+	//makes the children of this node, which must have none, be read from
+	//'source' when they are first accessed. The node takes ownership of
+	//'source'. The children are read on whichever thread first accesses
+	//them, so a node with a source must not be accessed from several
+	//threads at once.
+	void set_child_source(child_source* source);
+
+	//reads the children of this node and of all the nodes below it which
+	//have a source, so that the tree may then be read from several threads
+	//at once.
+	void load_all_children() const;
+
+	//a region of memory from which the nodes of a tree are allocated
+	//together. See arena_scope.
+	class arena;
+
+	//while an object of this class exists, the children added to 'cfg', and
+	//the children added to them in turn, are allocated together from one
+	//arena instead of each on its own, and the memory of the arena is freed
+	//at once when the last of them is destroyed. Nodes added once the object
+	//is destroyed are allocated on their own again, so that a tree which is
+	//kept and modified doesn't keep growing its arena. The readers of WML
+	//use it around the trees they build. Since the nodes added in the scope
+	//are only referred to by the reader, they may be shared as soon as the
+	//tree is copied, so references to them must not be kept past the scope.
+	class arena_scope
+	{
+	public:
+		explicit arena_scope(config& cfg);
+		~arena_scope();
+
+	private:
+		arena_scope(const arena_scope&);
+		void operator=(const arena_scope&);
+
+		config& cfg_;
+		arena* previous_;
+	};
+
 	//all the attributes of this node.
-	string_map values;
+	attribute_map values;
 
 private:
+	//reads the children from child_source_, if they have not been read yet
+	void load_children() const { if(child_source_ != NULL) read_child_source(); }
+	void read_child_source() const;
+
+	//allocates a child node, which is a copy of 'val' if it isn't NULL
+	config* new_child(const config* val);
+
+	//destroys a node allocated by new_child()
+	static void delete_child(config* cfg);
+
+	//returns a child node with the contents of 'cfg', which is 'cfg' itself
+	//if it can be shared, and a copy of it otherwise
+	config* share_child(const config* cfg);
+
+	//removes a reference to a child node, destroying the node if it was
+	//the last one
+	static void release_child(const config* cfg);
+
+	//returns the child node at 'slot' so that it can be modified, replacing
+	//it by a copy first if it is shared
+	config& own_child(const config*& slot);
+
+	//adds a child node at the end of the children, and returns its slot
+	const config*& push_child(const std::string& key, config* cfg);
+
 	//a list of all children of this node.
 	child_map children;
 
 	std::vector<child_pos> ordered_children;
+
+	child_source* child_source_;
+
+	//the arena this node was allocated from, from which its children are
+	//also allocated while the arena is in use. NULL if the node was
+	//allocated on its own.
+	arena* arena_;
+
+	//the number of nodes this node is a child of
+	size_t refs_;
+
+	//false once this node has been given out to be modified, after which
+	//it isn't shared any more
+	bool shareable_;
 };
 
 bool operator==(const config& a, const config& b);
@@ -51,11 +51,11 @@ namespace dialogs
 
 void advance_unit(const game_data& info,
 				  const gamemap& map,
-                  std::map<gamemap::location,unit>& units,
+                  unit_map& units,
                   gamemap::location loc,
                   display& gui, bool random_choice)
 {
-	std::map<gamemap::location,unit>::iterator u = units.find(loc);
+	unit_map::iterator u = units.find(loc);
 	if(u == units.end() || u->second.advances() == false)
 		return;
 
@@ -112,7 +112,7 @@ bool animate_unit_advancement(const game_data& info,unit_map& units, gamemap::lo
 {
 	const command_disabler cmd_disabler;
 
-	std::map<gamemap::location,unit>::iterator u = units.find(loc);
+	unit_map::iterator u = units.find(loc);
 	if(u == units.end() || u->second.advances() == false) {
 		return false;
 	}
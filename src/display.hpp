@@ -50,7 +50,7 @@ class gamestatus;
 class display
 {
 public:
-	typedef std::map<gamemap::location,unit> unit_map;
+	typedef ::unit_map unit_map;
 
 	display(unit_map& units, CVideo& video,
 			const gamemap& map, const gamestatus& status,
@@ -55,6 +55,7 @@
 #include "video.hpp"
 #include "wassert.hpp"
 #include "wml_separators.hpp"
+#include "serialization/binary_cache.hpp"
 #include "serialization/binary_or_text.hpp"
 #include "serialization/binary_wml.hpp"
 #include "serialization/parser.hpp"
@@ -507,7 +508,7 @@ bool game_controller::play_multiplayer_mode()
 	state_.snapshot = config();
 
 	config level = *lvl;
-	std::vector<config*> story;
+	config::child_list story;
 
 	const config* const era_cfg = game_config_.find_child("era","id",era);
 	if(era_cfg == NULL) {
@@ -558,7 +559,7 @@ bool game_controller::play_multiplayer_mode()
 
 		(*itors.first)->values["canrecruit"] = "1";
 
-		for(string_map::const_iterator i = side->values.begin(); i != side->values.end(); ++i) {
+		for(config::attribute_map::const_iterator i = side->values.begin(); i != side->values.end(); ++i) {
 			(*itors.first)->values[i->first] = i->second;
 		}
 
@@ -1295,8 +1296,7 @@ void game_controller::read_game_cfg(const preproc_map& defines, config& cfg, boo
 					std::cerr << "found valid cache at '" << fname << "' using it\n";
 					log_scope("read cache");
 					try {
-						scoped_istream stream = istream_file(fname);
-						read_compressed(cfg, *stream);
+						read_binary_cache(cfg, fname);
 						return;
 					} catch(config::error&) {
 						std::cerr << "cache is corrupt. Loading from files\n";
@@ -1309,8 +1309,12 @@ void game_controller::read_game_cfg(const preproc_map& defines, config& cfg, boo
 
 				preproc_map defines_map(defines);
 
+				//the preprocessed text of the files that didn't change is reused
+				//from the previous runs, unless the caches are disabled
+				const std::string preproc_cache = use_cache ? get_dir(cache + "/preprocessor") : "";
+
 				//read the file and then write to the cache
-				scoped_istream stream = preprocess_file("data/game.cfg", &defines_map);
+				scoped_istream stream = preprocess_file("data/game.cfg", &defines_map, preproc_cache);
 
 				std::string error_log, user_error_log;
 
@@ -1328,7 +1332,7 @@ void game_controller::read_game_cfg(const preproc_map& defines, config& cfg, boo
 
 					try {
 						preproc_map user_defines_map(defines_map);
-						scoped_istream stream = preprocess_file(*uc,&user_defines_map);
+						scoped_istream stream = preprocess_file(*uc,&user_defines_map,preproc_cache);
 
 						std::string campaign_error_log;
 
@@ -1373,8 +1377,7 @@ void game_controller::read_game_cfg(const preproc_map& defines, config& cfg, boo
 
 				} else {
 					try {
-						scoped_ostream cache = ostream_file(fname);
-						write_compressed(*cache, cfg);
+						write_binary_cache(fname, cfg);
 						config checksum_cfg;
 						data_tree_checksum().write(checksum_cfg);
 						scoped_ostream checksum = ostream_file(fname_checksum);
@@ -49,7 +49,7 @@ namespace {
 
 display* screen = NULL;
 gamemap* game_map = NULL;
-std::map<gamemap::location,unit>* units = NULL;
+unit_map* units = NULL;
 std::vector<team>* teams = NULL;
 game_state* state_of_game = NULL;
 const game_data* game_data_ptr = NULL;
@@ -59,7 +59,7 @@ gamestatus* status_ptr = NULL;
 
 namespace game_events {
 
-bool conditional_passed(const std::map<gamemap::location,unit>* units,
+bool conditional_passed(const unit_map* units,
                         const vconfig cond)
 {
 	//an 'or' statement means that if the contained statements are true,
@@ -81,7 +81,7 @@ bool conditional_passed(const std::map<gamemap::location,unit>* units,
 		if(units == NULL)
 			return false;
 
-		std::map<gamemap::location,unit>::const_iterator itor;
+		unit_map::const_iterator itor;
 		for(itor = units->begin(); itor != units->end(); ++itor) {
 			if(itor->second.hitpoints() > 0 && game_events::unit_matches_filter(itor, *u)) {
 				break;
@@ -803,7 +803,7 @@ bool event_handler::handle_event_command(const queued_event& event_info,
 			item["role"] = "";
 			vconfig filter(&item);
 
-			std::map<gamemap::location,unit>::iterator itor;
+			unit_map::iterator itor;
 			for(itor = units->begin(); itor != units->end(); ++itor) {
 				if(game_events::unit_matches_filter(itor, filter)) {
 					itor->second.assign_role(cfg["role"]);
@@ -870,7 +870,7 @@ bool event_handler::handle_event_command(const queued_event& event_info,
 	}
 
 	else if(cmd == "unit_overlay") {
-		for(std::map<gamemap::location,unit>::iterator itor = units->begin(); itor != units->end(); ++itor) {
+		for(unit_map::iterator itor = units->begin(); itor != units->end(); ++itor) {
 			if(game_events::unit_matches_filter(itor,cfg)) {
 				itor->second.add_overlay(cfg["image"]);
 				break;
@@ -879,7 +879,7 @@ bool event_handler::handle_event_command(const queued_event& event_info,
 	}
 
 	else if(cmd == "remove_unit_overlay") {
-		for(std::map<gamemap::location,unit>::iterator itor = units->begin(); itor != units->end(); ++itor) {
+		for(unit_map::iterator itor = units->begin(); itor != units->end(); ++itor) {
 			if(game_events::unit_matches_filter(itor,cfg)) {
 				itor->second.remove_overlay(cfg["image"]);
 				break;
@@ -1101,7 +1101,7 @@ bool event_handler::handle_event_command(const queued_event& event_info,
 
 	//displaying a message dialog
 	else if(cmd == "message") {
-		std::map<gamemap::location,unit>::iterator speaker = units->end();
+		unit_map::iterator speaker = units->end();
 		if(cfg["speaker"] == "unit") {
 			speaker = units->find(event_info.loc1);
 		} else if(cfg["speaker"] == "second_unit") {
@@ -1625,7 +1625,7 @@ bool unit_matches_filter(unit_map::const_iterator itor, const vconfig filter)
 }
 
 manager::manager(const config& cfg, display& gui_, gamemap& map_,
-                 std::map<gamemap::location,unit>& units_,
+                 unit_map& units_,
                  std::vector<team>& teams_,
                  game_state& state_of_game_, gamestatus& status,
 		 const game_data& game_data_) :
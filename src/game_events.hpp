@@ -48,7 +48,7 @@ struct manager {
 	//note that references will be maintained, and must remain valid
 	//for the life of the object.
 	manager(const config& scenario_cfg, display& disp, gamemap& map,
-			std::map<gamemap::location,unit>& units, std::vector<team>& teams,
+			unit_map& units, std::vector<team>& teams,
 			game_state& state_of_game, gamestatus& status, const game_data& data);
 	~manager();
 
@@ -71,7 +71,7 @@ void raise(const std::string& event,
           const gamemap::location& loc1=gamemap::location::null_location,
           const gamemap::location& loc2=gamemap::location::null_location);
 
-bool conditional_passed(const std::map<gamemap::location,unit>* units,
+bool conditional_passed(const unit_map* units,
                         const vconfig cond);
 bool pump();
 
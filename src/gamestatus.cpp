@@ -655,21 +655,21 @@ void game_state::get_variable_internal(const std::string& key, config& cfg,
 			element = std::string(element.begin(),index_start);
 		}
 
-		const config::child_list& items = cfg.get_children(element);
-
 		//special case -- '.length' on an array returns the size of the array
 		if(explicit_index == false && sub_key == "length") {
-			if(items.empty()) {
+			const config::child_itors items = cfg.child_range(element);
+			if(items.first == items.second) {
 				if(varout != NULL) {
 					static t_string zero_str = "0";
 					*varout = &zero_str;
 				}
 			} else {
-				int size = minimum<int>(MaxLoop,int(items.size()));
-				(*items.back())["__length"] = lexical_cast<std::string>(size);
+				int size = minimum<int>(MaxLoop,int(items.second - items.first));
+				config& last = **(items.second - 1);
+				last["__length"] = lexical_cast<std::string>(size);
 
 				if(varout != NULL) {
-					*varout = &(*items.back())["__length"];
+					*varout = &last["__length"];
 				}
 			}
 
@@ -680,11 +680,12 @@ void game_state::get_variable_internal(const std::string& key, config& cfg,
 			cfg.add_child(element);
 		}
 
+		config& item = *cfg.child_range(element).first[index];
 		if(cfgout != NULL) {
-			*cfgout = cfg.get_children(element)[index];
+			*cfgout = &item;
 		}
 
-		get_variable_internal(sub_key,*cfg.get_children(element)[index],varout,cfgout);
+		get_variable_internal(sub_key,item,varout,cfgout);
 	} else {
 		if(varout != NULL) {
 			*varout = &cfg[key];
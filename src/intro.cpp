@@ -165,7 +165,7 @@ bool show_intro_part(display &disp, const config& part,
 
 		bool pass = false;
 
-		for(std::vector<config*>::const_iterator i = images.begin(); i != images.end(); ++i){
+		for(config::child_list::const_iterator i = images.begin(); i != images.end(); ++i){
 			const std::string& xloc = (**i)["x"];
 			const std::string& yloc = (**i)["y"];
 			const std::string& image_name = (**i)["file"];
@@ -214,7 +214,7 @@ bool set_language(const language_def& locale)
 		return false;
 	}
 
-	for(string_map::const_iterator j = langp->values.begin(); j != langp->values.end(); ++j) {
+	for(config::attribute_map::const_iterator j = langp->values.begin(); j != langp->values.end(); ++j) {
 		strings_[j->first] = j->second;
 	}
 	// end of string_table fill
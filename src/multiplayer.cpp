@@ -29,6 +29,8 @@
 #include "replay.hpp"
 #include "video.hpp"
 #include "statistics.hpp"
+#include "serialization/binary_wml.hpp"
+#include "serialization/deflate.hpp"
 #include "serialization/string_utils.hpp"
 
 #define LOG_NW LOG_STREAM(info, network)
@@ -165,8 +167,30 @@ server_type open_connection(display& disp, const std::string& original_host)
 			config cfg;
 			config res;
 			cfg["version"] = game_config::version;
+
+			//use the shared dictionary if the server offers the one we know,
+			//and zlib if both can
+			const config& query = *data.child("version");
+			const bool dictionary = query["dictionary"] == shared_dictionary_version;
+			if(dictionary) {
+				cfg["dictionary"] = shared_dictionary_version;
+			}
+
+			const bool deflate = query["compression"] == "deflate" && deflate_available();
+			if(deflate) {
+				cfg["compression"] = "deflate";
+			}
+
 			res.add_child("version", cfg);
 			network::send_data(res);
+
+			if(dictionary) {
+				network::use_shared_dictionary(sock);
+			}
+
+			if(deflate) {
+				network::use_deflate(sock);
+			}
 		}
 
 		//if we got a direction to login
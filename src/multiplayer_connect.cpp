@@ -452,7 +452,7 @@ void connect::side::resolve_random()
 
 		// Builds the list of sides which aren't random
 		std::vector<int> nonrandom_sides;
-		for(config::child_iterator itor = parent_->era_sides_.begin();
+		for(config::const_child_iterator itor = parent_->era_sides_.begin();
 				itor != parent_->era_sides_.end(); ++itor) {
 			if((**itor)["random_faction"] != "yes") {
 				nonrandom_sides.push_back(itor - parent_->era_sides_.begin());
@@ -828,7 +828,7 @@ void connect::lists_init()
 	player_types_.push_back(_("Computer Player"));
 	player_types_.push_back(_("Empty"));
 
-	for(std::vector<config*>::const_iterator faction = era_sides_.begin(); faction != era_sides_.end(); ++faction) {
+	for(config::child_list::const_iterator faction = era_sides_.begin(); faction != era_sides_.end(); ++faction) {
 		player_factions_.push_back((**faction)["name"]);
 	}
 
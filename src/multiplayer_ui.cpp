@@ -374,7 +374,7 @@ void ui::gamelist_updated(bool silent)
 {
 	std::vector<std::string> user_strings;
 	config::child_list users = gamelist_.get_children("user");
-	config::child_iterator user;
+	config::const_child_iterator user;
 	for (user = users.begin(); user != users.end(); ++user) {
 		const std::string prefix = (**user)["available"] == "no" ? "#" : "";
 		user_strings.push_back(prefix + (**user)["name"].str());
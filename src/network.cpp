@@ -14,6 +14,7 @@
 #include "global.hpp"
 
 #include "serialization/binary_wml.hpp"
+#include "serialization/deflate.hpp"
 #include "config.hpp"
 #include "gettext.hpp"
 #include "log.hpp"
@@ -22,11 +23,13 @@
 #include "thread.hpp"
 #include "util.hpp"
 #include "wassert.hpp"
+#include "wesconfig.h"
 
 #include "SDL_net.h"
 
 #include <algorithm>
 #include <cerrno>
+#include <cstring>
 #include <queue>
 #include <iostream>
 #include <set>
@@ -46,6 +49,11 @@
 #define SOCKET int
 #endif
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#include <unistd.h>
+#endif
+
 #define LOG_NW LOG_STREAM(info, network)
 #define WRN_NW LOG_STREAM(warn, network)
 // only warnings and not errors to avoid DoS by log flooding
@@ -58,7 +66,8 @@ namespace {
 struct connection_details {
 	connection_details(TCPsocket sock, const std::string& host, int port)
 		: sock(sock), host(host), port(port), remote_handle(0),
-	      connected_at(SDL_GetTicks()), sent(0), received(0)
+	      connected_at(SDL_GetTicks()), sent(0), received(0),
+	      deflate(false), deflate_agreed(false), inflate(false)
 	{}
 
 	TCPsocket sock;
@@ -70,16 +79,39 @@ struct connection_details {
 	int remote_handle;
 
 	int connected_at;
-	int sent, received;
+	size_t sent, received;
+
+	//whether the peer has agreed to compress data with zlib. The data sent
+	//then starts with a byte telling if the rest is deflated. So does the
+	//data received from the peer's marker on: 'deflate_agreed' is set until
+	//then, and 'inflate' after.
+	bool deflate, deflate_agreed, inflate;
 };
 
+//the byte in front of the data of connections which use zlib
+const char plain_data = 0, deflated_data = 1;
+
+//data smaller than this hardly shrinks when deflated, so it is sent as it is
+const size_t min_deflate_size = 256;
+
+//the largest data a peer may send, once decompressed
+const size_t max_data_size = 100000000;
+
 typedef std::map<network::connection,connection_details> connection_map;
 connection_map connections;
 
+//data may be sent from several threads, so the connections, their schemas
+//and the bad sockets are changed, and read when sending data, with this
+//mutex locked
+threading::mutex* connections_mutex = NULL;
+
 network::connection connection_id = 1;
 
 int create_connection(TCPsocket sock, const std::string& host, int port)
 {
+	network_worker_pool::add_socket(sock);
+
+	const threading::lock lock(*connections_mutex);
 	connections.insert(std::pair<network::connection,connection_details>(connection_id,connection_details(sock,host,port)));
 	return connection_id++;
 }
@@ -101,6 +133,7 @@ TCPsocket get_socket(network::connection handle)
 
 void remove_connection(network::connection handle)
 {
+	const threading::lock lock(*connections_mutex);
 	connections.erase(handle);
 }
 
@@ -134,13 +167,29 @@ sockets_list sockets;
 
 struct schema_pair
 {
+	schema_pair() : dictionary_agreed(false), dictionary_codes(false) {}
 	compression_schema incoming, outgoing;
+
+	//whether the peer has agreed to use the shared dictionary, but hasn't
+	//yet sent the marker after which its data uses it
+	bool dictionary_agreed;
+
+	//whether the words of 'broadcast_schema' have the same codes in
+	//'outgoing', so that the data written with it can be sent to the peer
+	bool dictionary_codes;
 };
 
 typedef std::map<network::connection,schema_pair> schema_map;
 
 schema_map schemas;
 
+//the schema with which the data sent to several connections is written:
+//the outgoing schema of the first connection which agreed on the shared
+//dictionary, once it added the dictionary. As all connections go through the
+//same version handshake before, the others have the same words with the same
+//codes. Set with 'connections_mutex' locked, and only read after that.
+compression_schema broadcast_schema;
+
 struct partial_buffer {
 	partial_buffer() : upto(0) {}
 	std::vector<char> buf;
@@ -154,16 +203,45 @@ std::set<network::connection> bad_sockets;
 
 network_worker_pool::manager* worker_pool_man = NULL;
 
+#ifdef HAVE_SYS_EPOLL_H
+//the sockets in the socket sets are also watched with epoll, so that waiting
+//for activity doesn't cost more as the number of connections grows
+int epoll_fd = -1;
+
+//the file descriptor given to the last call to wait_for_activity
+int extra_watched_fd = -1;
+
+void watch_fd(int fd)
+{
+	if(epoll_fd != -1) {
+		struct epoll_event event;
+		std::memset(&event,0,sizeof(event));
+		event.events = EPOLLIN;
+		event.data.fd = fd;
+		epoll_ctl(epoll_fd,EPOLL_CTL_ADD,fd,&event);
+	}
+}
+
+void unwatch_fd(int fd)
+{
+	if(epoll_fd != -1) {
+		struct epoll_event event;
+		epoll_ctl(epoll_fd,EPOLL_CTL_DEL,fd,&event);
+	}
+}
+#endif
+
 }
 
 namespace network {
 
-connection_stats::connection_stats(int sent, int received, int connected_at)
+connection_stats::connection_stats(size_t sent, size_t received, int connected_at)
        : bytes_sent(sent), bytes_received(received), time_connected(SDL_GetTicks() - connected_at)
 {}
 
 connection_stats get_connection_stats(connection connection_num)
 {
+	const threading::lock lock(*connections_mutex);
 	connection_details& details = get_connection_details(connection_num);
 	return connection_stats(details.sent,details.received,details.connected_at);
 }
@@ -171,6 +249,7 @@ connection_stats get_connection_stats(connection connection_num)
 error::error(const std::string& msg, connection sock) : message(msg), socket(sock)
 {
 	if(socket) {
+		const threading::lock lock(*connections_mutex);
 		bad_sockets.insert(socket);
 	}
 }
@@ -200,8 +279,18 @@ manager::manager(size_t nthreads) : free_(true)
 	}
 
 	socket_set = SDLNet_AllocSocketSet(512);
+	connections_mutex = new threading::mutex;
 
 	worker_pool_man = new network_worker_pool::manager(nthreads);
+
+#ifdef HAVE_SYS_EPOLL_H
+	//waiting with epoll is only possible if the worker threads can wake us up
+	//when they have received data
+	if(network_worker_pool::activity_fd() != -1) {
+		epoll_fd = epoll_create(512);
+		watch_fd(network_worker_pool::activity_fd());
+	}
+#endif
 }
 
 manager::~manager()
@@ -210,9 +299,18 @@ manager::~manager()
 		disconnect();
 		delete worker_pool_man;
 		worker_pool_man = NULL;
+		delete connections_mutex;
+		connections_mutex = NULL;
 		SDLNet_FreeSocketSet(socket_set);
 		socket_set = 0;
 		waiting_sockets.clear();
+#ifdef HAVE_SYS_EPOLL_H
+		if(epoll_fd != -1) {
+			close(epoll_fd);
+			epoll_fd = -1;
+			extra_watched_fd = -1;
+		}
+#endif
 		SDLNet_Quit();
 	}
 }
@@ -293,6 +391,24 @@ namespace {
 		IPaddress localAddress;
 		int sflag;
 	};
+
+#ifdef HAVE_SYS_EPOLL_H
+	void watch_socket(TCPsocket sock)
+	{
+		watch_fd(((_TCPsocket*)sock)->channel);
+	}
+
+	void unwatch_socket(TCPsocket sock)
+	{
+		unwatch_fd(((_TCPsocket*)sock)->channel);
+	}
+#else
+	void watch_socket(TCPsocket /*sock*/)
+	{}
+
+	void unwatch_socket(TCPsocket /*sock*/)
+	{}
+#endif
 }
 
 void connect_operation::run()
@@ -343,6 +459,7 @@ void connect_operation::run()
 	if(hostname == NULL) {
 		const threading::lock l(get_mutex());
 		connect_ = create_connection(sock,"",port_);
+		watch_socket(sock);
 		return;
 	}
 
@@ -376,11 +493,17 @@ void connect_operation::run()
 		return;
 	}
 
+	watch_socket(sock);
+
 	waiting_sockets.insert(connect_);
 
 	sockets.push_back(connect_);
-	wassert(schemas.count(connect_) == 0);
-	schemas.insert(std::pair<network::connection,schema_pair>(connect_,schema_pair()));
+
+	{
+		const threading::lock lock(*connections_mutex);
+		wassert(schemas.count(connect_) == 0);
+		schemas.insert(std::pair<network::connection,schema_pair>(connect_,schema_pair()));
+	}
 
 	while(!notify_finished());
 }
@@ -432,6 +555,7 @@ connection accept_connection()
 
 		if(pending_socket_set != 0) {
 			SDLNet_TCP_AddSocket(pending_socket_set,sock);
+			watch_socket(sock);
 		}
 	}
 
@@ -457,6 +581,7 @@ connection accept_connection()
 
 		const TCPsocket sock = *i;
 		SDLNet_TCP_DelSocket(pending_socket_set,sock);
+		unwatch_socket(sock);
 		pending_sockets.erase(i);
 
 		LOG_NW << "receiving data from pending socket...\n";
@@ -479,6 +604,8 @@ connection accept_connection()
 			throw network::error(_("Could not add socket to socket set"));
 		}
 
+		watch_socket(sock);
+
 
 		const connection connect = create_connection(sock,"",0);
 
@@ -492,6 +619,8 @@ connection accept_connection()
 
 		waiting_sockets.insert(connect);
 		sockets.push_back(connect);
+
+		const threading::lock lock(*connections_mutex);
 		wassert(schemas.count(connect) == 0);
 		schemas.insert(std::pair<network::connection,schema_pair>(connect,schema_pair()));
 		return connect;
@@ -521,8 +650,11 @@ bool disconnect(connection s)
 		}
 	}
 
-	schemas.erase(s);
-	bad_sockets.erase(s);
+	{
+		const threading::lock lock(*connections_mutex);
+		schemas.erase(s);
+		bad_sockets.erase(s);
+	}
 
 	std::deque<network::connection>::iterator dqi = std::find(disconnection_queue.begin(),disconnection_queue.end(),s);
 	if(dqi != disconnection_queue.end()) {
@@ -537,6 +669,7 @@ bool disconnect(connection s)
 
 		waiting_sockets.erase(s);
 		SDLNet_TCP_DelSocket(socket_set,sock);
+		unwatch_socket(sock);
 		SDLNet_TCP_Close(sock);
 
 		remove_connection(s);
@@ -621,6 +754,7 @@ connection receive_data(config& cfg, connection connection_num)
 
 			waiting_sockets.erase(i++);
 			SDLNet_TCP_DelSocket(socket_set,sock);
+			unwatch_socket(sock);
 			network_worker_pool::receive_data(sock);
 		} else {
 			++i;
@@ -635,33 +769,166 @@ connection receive_data(config& cfg, connection connection_num)
 	}
 
 	SDLNet_TCP_AddSocket(socket_set,sock);
+	watch_socket(sock);
 
-	connection result = 0;
-	for(connection_map::const_iterator j = connections.begin(); j != connections.end(); ++j) {
+	connection_map::iterator info = connections.end();
+	for(connection_map::iterator j = connections.begin(); j != connections.end(); ++j) {
 		if(j->second.sock == sock) {
-			result = j->first;
+			info = j;
+
+			//the data was sent with its size in front of it
+			j->second.received += buf.size() + 4;
 			break;
 		}
 	}
 
-	if(result == 0) {
+	if(info == connections.end()) {
 		assert(false);
-		return result;
+		return 0;
 	}
+
+	const connection result = info->first;
 	waiting_sockets.insert(result);
 
 	const schema_map::iterator schema = schemas.find(result);
 	wassert(schema != schemas.end());
 
-	std::string buffer(buf.begin(), buf.end());
-	std::istringstream stream(buffer);
-	read_compressed(cfg, stream, schema->second.incoming);
+	//a peer which switches to the shared dictionary or to zlib sends a
+	//marker with no data, so that what it sent before is still read as it
+	//was sent. It switches to both at once, right after its reply to the
+	//version handshake, so the marker of the first switch also stands for
+	//the other.
+	if(buf.size() == 1 && buf[0] == 0) {
+		if(schema->second.dictionary_agreed) {
+			schema->second.dictionary_agreed = false;
+			add_shared_dictionary(schema->second.incoming);
+		}
+
+		if(info->second.deflate_agreed) {
+			info->second.deflate_agreed = false;
+			info->second.inflate = true;
+		}
+
+		return receive_data(cfg,connection_num);
+	}
+
+	//the data is decoded where the worker received it
+	const char* data = buf.empty() ? NULL : &buf[0];
+	const char* end = data + buf.size();
+	std::vector<char> inflated;
+	if(info->second.inflate && data != end) {
+		if(*data++ == deflated_data) {
+			inflate_data(data,end,inflated,false,max_data_size);
+			data = inflated.empty() ? NULL : &inflated[0];
+			end = data + inflated.size();
+		}
+	}
+
+	read_compressed(cfg, data, end, schema->second.incoming);
 
 	return result;
 }
 
+#ifdef HAVE_SYS_EPOLL_H
+void wait_for_activity(int timeout, int fd)
+{
+	if(epoll_fd != -1) {
+		if(fd != extra_watched_fd) {
+			if(extra_watched_fd != -1) {
+				unwatch_fd(extra_watched_fd);
+			}
+
+			if(fd != -1) {
+				watch_fd(fd);
+			}
+
+			extra_watched_fd = fd;
+		}
+
+		//queued disconnections are reported by the next receive_data
+		if(disconnection_queue.empty()) {
+			struct epoll_event events[64];
+			epoll_wait(epoll_fd,events,sizeof(events)/sizeof(*events),timeout);
+		}
+
+		//the caller is about to receive all the data received so far, so only
+		//data received from now on must wake up the next wait
+		network_worker_pool::clear_activity();
+		return;
+	}
+
+	SDL_Delay(minimum<int>(timeout,20));
+}
+#else
+void wait_for_activity(int timeout, int /*fd*/)
+{
+	SDL_Delay(minimum<int>(timeout,20));
+}
+#endif
+
 namespace {
 	size_t default_max_send_size = 0;
+
+	//the size of the last data sent, used to size the buffer of the next.
+	//Guarded by 'connections_mutex'.
+	size_t last_send_size = 0;
+
+	//starts a buffer to be sent down a socket, leaving room for the size of
+	//the data. The compressed data is then written at the end of the buffer.
+	void begin_send_buffer(std::vector<char>& buf, size_t size_hint)
+	{
+		buf.reserve(maximum<size_t>(size_hint,64));
+		buf.resize(4);
+	}
+
+	//frames the compressed data written to the buffer
+	void end_send_buffer(std::vector<char>& buf)
+	{
+		buf.push_back(0);
+		SDLNet_Write32(buf.size()-4,&buf[0]);
+	}
+
+	//appends the compressed data in [begin,end) to the buffer of a
+	//connection which uses zlib. Data which doesn't shrink by deflating it is
+	//sent as it is.
+	void append_deflated(std::vector<char>& buf, const char* begin, const char* end)
+	{
+		const size_t size = end - begin;
+		if(size >= min_deflate_size) {
+			const size_t start = buf.size();
+			buf.push_back(deflated_data);
+			deflate_data(begin,end,buf,false);
+			if(buf.size() - start <= size) {
+				return;
+			}
+
+			buf.resize(start);
+		}
+
+		buf.push_back(plain_data);
+		buf.insert(buf.end(),begin,end);
+	}
+
+	//queues the marker telling the peer that the data sent after it uses the
+	//compression agreed on during the version handshake. The marker is only
+	//the nul ending each buffer, as no data sent is empty. Must be called
+	//with 'connections_mutex' locked.
+	void queue_marker(network::connection connection_num)
+	{
+		if(bad_sockets.count(connection_num) || bad_sockets.count(0)) {
+			return;
+		}
+
+		const connection_map::iterator info = connections.find(connection_num);
+		wassert(info != connections.end());
+
+		std::vector<char> buf;
+		begin_send_buffer(buf,0);
+		end_send_buffer(buf);
+
+		info->second.sent += buf.size();
+		network_worker_pool::queue_data(info->second.sock,buf);
+	}
 }
 
 void set_default_send_size(size_t max_size)
@@ -676,10 +943,6 @@ void send_data(const config& cfg, connection connection_num, size_t max_size, SE
 		return;
 	}
 
-	if(bad_sockets.count(connection_num) || bad_sockets.count(0)) {
-		return;
-	}
-
 	if(max_size == 0) {
 		max_size = default_max_send_size;
 	}
@@ -688,36 +951,46 @@ void send_data(const config& cfg, connection connection_num, size_t max_size, SE
 		max_size = 8;
 	}
 
-	log_scope2(network, "sending data");
+	//data may be sent from several threads, so the scope isn't logged, as
+	//that indents the log
+	LOG_NW << "sending data\n";
 	if(!connection_num) {
 		LOG_NW << "sockets: " << sockets.size() << "\n";
-		for(sockets_list::const_iterator i = sockets.begin();
-		    i != sockets.end(); ++i) {
-			LOG_NW << "server socket: " << server_socket << "\ncurrent socket: " << *i << "\n";
-			send_data(cfg,*i);
-		}
+		queue_data(cfg,sockets);
+		return;
+	}
 
+	//the data is compressed and queued with the lock held, so that it is
+	//queued in the order the schema of the connection expects
+	const threading::lock lock(*connections_mutex);
+	if(bad_sockets.count(connection_num) || bad_sockets.count(0)) {
 		return;
 	}
 
 	const schema_map::iterator schema = schemas.find(connection_num);
 	wassert(schema != schemas.end());
 
-	std::ostringstream compressor;
-	write_compressed(compressor, cfg, schema->second.outgoing);
-	std::string const &value = compressor.str();
-
 //	std::cerr << "--- SEND DATA to " << ((int)connection_num) << ": '"
 //	          << cfg.write() << "'\n--- END SEND DATA\n";
 
-	std::vector<char> buf(4 + value.size() + 1);
-	SDLNet_Write32(value.size()+1,&buf[0]);
-	std::copy(value.begin(),value.end(),buf.begin()+4);
-	buf.back() = 0;
-
 	const connection_map::iterator info = connections.find(connection_num);
 	wassert(info != connections.end());
 
+	std::vector<char> buf;
+	begin_send_buffer(buf,last_send_size);
+	if(info->second.deflate) {
+		std::vector<char> data;
+		write_compressed(data, cfg, schema->second.outgoing);
+		const char* const begin = data.empty() ? NULL : &data[0];
+		append_deflated(buf,begin,begin + data.size());
+	} else {
+		write_compressed(buf, cfg, schema->second.outgoing);
+	}
+
+	end_send_buffer(buf);
+	last_send_size = buf.size();
+
+	info->second.sent += buf.size();
 	network_worker_pool::queue_data(info->second.sock,buf);
 }
 
@@ -726,19 +999,168 @@ void queue_data(const config& cfg, connection connection_num)
 	send_data(cfg,connection_num,0,QUEUE_ONLY);
 }
 
+void queue_data(const config& cfg, const std::vector<connection>& connection_nums)
+{
+	if(cfg.empty()) {
+		return;
+	}
+
+	//the connections get the data in one of four buffers, as they use the
+	//shared dictionary and zlib or not
+	enum { SHARED_DICTIONARY = 1, DEFLATE = 2, NBUFFERS = 4 };
+	std::vector<connection> targets[NBUFFERS];
+	size_t size_hint;
+	{
+		const threading::lock lock(*connections_mutex);
+		if(bad_sockets.count(0)) {
+			return;
+		}
+
+		for(std::vector<connection>::const_iterator i = connection_nums.begin(); i != connection_nums.end(); ++i) {
+			if(bad_sockets.count(*i) == 0) {
+				const connection_map::const_iterator info = connections.find(*i);
+				wassert(info != connections.end());
+				const schema_map::const_iterator schema = schemas.find(*i);
+				wassert(schema != schemas.end());
+				targets[(schema->second.dictionary_codes ? SHARED_DICTIONARY : 0) |
+				        (info->second.deflate ? DEFLATE : 0)].push_back(*i);
+			}
+		}
+
+		size_hint = last_send_size;
+	}
+
+	size_t ntargets = 0;
+	for(int n = 0; n != NBUFFERS; ++n) {
+		ntargets += targets[n].size();
+	}
+
+	//a single connection is better served by its own compression schema
+	if(ntargets <= 1) {
+		for(int n = 0; n != NBUFFERS; ++n) {
+			if(targets[n].empty() == false) {
+				queue_data(cfg,targets[n].front());
+			}
+		}
+
+		return;
+	}
+
+	LOG_NW << "sending data to several connections\n";
+
+	//the data is written with the words of 'broadcast_schema' for the
+	//connections which use the shared dictionary, and literally for the
+	//others. Neither adds to a schema, so the data is written without
+	//holding the lock.
+	std::vector<char> data[2];
+	std::vector<char> bufs[NBUFFERS];
+	for(int n = 0; n != NBUFFERS; ++n) {
+		if(targets[n].empty()) {
+			continue;
+		}
+
+		std::vector<char>& compressed = data[n & SHARED_DICTIONARY];
+		if(compressed.empty()) {
+			if(n & SHARED_DICTIONARY) {
+				write_compressed_shared(compressed, cfg, broadcast_schema);
+			} else {
+				write_compressed_literal(compressed, cfg);
+			}
+		}
+
+		const char* const begin = &compressed[0];
+		begin_send_buffer(bufs[n],size_hint);
+		if(n & DEFLATE) {
+			append_deflated(bufs[n],begin,begin + compressed.size());
+		} else {
+			bufs[n].insert(bufs[n].end(),begin,begin + compressed.size());
+		}
+
+		end_send_buffer(bufs[n]);
+	}
+
+	std::vector<TCPsocket> socks[NBUFFERS];
+	{
+		const threading::lock lock(*connections_mutex);
+		for(int n = 0; n != NBUFFERS; ++n) {
+			for(std::vector<connection>::const_iterator t = targets[n].begin(); t != targets[n].end(); ++t) {
+				const connection_map::iterator info = connections.find(*t);
+				wassert(info != connections.end());
+				info->second.sent += bufs[n].size();
+				socks[n].push_back(info->second.sock);
+			}
+
+			if(targets[n].empty() == false) {
+				last_send_size = bufs[n].size();
+			}
+		}
+	}
+
+	for(int n = 0; n != NBUFFERS; ++n) {
+		if(socks[n].empty() == false) {
+			network_worker_pool::queue_data(socks[n],bufs[n]);
+		}
+	}
+}
+
 void process_send_queue(connection connection_num, size_t max_size)
 {
 	check_error();
 }
 
-void send_data_all_except(const config& cfg, connection connection_num, size_t max_size)
+void send_data_all_except(const config& cfg, connection connection_num, size_t /*max_size*/)
 {
+	//the data is compressed once and queued whole for all the connections,
+	//as send_data queues it whole whatever the size
+	std::vector<connection> targets;
 	for(sockets_list::const_iterator i = sockets.begin(); i != sockets.end(); ++i) {
-		if(*i == connection_num) {
-			continue;
+		if(*i != connection_num) {
+			targets.push_back(*i);
 		}
+	}
+
+	queue_data(cfg,targets);
+}
+
+void use_shared_dictionary(connection connection_num)
+{
+	const threading::lock lock(*connections_mutex);
+	const schema_map::iterator schema = schemas.find(connection_num);
+	if(schema == schemas.end()) {
+		return;
+	}
+
+	//the data received uses the dictionary after the peer's marker, and the
+	//data sent uses it after ours
+	schema->second.dictionary_agreed = true;
+	queue_marker(connection_num);
+	add_shared_dictionary(schema->second.outgoing);
+
+	if(broadcast_schema.word_to_char.empty()) {
+		broadcast_schema = schema->second.outgoing;
+	}
+
+	const compression_schema::word_char_map& words = schema->second.outgoing.word_to_char;
+	bool same_codes = true;
+	for(compression_schema::word_char_map::const_iterator w = broadcast_schema.word_to_char.begin();
+	    w != broadcast_schema.word_to_char.end() && same_codes; ++w) {
+		const compression_schema::word_char_map::const_iterator code = words.find(w->first);
+		same_codes = code != words.end() && code->second == w->second;
+	}
 
-		send_data(cfg,*i,max_size);
+	schema->second.dictionary_codes = same_codes;
+}
+
+void use_deflate(connection connection_num)
+{
+	const threading::lock lock(*connections_mutex);
+	const connection_map::iterator info = connections.find(connection_num);
+	if(info != connections.end()) {
+		//the data received is deflated after the peer's marker, and the data
+		//sent after ours
+		info->second.deflate_agreed = true;
+		queue_marker(connection_num);
+		info->second.deflate = true;
 	}
 }
 
@@ -19,6 +19,7 @@ class config;
 #include "SDL_net.h"
 
 #include <string>
+#include <vector>
 
 namespace threading
 {
@@ -107,6 +108,13 @@ void queue_disconnect(connection connection_num);
 connection receive_data(config& cfg, connection connection_num=0);
 connection receive_data(config& cfg, connection connection_num, int timeout);
 
+//function to wait until there may be a connection to accept or data to
+//receive, or until 'timeout' milliseconds have passed. If 'fd' isn't -1, input
+//on that file descriptor also ends the wait. Where this can't be waited for
+//efficiently, it sleeps for a short while instead, so it must be called in a
+//loop which checks for connections and data anyway.
+void wait_for_activity(int timeout, int fd=-1);
+
 //sets the default maximum number of bytes to send to a client at a time
 void set_default_send_size(size_t send_size);
 
@@ -130,6 +138,11 @@ void send_data(const config& cfg, connection connection_num=0, size_t max_size=0
 //function to queue data to be sent. queue_data(cfg,sock) is equivalent to send_data(cfg,sock,0,QUEUE_ONLY)
 void queue_data(const config& cfg, connection connection_num=0);
 
+//function to queue data to be sent to several connections. The data is
+//serialized once, without the connections' compression schemas, and shared
+//between the connections, so that the cost doesn't grow with their number.
+void queue_data(const config& cfg, const std::vector<connection>& connection_nums);
+
 //function to send any data that is in a connection's send_queue, up to a maximum
 //of 'max_size' bytes -- or the entire send queue if 'max_size' bytes is 0
 void process_send_queue(connection connection_num=0, size_t max_size=0);
@@ -137,14 +150,30 @@ void process_send_queue(connection connection_num=0, size_t max_size=0);
 //function to send data to all peers except 'connection_num'
 void send_data_all_except(const config& cfg, connection connection_num, size_t max_size=0);
 
+//function to add the shared dictionary of binary WML to the compression
+//schemas of a connection, once its peer has agreed to use it during the
+//version handshake. The data sent uses it from then on, after a marker which
+//tells the peer to use it for the data received from then on. The peer
+//replying to the handshake calls it right after sending its reply, and the
+//other peer right after receiving it.
+void use_shared_dictionary(connection connection_num);
+
+//function to compress the data of a connection with zlib, once its peer
+//has agreed to it during the version handshake, in the same way as
+//use_shared_dictionary. If both are used, they are called one right after
+//the other. Only data large enough to shrink is compressed.
+void use_deflate(connection connection_num);
+
 //function to get the remote ip address of a socket
 std::string ip_address(connection connection_num);
 
 struct connection_stats
 {
-	connection_stats(int sent, int received, int connected_at);
+	connection_stats(size_t sent, size_t received, int connected_at);
 
-	int bytes_sent, bytes_received;
+	//the counts wrap around once past the range of size_t, which the
+	//difference of two counts doesn't mind
+	size_t bytes_sent, bytes_received;
 	int time_connected;
 };
 
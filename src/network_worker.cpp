@@ -40,6 +40,10 @@
 #    include <fcntl.h>
 #  endif
 #  define SOCKET int
+#  ifdef HAVE_SYS_EPOLL_H
+#    define USE_ACTIVITY_PIPE 1
+#    include <unistd.h>
+#  endif
 #  ifdef HAVE_POLL_H
 #    define USE_POLL 1
 #    include <poll.h>
@@ -79,51 +83,189 @@ struct buffer {
 	mutable std::vector<char> buf;
 };
 
+//data to be sent to one or more sockets. It is shared by those sockets, and
+//freed when it has been sent to all of them.
+struct shared_data {
+	explicit shared_data(size_t refs) : refs(refs) {}
+
+	std::vector<char> buf;
+
+	//the number of sockets which still hold the data, guarded by 'mutex'
+	size_t refs;
+	threading::mutex mutex;
+};
+
+//called when a socket is done with some data, to free it if no other
+//socket holds it
+void release_data(shared_data* data)
+{
+	bool last;
+	{
+		const threading::lock lock(data->mutex);
+		last = --data->refs == 0;
+	}
+
+	if(last) {
+		delete data;
+	}
+}
+
+enum SOCKET_STATE { SOCKET_READY, SOCKET_LOCKED, SOCKET_ERRORED, SOCKET_INTERRUPT, SOCKET_CLOSED };
+
+//what the worker threads know about a socket. Each socket has its own lock,
+//so that threads serving different sockets don't wait for each other.
+struct socket_state {
+	explicit socket_state(TCPsocket sock) : sock(sock), state(SOCKET_READY), receive_pending(false), queued(false)
+	{}
+
+	bool has_work() const { return state == SOCKET_READY && (sends.empty() == false || receive_pending); }
+
+	const TCPsocket sock;
+
+	//all the members below are guarded by 'mutex'
+	threading::mutex mutex;
+	SOCKET_STATE state;
+
+	//the data waiting to be sent down the socket, in order
+	std::deque<shared_data*> sends;
+
+	//true if data is waiting to be received from the socket
+	bool receive_pending;
+
+	//true if the socket is in the ready queue. It is never there more than
+	//once, so that only one thread at a time serves it.
+	bool queued;
+
+	std::pair<network::statistics,network::statistics> stats;
+};
+
+//locks are always taken in this order: 'states_mutex', the lock of a socket,
+//then 'queue_mutex' or 'results_mutex'
+
 bool managed = false;
-typedef std::vector< buffer * > buffer_set;
-buffer_set bufs;
 
-//a queue of sockets that we are waiting to receive on
-typedef std::vector<TCPsocket> receive_list;
-receive_list pending_receives;
+//the state of each socket, guarded by 'states_mutex'. The map is only used
+//to find the state of a socket, not while data is transferred.
+typedef std::map<TCPsocket,socket_state*> socket_state_map;
+socket_state_map socket_states;
+threading::mutex* states_mutex = NULL;
+
+//the sockets which have work to be done, guarded by 'queue_mutex'. A thread
+//takes the socket at the front of the queue, and puts it back at the end if
+//it still has work after one transfer, so that the sockets are served in turn.
+std::deque<socket_state*> ready_queue;
+threading::mutex* queue_mutex = NULL;
+threading::condition* cond = NULL;
 
+//the results of the transfers, guarded by 'results_mutex'
 typedef std::deque<buffer> received_queue;
 received_queue received_data_queue;
+std::vector<TCPsocket> errored_sockets;
+threading::mutex* results_mutex = NULL;
 
-enum SOCKET_STATE { SOCKET_READY, SOCKET_LOCKED, SOCKET_ERRORED, SOCKET_INTERRUPT };
-typedef std::map<TCPsocket,SOCKET_STATE> socket_state_map;
-typedef std::map<TCPsocket, std::pair<network::statistics,network::statistics> > socket_stats_map;
+std::vector<threading::thread*> threads;
 
-socket_state_map sockets_locked;
-socket_stats_map transfer_stats;
+#ifdef USE_ACTIVITY_PIPE
+//a pipe which is written to when there is activity, so that the main thread
+//can wait for it along with the sockets
+int activity_pipe[2] = { -1, -1 };
+bool activity_signalled = false;
+#endif
 
-int socket_errors = 0;
-threading::mutex* global_mutex = NULL;
-threading::condition* cond = NULL;
+//signals that data has been received or an error has occurred. Must be
+//called with the results mutex locked.
+void signal_activity()
+{
+#ifdef USE_ACTIVITY_PIPE
+	if(activity_signalled == false && activity_pipe[1] != -1) {
+		const char c = 0;
+		activity_signalled = write(activity_pipe[1],&c,1) == 1;
+	}
+#endif
+}
 
-std::vector<threading::thread*> threads;
+//returns the state of a socket, or NULL if it wasn't added, or if it was
+//forgotten once closed or after an error. Data may still be queued by other
+//threads for a socket which was forgotten, and is then dropped. Must be
+//called with the states mutex locked.
+socket_state* get_state(TCPsocket sock)
+{
+	const socket_state_map::const_iterator i = socket_states.find(sock);
+	return i != socket_states.end() ? i->second : NULL;
+}
+
+//puts a socket in the ready queue if it has work to be done and isn't there
+//already. Must be called with the socket locked.
+void schedule(socket_state& s)
+{
+	if(s.queued == false && s.has_work()) {
+		s.queued = true;
+		{
+			const threading::lock lock(*queue_mutex);
+			ready_queue.push_back(&s);
+		}
 
-SOCKET_STATE send_buf(TCPsocket sock, std::vector<char>& buf) {
+		cond->notify_one();
+	}
+}
+
+//drops everything waiting to be sent to or received from a socket which no
+//thread is serving, and marks it closed. Returns true if the state can be
+//freed at once: a socket still in the ready queue is freed by the thread
+//which takes it out. Must be called with the socket locked.
+bool forget_socket(socket_state& s)
+{
+	for(std::deque<shared_data*>::const_iterator i = s.sends.begin(); i != s.sends.end(); ++i) {
+		release_data(*i);
+	}
+
+	s.sends.clear();
+	s.receive_pending = false;
+	s.state = SOCKET_CLOSED;
+
+	{
+		const threading::lock lock(*results_mutex);
+		for(received_queue::iterator j = received_data_queue.begin(); j != received_data_queue.end(); ) {
+			if(j->sock == s.sock) {
+				j = received_data_queue.erase(j);
+			} else {
+				++j;
+			}
+		}
+
+		errored_sockets.erase(std::remove(errored_sockets.begin(),errored_sockets.end(),s.sock),errored_sockets.end());
+	}
+
+	return s.queued == false;
+}
+
+//returns true if the transfer going on on a socket hasn't been interrupted
+bool still_locked(socket_state& s)
+{
+	const threading::lock lock(s.mutex);
+	return s.state == SOCKET_LOCKED;
+}
+
+SOCKET_STATE send_buf(socket_state& s, const std::vector<char>& buf) {
 #ifdef __BEOS__
 	int timeout = 15000;
 #endif
+	const TCPsocket sock = s.sock;
 	size_t upto = 0;
 	size_t size = buf.size();
 	{
-		const threading::lock lock(*global_mutex);
-		transfer_stats[sock].first.fresh_current(size);
+		const threading::lock lock(s.mutex);
+		s.stats.first.fresh_current(size);
 	}
 #ifdef __BEOS__
 	while(upto < size && timeout > 0) {
 #else
 	while(upto < size) {
 #endif
-		{
-			// check if the socket is still locked
-			const threading::lock lock(*global_mutex);
-			if(sockets_locked[sock] != SOCKET_LOCKED)
-				return SOCKET_ERRORED;
-		}
+		// check if the socket is still locked
+		if(!still_locked(s))
+			return SOCKET_ERRORED;
+
 		const int res = SDLNet_TCP_Send(sock, &buf[upto], static_cast<int>(size - upto));
 
 		if(res <= 0) {
@@ -173,15 +315,16 @@ SOCKET_STATE send_buf(TCPsocket sock, std::vector<char>& buf) {
 #endif
 		upto += static_cast<size_t>(res);
 		{
-			const threading::lock lock(*global_mutex);
-			transfer_stats[sock].first.transfer(static_cast<size_t>(res));
+			const threading::lock lock(s.mutex);
+			s.stats.first.transfer(static_cast<size_t>(res));
 		}
 	}
 	return SOCKET_READY;
 }
 
-SOCKET_STATE receive_buf(TCPsocket sock, std::vector<char>& buf)
+SOCKET_STATE receive_buf(socket_state& s, std::vector<char>& buf)
 {
+	const TCPsocket sock = s.sock;
 	char num_buf[4];
 	int len = SDLNet_TCP_Recv(sock,num_buf,4);
 
@@ -200,18 +343,14 @@ SOCKET_STATE receive_buf(TCPsocket sock, std::vector<char>& buf)
 	const char* const end = beg + len;
 
 	{
-		const threading::lock lock(*global_mutex);
-		transfer_stats[sock].second.fresh_current(len);
+		const threading::lock lock(s.mutex);
+		s.stats.second.fresh_current(len);
 	}
 
 	while(beg != end) {
-		{
-			// if we are receiving the socket is in sockets_locked
-			// check if it is still locked
-			const threading::lock lock(*global_mutex);
-			if(sockets_locked[sock] != SOCKET_LOCKED) {
-				return SOCKET_ERRORED;
-			}
+		// check if the socket is still locked
+		if(!still_locked(s)) {
+			return SOCKET_ERRORED;
 		}
 
 		const int res = SDLNet_TCP_Recv(sock, beg, end - beg);
@@ -255,8 +394,8 @@ SOCKET_STATE receive_buf(TCPsocket sock, std::vector<char>& buf)
 
 		beg += res;
 		{
-			const threading::lock lock(*global_mutex);
-			transfer_stats[sock].second.transfer(static_cast<size_t>(res));
+			const threading::lock lock(s.mutex);
+			s.stats.second.transfer(static_cast<size_t>(res));
 		}
 	}
 	return SOCKET_READY;
@@ -267,86 +406,86 @@ int process_queue(void* data)
 	LOG_NW << "thread started...\n";
 	for(;;) {
 
-		//if we find a socket to send data to, sent_buf will be non-NULL. If we find a socket
-		//to receive data from, sent_buf will be NULL. 'sock' will always refer to the socket
-		//that data is being sent to/received from
-		TCPsocket sock = NULL;
-		buffer *sent_buf = NULL;
+		socket_state* s = NULL;
 
 		{
-			const threading::lock lock(*global_mutex);
-
-			for(;;) {
-
-				buffer_set::iterator itor = bufs.begin(), itor_end = bufs.end();
-				for(; itor != itor_end; ++itor) {
-					socket_state_map::iterator lock_it = sockets_locked.find((*itor)->sock);
-					wassert(lock_it != sockets_locked.end());
-					if(lock_it->second == SOCKET_READY) {
-						lock_it->second = SOCKET_LOCKED;
-						sent_buf = *itor;
-						sock = sent_buf->sock;
-						bufs.erase(itor);
-						break;
-					}
+			const threading::lock lock(*queue_mutex);
+			while(ready_queue.empty()) {
+				if(managed == false) {
+					LOG_NW << "worker thread exiting...\n";
+					return 0;
 				}
 
-				if(sock == NULL) {
-					receive_list::iterator itor = pending_receives.begin(), itor_end = pending_receives.end();
-					for(; itor != itor_end; ++itor) {
-						socket_state_map::iterator lock_it = sockets_locked.find(*itor);
-						wassert(lock_it != sockets_locked.end());
-						if(lock_it->second == SOCKET_READY) {
-							lock_it->second = SOCKET_LOCKED;
-							sock = *itor;
-							pending_receives.erase(itor);
-							break;
-						}
-					}
-				}
+				cond->wait(*queue_mutex); // temporarily release the mutex and wait for a socket
+			}
 
-				if(sock != NULL) {
-					break;
-				}
+			s = ready_queue.front();
+			ready_queue.pop_front();
+		}
 
-				if(managed == false) {
-					LOG_NW << "worker thread exiting...\n";
-					return 0;
+		//if we find data to send, sent_data will be non-NULL. Otherwise we
+		//receive data from the socket.
+		shared_data* sent_data = NULL;
+		bool closed = false;
+
+		{
+			const threading::lock lock(s->mutex);
+			s->queued = false;
+			if(s->state == SOCKET_CLOSED) {
+				closed = true;
+			} else if(s->has_work()) {
+				if(s->sends.empty() == false) {
+					sent_data = s->sends.front();
+					s->sends.pop_front();
+				} else {
+					s->receive_pending = false;
 				}
 
-				cond->wait(*global_mutex); // temporarily release the mutex and wait for a buffer
+				s->state = SOCKET_LOCKED;
+			} else {
+				continue;
 			}
 		}
 
-		wassert(sock);
+		if(closed) {
+			//the socket was closed while it was in the queue, leaving us to
+			//free its state
+			delete s;
+			continue;
+		}
 
 		LOG_NW << "thread found a buffer...\n";
 
 		SOCKET_STATE result = SOCKET_READY;
 		std::vector<char> buf;
 
-		if(sent_buf != NULL) {
-			result = send_buf(sent_buf->sock, sent_buf->buf);
-			delete sent_buf;
-			sent_buf = NULL;
+		if(sent_data != NULL) {
+			//the data may be sent to other sockets at the same time, but it
+			//is only read until all of them release it
+			result = send_buf(*s, sent_data->buf);
+			release_data(sent_data);
 		} else {
-			result = receive_buf(sock,buf);
+			result = receive_buf(*s, buf);
 		}
 
 		{
-			const threading::lock lock(*global_mutex);
-			socket_state_map::iterator lock_it = sockets_locked.find(sock);
-			wassert(lock_it != sockets_locked.end());
-			lock_it->second = result;
-			if(result == SOCKET_ERRORED) {
-				++socket_errors;
-			}
+			const threading::lock lock(s->mutex);
+			s->state = result;
+
+			//if there was an error or we received data, let the main thread know
+			if(result == SOCKET_ERRORED || buf.empty() == false) {
+				const threading::lock lock(*results_mutex);
+				if(result == SOCKET_ERRORED) {
+					errored_sockets.push_back(s->sock);
+				} else {
+					received_data_queue.push_back(buffer(s->sock));
+					received_data_queue.back().buf.swap(buf);
+				}
 
-			//if we received data, add it to the queue
-			if(result == SOCKET_READY && buf.empty() == false) {
-				received_data_queue.push_back(buffer(sock));
-				received_data_queue.back().buf.swap(buf);
+				signal_activity();
 			}
+
+			schedule(*s);
 		}
 	}
 	// unreachable
@@ -361,9 +500,20 @@ manager::manager(size_t nthreads) : active_(!managed)
 {
 	if(active_) {
 		managed = true;
-		global_mutex = new threading::mutex();
+		states_mutex = new threading::mutex();
+		queue_mutex = new threading::mutex();
+		results_mutex = new threading::mutex();
 		cond = new threading::condition();
 
+#ifdef USE_ACTIVITY_PIPE
+		if(pipe(activity_pipe) == 0) {
+			fcntl(activity_pipe[0],F_SETFL,fcntl(activity_pipe[0],F_GETFL,0)|O_NONBLOCK);
+			fcntl(activity_pipe[1],F_SETFL,fcntl(activity_pipe[1],F_GETFL,0)|O_NONBLOCK);
+		} else {
+			activity_pipe[0] = activity_pipe[1] = -1;
+		}
+#endif
+
 		for(size_t n = 0; n != nthreads; ++n) {
 			threads.push_back(new threading::thread(process_queue,NULL));
 		}
@@ -374,9 +524,8 @@ manager::~manager()
 {
 	if(active_) {
 		{
-			const threading::lock lock(*global_mutex);
+			const threading::lock lock(*queue_mutex);
 			managed = false;
-			socket_errors = 0;
 		}
 		cond->notify_all();
 
@@ -388,33 +537,76 @@ manager::~manager()
 
 		threads.clear();
 
-		delete global_mutex;
+		//free the states of the sockets, including those which were closed
+		//while they were in the queue
+		for(std::deque<socket_state*>::const_iterator q = ready_queue.begin(); q != ready_queue.end(); ++q) {
+			if((*q)->state == SOCKET_CLOSED) {
+				delete *q;
+			}
+		}
+
+		ready_queue.clear();
+
+		for(socket_state_map::const_iterator s = socket_states.begin(); s != socket_states.end(); ++s) {
+			for(std::deque<shared_data*>::const_iterator d = s->second->sends.begin(); d != s->second->sends.end(); ++d) {
+				release_data(*d);
+			}
+
+			delete s->second;
+		}
+
+		socket_states.clear();
+		received_data_queue.clear();
+		errored_sockets.clear();
+
+		delete states_mutex;
+		delete queue_mutex;
+		delete results_mutex;
 		delete cond;
-		global_mutex = NULL;
+		states_mutex = NULL;
+		queue_mutex = NULL;
+		results_mutex = NULL;
 		cond = NULL;
 
-		sockets_locked.clear();
-		transfer_stats.clear();
+#ifdef USE_ACTIVITY_PIPE
+		if(activity_pipe[0] != -1) {
+			close(activity_pipe[0]);
+			close(activity_pipe[1]);
+			activity_pipe[0] = activity_pipe[1] = -1;
+		}
+
+		activity_signalled = false;
+#endif
 
 		LOG_NW << "exiting manager::~manager()\n";
 	}
 }
 
-void receive_data(TCPsocket sock)
+void add_socket(TCPsocket sock)
 {
-	{
-		const threading::lock lock(*global_mutex);
+	const threading::lock lock(*states_mutex);
+	socket_state*& s = socket_states[sock];
+	if(s == NULL) {
+		s = new socket_state(sock);
+	}
+}
 
-		pending_receives.push_back(sock);
-		sockets_locked.insert(std::pair<TCPsocket,SOCKET_STATE>(sock,SOCKET_READY));
+void receive_data(TCPsocket sock)
+{
+	const threading::lock lock(*states_mutex);
+	socket_state* const s = get_state(sock);
+	if(s == NULL) {
+		return;
 	}
 
-	cond->notify_one();
+	const threading::lock state_lock(s->mutex);
+	s->receive_pending = true;
+	schedule(*s);
 }
 
 TCPsocket get_received_data(TCPsocket sock, std::vector<char>& buf)
 {
-	const threading::lock lock(*global_mutex);
+	const threading::lock lock(*results_mutex);
 	received_queue::iterator itor = received_data_queue.begin();
 	if(sock != NULL) {
 		for(; itor != received_data_queue.end(); ++itor) {
@@ -438,94 +630,185 @@ void queue_data(TCPsocket sock, std::vector<char>& buf)
 {
 	LOG_NW << "queuing " << buf.size() << " bytes of data...\n";
 
-	{
-		const threading::lock lock(*global_mutex);
-
-		buffer *queued_buf = new buffer(sock);
-		queued_buf->buf.swap(buf);
-		bufs.push_back(queued_buf);
+	shared_data* const data = new shared_data(1);
+	data->buf.swap(buf);
 
-		sockets_locked.insert(std::pair<TCPsocket,SOCKET_STATE>(sock,SOCKET_READY));
+	const threading::lock lock(*states_mutex);
+	socket_state* const s = get_state(sock);
+	if(s == NULL) {
+		LOG_NW << "dropping the data queued for a closed socket\n";
+		release_data(data);
+		return;
 	}
 
-	cond->notify_one();
+	const threading::lock state_lock(s->mutex);
+	s->sends.push_back(data);
+	schedule(*s);
 }
 
-namespace
+void queue_data(const std::vector<TCPsocket>& socks, std::vector<char>& buf)
 {
-
-void remove_buffers(TCPsocket sock)
-{
-	buffer_set new_bufs;
-	new_bufs.reserve(bufs.size());
-	for(buffer_set::iterator i = bufs.begin(), i_end = bufs.end(); i != i_end; ++i) {
-		if ((*i)->sock == sock)
-			delete *i;
-		else
-			new_bufs.push_back(*i);
+	if(socks.empty()) {
+		return;
 	}
-	bufs.swap(new_bufs);
 
-	for(received_queue::iterator j = received_data_queue.begin(); j != received_data_queue.end(); ) {
-		if(j->sock == sock) {
-			j = received_data_queue.erase(j);
-		} else {
-			++j;
+	LOG_NW << "queuing " << buf.size() << " bytes of data to " << socks.size() << " sockets...\n";
+
+	shared_data* const data = new shared_data(socks.size());
+	data->buf.swap(buf);
+
+	const threading::lock lock(*states_mutex);
+	for(std::vector<TCPsocket>::const_iterator sock = socks.begin(); sock != socks.end(); ++sock) {
+		socket_state* const s = get_state(*sock);
+		if(s == NULL) {
+			LOG_NW << "dropping the data queued for a closed socket\n";
+			release_data(data);
+			continue;
 		}
+
+		const threading::lock state_lock(s->mutex);
+		s->sends.push_back(data);
+		schedule(*s);
 	}
 }
 
+int activity_fd()
+{
+#ifdef USE_ACTIVITY_PIPE
+	return activity_pipe[0];
+#else
+	return -1;
+#endif
+}
+
+void clear_activity()
+{
+#ifdef USE_ACTIVITY_PIPE
+	const threading::lock lock(*results_mutex);
+	if(activity_signalled) {
+		char buf[16];
+		while(read(activity_pipe[0],buf,sizeof(buf)) > 0) {
+		}
+
+		activity_signalled = false;
+	}
+#endif
 }
 
 bool close_socket(TCPsocket sock)
 {
-	const threading::lock lock(*global_mutex);
-
-	pending_receives.erase(std::remove(pending_receives.begin(),pending_receives.end(),sock),pending_receives.end());
+	const threading::lock lock(*states_mutex);
 
-	const socket_state_map::iterator lock_it = sockets_locked.find(sock);
-	if(lock_it == sockets_locked.end()) {
-		remove_buffers(sock);
+	const socket_state_map::iterator i = socket_states.find(sock);
+	if(i == socket_states.end()) {
 		return true;
 	}
 
-	if(lock_it->second != SOCKET_LOCKED && lock_it->second != SOCKET_INTERRUPT) {
-		sockets_locked.erase(lock_it);
-		remove_buffers(sock);
-		return true;
-	} else {
-		lock_it->second = SOCKET_INTERRUPT;
-		return false;
+	socket_state* const s = i->second;
+	bool free_state;
+
+	{
+		const threading::lock state_lock(s->mutex);
+		if(s->state == SOCKET_LOCKED || s->state == SOCKET_INTERRUPT) {
+			s->state = SOCKET_INTERRUPT;
+			return false;
+		}
+
+		free_state = forget_socket(*s);
+	}
+
+	socket_states.erase(i);
+	if(free_state) {
+		delete s;
 	}
+
+	return true;
 }
 
 TCPsocket detect_error()
 {
-	const threading::lock lock(*global_mutex);
-	if(socket_errors > 0) {
-		for(socket_state_map::iterator i = sockets_locked.begin(); i != sockets_locked.end(); ++i) {
-			if(i->second == SOCKET_ERRORED) {
-				--socket_errors;
-				const TCPsocket sock = i->first;
-				sockets_locked.erase(i);
-				remove_buffers(sock);
-				pending_receives.erase(std::remove(pending_receives.begin(),pending_receives.end(),sock),pending_receives.end());
-				return sock;
+	for(;;) {
+		TCPsocket sock;
+		{
+			const threading::lock lock(*results_mutex);
+			if(errored_sockets.empty()) {
+				return 0;
 			}
+
+			sock = errored_sockets.front();
+			errored_sockets.erase(errored_sockets.begin());
 		}
-	}
 
-	socket_errors = 0;
+		const threading::lock lock(*states_mutex);
 
-	return 0;
+		const socket_state_map::iterator i = socket_states.find(sock);
+		if(i == socket_states.end()) {
+			continue;
+		}
+
+		socket_state* const s = i->second;
+		bool free_state;
+
+		{
+			const threading::lock state_lock(s->mutex);
+			if(s->state != SOCKET_ERRORED) {
+				continue;
+			}
+
+			free_state = forget_socket(*s);
+		}
+
+		socket_states.erase(i);
+		if(free_state) {
+			delete s;
+		}
+
+		return sock;
+	}
 }
 
 std::pair<network::statistics,network::statistics> get_current_transfer_stats(TCPsocket sock)
 {
-	const threading::lock lock(*global_mutex);
-	return transfer_stats[sock];
-}
+	const threading::lock lock(*states_mutex);
+
+	const socket_state_map::const_iterator i = socket_states.find(sock);
+	if(i == socket_states.end()) {
+		return std::pair<network::statistics,network::statistics>();
+	}
 
+	const threading::lock state_lock(i->second->mutex);
+	return i->second->stats;
 }
 
+pool_stats get_pool_stats()
+{
+	pool_stats res;
+
+	{
+		const threading::lock lock(*states_mutex);
+		res.sockets = socket_states.size();
+		for(socket_state_map::const_iterator i = socket_states.begin(); i != socket_states.end(); ++i) {
+			const threading::lock state_lock(i->second->mutex);
+			res.pending_sends += i->second->sends.size();
+			for(std::deque<shared_data*>::const_iterator d = i->second->sends.begin(); d != i->second->sends.end(); ++d) {
+				//the data doesn't change once it is queued
+				res.pending_send_bytes += (*d)->buf.size();
+			}
+		}
+	}
+
+	{
+		const threading::lock lock(*queue_mutex);
+		res.ready_sockets = ready_queue.size();
+	}
+
+	{
+		const threading::lock lock(*results_mutex);
+		res.received_messages = received_data_queue.size();
+		res.errored_sockets = errored_sockets.size();
+	}
 
+	return res;
+}
+
+}
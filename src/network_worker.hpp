@@ -39,18 +39,53 @@ private:
 	bool active_;
 };
 
+//starts managing a new socket. Data received from or queued for a socket
+//which isn't managed, such as one closed or forgotten after an error, is
+//ignored.
+void add_socket(TCPsocket sock);
+
 //function to asynchronously received data to the given socket
 void receive_data(TCPsocket sock);
 
 TCPsocket get_received_data(TCPsocket sock, std::vector<char>& buf);
 
 void queue_data(TCPsocket sock, std::vector<char>& buf);
+
+//queues the same data to be sent to several sockets. The data is shared
+//between them rather than copied for each.
+void queue_data(const std::vector<TCPsocket>& socks, std::vector<char>& buf);
+
+//returns a file descriptor which becomes readable when data has been received
+//or an error has occurred on a socket, or -1 if there is none
+int activity_fd();
+
+//makes the file descriptor returned by activity_fd() unreadable again, until
+//there is more activity
+void clear_activity();
+
 bool socket_locked(TCPsocket sock);
 bool close_socket(TCPsocket sock);
 TCPsocket detect_error();
 
 std::pair<network::statistics,network::statistics> get_current_transfer_stats(TCPsocket sock);
 
+//the work waiting to be done by or collected from the worker threads
+struct pool_stats
+{
+	pool_stats() : sockets(0), ready_sockets(0), pending_sends(0), pending_send_bytes(0),
+	               received_messages(0), errored_sockets(0)
+	{}
+
+	size_t sockets;
+	size_t ready_sockets;      //sockets with work, waiting for a thread
+	size_t pending_sends;      //data waiting to be sent, counted once per socket
+	size_t pending_send_bytes;
+	size_t received_messages;  //data received, waiting for get_received_data()
+	size_t errored_sockets;    //errors waiting for detect_error()
+};
+
+pool_stats get_pool_stats();
+
 }
 
 #endif
@@ -25,6 +25,7 @@ class gamestatus;
 
 #include <cmath>
 #include <iostream>
+#include <queue>
 
 #define LOG_PF LOG_STREAM(info, engine)
 
@@ -218,7 +219,7 @@ label_AStarSearch_end:
 
 namespace {
 	gamemap::location find_vacant(const gamemap& map,
-		const std::map<gamemap::location,unit>& units,
+		const unit_map& units,
 		const gamemap::location& loc, int depth,
 		VACANT_TILE_TYPE vacancy,
 		std::set<gamemap::location>& touched)
@@ -254,7 +255,7 @@ namespace {
 }
 
 gamemap::location find_vacant_tile(const gamemap& map,
-																	 const std::map<gamemap::location,unit>& units,
+																	 const unit_map& units,
 																	 const gamemap::location& loc,
 																	 VACANT_TILE_TYPE vacancy)
 {
@@ -327,14 +328,14 @@ void get_tiles_radius(gamemap const &map, std::vector<gamemap::location> const &
 }
 
 bool enemy_zoc(gamemap const &map, gamestatus const &status,
-               std::map<gamemap::location, unit> const &units,
+               unit_map const &units,
                std::vector<team> const &teams,
                gamemap::location const &loc, team const &current_team, int side)
 {
 	gamemap::location locs[6];
 	get_adjacent_tiles(loc,locs);
 	for(int i = 0; i != 6; ++i) {
-		const std::map<gamemap::location,unit>::const_iterator it
+		const unit_map::const_iterator it
 			= find_visible_unit(units,locs[i],
 			map,
 			status.get_time_of_day().lawful_bonus,
@@ -348,124 +349,253 @@ bool enemy_zoc(gamemap const &map, gamestatus const &status,
 	return false;
 }
 
+threat_grid::threat_grid(gamemap const &map, gamestatus const &status,
+                         unit_map const &units,
+                         std::vector<team> const &teams, team const &current_team, int side)
+	: side_(side), width_(map.x()), height_(map.y()), flags_(map.x() * map.y(), 0)
+{
+	const int lawful_bonus = status.get_time_of_day().lawful_bonus;
+
+	for(unit_map::const_iterator u = units.begin(); u != units.end(); ++u) {
+		const gamemap::location& loc = u->first;
+		if(!map.on_board(loc) || !current_team.is_enemy(u->second.side()) ||
+		   u->second.invisible(map.underlying_terrain(map[loc.x][loc.y]),
+		                       lawful_bonus, loc, units, teams)) {
+			continue;
+		}
+
+		flags_[loc.x + loc.y * width_] |= ENEMY;
+
+		if(u->second.side() == side || !u->second.emits_zoc()) {
+			continue;
+		}
+
+		const unsigned char zoc = current_team.fogged(loc.x, loc.y) ? ZOC : ZOC | UNFOGGED_ZOC;
+
+		gamemap::location adj[6];
+		get_adjacent_tiles(loc, adj);
+		for(size_t i = 0; i != 6; ++i) {
+			if(map.on_board(adj[i])) {
+				flags_[adj[i].x + adj[i].y * width_] |= zoc;
+			}
+		}
+	}
+}
+
+unsigned char threat_grid::flags(gamemap::location const &loc) const
+{
+	if(loc.x < 0 || loc.y < 0 || loc.x >= width_ || loc.y >= height_)
+		return 0;
+
+	return flags_[loc.x + loc.y * width_];
+}
+
 namespace {
 
-	void find_routes(const gamemap& map, const gamestatus& status,
-		const game_data& gamedata,
-		const std::map<gamemap::location,unit>& units,
+	//the search state of every hex of the map is kept in flat arrays indexed
+	//by x + y*width, so that relaxing an edge costs neither an allocation nor
+	//a copy of the route leading to it. The movement left at a hex is encoded
+	//as turns_left * total_movement + move_left, which is also the value
+	//stored in paths::route::move_left.
+	struct route_search
+	{
+		route_search(const gamemap& map)
+			: width(map.x()), height(map.y()),
+			  best(width * height, -1), turns(width * height, 0),
+			  moves(width * height, 0), parent(width * height, -1),
+			  closed(width * height, false)
+		{}
+
+		int index(const gamemap::location& loc) const { return loc.x + loc.y * width; }
+		gamemap::location location(int index) const { return gamemap::location(index % width, index / width); }
+
+		int width, height;
+		std::vector<int> best, turns, moves, parent;
+		std::vector<bool> closed;
+		std::vector<int> order; //hexes in the order they were settled
+	};
+
+	//the open list of the search: pairs of (movement left, hex index), the
+	//hex with the most movement left being on top of the heap
+	typedef std::priority_queue<std::pair<int, int> > route_queue;
+
+	void find_routes(const gamemap& map,
+		const unit_map& units,
 		const unit& u,
 		const gamemap::location& loc,
-		int move_left,
 		std::map<gamemap::location,paths::route>& routes,
 		std::vector<team> const &teams,
-		bool ignore_zocs, bool allow_teleport, int turns_left, bool starting_pos)
+		bool ignore_zocs, bool allow_teleport, int turns_left,
+		threat_grid const &threats)
 	{
-		if(size_t(u.side()-1) >= teams.size()) {
-			return;
-		}
-
 		team const &current_team = teams[u.side()-1];
+		const int total_movement = u.total_movement();
 
-		//find adjacent tiles
-		std::vector<gamemap::location> locs(6);
-		get_adjacent_tiles(loc,&locs[0]);
-
-		//check for teleporting units -- we must be on a vacant (or occupied by this unit)
-		//village, that is controlled by our team to be able to teleport.
-		if (allow_teleport && map.is_village(loc) &&
-		    current_team.owns_village(loc) && (starting_pos || units.count(loc) == 0)) {
-			const std::vector<gamemap::location>& villages = map.villages();
-
-			//if we are on a village, see all friendly villages that we can
-			//teleport to
-			for(std::vector<gamemap::location>::const_iterator t = villages.begin();
-			    t != villages.end(); ++t) {
-				if (!current_team.owns_village(*t) || units.count(*t))
-					continue;
+		route_search search(map);
+		route_queue queue;
 
-				locs.push_back(*t);
-			}
-		}
+		//the starting hex is recorded with the movement left this turn only,
+		//but it is expanded with all the additional turns available
+		const int start = search.index(loc);
+		search.best[start] = u.movement_left();
+		search.turns[start] = turns_left;
+		search.moves[start] = u.movement_left();
+		queue.push(std::make_pair(turns_left * total_movement + u.movement_left(), start));
+
+		std::vector<gamemap::location> locs(6);
 
-		//iterate over all adjacent tiles
-		for(size_t i = 0; i != locs.size(); ++i) {
-			const gamemap::location& currentloc = locs[i];
+		while(!queue.empty()) {
+			const int cur = queue.top().second;
+			const int cur_total = queue.top().first;
+			queue.pop();
 
-			//check if the adjacent location is off the board
-			if (currentloc.x < 0 || currentloc.y < 0 ||
-			    currentloc.x >= map.x() || currentloc.y >= map.y())
+			if(search.closed[cur])
 				continue;
 
-			//see if the tile is on top of an enemy unit
-			const std::map<gamemap::location,unit>::const_iterator unit_it =
-				find_visible_unit(units, locs[i], map,
-				                  status.get_time_of_day().lawful_bonus,
-				                  teams, current_team);
+			search.closed[cur] = true;
+			search.order.push_back(cur);
 
-			if (unit_it != units.end() &&
-			    current_team.is_enemy(unit_it->second.side()))
+			if(cur_total <= 0)
 				continue;
 
-			//find the terrain of the adjacent location
-			const gamemap::TERRAIN terrain = map[currentloc.x][currentloc.y];
+			const gamemap::location curloc = search.location(cur);
+			const int cur_turns = search.turns[cur];
+			const int cur_moves = search.moves[cur];
 
-			//find the movement cost of this type onto the terrain
-			const int move_cost = u.movement_cost(map,terrain);
-			if (move_cost <= move_left ||
-			    turns_left > 0 && move_cost <= u.total_movement()) {
-				int new_move_left = move_left - move_cost;
-				int new_turns_left = turns_left;
-				if (new_move_left < 0) {
-					--new_turns_left;
-					new_move_left = u.total_movement() - move_cost;
+			//find adjacent tiles
+			locs.resize(6);
+			get_adjacent_tiles(curloc,&locs[0]);
+
+			//check for teleporting units -- we must be on a vacant (or occupied by this unit)
+			//village, that is controlled by our team to be able to teleport.
+			if (allow_teleport && map.is_village(curloc) &&
+			    current_team.owns_village(curloc) && (cur == start || units.count(curloc) == 0)) {
+				const std::vector<gamemap::location>& villages = map.villages();
+
+				//if we are on a village, see all friendly villages that we can
+				//teleport to
+				for(std::vector<gamemap::location>::const_iterator t = villages.begin();
+				    t != villages.end(); ++t) {
+					if (!current_team.owns_village(*t) || units.count(*t))
+						continue;
+
+					locs.push_back(*t);
 				}
+			}
 
-				const int total_movement = new_turns_left * u.total_movement() + new_move_left;
+			//iterate over all adjacent tiles
+			for(size_t i = 0; i != locs.size(); ++i) {
+				const gamemap::location& currentloc = locs[i];
 
-				const std::map<gamemap::location,paths::route>::const_iterator
-					rtit = routes.find(currentloc);
+				//check if the adjacent location is off the board
+				if (currentloc.x < 0 || currentloc.y < 0 ||
+				    currentloc.x >= map.x() || currentloc.y >= map.y())
+					continue;
 
-				//if a better route to that tile has already been found
-				if(rtit != routes.end() && rtit->second.move_left >= total_movement)
+				const int next = search.index(currentloc);
+
+				//a hex settled by the search cannot be improved, except for
+				//the starting hex which only records this turn's movement
+				if(search.closed[next] && next != start)
 					continue;
 
-				const bool zoc = !ignore_zocs && enemy_zoc(map,status,units,teams,currentloc,
-							current_team,u.side());
-				paths::route new_route = routes[loc];
-				new_route.steps.push_back(loc);
+				//see if the tile is on top of an enemy unit
+				if (threats.enemy(currentloc))
+					continue;
+
+				//find the terrain of the adjacent location
+				const gamemap::TERRAIN terrain = map[currentloc.x][currentloc.y];
 
+				//find the movement cost of this type onto the terrain
+				const int move_cost = u.movement_cost(map,terrain);
+				if (move_cost > cur_moves &&
+				    (cur_turns <= 0 || move_cost > total_movement))
+					continue;
+
+				int new_move_left = cur_moves - move_cost;
+				int new_turns_left = cur_turns;
+				if (new_move_left < 0) {
+					--new_turns_left;
+					new_move_left = total_movement - move_cost;
+				}
+
+				//if a better route to that tile has already been found
+				if(search.best[next] >= new_turns_left * total_movement + new_move_left)
+					continue;
+
+				const bool zoc = !ignore_zocs && threats.zoc(currentloc);
 				const int zoc_move_left = zoc ? 0 : new_move_left;
-				new_route.move_left = u.total_movement() * new_turns_left + zoc_move_left;
-				routes[currentloc] = new_route;
+				const int new_total = new_turns_left * total_movement + zoc_move_left;
+				if(search.best[next] >= new_total)
+					continue;
 
-				if (new_route.move_left > 0) {
-					find_routes(map, status, gamedata, units, u, currentloc,
-					            zoc_move_left, routes, teams, ignore_zocs,
-					            allow_teleport, new_turns_left, false);
+				search.best[next] = new_total;
+				search.parent[next] = cur;
+
+				if(next != start) {
+					search.turns[next] = new_turns_left;
+					search.moves[next] = zoc_move_left;
+					queue.push(std::make_pair(new_total, next));
 				}
 			}
 		}
+
+		//build the routes. Hexes are settled after the hex they are reached
+		//from, so the steps of the parent are always known by then.
+		for(std::vector<int>::const_iterator i = search.order.begin(); i != search.order.end(); ++i) {
+			paths::route& rt = routes[search.location(*i)];
+			rt.move_left = search.best[*i];
+			if(*i == start)
+				continue;
+
+			const int from = search.parent[*i];
+			if(from != start)
+				rt.steps = routes[search.location(from)].steps;
+			rt.steps.push_back(search.location(from));
+		}
+
+		//the starting hex may have been reached again with more movement left
+		//by going back and forth when planning several turns ahead
+		const int from = search.parent[start];
+		if(from != -1) {
+			paths::route& rt = routes[loc];
+			rt.steps = routes[search.location(from)].steps;
+			rt.steps.push_back(search.location(from));
+		}
 	}
 
 } //end anon namespace
 
 paths::paths(gamemap const &map, gamestatus const &status,
-             game_data const &gamedata,
-             std::map<gamemap::location, unit> const &units,
+             game_data const &/*gamedata*/,
+             unit_map const &units,
              gamemap::location const &loc,
              std::vector<team> const &teams,
-             bool ignore_zocs, bool allow_teleport, int additional_turns)
+             bool ignore_zocs, bool allow_teleport, int additional_turns,
+             threat_grid const *threats)
 {
-	const std::map<gamemap::location,unit>::const_iterator i = units.find(loc);
+	const unit_map::const_iterator i = units.find(loc);
 	if(i == units.end()) {
 		std::cerr << "unit not found\n";
 		return;
 	}
 
 	routes[loc].move_left = i->second.movement_left();
-	find_routes(map,status,gamedata,units,i->second,loc,
-		i->second.movement_left(),routes,teams,
-		ignore_zocs,allow_teleport,additional_turns,true);
+
+	const int side = i->second.side();
+	if(size_t(side-1) >= teams.size()) {
+		return;
+	}
+
+	if(threats != NULL) {
+		wassert(threats->side() == side);
+		find_routes(map,units,i->second,loc,routes,teams,
+			ignore_zocs,allow_teleport,additional_turns,*threats);
+	} else {
+		const threat_grid grid(map,status,units,teams,teams[side-1],side);
+		find_routes(map,units,i->second,loc,routes,teams,
+			ignore_zocs,allow_teleport,additional_turns,grid);
+	}
 }
 
 int route_turns_to_complete(unit const &u, gamemap const &map, paths::route const &rt)
@@ -495,8 +625,8 @@ int route_turns_to_complete(unit const &u, gamemap const &map, paths::route cons
 shortest_path_calculator::shortest_path_calculator(unit const &u, team const &t, unit_map const &units,
                                                    std::vector<team> const &teams, gamemap const &map,
                                                    gamestatus const &status)
-	: unit_(u), team_(t), units_(units), teams_(teams), map_(map),
-	  lawful_bonus_(status.get_time_of_day().lawful_bonus),
+	: unit_(u), team_(t), map_(map),
+	  threats_(map, status, units, teams, t, u.side()),
 	  unit_is_skirmisher_(unit_.type().is_skirmisher()),
 	  movement_left_(unit_.movement_left()),
 	  total_movement_(unit_.total_movement())
@@ -522,25 +652,11 @@ double shortest_path_calculator::cost(const gamemap::location& loc, const double
 	if (total_movement_ < base_cost)
 		return getNoPathValue();
 
-	unit_map::const_iterator
-		enemy_unit = find_visible_unit(units_, loc, map_, lawful_bonus_, teams_, team_),
-		units_end = units_.end();
-
-	if (enemy_unit != units_end && team_.is_enemy(enemy_unit->second.side()))
+	if (threats_.enemy(loc))
 		return getNoPathValue();
 
-	if (!isDst && !unit_is_skirmisher_) {
-		gamemap::location adj[6];
-		get_adjacent_tiles(loc, adj);
-
-		for (size_t i = 0; i != 6; ++i) {
-			enemy_unit = find_visible_unit(units_, adj[i], map_, lawful_bonus_, teams_, team_);
-
-			if (enemy_unit != units_end && team_.is_enemy(enemy_unit->second.side()) &&
-			    !team_.fogged(adj[i].x, adj[i].y) && enemy_unit->second.emits_zoc())
-				return getNoPathValue();
-		}
-	}
+	if (!isDst && !unit_is_skirmisher_ && threats_.unfogged_zoc(loc))
+		return getNoPathValue();
 
 	//compute how many movement points are left in the game turn needed to
 	//reach the previous hex
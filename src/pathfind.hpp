@@ -46,13 +46,47 @@ enum VACANT_TILE_TYPE { VACANT_CASTLE, VACANT_ANY };
 //
 //if no valid location can be found, it will return a null location.
 gamemap::location find_vacant_tile(const gamemap& map,
-                                   const std::map<gamemap::location,unit>& un,
+                                   const unit_map& un,
                                    const gamemap::location& loc,
                                    VACANT_TILE_TYPE vacancy=VACANT_ANY);
 
+//grid of the enemy units current_team can see, and of the hexes on which
+//they exert a zone of control over units of the given side. Building it costs
+//one visibility check per unit, after which the pathfinding functions can
+//answer both questions without looking up any unit. It is a snapshot: it
+//must be rebuilt when units move.
+class threat_grid
+{
+public:
+	threat_grid(gamemap const &map, gamestatus const &status,
+	            unit_map const &units,
+	            std::vector<team> const &teams, team const &current_team, int side);
+
+	int side() const { return side_; }
+
+	//returns true if there is an enemy unit, visible to the side, on loc
+	bool enemy(gamemap::location const &loc) const { return (flags(loc) & ENEMY) != 0; }
+
+	//returns true if loc is in the zone of control of a visible enemy unit
+	bool zoc(gamemap::location const &loc) const { return (flags(loc) & ZOC) != 0; }
+
+	//returns true if loc is in the zone of control of a visible enemy unit
+	//which is not under the fog of the side
+	bool unfogged_zoc(gamemap::location const &loc) const { return (flags(loc) & UNFOGGED_ZOC) != 0; }
+
+private:
+	enum { ENEMY = 1, ZOC = 2, UNFOGGED_ZOC = 4 };
+
+	unsigned char flags(gamemap::location const &loc) const;
+
+	int side_;
+	int width_, height_;
+	std::vector<unsigned char> flags_;
+};
+
 //function which determines if a given location is an enemy zone of control
 bool enemy_zoc(gamemap const &map, gamestatus const &status,
-               std::map<gamemap::location, unit> const &units,
+               unit_map const &units,
                std::vector<team> const &teams, gamemap::location const &loc,
                team const &current_team, int side);
 
@@ -75,11 +109,14 @@ struct paths
 	//additional_turns: if 0, paths for how far the unit can move this turn
 	//will be calculated. If 1, paths for how far the unit can move by the
 	//end of next turn will be calculated, and so forth.
+	//threats: the threat grid of the unit's side, if the caller has one
+	//to share between several units. Otherwise one is built.
 	paths(gamemap const &map, gamestatus const &status,
 	      game_data const &gamedata,
-	      std::map<gamemap::location, unit> const &units,
+	      unit_map const &units,
 	      gamemap::location const &loc, std::vector<team> const &teams,
-	      bool ignore_zocs, bool allow_teleport, int additional_turns = 0);
+	      bool ignore_zocs, bool allow_teleport, int additional_turns = 0,
+	      threat_grid const *threats = NULL);
 
 	//structure which holds a single route between one location and another.
 	struct route
@@ -113,10 +150,8 @@ struct shortest_path_calculator : cost_calculator
 private:
 	unit const &unit_;
 	team const &team_;
-	unit_map const &units_;
-	std::vector<team> const &teams_;
 	gamemap const &map_;
-	int const lawful_bonus_;
+	threat_grid const threats_;
 	bool const unit_is_skirmisher_;
 	int const movement_left_;
 	int const total_movement_;
@@ -109,9 +109,9 @@ LEVEL_RESULT play_game(display& disp, game_state& state, const config& game_conf
 				scenario = &starting_pos;
 			}
 
-			const config::child_list& sides_list = starting_pos.get_children("side");
-			for(config::child_list::const_iterator side = sides_list.begin();
-					side != sides_list.end(); ++side) {
+			const config::child_itors sides_list = starting_pos.child_range("side");
+			for(config::child_iterator side = sides_list.first;
+					side != sides_list.second; ++side) {
 				if((**side)["controller"] == "network" &&
 						(**side)["description"] == preferences::login()) {
 					(**side)["controller"] = preferences::client_type();
@@ -238,9 +238,9 @@ LEVEL_RESULT play_game(display& disp, game_state& state, const config& game_conf
 				scenario = &starting_pos;
 
 				// Tweaks sides to adapt controllers and descriptions.
-				const config::child_list& sides_list = starting_pos.get_children("side");
-				for(config::child_list::const_iterator side = sides_list.begin();
-						side != sides_list.end(); ++side) {
+				const config::child_itors sides_list = starting_pos.child_range("side");
+				for(config::child_iterator side = sides_list.first;
+						side != sides_list.second; ++side) {
 
 					std::string id = (**side)["save_id"];
 					if(id.empty()) {
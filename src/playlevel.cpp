@@ -124,7 +124,7 @@ namespace {
 LEVEL_RESULT play_level(const game_data& gameinfo, const config& game_config,
 		config const* level, CVideo& video,
 		game_state& state_of_game,
-		const std::vector<config*>& story)
+		const config::child_list& story)
 {
 	//if the recorder has no event, adds an "game start" event to the
 	//recorder, whose only goal is to initialize the RNG
@@ -449,7 +449,7 @@ LEVEL_RESULT play_level(const game_data& gameinfo, const config& game_config,
 	                                    state_of_game,status,gameinfo);
 
 	if(recorder.skipping() == false) {
-		for(std::vector<config*>::const_iterator story_i = story.begin(); story_i != story.end(); ++story_i) {
+		for(config::child_list::const_iterator story_i = story.begin(); story_i != story.end(); ++story_i) {
 
 			show_intro(gui,**story_i, *level);
 		}
@@ -810,7 +810,7 @@ redo_turn:
 			                               state_of_game.scenario != "null";
 
 			//add all the units that survived the scenario
-			for(std::map<gamemap::location,unit>::iterator un = units.begin(); un != units.end(); ++un) {
+			for(unit_map::iterator un = units.begin(); un != units.end(); ++un) {
 				player_info *player=state_of_game.get_player(teams[un->second.side()-1].save_id());
 
 				if(player) {
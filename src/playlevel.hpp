@@ -40,6 +40,6 @@ struct end_turn_exception {
 LEVEL_RESULT play_level(const game_data& gameinfo, const config& terrain_config,
 		config const* level, CVideo& video,
 		game_state& state_of_game,
-		const std::vector<config*>& story);
+		const config::child_list& story);
 
 #endif
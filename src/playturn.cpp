@@ -67,7 +67,7 @@ void play_turn(const game_data& gameinfo, game_state& state_of_game,
                const gamestatus& status, const config& terrain_config,
                const config& level, CKey& key, display& gui, gamemap& map,
                std::vector<team>& teams, int team_num,
-               std::map<gamemap::location,unit>& units,
+               unit_map& units,
                turn_info::floating_textbox& textbox,
                replay_network_sender& network_sender)
 {
@@ -97,6 +97,8 @@ void play_turn(const game_data& gameinfo, game_state& state_of_game,
 	turn_info turn_data(gameinfo,state_of_game,status,terrain_config,level,
 	                    key,gui,map,teams,team_num,units,turn_info::PLAY_TURN,textbox,network_sender);
 
+	turn_data.send_snapshot();
+
 	//execute gotos - first collect gotos in a list
 	std::vector<gamemap::location> gotos;
 
@@ -221,6 +223,21 @@ void turn_info::send_data()
 	}
 }
 
+void turn_info::send_snapshot()
+{
+	if(!replay_sender_.take_snapshot_request()) {
+		return;
+	}
+
+	//the server replaces the commands it has received so far with the
+	//snapshot, so they must all have been sent
+	send_data();
+
+	config cfg;
+	write_game_snapshot(cfg.add_child("snapshot"));
+	network::send_data(cfg);
+}
+
 void turn_info::handle_event(const SDL_Event& event)
 {
 	if(gui::in_dialog()) {
@@ -1747,7 +1764,7 @@ void turn_info::write_game_snapshot(config& start) const
 		buf << side_num;
 		side["side"] = buf.str();
 
-		for(std::map<gamemap::location,unit>::const_iterator i = units_.begin(); i != units_.end(); ++i) {
+		for(unit_map::const_iterator i = units_.begin(); i != units_.end(); ++i) {
 			if(i->second.side() == side_num) {
 				config& u = side.add_child("unit");
 				i->first.write(u);
@@ -1771,9 +1788,9 @@ void turn_info::write_game_snapshot(config& start) const
 
 	// Clobber gold values to make sure the snapshot uses the values
 	// in [side] instead.
-	const config::child_list& players=start.get_children("player");
-	for(config::child_list::const_iterator pi=players.begin();
-	    pi!=players.end(); ++pi) {
+	const config::child_itors players=start.child_range("player");
+	for(config::child_iterator pi=players.first;
+	    pi!=players.second; ++pi) {
 		(**pi)["gold"] = "-1000000";
 	}
 
@@ -2766,6 +2783,11 @@ turn_info::PROCESS_DATA_RESULT turn_info::process_network_data(const config& cfg
 		throw network::error("");
 	}
 
+	//the snapshot is sent at the start of our next turn
+	if(cfg.child("request_snapshot") != NULL) {
+		replay_sender_.request_snapshot();
+	}
+
 	bool turn_end = false;
 
 	const config::child_list& turns = cfg.get_children("turn");
@@ -93,6 +93,11 @@ public:
 
 	void send_data();
 
+	//sends a snapshot of the game to the server, if it asked for one. This
+	//must only be done at the start of a turn, when everything done so far
+	//has been sent.
+	void send_snapshot();
+
 	undo_list& undos() { return undo_stack_; }
 
 	bool can_execute_command(hotkey::HOTKEY_COMMAND command) const;
@@ -263,7 +268,7 @@ void play_turn(const game_data& gameinfo, game_state& state_of_game,
 	       const config& level,
                CKey& key, display& gui, gamemap& map,
                std::vector<team>& teams, int team_num,
-               std::map<gamemap::location,unit>& units,
+               unit_map& units,
                turn_info::floating_textbox& textbox,
                replay_network_sender& network_sender);
 
@@ -130,7 +130,7 @@ bool fullscreen()
 {
 	static bool first_time = true;
 	if(first_time) {
-		const string_map::const_iterator fullscreen =
+		const config::attribute_map::const_iterator fullscreen =
 	                                   prefs.values.find("fullscreen");
 		is_fullscreen = fullscreen == prefs.values.end() || fullscreen->second == "true";
 	}
@@ -165,8 +165,8 @@ void set_fullscreen(bool ison)
 std::pair<int,int> resolution()
 {
 	const std::string postfix = fullscreen() ? "resolution" : "windowsize";
-	const string_map::const_iterator x = prefs.values.find('x' + postfix);
-	const string_map::const_iterator y = prefs.values.find('y' + postfix);
+	const config::attribute_map::const_iterator x = prefs.values.find('x' + postfix);
+	const config::attribute_map::const_iterator y = prefs.values.find('y' + postfix);
 	if(x != prefs.values.end() && y != prefs.values.end() &&
 	   x->second.empty() == false && y->second.empty() == false) {
 		std::pair<int,int> res (maximum(atoi(x->second.c_str()),min_allowed_width),
@@ -222,7 +222,7 @@ bool turbo()
 	if(non_interactive())
 		return true;
 
-	const string_map::const_iterator turbo = prefs.values.find("turbo");
+	const config::attribute_map::const_iterator turbo = prefs.values.find("turbo");
 	return turbo != prefs.values.end() && turbo->second == "true";
 }
 
@@ -293,7 +293,7 @@ void set_adjust_gamma(bool val)
 int gamma()
 {
 	static const int default_value = 100;
-	const string_map::const_iterator gamma = prefs.values.find("gamma");
+	const config::attribute_map::const_iterator gamma = prefs.values.find("gamma");
 	if(adjust_gamma() && gamma != prefs.values.end() && gamma->second.empty() == false)
 		return atoi(gamma->second.c_str());
 	else
@@ -319,7 +319,7 @@ bool is_muted()
 
 bool grid()
 {
-	const string_map::const_iterator turbo = prefs.values.find("grid");
+	const config::attribute_map::const_iterator turbo = prefs.values.find("grid");
 	return turbo != prefs.values.end() && turbo->second == "true";
 }
 
@@ -396,7 +396,7 @@ int scroll_speed()
 {
 	static const int default_value = 50;
 	int value = 0;
-	const string_map::const_iterator i = prefs.values.find("scroll");
+	const config::attribute_map::const_iterator i = prefs.values.find("scroll");
 	if(i != prefs.values.end() && i->second.empty() == false) {
 		value = atoi(i->second.c_str());
 	}
@@ -554,7 +554,7 @@ int turns()
 {
 	static const int default_value = 50;
 	int value = 0;
-	const string_map::const_iterator i = prefs.values.find("mp_turns");
+	const config::attribute_map::const_iterator i = prefs.values.find("mp_turns");
 	if(i != prefs.values.end() && i->second.empty() == false) {
 		value = atoi(i->second.c_str());
 	}
@@ -577,7 +577,7 @@ int village_gold()
 {
 	static const int default_value = 2;
 	int value = 0;
-	const string_map::const_iterator i = prefs.values.find("mp_village_gold");
+	const config::attribute_map::const_iterator i = prefs.values.find("mp_village_gold");
 	if(i != prefs.values.end() && i->second.empty() == false) {
 		value = atoi(i->second.c_str());
 	}
@@ -600,7 +600,7 @@ int xp_modifier()
 {
 	static const int default_value = 70;
 	int value = 0;
-	const string_map::const_iterator i = prefs.values.find("mp_xp_modifier");
+	const config::attribute_map::const_iterator i = prefs.values.find("mp_xp_modifier");
 	if(i != prefs.values.end() && i->second.empty() == false) {
 		value = atoi(i->second.c_str());
 	}
@@ -622,7 +622,7 @@ void set_xp_modifier(int value)
 int era()
 {
 	int value = 0;
-	const string_map::const_iterator i = prefs.values.find("mp_era");
+	const config::attribute_map::const_iterator i = prefs.values.find("mp_era");
 	if(i != prefs.values.end() && i->second.empty() == false) {
 		value = atoi(i->second.c_str());
 	}
@@ -640,7 +640,7 @@ void set_era(int value)
 int map()
 {
 	int value = 0;
-	const string_map::const_iterator i = prefs.values.find("mp_map");
+	const config::attribute_map::const_iterator i = prefs.values.find("mp_map");
 	if(i != prefs.values.end() && i->second.empty() == false) {
 		value = atoi(i->second.c_str());
 	}
@@ -802,6 +802,11 @@ bool compress_saves()
 	return prefs["compress_saves"] != "no";
 }
 
+int terrain_builder_threads()
+{
+	return maximum<int>(1, lexical_cast_default<int>(prefs["terrain_builder_threads"], 1));
+}
+
 std::set<std::string> &encountered_units() {
 	return encountered_units_set;
 }
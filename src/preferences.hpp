@@ -168,6 +168,9 @@ namespace preferences {
 
 	bool compress_saves();
 
+	//the number of threads on which terrain graphics are built
+	int terrain_builder_threads();
+
 	std::set<std::string> &encountered_units();
 	std::set<std::string> &encountered_terrains();
 
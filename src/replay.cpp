@@ -388,7 +388,7 @@ config replay::get_data_range(int cmd_start, int cmd_end, DATA_TYPE data_type)
 			res.add_child("command",*cmd[cmd_start]);
 
 			if(data_type == NON_UNDO_DATA) {
-				(*cmd[cmd_start])["sent"] = "yes";
+				command(cmd_start)["sent"] = "yes";
 			}
 		}
 
@@ -400,13 +400,14 @@ config replay::get_data_range(int cmd_start, int cmd_end, DATA_TYPE data_type)
 
 void replay::undo()
 {
-	config::child_itors cmd = cfg_.child_range("command");
-	while(cmd.first != cmd.second && (**(cmd.second-1))["undo"] == "no") {
-		--cmd.second;
+	const config::child_list& cmd = commands();
+	size_t n = cmd.size();
+	while(n != 0 && (*cmd[n-1])["undo"] == "no") {
+		--n;
 	}
 
-	if(cmd.first != cmd.second) {
-		cfg_.remove_child("command",cmd.second - cmd.first - 1);
+	if(n != 0) {
+		cfg_.remove_child("command",n-1);
 		current_ = NULL;
 		set_random(NULL);
 	}
@@ -417,6 +418,11 @@ const config::child_list& replay::commands() const
 	return cfg_.get_children("command");
 }
 
+config& replay::command(size_t n)
+{
+	return cfg_.child_at("command",n);
+}
+
 int replay::ncommands()
 {
 	return commands().size();
@@ -451,7 +457,7 @@ config* replay::get_next_action()
 
 	LOG_NW << "up to replay action " << pos_ << "/" << commands().size() << "\n";
 
-	current_ = commands()[pos_];
+	current_ = &command(pos_);
 	set_random(current_);
 	++pos_;
 	return current_;
@@ -621,7 +627,7 @@ bool do_replay(display& disp, const gamemap& map, const game_data& gameinfo,
 			const gamemap::location loc(*child);
 			const std::string& name = (*child)["name"];
 
-			std::map<gamemap::location,unit>::iterator u = units.find(loc);
+			unit_map::iterator u = units.find(loc);
 
 			if(u->second.unrenamable()) {
 				ERR_NW << "renaming unrenamable unit " << u->second.name() << "\n";
@@ -747,7 +753,7 @@ bool do_replay(display& disp, const gamemap& map, const game_data& gameinfo,
 			const gamemap::location src(*source);
 			const gamemap::location dst(*destination);
 
-			std::map<gamemap::location,unit>::iterator u = units.find(dst);
+			unit_map::iterator u = units.find(dst);
 			if(u != units.end()) {
 				ERR_NW << "destination already occupied: "
 				       << dst << '\n';
@@ -834,7 +840,7 @@ bool do_replay(display& disp, const gamemap& map, const game_data& gameinfo,
 			const std::string& weapon = (*child)["weapon"];
 			const int weapon_num = atoi(weapon.c_str());
 
-			std::map<gamemap::location,unit>::iterator u = units.find(src);
+			unit_map::iterator u = units.find(src);
 			if(u == units.end()) {
 				ERR_NW << "unfound location for source of attack\n";
 				throw replay::error();
@@ -845,7 +851,7 @@ bool do_replay(display& disp, const gamemap& map, const game_data& gameinfo,
 				if (!game_config::ignore_replay_errors) throw replay::error();
 			}
 
-			std::map<gamemap::location,unit>::const_iterator tgt = units.find(dst);
+			unit_map::const_iterator tgt = units.find(dst);
 
 			if(tgt == units.end()) {
 				ERR_NW << "unfound defender for attack: " << src << " -> " << dst << '\n';
@@ -899,7 +905,7 @@ bool do_replay(display& disp, const gamemap& map, const game_data& gameinfo,
 	return false; /* Never attained, but silent a gcc warning. --Zas */
 }
 
-replay_network_sender::replay_network_sender(replay& obj) : obj_(obj), upto_(obj_.ncommands())
+replay_network_sender::replay_network_sender(replay& obj) : obj_(obj), upto_(obj_.ncommands()), snapshot_requested_(false)
 {
 }
 
@@ -931,3 +937,15 @@ void replay_network_sender::commit_and_sync()
 		upto_ = obj_.ncommands();
 	}
 }
+
+void replay_network_sender::request_snapshot()
+{
+	snapshot_requested_ = true;
+}
+
+bool replay_network_sender::take_snapshot_request()
+{
+	const bool res = snapshot_requested_;
+	snapshot_requested_ = false;
+	return res;
+}
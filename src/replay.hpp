@@ -101,6 +101,10 @@ private:
 	void add_value(const std::string& type, int value);
 
 	const config::child_list& commands() const;
+
+	//the command at 'n', which can be modified
+	config& command(size_t n);
+
 	/** Adds a new empty command to the command list.
 	 *
 	 * @param update_random_context  If set to false, do not update the
@@ -130,7 +134,7 @@ extern replay recorder;
 //replays up to one turn from the recorder object
 //returns true if it got to the end of the turn without data running out
 bool do_replay(display& disp, const gamemap& map, const game_data& gameinfo,
-               std::map<gamemap::location,unit>& units,
+               unit_map& units,
 	       std::vector<team>& teams, int team_num, const gamestatus& state,
 	       game_state& state_of_game, replay* obj=NULL);
 
@@ -154,9 +158,15 @@ public:
 
 	void sync_non_undoable();
 	void commit_and_sync();
+
+	//the server asks for a snapshot of the game, which is sent at the start
+	//of our next turn. The request lasts as long as the level.
+	void request_snapshot();
+	bool take_snapshot_request();
 private:
 	replay& obj_;
 	int upto_;
+	bool snapshot_requested_;
 };
 
 #endif
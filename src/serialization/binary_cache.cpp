@@ -0,0 +1,343 @@
+/* $Id$ */
+/*
+   Copyright (C) 2003 by David White <davidnwhite@verizon.net>
+   Part of the Battle for Wesnoth Project http://www.wesnoth.org/
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License.
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY.
+
+   See the COPYING file for more details.
+*/
+
+#include "global.hpp"
+
+#include "config.hpp"
+#include "filesystem.hpp"
+#include "log.hpp"
+#include "serialization/binary_cache.hpp"
+#include "thread.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define LOG_CF LOG_STREAM(info, config)
+
+//the cache starts with a magic string and a version number, followed by the
+//root node. Each node is made of:
+// - the number of its attributes, followed by the name and serialized value
+//   of each attribute
+// - the number of its children, followed by the name of each child, the size
+//   of the child node in bytes, and the child node itself
+//
+//numbers are 32 bits, little endian. Strings are their length followed by
+//their characters. Thanks to the size of the nodes, the children of a node
+//can be skipped until they are needed.
+
+namespace {
+
+const char cache_magic[] = "WMLCACHE";
+const size_t cache_magic_size = sizeof(cache_magic) - 1;
+const size_t cache_version = 1;
+const int max_recursion_levels = 1000;
+
+void write_number(std::string& out, size_t n)
+{
+	for(int i = 0; i != 4; ++i) {
+		out += char((n >> (i*8)) & 0xFF);
+	}
+}
+
+void write_string(std::string& out, const std::string& str)
+{
+	write_number(out, str.size());
+	out += str;
+}
+
+void write_node(std::string& out, const config& cfg, int level)
+{
+	if(level > max_recursion_levels)
+		throw config::error("Too many recursion levels in config cache write");
+
+	size_t nvalues = 0;
+	config::attribute_map::const_iterator i;
+	for(i = cfg.values.begin(); i != cfg.values.end(); ++i) {
+		if(i->second.empty() == false) {
+			++nvalues;
+		}
+	}
+
+	write_number(out, nvalues);
+	for(i = cfg.values.begin(); i != cfg.values.end(); ++i) {
+		if(i->second.empty() == false) {
+			write_string(out, i->first);
+			write_string(out, i->second.to_serialized());
+		}
+	}
+
+	size_t nchildren = 0;
+	for(config::all_children_iterator j = cfg.ordered_begin(); j != cfg.ordered_end(); ++j) {
+		++nchildren;
+	}
+
+	write_number(out, nchildren);
+	for(config::all_children_iterator j = cfg.ordered_begin(); j != cfg.ordered_end(); ++j) {
+		const std::pair<const std::string*,const config*> item = *j;
+		write_string(out, *item.first);
+
+		//the size of the child is only known once it is written
+		const size_t size_pos = out.size();
+		write_number(out, 0);
+		write_node(out, *item.second, level + 1);
+
+		std::string size;
+		write_number(size, out.size() - size_pos - 4);
+		out.replace(size_pos, 4, size);
+	}
+}
+
+size_t read_number(const char*& p)
+{
+	const unsigned char* const u = reinterpret_cast<const unsigned char*>(p);
+	p += 4;
+	return size_t(u[0]) | (size_t(u[1]) << 8) | (size_t(u[2]) << 16) | (size_t(u[3]) << 24);
+}
+
+std::string read_string(const char*& p)
+{
+	const size_t size = read_number(p);
+	const char* const begin = p;
+	p += size;
+	return std::string(begin, p);
+}
+
+//checks that a node lies within [p,end) and is well formed, so that reading
+//it later can't fail. Returns the end of the node.
+const char* check_node(const char* p, const char* end, int level)
+{
+	if(level > max_recursion_levels)
+		throw config::error("Too many recursion levels in config cache read");
+
+	#define CHECK_SIZE(n) if(size_t(end - p) < size_t(n)) throw config::error("Unexpected end of data in config cache read")
+
+	CHECK_SIZE(4);
+	for(size_t nvalues = read_number(p); nvalues != 0; --nvalues) {
+		//the name and the value
+		for(int n = 0; n != 2; ++n) {
+			CHECK_SIZE(4);
+			const size_t size = read_number(p);
+			CHECK_SIZE(size);
+			p += size;
+		}
+	}
+
+	CHECK_SIZE(4);
+	for(size_t nchildren = read_number(p); nchildren != 0; --nchildren) {
+		CHECK_SIZE(4);
+		const size_t name_size = read_number(p);
+		CHECK_SIZE(name_size);
+		p += name_size;
+
+		CHECK_SIZE(4);
+		const size_t size = read_number(p);
+		CHECK_SIZE(size);
+		if(check_node(p, p + size, level + 1) != p + size)
+			throw config::error("Bad node size in config cache read");
+		p += size;
+	}
+
+	#undef CHECK_SIZE
+
+	return p;
+}
+
+//the contents of a cache file, mapped into memory where possible. It is
+//destroyed when the last node reading from it is done with it.
+class cache_file
+{
+public:
+	explicit cache_file(const std::string& fname);
+
+	const char* begin() const { return begin_; }
+	const char* end() const { return begin_ + size_; }
+
+	void add_ref();
+	void release();
+
+private:
+	~cache_file();
+	cache_file(const cache_file&);
+	void operator=(const cache_file&);
+
+	const char* begin_;
+	size_t size_;
+	bool mapped_;
+	std::string contents_;
+
+	//the nodes reading from the file may be in configs used by other threads,
+	//such as the terrain builder and the AI, so the count is changed under a lock
+	threading::mutex mutex_;
+	int refs_;
+};
+
+cache_file::cache_file(const std::string& fname) : begin_(NULL), size_(0), mapped_(false), refs_(0)
+{
+#ifndef _WIN32
+	const int fd = open(fname.c_str(), O_RDONLY);
+	if(fd != -1) {
+		struct stat st;
+		if(fstat(fd, &st) == 0 && st.st_size > 0) {
+			void* const data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if(data != MAP_FAILED) {
+				begin_ = reinterpret_cast<const char*>(data);
+				size_ = st.st_size;
+				mapped_ = true;
+			}
+		}
+
+		close(fd);
+	}
+#endif
+
+	if(!mapped_) {
+		contents_ = read_file(fname);
+		begin_ = contents_.data();
+		size_ = contents_.size();
+	}
+
+	LOG_CF << "read config cache '" << fname << "' of " << size_ << " bytes"
+	       << (mapped_ ? ", mapped into memory\n" : "\n");
+}
+
+void cache_file::add_ref()
+{
+	const threading::lock lock(mutex_);
+	++refs_;
+}
+
+void cache_file::release()
+{
+	bool last;
+	{
+		const threading::lock lock(mutex_);
+		last = --refs_ == 0;
+	}
+
+	if(last) {
+		delete this;
+	}
+}
+
+cache_file::~cache_file()
+{
+#ifndef _WIN32
+	if(mapped_) {
+		munmap(const_cast<char*>(begin_), size_);
+	}
+#endif
+}
+
+//holds a reference to a cache file while it is in use
+struct cache_file_ref
+{
+	explicit cache_file_ref(cache_file& file) : file(file) { file.add_ref(); }
+	~cache_file_ref() { file.release(); }
+
+	cache_file& file;
+
+private:
+	cache_file_ref(const cache_file_ref&);
+	void operator=(const cache_file_ref&);
+};
+
+void read_node(config& cfg, const char* p, cache_file& file);
+
+//the children of a node of a cache file, which are read when the node is
+//first asked about them
+class cache_child_source : public config::child_source
+{
+public:
+	cache_child_source(cache_file& file, const char* children) : ref_(file), children_(children)
+	{}
+
+	virtual void read_children(config& cfg) const
+	{
+		const config::arena_scope arena(cfg);
+		const char* p = children_;
+		for(size_t nchildren = read_number(p); nchildren != 0; --nchildren) {
+			const std::string name = read_string(p);
+			const size_t size = read_number(p);
+			read_node(cfg.add_child(name), p, ref_.file);
+			p += size;
+		}
+	}
+
+private:
+	cache_file_ref ref_;
+	const char* children_;
+};
+
+void read_node(config& cfg, const char* p, cache_file& file)
+{
+	for(size_t nvalues = read_number(p); nvalues != 0; --nvalues) {
+		const std::string name = read_string(p);
+		cfg.values.insert(std::make_pair(name, t_string::from_serialized(read_string(p))));
+	}
+
+	const char* children = p;
+	if(read_number(p) != 0) {
+		cfg.set_child_source(new cache_child_source(file, children));
+	}
+}
+
+}
+
+void write_binary_cache(const std::string& fname, config const &cfg)
+{
+	std::string out(cache_magic, cache_magic_size);
+	write_number(out, cache_version);
+	write_node(out, cfg, 0);
+
+	//the file is written aside and then renamed, as it may still be mapped
+	//by configs read from it
+	const std::string tmp_fname = fname + ".new";
+	write_file(tmp_fname, out);
+
+#ifdef _WIN32
+	std::remove(fname.c_str());
+#endif
+	if(std::rename(tmp_fname.c_str(), fname.c_str()) != 0) {
+		std::remove(tmp_fname.c_str());
+		throw io_exception("Could not write file: '" + fname + "'");
+	}
+}
+
+void read_binary_cache(config &cfg, const std::string& fname)
+{
+	cfg.clear();
+
+	const cache_file_ref ref(*new cache_file(fname));
+	const char* p = ref.file.begin();
+	const char* const end = ref.file.end();
+
+	if(size_t(end - p) < cache_magic_size + 4 || std::memcmp(p, cache_magic, cache_magic_size) != 0)
+		throw config::error("Not a config cache");
+	p += cache_magic_size;
+
+	if(read_number(p) != cache_version)
+		throw config::error("Unsupported config cache version");
+
+	if(check_node(p, end, 0) != end)
+		throw config::error("Trailing data in config cache");
+
+	read_node(cfg, p, ref.file);
+}
@@ -0,0 +1,37 @@
+/* $Id$ */
+/*
+   Copyright (C) 2003 by David White <davidnwhite@verizon.net>
+   Part of the Battle for Wesnoth Project http://www.wesnoth.org/
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License.
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY.
+
+   See the COPYING file for more details.
+*/
+
+#ifndef SERIALIZATION_BINARY_CACHE_HPP_INCLUDED
+#define SERIALIZATION_BINARY_CACHE_HPP_INCLUDED
+
+#include <string>
+
+class config;
+
+//functions to write and read the cache of the game config. Unlike the
+//compressed format, the cache records the size of each node, so that it can
+//be mapped into memory and the children of each node only read when they
+//are first accessed.
+
+//writes 'cfg' to the file 'fname'. The file is replaced at once, so that
+//configs still reading from a previous version of it are not disturbed.
+//throws io_exception
+void write_binary_cache(const std::string& fname, config const &cfg);
+
+//reads 'cfg' from the file 'fname'. The attributes of 'cfg' are read at
+//once, and the children of each node when they are first accessed. The file
+//stays mapped until all of them are read or destroyed.
+//throws config::error if the file is not a valid cache, and io_exception
+void read_binary_cache(config &cfg, const std::string& fname);
+
+#endif
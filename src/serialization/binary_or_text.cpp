@@ -17,14 +17,43 @@
 #include "config.hpp"
 #include "filesystem.hpp"
 #include "serialization/binary_wml.hpp"
+#include "serialization/deflate.hpp"
 #include "serialization/parser.hpp"
 
-#include <sstream>
+#include <istream>
+#include <iterator>
+#include <ostream>
+#include <vector>
+
+namespace {
+
+//gzip files hold compressed WML, or text WML once converted by hand
+void read_gzip(config &cfg, std::istream &in, std::string* error_log)
+{
+	const std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	std::vector<char> buf;
+	inflate_data(data.data(), data.data() + data.size(), buf, true, data.max_size());
+
+	if (buf.empty() == false && static_cast<unsigned char>(buf[0]) < 4) {
+		compression_schema schema;
+		read_compressed(cfg, &buf[0], &buf[0] + buf.size(), schema);
+	} else {
+		const char* const text = buf.empty() ? NULL : &buf[0];
+		read(cfg, text, text + buf.size(), error_log);
+	}
+}
+
+}
 
 bool detect_format_and_read(config &cfg, std::istream &in, std::string* error_log)
 {
 	unsigned char c = in.peek();
-	if (c < 4) {
+	if (c == 0x1f) {
+		//text WML doesn't start with control characters, nor does
+		//compressed WML with this one
+		read_gzip(cfg, in, error_log);
+		return true;
+	} else if (c < 4) {
 		read_compressed(cfg, in);
 		return true;
 	} else {
@@ -35,8 +64,17 @@ bool detect_format_and_read(config &cfg, std::istream &in, std::string* error_lo
 
 void write_possibly_compressed(std::ostream &out, config &cfg, bool compress)
 {
-	if (compress)
-		write_compressed(out, cfg);
-	else
+	if (!compress)
 		write(out, cfg);
+	else if (!deflate_available())
+		write_compressed(out, cfg);
+	else {
+		std::vector<char> data, buf;
+		compression_schema schema;
+		write_compressed(data, cfg, schema);
+
+		const char* const begin = data.empty() ? NULL : &data[0];
+		deflate_data(begin, begin + data.size(), buf, true);
+		out.write(&buf[0], buf.size());
+	}
 }
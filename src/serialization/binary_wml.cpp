@@ -19,8 +19,10 @@
 #include "serialization/binary_wml.hpp"
 
 #include <algorithm>
+#include <cstring>
 #include <iostream>
-#include <sstream>
+#include <iterator>
+#include <vector>
 
 #define ERR_CF LOG_STREAM(err, config)
 
@@ -55,9 +57,10 @@ static const size_t compress_max_words = compress_end_words - compress_first_wor
 static const size_t max_schema_item_length = 20;
 static const int max_recursion_levels = 1000;
 
-static void compress_output_literal_word(std::ostream &out, std::string const &word)
+static void compress_output_literal_word(std::vector<char> &out, std::string const &word)
 {
-	out.write(word.c_str(), word.length() + 1);
+	out.insert(out.end(), word.begin(), word.end());
+	out.push_back('\0');
 }
 
 static compression_schema::word_char_map::const_iterator
@@ -73,7 +76,7 @@ add_word_to_schema(std::string const &word, compression_schema &schema)
 }
 
 static compression_schema::word_char_map::const_iterator
-get_word_in_schema(std::string const &word, compression_schema &schema, std::ostream &out)
+get_word_in_schema(std::string const &word, compression_schema &schema, std::vector<char> &out)
 {
 	if (word.size() > max_schema_item_length)
 		return schema.word_to_char.end();
@@ -87,7 +90,7 @@ get_word_in_schema(std::string const &word, compression_schema &schema, std::ost
 		//we can add the word to the schema
 
 		//we insert the code to add a schema item, followed by the zero-delimited word
-		out.put(compress_schema_item);
+		out.push_back(compress_schema_item);
 		compress_output_literal_word(out, word);
 
 		return add_word_to_schema(word, schema);
@@ -97,38 +100,82 @@ get_word_in_schema(std::string const &word, compression_schema &schema, std::ost
 	}
 }
 
-static void compress_emit_word(std::ostream &out, std::string const &word, compression_schema &schema)
+//the words of the shared dictionary, in the order they are added to schemas.
+//The most common element and attribute names of network games: the lobby and
+//handshake messages of the server, the commands of replays, and the sides and
+//units of the levels sent as games start. Changing the list in any way needs
+//a new 'shared_dictionary_version'.
+static const char* const shared_dictionary_words[] = {
+	"version", "dictionary", "mustlogin", "login", "username", "join_lobby", "join_game",
+	"gamelist", "gamelist_diff", "game", "user", "available", "insert", "delete",
+	"insert_child", "delete_child", "change_child", "index", "name", "id", "turn", "command",
+	"random", "results", "move", "source", "destination", "x", "y", "attack", "weapon",
+	"value", "chance", "hits", "damage", "recruit", "recall", "from", "end_turn", "speak",
+	"message", "sender", "label", "text", "start_game", "leave_game", "join", "observer",
+	"observer_quit", "snapshot", "request_snapshot", "side", "side_secured", "controller",
+	"team_name", "user_team_name", "description", "user_description", "player", "type", "gold",
+	"village_gold", "income", "leader", "canrecruit", "faction", "random_faction", "team",
+	"colour", "fog", "shroud", "share_view", "share_maps", "save_id", "allow_changes",
+	"mp_use_map_settings", "mp_fog", "mp_shroud", "mp_village_gold", "experience_modifier",
+	"slots", "vacant_slots", "observers", "turns", "turn_at", "map_data", "map", "scenario",
+	"era", "multiplayer", "multiplayer_side", "next_scenario", "replay", "replay_start",
+	"start", "store_next_scenario", "unit", "hitpoints", "max_hitpoints", "experience",
+	"max_experience", "moves", "max_moves", "facing", "resting", "unrenamable",
+	"random_traits", "gender", "upkeep", "level", "alignment", "race", "modifications",
+	"trait", "effect", "apply_to", "increase", "increase_total", "increase_damage", "range",
+	"image", "image_defensive", "movement_type", "cost", "usage", "attacks_left", "goto_x",
+	"goto_y", "time", "lawful_bonus", "red", "green", "blue", "event", "filter", "status",
+	"error", "kick", "ban", "info", "query", "campaign_type", "difficulty", "objectives",
+	"objective", "condition", "village"
+};
+
+const char* const shared_dictionary_version = "1";
+
+void add_shared_dictionary(compression_schema &schema)
 {
-	//get the word in the schema
-	const compression_schema::word_char_map::const_iterator w = get_word_in_schema(word, schema, out);
-	if (w != schema.word_to_char.end()) {
+	const size_t nwords = sizeof(shared_dictionary_words)/sizeof(*shared_dictionary_words);
+	for (size_t n = 0; n != nwords && schema.word_to_char.size() < compress_max_words; ++n) {
+		const std::string word(shared_dictionary_words[n]);
+		if (schema.word_to_char.count(word) == 0)
+			add_word_to_schema(word, schema);
+	}
+}
+
+static void compress_emit_word(std::vector<char> &out, std::string const &word, compression_schema *schema, bool add_words)
+{
+	//get the word in the schema, if there is a schema
+	compression_schema::word_char_map::const_iterator w;
+	if (schema != NULL && (w = add_words ? get_word_in_schema(word, *schema, out) : schema->word_to_char.find(word))
+	                      != schema->word_to_char.end()) {
 		//the word is in the schema, all we have to do is output the compression code for it.
-		out.put(w->second);
+		out.push_back(w->second);
 	} else {
 		//the word is not in the schema. Output it as a literal word
-		out.put(compress_literal_word);
+		out.push_back(compress_literal_word);
 		compress_output_literal_word(out, word);
 	}
 }
 
-static std::string compress_read_literal_word(std::istream &in)
+static std::string compress_read_literal_word(const char *&in, const char *end)
 {
-	std::string buffer;
-	std::getline(in, buffer, '\0');
-	if (!in.good())
+	const char *const word_end = static_cast<const char *>(std::memchr(in, '\0', end - in));
+	if (word_end == NULL)
 		throw config::error("Unexpected end of data in compressed config read");
-	return buffer;
+
+	const char *const begin = in;
+	in = word_end + 1;
+	return std::string(begin, word_end);
 }
 
-static void write_compressed_internal(std::ostream &out, config const &cfg, compression_schema &schema, int level)
+static void write_compressed_internal(std::vector<char> &out, config const &cfg, compression_schema *schema, bool add_words, int level)
 {
 	if (level > max_recursion_levels)
 		throw config::error("Too many recursion levels in compressed config write");
 
-	for (string_map::const_iterator i = cfg.values.begin(), i_end = cfg.values.end(); i != i_end; ++i) {
+	for (config::attribute_map::const_iterator i = cfg.values.begin(), i_end = cfg.values.end(); i != i_end; ++i) {
 		if (i->second.empty() == false) {
 			//output the name, using compression
-			compress_emit_word(out, i->first, schema);
+			compress_emit_word(out, i->first, schema, add_words);
 
 			//output the value, with no compression
 			compress_output_literal_word(out, i->second.to_serialized());
@@ -140,28 +187,50 @@ static void write_compressed_internal(std::ostream &out, config const &cfg, comp
 		std::string const &name = *item.first;
 		config const &cfg2 = *item.second;
 
-		out.put(compress_open_element);
-		compress_emit_word(out, name, schema);
-		write_compressed_internal(out, cfg2, schema, level + 1);
-		out.put(compress_close_element);
+		out.push_back(compress_open_element);
+		compress_emit_word(out, name, schema, add_words);
+		write_compressed_internal(out, cfg2, schema, add_words, level + 1);
+		out.push_back(compress_close_element);
 	}
 }
 
+void write_compressed(std::vector<char> &out, config const &cfg, compression_schema &schema)
+{
+	write_compressed_internal(out, cfg, &schema, true, 0);
+}
+
+void write_compressed_literal(std::vector<char> &out, config const &cfg)
+{
+	write_compressed_internal(out, cfg, NULL, false, 0);
+}
+
+void write_compressed_shared(std::vector<char> &out, config const &cfg, compression_schema const &schema)
+{
+	//the schema is only looked up, as no words are added to it
+	write_compressed_internal(out, cfg, const_cast<compression_schema *>(&schema), false, 0);
+}
+
+static void write_buffer(std::ostream &out, std::vector<char> const &buf)
+{
+	if (buf.empty() == false)
+		out.write(&buf[0], buf.size());
+}
+
 void write_compressed(std::ostream &out, config const &cfg, compression_schema &schema)
 {
-	write_compressed_internal(out, cfg, schema, 0);
+	std::vector<char> buf;
+	write_compressed(buf, cfg, schema);
+	write_buffer(out, buf);
 }
 
-static void read_compressed_internal(config &cfg, std::istream &in, compression_schema &schema, int level)
+static void read_compressed_internal(config &cfg, const char *&in, const char *end, compression_schema &schema, int level)
 {
 	if (level >= max_recursion_levels)
 		throw config::error("Too many recursion levels in compressed config read");
 
 	bool in_open_element = false;
-	for(;;) {
-		unsigned char const c = in.get();
-		if (!in.good())
-			return;
+	while (in != end) {
+		unsigned char const c = *in++;
 		switch (c) {
 		case compress_open_element:
 			in_open_element = true;
@@ -169,13 +238,13 @@ static void read_compressed_internal(config &cfg, std::istream &in, compression_
 		case compress_close_element:
 			return;
 		case compress_schema_item:
-			add_word_to_schema(compress_read_literal_word(in), schema);
+			add_word_to_schema(compress_read_literal_word(in, end), schema);
 			break;
 
 		default: {
 			std::string word;
 			if (c == compress_literal_word) {
-				word = compress_read_literal_word(in);
+				word = compress_read_literal_word(in, end);
 			} else {
 				unsigned int code = c;
 
@@ -192,10 +261,10 @@ static void read_compressed_internal(config &cfg, std::istream &in, compression_
 			if (in_open_element) {
 				in_open_element = false;
 				config &cfg2 = cfg.add_child(word);
-				read_compressed_internal(cfg2, in, schema, level + 1);
+				read_compressed_internal(cfg2, in, end, schema, level + 1);
 			} else {
 				//we have a name/value pair, the value is always a literal string
-				std::string value = compress_read_literal_word(in);
+				std::string value = compress_read_literal_word(in, end);
 				t_string t_value = t_string::from_serialized(value);
 				cfg.values.insert(std::make_pair(word, t_value));
 			}
@@ -205,10 +274,18 @@ static void read_compressed_internal(config &cfg, std::istream &in, compression_
 	}
 }
 
-void read_compressed(config &cfg, std::istream &in, compression_schema &schema)
+void read_compressed(config &cfg, const char *begin, const char *end, compression_schema &schema)
 {
 	cfg.clear();
-	read_compressed_internal(cfg, in, schema, 0);
+	const config::arena_scope arena(cfg);
+	read_compressed_internal(cfg, begin, end, schema, 0);
+}
+
+void read_compressed(config &cfg, std::istream &in, compression_schema &schema)
+{
+	//the data is read in one go, and then decoded from memory
+	const std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	read_compressed(cfg, data.data(), data.data() + data.size(), schema);
 }
 
 void write_compressed(std::ostream &out, config const &cfg) {
@@ -220,3 +297,9 @@ void read_compressed(config &cfg, std::istream &in) {
 	compression_schema schema;
 	read_compressed(cfg, in, schema);
 }
+
+void write_compressed_literal(std::ostream &out, config const &cfg) {
+	std::vector<char> buf;
+	write_compressed_literal(buf, cfg);
+	write_buffer(out, buf);
+}
@@ -17,6 +17,7 @@
 #include <iosfwd>
 #include <map>
 #include <string>
+#include <vector>
 
 class config;
 
@@ -38,7 +39,34 @@ struct compression_schema
 void write_compressed(std::ostream &out, config const &cfg, compression_schema &schema);
 void read_compressed(config &cfg, std::istream &in, compression_schema &schema); //throws config::error
 
+//the same, writing the data at the end of a buffer and reading it from the
+//memory in [begin,end), without going through a stream. This is how network
+//data is written and read.
+void write_compressed(std::vector<char> &out, config const &cfg, compression_schema &schema);
+void read_compressed(config &cfg, const char *begin, const char *end, compression_schema &schema); //throws config::error
+
 void write_compressed(std::ostream &out, config const &cfg);
 void read_compressed(config &cfg, std::istream &in);
 
+//writes compressed data without using or adding to any schema: all words are
+//written literally. The data can be read with whatever schema the receiver
+//has, and leaves that schema as it was, so the same data can be sent to
+//several peers.
+void write_compressed_literal(std::ostream &out, config const &cfg);
+void write_compressed_literal(std::vector<char> &out, config const &cfg);
+
+//the same, except that the words of 'schema' are written with their codes.
+//The data can be read by any receiver whose schema has the same codes for
+//those words, such as the peers which agreed on the shared dictionary.
+void write_compressed_shared(std::vector<char> &out, config const &cfg, compression_schema const &schema);
+
+//a dictionary of the words most used in network games, which both peers of a
+//connection can add to their schemas once they agree on it, so that those
+//words don't have to be sent as schema items first. Words already in the
+//schema are skipped, so both peers must add the dictionary at the same point
+//of the data. The version is that of the list of words: peers only use the
+//dictionary if their versions are the same.
+extern const char* const shared_dictionary_version;
+void add_shared_dictionary(compression_schema &schema);
+
 #endif
@@ -0,0 +1,137 @@
+/* $Id$ */
+/*
+   Copyright (C) 2003 by David White <davidnwhite@verizon.net>
+   Part of the Battle for Wesnoth Project http://www.wesnoth.org/
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License.
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY.
+
+   See the COPYING file for more details.
+*/
+
+#include "global.hpp"
+
+#include "config.hpp"
+#include "serialization/deflate.hpp"
+#include "wesconfig.h"
+
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
+
+bool is_gzip_data(const char *begin, const char *end)
+{
+	return end - begin >= 2 && static_cast<unsigned char>(begin[0]) == 0x1f
+	                        && static_cast<unsigned char>(begin[1]) == 0x8b;
+}
+
+#ifdef USE_ZLIB
+
+namespace {
+
+//the data is compressed and decompressed through a buffer of this size at the
+//end of the output
+const size_t chunk_size = 16384;
+
+//windowBits for zlib: the largest window, with a gzip header or with none
+int window_bits(bool gzip)
+{
+	return gzip ? 15 + 16 : -15;
+}
+
+}
+
+bool deflate_available()
+{
+	return true;
+}
+
+void deflate_data(const char *begin, const char *end, std::vector<char> &out, bool gzip)
+{
+	z_stream stream;
+	stream.zalloc = Z_NULL;
+	stream.zfree = Z_NULL;
+	stream.opaque = Z_NULL;
+
+	//files are written once and read many times, so they are compressed as
+	//much as they can be. Network data is compressed as it is sent, so
+	//quickly.
+	const int level = gzip ? Z_BEST_COMPRESSION : Z_BEST_SPEED;
+	if (deflateInit2(&stream, level, Z_DEFLATED, window_bits(gzip), 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		throw config::error("Could not initialize zlib compression");
+
+	stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(begin));
+	stream.avail_in = end - begin;
+
+	int res;
+	do {
+		const size_t size = out.size();
+		out.resize(size + chunk_size);
+		stream.next_out = reinterpret_cast<Bytef *>(&out[size]);
+		stream.avail_out = chunk_size;
+
+		res = deflate(&stream, Z_FINISH);
+		out.resize(out.size() - stream.avail_out);
+	} while (res == Z_OK);
+
+	deflateEnd(&stream);
+	if (res != Z_STREAM_END)
+		throw config::error("Could not compress data with zlib");
+}
+
+void inflate_data(const char *begin, const char *end, std::vector<char> &out, bool gzip, size_t max_size)
+{
+	z_stream stream;
+	stream.zalloc = Z_NULL;
+	stream.zfree = Z_NULL;
+	stream.opaque = Z_NULL;
+	stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(begin));
+	stream.avail_in = end - begin;
+
+	if (inflateInit2(&stream, window_bits(gzip)) != Z_OK)
+		throw config::error("Could not initialize zlib decompression");
+
+	const size_t start = out.size();
+	int res;
+	do {
+		if (out.size() - start >= max_size) {
+			inflateEnd(&stream);
+			throw config::error("Compressed data is too large");
+		}
+
+		const size_t size = out.size();
+		out.resize(size + chunk_size);
+		stream.next_out = reinterpret_cast<Bytef *>(&out[size]);
+		stream.avail_out = chunk_size;
+
+		res = inflate(&stream, Z_NO_FLUSH);
+		out.resize(out.size() - stream.avail_out);
+	} while (res == Z_OK);
+
+	inflateEnd(&stream);
+	if (res != Z_STREAM_END)
+		throw config::error("Invalid compressed data");
+	if (out.size() - start > max_size)
+		throw config::error("Compressed data is too large");
+}
+
+#else
+
+bool deflate_available()
+{
+	return false;
+}
+
+void deflate_data(const char *, const char *, std::vector<char> &, bool)
+{
+	throw config::error("This build cannot compress data with zlib");
+}
+
+void inflate_data(const char *, const char *, std::vector<char> &, bool, size_t)
+{
+	throw config::error("This build cannot read data compressed with zlib");
+}
+
+#endif
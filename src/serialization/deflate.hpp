@@ -0,0 +1,43 @@
+/* $Id$ */
+/*
+   Copyright (C) 2003 by David White <davidnwhite@verizon.net>
+   Part of the Battle for Wesnoth Project http://www.wesnoth.org/
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License.
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY.
+
+   See the COPYING file for more details.
+*/
+
+#ifndef SERIALIZATION_DEFLATE_HPP_INCLUDED
+#define SERIALIZATION_DEFLATE_HPP_INCLUDED
+
+#include <cstddef>
+#include <vector>
+
+//functions to compress data with zlib, beneath the compressed format of WML.
+//zlib is optional: without it, nothing is compressed, and compressed data
+//can't be read.
+
+//returns true if this build can compress and decompress data
+bool deflate_available();
+
+//appends the data in [begin,end), compressed, to 'out'. If 'gzip' is true,
+//it is written in the gzip format, as files are. Otherwise it is written as
+//a raw deflate stream, without any header, as network data is.
+//throws config::error if zlib isn't available
+void deflate_data(const char *begin, const char *end, std::vector<char> &out, bool gzip);
+
+//appends the data decompressed from [begin,end) to 'out'. The data is read
+//as gzip or raw deflate data, as it was written. Anything after the end of
+//the compressed data is ignored.
+//throws config::error if the data isn't valid, or if it decompresses to more
+//than 'max_size' bytes
+void inflate_data(const char *begin, const char *end, std::vector<char> &out, bool gzip, size_t max_size);
+
+//returns true if [begin,end) starts as gzip data does
+bool is_gzip_data(const char *begin, const char *end);
+
+#endif
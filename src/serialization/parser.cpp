@@ -43,13 +43,14 @@ namespace {
 class parser
 {
 public:
-	parser(config& cfg, std::istream& in);
+	parser(config& cfg, const char* begin, const char* end);
 	void operator() (std::string* error_log=NULL);
 
 private:
 	void parse_element();
 	void parse_variable();
 	void parse_directive();
+	void add_text(t_string& value);
 	std::string lineno_string(utils::string_map &map, std::string const &lineno,
 			          std::string const &error_string);
 	void error(const std::string& message);
@@ -69,10 +70,14 @@ private:
 	};
 
 	std::stack<element> elements;
+
+	//kept from one variable to the next, so that their memory is reused
+	std::vector<std::string> variables_;
+	std::string text_;
 };
 
-parser::parser(config &cfg, std::istream &in)
-	: cfg_(cfg), tok_(in)
+parser::parser(config &cfg, const char* begin, const char* end)
+	: cfg_(cfg), tok_(begin, end)
 {
 }
 
@@ -134,7 +139,7 @@ void parser::parse_element()
 
 	switch(tok_.current_token().type) {
 	case token::STRING: // [element]
-		elname = tok_.current_token().value;
+		elname = tok_.current_token().value.str();
 		if (tok_.next_token().type != ']')
 			error(_("Unterminated [element] tag"));
 
@@ -147,7 +152,7 @@ void parser::parse_element()
 	case '+': // [+element]
 		if (tok_.next_token().type != token::STRING)
 			error(_("Invalid tag name"));
-		elname = tok_.current_token().value;
+		elname = tok_.current_token().value.str();
 		if (tok_.next_token().type != ']')
 			error(_("Unterminated [+element] tag"));
 
@@ -166,7 +171,7 @@ void parser::parse_element()
 	case '/': // [/element]
 		if(tok_.next_token().type != token::STRING)
 			error(_("Invalid closing tag name"));
-		elname = tok_.current_token().value;
+		elname = tok_.current_token().value.str();
 		if(tok_.next_token().type != ']')
 			error(_("Unterminated closing tag"));
 		if(elements.size() <= 1)
@@ -189,7 +194,8 @@ void parser::parse_element()
 void parser::parse_variable()
 {
 	config& cfg = *elements.top().cfg;
-	std::vector<std::string> variables;
+	std::vector<std::string>& variables = variables_;
+	variables.clear();
 	variables.push_back("");
 
 	while (tok_.current_token().type != '=') {
@@ -197,7 +203,7 @@ void parser::parse_variable()
 		case token::STRING:
 			if(!variables.back().empty())
 				variables.back() += ' ';
-			variables.back() += tok_.current_token().value;
+			variables.back().append(tok_.current_token().value.begin, tok_.current_token().value.end);
 			break;
 		case ',':
 			if(variables.back().empty()) {
@@ -222,37 +228,48 @@ void parser::parse_variable()
 	}
 
 	std::vector<std::string>::const_iterator curvar = variables.begin();
+	t_string* value = &cfg[*curvar];
+
+	// The untranslatable text of the value is gathered in text_, and only
+	// added to the value before a translatable part, or at the end.
+	text_ = "";
 
 	bool ignore_next_newlines = false;
 	while(1) {
 		tok_.next_token();
 		wassert(curvar != variables.end());
 
-		switch (tok_.current_token().type) {
+		const token& tok = tok_.current_token();
+		switch (tok.type) {
 		case ',':
 			if ((curvar+1) != variables.end()) {
+				add_text(*value);
 				curvar++;
-				cfg[*curvar] = "";
+				value = &cfg[*curvar];
+				*value = "";
 				continue;
 			} else {
-				cfg[*curvar] += ",";
+				text_ += ',';
 			}
 			break;
 		case '_':
 			tok_.next_token();
-			switch (tok_.current_token().type) {
+			switch (tok.type) {
 			case token::UNTERMINATED_QSTRING:
+				add_text(*value);
 				error(_("Unterminated quoted string"));
 				break;
 			case token::QSTRING:
-				cfg[*curvar] += t_string(tok_.current_token().value, tok_.textdomain());
+				add_text(*value);
+				*value += t_string(tok.value.str(), tok_.textdomain());
 				break;
 			default:
-				cfg[*curvar] += "_";
-				cfg[*curvar] += tok_.current_token().value;
+				text_ += '_';
+				text_.append(tok.value.begin, tok.value.end);
 				break;
 			case token::END:
 			case token::LF:
+				add_text(*value);
 				return;
 			}
 			break;
@@ -260,30 +277,41 @@ void parser::parse_variable()
 			// Ignore this
 			break;
 		default:
-			cfg[*curvar] += tok_.current_token().leading_spaces + tok_.current_token().value;
+			text_.append(tok.leading_spaces.begin, tok.leading_spaces.end);
+			text_.append(tok.value.begin, tok.value.end);
 			break;
 		case token::QSTRING:
-			cfg[*curvar] += tok_.current_token().value;
+			text_.append(tok.value.begin, tok.value.end);
 			break;
 		case token::UNTERMINATED_QSTRING:
+			add_text(*value);
 			error(_("Unterminated quoted string"));
 			break;
 		case token::LF:
-			if(!ignore_next_newlines)
+			if(!ignore_next_newlines) {
+				add_text(*value);
 				return;
+			}
 			break;
 		case token::END:
+			add_text(*value);
 			return;
 		}
 
-		if (tok_.current_token().type == '+') {
+		if (tok.type == '+') {
 			ignore_next_newlines = true;
-		} else if (tok_.current_token().type != token::LF) {
+		} else if (tok.type != token::LF) {
 			ignore_next_newlines = false;
 		}
 	}
 }
 
+void parser::add_text(t_string& value)
+{
+	value += text_;
+	text_ = "";
+}
+
 std::string parser::lineno_string(utils::string_map &i18n_symbols, std::string const &lineno,
 			          std::string const &error_string)
 {
@@ -317,7 +345,21 @@ void parser::error(const std::string& error_type)
 
 void read(config &cfg, std::istream &data_in, std::string* error_log)
 {
-	parser(cfg, data_in)(error_log);
+	//the text is read into memory first, and parsed there
+	std::string text;
+	char buf[16384];
+	while(data_in.good()) {
+		data_in.read(buf, sizeof(buf));
+		text.append(buf, data_in.gcount());
+	}
+
+	read(cfg, text.data(), text.data() + text.size(), error_log);
+}
+
+void read(config &cfg, const char* begin, const char* end, std::string* error_log)
+{
+	const config::arena_scope arena(cfg);
+	parser(cfg, begin, end)(error_log);
 }
 
 static char const *AttributeEquals = "=";
@@ -352,7 +394,7 @@ static void write_internal(config const &cfg, std::ostream &out, std::string& te
 	if (tab > max_recursion_levels)
 		return;
 
-	for(string_map::const_iterator i = cfg.values.begin(), i_end = cfg.values.end(); i != i_end; ++i) {
+	for(config::attribute_map::const_iterator i = cfg.values.begin(), i_end = cfg.values.end(); i != i_end; ++i) {
 		if (!i->second.empty()) {
 			bool first = true;
 
@@ -22,6 +22,10 @@ class config;
 //read data in, clobbering existing data.
 void read(config &cfg, std::istream &in, std::string* error_log = NULL); //throws config::error
 
+//the same, reading the text in [begin,end) without copying it first. This is
+//how text already in memory, such as a preprocessed file, is read.
+void read(config &cfg, const char* begin, const char* end, std::string* error_log = NULL); //throws config::error
+
 void write(std::ostream &out, config const &cfg);
 
 #endif
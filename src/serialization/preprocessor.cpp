@@ -15,7 +15,9 @@
 #include "global.hpp"
 
 #include <algorithm>
+#include <cstdio>
 #include <iostream>
+#include <set>
 #include <sstream>
 #include <vector>
 
@@ -42,11 +44,93 @@ struct config {
 };
 
 class preprocessor;
+class preprocessor_cache;
 class preprocessor_file;
 class preprocessor_data;
 class preprocessor_streambuf;
 struct preprocessor_deleter;
 
+namespace {
+
+//a checksum of the text in [begin,end), following 'sum'. It is only used to
+//tell whether the text has changed since it was cached.
+unsigned int checksum(char const *begin, char const *end, unsigned int sum = 2166136261u)
+{
+	for(; begin != end; ++begin) {
+		sum = (sum ^ static_cast<unsigned char>(*begin)) * 16777619u;
+	}
+	return sum;
+}
+
+unsigned int checksum(std::string const &s, unsigned int sum = 2166136261u)
+{
+	return checksum(s.data(), s.data() + s.size(), checksum("\n", "\n" + 1, sum));
+}
+
+//the checksum of what a macro expands to
+unsigned int checksum(preproc_define const &val)
+{
+	unsigned int sum = checksum(val.value);
+	for(std::vector< std::string >::const_iterator i = val.arguments.begin(); i != val.arguments.end(); ++i) {
+		sum = checksum(*i, sum);
+	}
+	std::ostringstream s;
+	s << val.linenum << ' ' << val.location << ' ' << val.textdomain;
+	return checksum(s.str(), sum);
+}
+
+std::string hex_string(unsigned int n)
+{
+	std::ostringstream s;
+	s << std::hex << n;
+	return s.str();
+}
+
+}
+
+//the preprocessed text of the files, kept in a directory from one run to the
+//next. Only the text of a file which includes no other file and defines no
+//macro is cached: it then only depends on the file, on the state of the
+//preprocessor when the file is included, and on the macros it uses, whose
+//checksums are kept with the text and checked when it is read back. The
+//files which include others are preprocessed again, but the files they
+//include are read from the cache.
+class preprocessor_cache
+{
+	//a file being preprocessed, whose text is recorded as it is written
+	struct recorded_file
+	{
+		int depth;
+		bool cacheable;
+		std::string name, key;
+		unsigned int size, sum;
+		std::set< std::string > macros;
+		std::string output;
+	};
+
+	std::string dir_;
+	std::string define_set_;
+	std::vector< recorded_file > recordings_;
+
+	std::string entry_name(std::string const &name) const;
+public:
+	preprocessor_cache(std::string const &dir, preproc_map const &defines);
+
+	static std::string make_key(std::string const &location, int linenum,
+	                            std::string const &textdomain, bool quoted);
+
+	bool read(std::string const &name, std::string const &key, std::string const &text,
+	          preproc_map const &defines, std::string &output) const;
+	void start(std::string const &name, std::string const &key, std::string const &text, int depth);
+	bool recording(int depth) const;
+	bool recording() const;
+	void finish(preproc_map const &defines, std::string const &key);
+
+	void use_define(std::string const &symbol);
+	void forbid();
+	void add_output(char const *begin, char const *end);
+};
+
 class preprocessor
 {
 	preprocessor *const old_preprocessor_;
@@ -74,25 +158,102 @@ class preprocessor_streambuf: public std::streambuf
 	int linenum_;
 	int depth_;
 	bool quoted_;
+	//the cache, shared with the streams made for macro arguments, which
+	//don't read from it themselves
+	preprocessor_cache *cache_;
+	bool nested_;
+	//how much of buffer_ has been added to the text being recorded
+	size_t recorded_;
 	friend class preprocessor;
 	friend class preprocessor_file;
 	friend class preprocessor_data;
 	friend struct preprocessor_deleter;
 	preprocessor_streambuf(preprocessor_streambuf const &);
+
+	std::istream *open_file(std::string const &name);
+	preproc_define const *find_define(std::string const &symbol);
+	void forbid_caching();
+	void record_output();
+	void end_recording();
 public:
-	preprocessor_streambuf(preproc_map *);
+	preprocessor_streambuf(preproc_map *, preprocessor_cache *);
 };
 
-preprocessor_streambuf::preprocessor_streambuf(preproc_map *def)
+preprocessor_streambuf::preprocessor_streambuf(preproc_map *def, preprocessor_cache *cache)
 	: current_(NULL), defines_(def), textdomain_(PACKAGE),
-	  depth_(0), quoted_(false)
+	  depth_(0), quoted_(false), cache_(cache), nested_(false), recorded_(0)
 {
 }
 
 preprocessor_streambuf::preprocessor_streambuf(preprocessor_streambuf const &t)
 	: current_(NULL), defines_(t.defines_),
-	  textdomain_(PACKAGE), depth_(t.depth_), quoted_(t.quoted_)
+	  textdomain_(PACKAGE), depth_(t.depth_), quoted_(t.quoted_),
+	  cache_(t.cache_), nested_(true), recorded_(0)
+{
+}
+
+//opens the file 'name' to preprocess it. If its preprocessed text is in the
+//cache, it is written out instead, and NULL is returned.
+std::istream *preprocessor_streambuf::open_file(std::string const &name)
 {
+	if (cache_ == NULL || nested_)
+		return istream_file(name);
+
+	std::string const &text = read_file(name);
+	std::string const &key = preprocessor_cache::make_key(location_, linenum_, textdomain_, quoted_);
+	std::string output;
+	if (cache_->read(name, key, text, *defines_, output)) {
+		LOG_CF << "using the cached text of " << name << '\n';
+		buffer_ << output;
+		return NULL;
+	}
+
+	// the text is recorded from the line directives the preprocessor
+	// starts with, which are written at the next depth
+	record_output();
+	cache_->start(name, key, text, depth_ + 1);
+	return new std::istringstream(text);
+}
+
+//looks up a macro, which the text being recorded then depends on
+preproc_define const *preprocessor_streambuf::find_define(std::string const &symbol)
+{
+	if (cache_ != NULL)
+		cache_->use_define(symbol);
+	preproc_map::const_iterator i = defines_->find(symbol);
+	return i != defines_->end() ? &i->second : NULL;
+}
+
+//the files being recorded include another file or define a macro
+void preprocessor_streambuf::forbid_caching()
+{
+	if (cache_ != NULL)
+		cache_->forbid();
+}
+
+//adds what has been written since the last call to the text being recorded
+void preprocessor_streambuf::record_output()
+{
+	if (cache_ == NULL || nested_)
+		return;
+	if (!cache_->recording()) {
+		recorded_ = buffer_.tellp();
+		return;
+	}
+
+	std::string const &s = buffer_.str();
+	cache_->add_output(s.data() + recorded_, s.data() + s.size());
+	recorded_ = s.size();
+}
+
+//the preprocessor at the current depth is done; if it read a file which is
+//being recorded, the text of the file is cached
+void preprocessor_streambuf::end_recording()
+{
+	if (cache_ == NULL || nested_ || !cache_->recording(depth_))
+		return;
+	record_output();
+	cache_->finish(*defines_, preprocessor_cache::make_key(location_, linenum_, textdomain_, quoted_));
 }
 
 int preprocessor_streambuf::underflow()
@@ -108,12 +269,15 @@ int preprocessor_streambuf::underflow()
 			out_buffer_ = out_buffer_.substr(sz - 3);
 			sz = 3;
 		}
+		record_output();
 		buffer_.str(std::string());
 		buffer_ << out_buffer_;
+		recorded_ = sz;
 	}
 	while (current_) {
 		if (current_->get_chunk()) {
-			if (buffer_.str().size() >= 2000)
+			// the size is looked at without copying the buffer
+			if (buffer_.tellp() >= std::streampos(2000))
 				break;
 		} else {
 			 // automatically restore the previous preprocessor
@@ -151,6 +315,7 @@ preprocessor::~preprocessor()
 		                << ' ' << old_location_ << '\n';
 	if (!old_textdomain_.empty())
 		target_.buffer_ << "\376textdomain " << old_textdomain_ << '\n';
+	target_.end_recording();
 	--target_.depth_;
 }
 
@@ -196,10 +361,11 @@ public:
 preprocessor_file::preprocessor_file(preprocessor_streambuf &t, std::string const &name)
 	: preprocessor(t)
 {
+	t.forbid_caching();
 	if (is_directory(name))
 		get_files_in_dir(name, &files_, NULL, ENTIRE_FILE_PATH);
-	else
-		new preprocessor_data(t, istream_file(name), "", name, 1, directory_name(name), t.textdomain_);
+	else if (std::istream *in = t.open_file(name))
+		new preprocessor_data(t, in, "", name, 1, directory_name(name), t.textdomain_);
 	pos_ = files_.begin();
 	end_ = files_.end();
 }
@@ -459,6 +625,7 @@ bool preprocessor_data::get_chunk()
 				throw config::error(error.str());
 			}
 			if (!skipping_) {
+				target_.forbid_caching();
 				buffer.erase(buffer.end() - 7, buffer.end());
 				target_.defines_->insert(std::make_pair(
 					symbol, preproc_define(buffer, items, target_.textdomain_,
@@ -468,7 +635,7 @@ bool preprocessor_data::get_chunk()
 		} else if (command == "ifdef") {
 			skip_spaces();
 			std::string const &symbol = read_word();
-			bool skip = target_.defines_->count(symbol) == 0;
+			bool skip = target_.find_define(symbol) == NULL;
 			LOG_CF << "testing for macro " << symbol << ": " << (skip ? "not defined" : "defined") << '\n';
 			if (skip)
 				++skipping_;
@@ -552,10 +719,9 @@ bool preprocessor_data::get_chunk()
 			}
 			//if this is a known pre-processing symbol, then we insert
 			//it, otherwise we assume it's a file name to load
-			preproc_map::const_iterator macro = target_.defines_->find(symbol),
-			                            unknown_macro = target_.defines_->end();
-			if (macro != unknown_macro) {
-				preproc_define const &val = macro->second;
+			preproc_define const *macro = target_.find_define(symbol);
+			if (macro != NULL) {
+				preproc_define const &val = *macro;
 				size_t nb_arg = strings_.size() - token.stack_pos - 1;
 				if (nb_arg != val.arguments.size()) {
 					std::ostringstream error;
@@ -705,6 +871,7 @@ bool preprocessor_data::get_chunk()
 					}
 				}
 			} else {
+				target_.forbid_caching();
 				ERR_CF << "too much nested preprocessing inclusions at "
 				       << linenum_ << ' ' << target_.location_
 				       << ". Aborting.\n";
@@ -723,12 +890,14 @@ struct preprocessor_deleter: std::basic_istream<char>
 {
 	preprocessor_streambuf *buf_;
 	preproc_map *defines_;
-	preprocessor_deleter(preprocessor_streambuf *buf, preproc_map *defines);
+	preprocessor_cache *cache_;
+	preprocessor_deleter(preprocessor_streambuf *buf, preproc_map *defines, preprocessor_cache *cache);
 	~preprocessor_deleter();
 };
 
-preprocessor_deleter::preprocessor_deleter(preprocessor_streambuf *buf, preproc_map *defines)
-	: std::basic_istream<char>(buf), buf_(buf), defines_(defines)
+preprocessor_deleter::preprocessor_deleter(preprocessor_streambuf *buf, preproc_map *defines,
+                                           preprocessor_cache *cache)
+	: std::basic_istream<char>(buf), buf_(buf), defines_(defines), cache_(cache)
 {
 }
 
@@ -737,11 +906,194 @@ preprocessor_deleter::~preprocessor_deleter()
 	rdbuf(NULL);
 	delete buf_;
 	delete defines_;
+	delete cache_;
+}
+
+static const char *const cache_version = "wesnoth preprocessor cache 1";
+
+preprocessor_cache::preprocessor_cache(std::string const &dir, preproc_map const &defines)
+	: dir_(dir)
+{
+	// the define set only picks the file the text is cached in, so that
+	// the texts of each set are kept apart
+	unsigned int sum = checksum(std::string());
+	for(preproc_map::const_iterator i = defines.begin(); i != defines.end(); ++i) {
+		sum = checksum(i->first, sum);
+	}
+	define_set_ = hex_string(sum);
+}
+
+std::string preprocessor_cache::make_key(std::string const &location, int linenum,
+                                         std::string const &textdomain, bool quoted)
+{
+	std::ostringstream s;
+	s << linenum << ' ' << (quoted ? 1 : 0) << ' ' << textdomain << ' ' << location;
+	return s.str();
+}
+
+// a file has one entry per define set, whichever place it is included from:
+// the key is checked in the header, so that an entry made from another place
+// is replaced rather than kept along with it
+std::string preprocessor_cache::entry_name(std::string const &name) const
+{
+	std::string res = name;
+	for(std::string::iterator i = res.begin(); i != res.end(); ++i) {
+		if (*i == '/' || *i == '\\' || *i == ':')
+			*i = '_';
+	}
+	return dir_ + "/" + res + "-" + define_set_;
+}
+
+namespace {
+
+//reads the line starting at 'pos' in 's', and moves 'pos' past it
+bool read_line(std::string const &s, std::string::size_type &pos, std::string &line)
+{
+	std::string::size_type end = s.find('\n', pos);
+	if (end == std::string::npos)
+		return false;
+	line.assign(s, pos, end - pos);
+	pos = end + 1;
+	return true;
+}
+
+}
+
+bool preprocessor_cache::read(std::string const &name, std::string const &key, std::string const &text,
+                              preproc_map const &defines, std::string &output) const
+{
+	std::string const &entry = read_file(entry_name(name));
+	std::string::size_type pos = 0;
+	std::string line;
+
+	std::ostringstream header;
+	header << cache_version << '\n' << name << '\n' << define_set_ << '\n' << key << '\n'
+	       << text.size() << ' ' << checksum(text) << '\n';
+	std::string const &h = header.str();
+	if (entry.compare(0, h.size(), h) != 0)
+		return false;
+	pos = h.size();
+
+	// the macros the text was made with must all be the same
+	size_t nb_macros;
+	if (!read_line(entry, pos, line) || !(std::istringstream(line) >> nb_macros))
+		return false;
+	for(size_t n = 0; n != nb_macros; ++n) {
+		if (!read_line(entry, pos, line))
+			return false;
+		std::string::size_type space = line.find(' ');
+		if (space == std::string::npos)
+			return false;
+		preproc_map::const_iterator macro = defines.find(line.substr(0, space));
+		std::string const &sum = macro != defines.end() ? hex_string(checksum(macro->second)) : "-";
+		if (line.compare(space + 1, std::string::npos, sum) != 0)
+			return false;
+	}
+
+	size_t size;
+	if (!read_line(entry, pos, line) || !(std::istringstream(line) >> size) || entry.size() - pos != size)
+		return false;
+	output.assign(entry, pos, size);
+	return true;
+}
+
+void preprocessor_cache::start(std::string const &name, std::string const &key, std::string const &text, int depth)
+{
+	recordings_.push_back(recorded_file());
+	recorded_file &r = recordings_.back();
+	r.depth = depth;
+	r.cacheable = true;
+	r.name = name;
+	r.key = key;
+	r.size = text.size();
+	r.sum = checksum(text);
+}
+
+bool preprocessor_cache::recording(int depth) const
+{
+	return !recordings_.empty() && recordings_.back().depth == depth;
+}
+
+bool preprocessor_cache::recording() const
+{
+	for(std::vector< recorded_file >::const_iterator i = recordings_.begin(); i != recordings_.end(); ++i) {
+		if (i->cacheable)
+			return true;
+	}
+	return false;
+}
+
+void preprocessor_cache::use_define(std::string const &symbol)
+{
+	for(std::vector< recorded_file >::iterator i = recordings_.begin(); i != recordings_.end(); ++i) {
+		if (i->cacheable)
+			i->macros.insert(symbol);
+	}
+}
+
+void preprocessor_cache::forbid()
+{
+	for(std::vector< recorded_file >::iterator i = recordings_.begin(); i != recordings_.end(); ++i) {
+		i->cacheable = false;
+		i->macros.clear();
+		std::string().swap(i->output);
+	}
+}
+
+void preprocessor_cache::add_output(char const *begin, char const *end)
+{
+	for(std::vector< recorded_file >::iterator i = recordings_.begin(); i != recordings_.end(); ++i) {
+		if (i->cacheable)
+			i->output.append(begin, end);
+	}
+}
+
+void preprocessor_cache::finish(preproc_map const &defines, std::string const &key)
+{
+	recorded_file const &r = recordings_.back();
+
+	// a file which leaves a quoted string open isn't cached
+	if (r.cacheable && key == r.key) {
+		std::ostringstream header;
+		header << cache_version << '\n' << r.name << '\n' << define_set_ << '\n' << r.key << '\n'
+		       << r.size << ' ' << r.sum << '\n' << r.macros.size() << '\n';
+		for(std::set< std::string >::const_iterator i = r.macros.begin(); i != r.macros.end(); ++i) {
+			preproc_map::const_iterator macro = defines.find(*i);
+			header << *i << ' ' << (macro != defines.end() ? hex_string(checksum(macro->second)) : "-") << '\n';
+		}
+		header << r.output.size() << '\n';
+
+		// the entry is replaced at once, so that it is never read half written
+		std::string const &entry = entry_name(r.name);
+		std::string const &tmp_entry = entry + ".tmp";
+		bool written;
+		{
+			scoped_ostream out = ostream_file(tmp_entry);
+			*out << header.str();
+			out->write(r.output.data(), r.output.size());
+			out->flush();
+			written = !out->fail();
+		}
+
+		// rename() doesn't replace an existing file on windows
+		if (written && std::rename(tmp_entry.c_str(), entry.c_str()) != 0) {
+			std::remove(entry.c_str());
+			written = std::rename(tmp_entry.c_str(), entry.c_str()) == 0;
+		}
+
+		if (!written) {
+			ERR_CF << "could not cache the text of " << r.name << '\n';
+			std::remove(tmp_entry.c_str());
+		}
+	}
+
+	recordings_.pop_back();
 }
 
 
 std::istream *preprocess_file(std::string const &fname,
-                              preproc_map *defines)
+                              preproc_map *defines,
+                              std::string const &cache_dir)
 {
 	log_scope("preprocessing file...");
 	preproc_map *owned_defines = NULL;
@@ -751,7 +1103,10 @@ std::istream *preprocess_file(std::string const &fname,
 		owned_defines = new preproc_map;
 		defines = owned_defines;
 	}
-	preprocessor_streambuf *buf = new preprocessor_streambuf(defines);
+	preprocessor_cache *cache = NULL;
+	if (!cache_dir.empty())
+		cache = new preprocessor_cache(cache_dir, *defines);
+	preprocessor_streambuf *buf = new preprocessor_streambuf(defines, cache);
 	new preprocessor_file(*buf, fname);
-	return new preprocessor_deleter(buf, owned_defines);
+	return new preprocessor_deleter(buf, owned_defines, cache);
 }
@@ -38,8 +38,12 @@ struct preproc_define
 typedef std::map< std::string, preproc_define > preproc_map;
 
 //function to use the WML preprocessor on a file, and returns the resulting
-//preprocessed file data. defines is a map of symbols defined.
+//preprocessed file data. defines is a map of symbols defined. If cache_dir
+//isn't empty, the preprocessed text of each file is kept in that directory,
+//so that the files which haven't changed since, and whose macros haven't
+//changed either, aren't preprocessed again.
 std::istream *preprocess_file(std::string const &fname,
-                              preproc_map *defines = NULL);
+                              preproc_map *defines = NULL,
+                              std::string const &cache_dir = "");
 
 #endif
@@ -16,31 +16,49 @@
 #include "tokenizer.hpp"
 #include "string_utils.hpp"
 
-#include <iostream>
-#include <sstream>
+#include <algorithm>
+#include <cstdio>
 
-tokenizer::tokenizer(std::istream& in) :
-	in_(in),
+tokenizer::tokenizer(const char* begin, const char* end) :
+	pos_(begin),
+	end_(end),
 	lineno_(1)
 {
-	if(in_.good()) {
-		current_ = in_.get();
+	if(pos_ != end_) {
+		current_ = static_cast<unsigned char>(*pos_);
 	} else {
 		current_ = EOF;
 	}
 }
 
+namespace {
+
+bool starts_with(const char* begin, const char* end, const char* word)
+{
+	for(; *word != '\0'; ++word, ++begin) {
+		if(begin == end || *begin != *word)
+			return false;
+	}
+	return begin != end && (*begin == ' ' || *begin == '\t');
+}
+
+}
+
 void tokenizer::skip_comment()
 {
 	// Dump comments up to \n
-	std::string comment;
-	next_char();
-	while (current_ != EOF && current_ != '\n') {
-		comment += current_;
-		next_char();
-	}
+	const char* const begin = pos_ + 1;
+	const char* const end = std::find(begin, end_, '\n');
+	skip_to(end);
+
+	// Identifies and processes tokenizer directives. Other comments are
+	// left in the buffer.
+	if (!starts_with(begin, end, "textdomain") && !starts_with(begin, end, "line"))
+		return;
+
+	std::string comment(begin, end);
+	comment.erase(std::remove(comment.begin(), comment.end(), '\r'), comment.end());
 
-	// Identifies and processes tokenizer directives
 	std::string::size_type pos = comment.find_first_of(" \t");
 	if (pos != std::string::npos) {
 		const std::string word = comment.substr(0, pos);
@@ -60,20 +78,29 @@ void tokenizer::skip_comment()
 
 const token& tokenizer::next_token()
 {
-	token_.value = "";
-	token_.leading_spaces = "";
-
-	// Dump spaces and inlined comments
-	for(;;) {
-		while (is_space(current_)) {
-			token_.leading_spaces += current_;
+	// Dump spaces and inlined comments. The spaces are left in the buffer,
+	// unless they are split by comments or carriage returns.
+	const char* spaces_end = pos_;
+	while (spaces_end != end_ && is_space(*spaces_end))
+		++spaces_end;
+
+	if (spaces_end == end_ || (*spaces_end != '\r' && static_cast<unsigned char>(*spaces_end) != 254)) {
+		token_.leading_spaces.assign(pos_, spaces_end);
+		skip_to(spaces_end);
+	} else {
+		leading_spaces_ = "";
+		for(;;) {
+			while (is_space(current_)) {
+				leading_spaces_ += current_;
+				next_char();
+			}
+			if (current_ != 254)
+				break;
+			skip_comment();
+			--lineno_;
 			next_char();
 		}
-		if (current_ != 254)
-			break;
-		skip_comment();
-		--lineno_;
-		next_char();
+		token_.leading_spaces.assign(leading_spaces_);
 	}
 
 	if (current_ == '#')
@@ -84,9 +111,26 @@ const token& tokenizer::next_token()
 	switch(current_) {
 	case EOF:
 		token_.type = token::END;
+		token_.value.assign(end_, end_);
 		break;
-	case '"':
+	case '"': {
 		token_.type = token::QSTRING;
+
+		// Most strings are left in the buffer: only those with doubled
+		// quotes, carriage returns or inlined comments are copied.
+		const char* const begin = pos_ + 1;
+		const char* end = begin;
+		while (end != end_ && *end != '"' && *end != '\r' && static_cast<unsigned char>(*end) != 254)
+			++end;
+
+		if (end != end_ && *end == '"' && (end + 1 == end_ || end[1] != '"')) {
+			lineno_ += std::count(begin, end, '\n');
+			token_.value.assign(begin, end);
+			skip_to(end);
+			break;
+		}
+
+		value_ = "";
 		while (1) {
 			next_char();
 
@@ -104,26 +148,28 @@ const token& tokenizer::next_token()
 				continue;
 			}
 
-			token_.value += current_;
+			value_ += current_;
 		};
+		token_.value.assign(value_);
 		break;
+	}
 	case '[': case ']': case '/': case '\n': case '=': case ',': case '+':
 		token_.type = token::token_type(current_);
-		token_.value = current_;
+		token_.value.assign(pos_, pos_ + 1);
 		break;
 	default:
 		if(is_alnum(current_)) {
 			token_.type = token::STRING;
-			token_.value += current_;
-			while(is_alnum(peek_char())) {
-				next_char();
-				token_.value += current_;
-			}
+			const char* end = pos_ + 1;
+			while(end != end_ && is_alnum(*end))
+				++end;
+			token_.value.assign(pos_, end);
+			skip_to(end - 1);
 		} else {
 			token_.type = token::MISC;
-			token_.value += current_;
+			token_.value.assign(pos_, pos_ + 1);
 		}
-		if(token_.value == "_")
+		if(token_.value.size() == 1 && *token_.value.begin == '_')
 			token_.type = token::token_type('_');
 	}
 
@@ -133,28 +179,40 @@ const token& tokenizer::next_token()
 	return token_;
 }
 
-const token& tokenizer::current_token()
-{
-	return token_;
-}
-
 void tokenizer::next_char()
 {
 	if (current_ == '\n')
 		lineno_++;
+	if (pos_ == end_)
+		return;
 
 	do {
-		if(in_.good()) {
-			current_ = in_.get();
-		} else {
-			current_ = EOF;
-		}
-	} while(current_ == '\r');
+		++pos_;
+	} while(pos_ != end_ && *pos_ == '\r');
+
+	if(pos_ != end_) {
+		current_ = static_cast<unsigned char>(*pos_);
+	} else {
+		current_ = EOF;
+	}
+}
+
+//moves to 'pos' without counting the lines on the way
+void tokenizer::skip_to(const char* pos)
+{
+	pos_ = pos;
+	if(pos_ != end_) {
+		current_ = static_cast<unsigned char>(*pos_);
+	} else {
+		current_ = EOF;
+	}
 }
 
-int tokenizer::peek_char()
+int tokenizer::peek_char() const
 {
-	return in_.peek();
+	if(pos_ == end_ || pos_ + 1 == end_)
+		return EOF;
+	return static_cast<unsigned char>(pos_[1]);
 }
 
 bool tokenizer::is_space(int c)
@@ -167,11 +225,23 @@ bool tokenizer::is_alnum(int c)
 	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
 }
 
-std::string tokenizer::get_line()
+std::string tokenizer::get_line() const
 {
-	std::ostringstream s;
-	s << tokenstart_lineno_ << ' ' << file_;
-	return s.str();
+	//this is done for each element, so the line number is written by hand
+	//rather than through a stream
+	char buf[32];
+	char* const end = buf + sizeof(buf);
+	char* begin = end;
+	size_t lineno = tokenstart_lineno_;
+	do {
+		*--begin = '0' + lineno % 10;
+		lineno /= 10;
+	} while(lineno != 0);
+
+	std::string res(begin, end);
+	res += ' ';
+	res += file_;
+	return res;
 }
 
 std::string& tokenizer::textdomain()
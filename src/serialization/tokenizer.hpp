@@ -14,11 +14,29 @@
 #ifndef TOKENIZER_H_INCLUDED
 #define TOKENIZER_H_INCLUDED
 
-#include <istream>
+#include <cstddef>
 #include <string>
 
 class config;
 
+//a piece of the text being read. It points into the buffer the tokenizer
+//reads, or into the tokenizer itself when the text had to be unescaped, so
+//it is only valid until the next token is read.
+struct token_text
+{
+	token_text() : begin(NULL), end(NULL) {}
+
+	void assign(const char* b, const char* e) { begin = b; end = e; }
+	void assign(const std::string& s) { begin = s.data(); end = begin + s.size(); }
+
+	bool empty() const { return begin == end; }
+	size_t size() const { return end - begin; }
+	std::string str() const { return std::string(begin, end); }
+
+	const char* begin;
+	const char* end;
+};
+
 struct token
 {
 	enum token_type {
@@ -38,28 +56,32 @@ struct token
 		END
 	} type;
 
-	std::string leading_spaces;
-	std::string value;
+	token_text leading_spaces;
+	token_text value;
 };
 
+//reads the tokens of the text in [begin,end), which must stay in memory as
+//long as the tokenizer is used. The text of the tokens isn't copied, unless
+//it holds doubled quotes, carriage returns or inlined comments.
 class tokenizer
 {
 public:
-	tokenizer(std::istream& in);
+	tokenizer(const char* begin, const char* end);
 
 	const token& next_token();
-	const token& current_token();
-	std::string get_line();
+	const token& current_token() const { return token_; }
+	std::string get_line() const;
 	std::string& textdomain();
 private:
 	void next_char();
-	int get_char();
-	int peek_char();
-	bool is_space(int c);
-	bool is_alnum(int c);
+	void skip_to(const char* pos);
+	int peek_char() const;
+	static bool is_space(int c);
+	static bool is_alnum(int c);
 	void skip_comment();
 
-	std::istream& in_;
+	const char* pos_;
+	const char* const end_;
 	int current_;
 
 	std::string textdomain_;
@@ -67,6 +89,9 @@ private:
 	size_t tokenstart_lineno_;
 	size_t lineno_;
 	token token_;
+
+	//the text of the current token, when it can't be left in the buffer
+	std::string leading_spaces_, value_;
 };
 
 #endif
@@ -0,0 +1,242 @@
+/* $Id$ */
+/*
+   Copyright (C) 2003-5 by David White <davidnwhite@verizon.net>
+   Part of the Battle for Wesnoth Project http://www.wesnoth.org/
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License.
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY.
+
+   See the COPYING file for more details.
+*/
+
+#include "../global.hpp"
+
+#include "../util.hpp"
+#include "../wassert.hpp"
+
+#include "config_journal.hpp"
+
+#include <algorithm>
+
+size_t config_journal::list_changes::old_index(size_t index) const
+{
+	//the children from the last diff are still in the same order, without
+	//the removed ones
+	for(std::set<size_t>::const_iterator i = removed.begin(); i != removed.end() && *i <= index; ++i) {
+		++index;
+	}
+
+	return index;
+}
+
+config_journal::config_journal(config& cfg) : cfg_(cfg)
+{
+	node_location& loc = locations_[&cfg_];
+	loc.parent = NULL;
+}
+
+config& config_journal::add_child(config& parent, const std::string& key, const config& val)
+{
+	wassert(locations_.count(&parent));
+
+	list_changes& list = get_list_changes(parent,key);
+	config& child = parent.add_child(key,val);
+	list.added.push_back(&child);
+
+	node_location& loc = locations_[&child];
+	loc.parent = &parent;
+	loc.key = key;
+
+	return child;
+}
+
+void config_journal::remove_child(config& parent, const std::string& key, const config& child)
+{
+	const config::child_list& children = parent.get_children(key);
+	const config::child_list::const_iterator i = std::find(children.begin(),children.end(),&child);
+	if(i == children.end()) {
+		return;
+	}
+
+	const size_t index = i - children.begin();
+	list_changes& list = get_list_changes(parent,key);
+
+	const size_t nold = list.old_size - list.removed.size();
+	if(index < nold) {
+		list.removed.insert(list.old_index(index));
+	} else {
+		list.added.erase(list.added.begin() + (index - nold));
+	}
+
+	std::map<std::string,std::set<const config*> >& changed = changes_[&parent].changed_children;
+	const std::map<std::string,std::set<const config*> >::iterator c = changed.find(key);
+	if(c != changed.end()) {
+		c->second.erase(&child);
+	}
+
+	forget(child);
+	parent.remove_child(key,index);
+}
+
+void config_journal::set_value(config& node, const std::string& key, const t_string& value)
+{
+	wassert(locations_.count(&node));
+
+	const config::attribute_map::const_iterator i = node.values.find(key);
+	if(i != node.values.end() && i->second == value) {
+		return;
+	}
+
+	node.values[key] = value;
+	mark_changed(node).values.insert(key);
+}
+
+config config_journal::get_diff()
+{
+	config res;
+	if(changes_.count(&cfg_)) {
+		write_diff(cfg_,res);
+	}
+
+	changes_.clear();
+	return res;
+}
+
+void config_journal::clear()
+{
+	changes_.clear();
+}
+
+config_journal::node_changes& config_journal::mark_changed(const config& node)
+{
+	node_changes& res = changes_[&node];
+
+	//let each ancestor know which of its children leads to the change, up
+	//to one which already knows
+	const config* child = &node;
+	for(;;) {
+		const std::map<const config*,node_location>::const_iterator loc = locations_.find(child);
+		wassert(loc != locations_.end());
+		if(loc->second.parent == NULL) {
+			break;
+		}
+
+		if(changes_[loc->second.parent].changed_children[loc->second.key].insert(child).second == false) {
+			break;
+		}
+
+		child = loc->second.parent;
+	}
+
+	return res;
+}
+
+config_journal::list_changes& config_journal::get_list_changes(const config& parent, const std::string& key)
+{
+	std::map<std::string,list_changes>& lists = mark_changed(parent).lists;
+	std::map<std::string,list_changes>::iterator i = lists.find(key);
+	if(i == lists.end()) {
+		//this is the first change to the list since the last diff, so the
+		//list is still as it was then
+		i = lists.insert(std::pair<std::string,list_changes>(key,list_changes(parent.get_children(key).size()))).first;
+	}
+
+	return i->second;
+}
+
+void config_journal::forget(const config& node)
+{
+	locations_.erase(&node);
+	changes_.erase(&node);
+
+	for(config::all_children_iterator i = node.ordered_begin(); i != node.ordered_end(); ++i) {
+		forget(*(*i).second);
+	}
+}
+
+void config_journal::write_diff(const config& node, config& res) const
+{
+	const std::map<const config*,node_changes>::const_iterator changes = changes_.find(&node);
+	if(changes == changes_.end()) {
+		return;
+	}
+
+	config* inserts = NULL;
+	config* deletes = NULL;
+	for(std::set<std::string>::const_iterator v = changes->second.values.begin(); v != changes->second.values.end(); ++v) {
+		const t_string& value = node[*v];
+		if(value.empty()) {
+			if(deletes == NULL) {
+				deletes = &res.add_child("delete");
+			}
+
+			(*deletes)[*v] = "x";
+		} else {
+			if(inserts == NULL) {
+				inserts = &res.add_child("insert");
+			}
+
+			(*inserts)[*v] = value;
+		}
+	}
+
+	std::set<std::string> keys;
+	std::map<std::string,list_changes>::const_iterator list;
+	for(list = changes->second.lists.begin(); list != changes->second.lists.end(); ++list) {
+		keys.insert(list->first);
+	}
+
+	std::map<std::string,std::set<const config*> >::const_iterator changed;
+	for(changed = changes->second.changed_children.begin(); changed != changes->second.changed_children.end(); ++changed) {
+		keys.insert(changed->first);
+	}
+
+	for(std::set<std::string>::const_iterator key = keys.begin(); key != keys.end(); ++key) {
+		list = changes->second.lists.find(*key);
+		const list_changes* const lc = list != changes->second.lists.end() ? &list->second : NULL;
+
+		//apply_diff first changes the children from the last diff, where
+		//they were then
+		changed = changes->second.changed_children.find(*key);
+		if(changed != changes->second.changed_children.end()) {
+			const config::child_list& children = node.get_children(*key);
+			for(std::set<const config*>::const_iterator c = changed->second.begin(); c != changed->second.end(); ++c) {
+				//children added since the last diff are inserted as they are now
+				if(lc != NULL && std::find(lc->added.begin(),lc->added.end(),*c) != lc->added.end()) {
+					continue;
+				}
+
+				size_t index = std::find(children.begin(),children.end(),*c) - children.begin();
+				wassert(index != children.size());
+				if(lc != NULL) {
+					index = lc->old_index(index);
+				}
+
+				config& change = res.add_child("change_child");
+				change["index"] = lexical_cast<std::string>(index);
+				write_diff(**c,change.add_child(*key));
+			}
+		}
+
+		if(lc == NULL) {
+			continue;
+		}
+
+		//then it inserts the new children, after those from the last diff
+		for(size_t n = 0; n != lc->added.size(); ++n) {
+			config& insert = res.add_child("insert_child");
+			insert["index"] = lexical_cast<std::string>(lc->old_size + n);
+			insert.add_child(*key,*lc->added[n]);
+		}
+
+		//and finally deletes the removed children, from the last one so that
+		//the indexes of the others don't change
+		for(std::set<size_t>::const_reverse_iterator r = lc->removed.rbegin(); r != lc->removed.rend(); ++r) {
+			config& del = res.add_child("delete_child");
+			del["index"] = lexical_cast<std::string>(*r);
+			del.add_child(*key);
+		}
+	}
+}
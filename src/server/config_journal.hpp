@@ -0,0 +1,114 @@
+/* $Id$ */
+/*
+   Copyright (C) 2003-5 by David White <davidnwhite@verizon.net>
+   Part of the Battle for Wesnoth Project http://www.wesnoth.org/
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License.
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY.
+
+   See the COPYING file for more details.
+*/
+
+#ifndef CONFIG_JOURNAL_HPP_INCLUDED
+#define CONFIG_JOURNAL_HPP_INCLUDED
+
+#include "../config.hpp"
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+//a journal of the changes made to a config, such as the lobby's list of users
+//and games. It makes the diff of the config since the last diff, in the
+//format of config::get_diff, from the changes themselves rather than by
+//comparing the config with a copy of its previous state.
+//
+//the config must only be changed through the journal, which adds children at
+//the end of their list, removes them, and sets values.
+class config_journal
+{
+public:
+	explicit config_journal(config& cfg);
+
+	//adds a child at the end of the children called 'key' of 'parent', which
+	//must be the config or one of the children added by the journal
+	config& add_child(config& parent, const std::string& key, const config& val=config());
+
+	//removes 'child' from the children called 'key' of 'parent', if it is
+	//one of them
+	void remove_child(config& parent, const std::string& key, const config& child);
+
+	//sets an attribute of the config or of one of the children added by the
+	//journal
+	void set_value(config& node, const std::string& key, const t_string& value);
+
+	//returns the diff of the config since the last diff, and starts recording
+	//changes from now on
+	config get_diff();
+
+	//forgets the changes made since the last diff
+	void clear();
+
+private:
+	config_journal(const config_journal&);
+	void operator=(const config_journal&);
+
+	//the changes made to a list of children since the last diff
+	struct list_changes
+	{
+		explicit list_changes(size_t old_size=0) : old_size(old_size) {}
+
+		//the size of the list at the last diff
+		size_t old_size;
+
+		//the indexes of the removed children, in the list at the last diff
+		std::set<size_t> removed;
+
+		//the children added since, in order. As children are only added at
+		//the end, they all follow the children from the last diff.
+		std::vector<const config*> added;
+
+		//the index at the last diff of the child now at 'index', which must
+		//not have been added since
+		size_t old_index(size_t index) const;
+	};
+
+	//the changes made to a node since the last diff
+	struct node_changes
+	{
+		//the attributes which have been set
+		std::set<std::string> values;
+
+		//the lists of children which have had children added or removed
+		std::map<std::string,list_changes> lists;
+
+		//the children which have changes of their own, by list
+		std::map<std::string,std::set<const config*> > changed_children;
+	};
+
+	//the parent of a node, and the list of children it is in
+	struct node_location
+	{
+		const config* parent;
+		std::string key;
+	};
+
+	//records that a node has changes, so that the diff goes down to it
+	node_changes& mark_changed(const config& node);
+
+	list_changes& get_list_changes(const config& parent, const std::string& key);
+
+	//forgets a removed node and its children
+	void forget(const config& node);
+
+	void write_diff(const config& node, config& res) const;
+
+	config& cfg_;
+	std::map<const config*,node_location> locations_;
+	std::map<const config*,node_changes> changes_;
+};
+
+#endif
@@ -21,7 +21,7 @@
 
 int game::id_num = 1;
 
-game::game(const player_map& info) : player_info_(&info), id_(id_num++), sides_taken_(9), side_controllers_(9), started_(false), description_(NULL), end_turn_(0), allow_observers_(true)
+game::game(const player_map& info) : player_info_(&info), id_(id_num++), sides_taken_(9), side_controllers_(9), started_(false), history_size_(0), snapshot_size_(0), snapshot_requested_(false), ncommands_(0), description_(NULL), journal_(NULL), end_turn_(0), allow_observers_(true)
 {}
 
 bool game::is_owner(network::connection player) const
@@ -92,6 +92,37 @@ bool game::filter_commands(network::connection player, config& cfg)
 }
 
 namespace {
+//the size the history of a game may reach before its players are asked for
+//a snapshot. It may also reach the size of the game's last snapshot, so that
+//snapshots are not asked for more often than they shrink the history.
+const size_t min_history_size = 64*1024;
+
+//the size of data as it is sent to several connections, without their
+//compression schemas: each name is a literal word, followed by the value of
+//attributes. It is counted without writing the data, as it is for every
+//command of the game, so translatable values count as they are stored, a
+//few bytes off their serialized size.
+size_t data_size(const config& data)
+{
+	size_t size = 0;
+	for(config::attribute_map::const_iterator i = data.values.begin(); i != data.values.end(); ++i) {
+		if(i->second.empty() == false) {
+			//the literal word code, and the name and the value, with their nuls
+			size += 3 + i->first.size() + i->second.value().size();
+		}
+	}
+
+	for(config::all_children_iterator j = data.ordered_begin(); j != data.ordered_end(); ++j) {
+		const std::pair<const std::string*,const config*> item = *j;
+
+		//the codes opening the element and of the literal word, the name and
+		//its nul, and the code closing the element
+		size += 4 + item.first->size() + data_size(*item.second);
+	}
+
+	return size;
+}
+
 std::string describe_turns(int turn, const std::string& num_turns)
 {
 	char buf[50];
@@ -119,7 +150,7 @@ void game::start_game()
 
 	describe_slots();
 	if(description()) {
-		description()->values["turn"] = describe_turns(1,level()["turns"]);
+		journal_->set_value(*description(),"turn",describe_turns(1,level()["turns"]));
 	}
 
 	allow_observers_ = level_["observer"] != "no";
@@ -344,8 +375,8 @@ bool game::describe_slots()
 	snprintf(buf,sizeof(buf),"%d",val);
 
 	if(buf != (*description())["slots"]) {
-		description()->values["slots"] = buf;
-		description()->values["observer"] = level_["observer"];
+		journal_->set_value(*description(),"slots",buf);
+		journal_->set_value(*description(),"observer",level_["observer"]);
 		return true;
 	} else {
 		return false;
@@ -389,6 +420,7 @@ bool game::process_commands(const config& cfg)
 	//std::cerr << "processing commands: '" << cfg.write() << "'\n";
 	bool res = false;
 	const config::child_list& cmd = cfg.get_children("command");
+	ncommands_ += cmd.size();
 	for(config::child_list::const_iterator i = cmd.begin(); i != cmd.end(); ++i) {
 		if((**i).child("end_turn") != NULL) {
 			res = res || end_turn();
@@ -417,7 +449,7 @@ bool game::end_turn()
 		return false;
 	}
 
-	desc->values["turn"] = describe_turns(int(turn),level()["turns"]);
+	journal_->set_value(*desc,"turn",describe_turns(int(turn),level()["turns"]));
 
 	return true;
 }
@@ -535,12 +567,15 @@ int game::id() const
 
 void game::send_data(const config& data, network::connection exclude)
 {
+	std::vector<network::connection> recipients;
 	for(std::vector<network::connection>::const_iterator
 	    i = players_.begin(); i != players_.end(); ++i) {
 		if(*i != exclude && (allow_observers_ || is_needed(*i) || sides_.count(*i) == 1)) {
-			network::queue_data(data,*i);
+			recipients.push_back(*i);
 		}
 	}
+
+	network::queue_data(data,recipients);
 }
 
 bool game::player_on_team(const std::string& team, network::connection player) const
@@ -560,30 +595,75 @@ bool game::player_on_team(const std::string& team, network::connection player) c
 
 void game::send_data_team(const config& data, const std::string& team, network::connection exclude)
 {
+	std::vector<network::connection> recipients;
 	for(std::vector<network::connection>::const_iterator i = players_.begin(); i != players_.end(); ++i) {
 		if(*i != exclude && player_on_team(team,*i)) {
-			network::queue_data(data,*i);
+			recipients.push_back(*i);
 		}
 	}
+
+	network::queue_data(data,recipients);
 }
 
 void game::send_data_observers(const config& data)
 {
+	std::vector<network::connection> recipients;
 	for(std::vector<network::connection>::const_iterator i = players_.begin(); i != players_.end(); ++i) {
 		if(is_observer(*i)) {
-			network::queue_data(data,*i);
+			recipients.push_back(*i);
 		}
 	}
+
+	network::queue_data(data,recipients);
 }
 
 void game::record_data(const config& data)
 {
 	history_.append(data);
+	history_size_ += data_size(data);
+
+	//clients which don't know about snapshots just ignore the request
+	if(!snapshot_requested_ && history_size_ > maximum(min_history_size,snapshot_size_)) {
+		std::vector<network::connection> recipients;
+		for(std::multimap<network::connection,size_t>::const_iterator i = sides_.begin(); i != sides_.end(); ++i) {
+			if(std::find(recipients.begin(),recipients.end(),i->first) == recipients.end()) {
+				recipients.push_back(i->first);
+			}
+		}
+
+		config request;
+		request.add_child("request_snapshot");
+		network::queue_data(request,recipients);
+		snapshot_requested_ = true;
+	}
 }
 
 void game::reset_history()
 {
 	history_.clear();
+	history_size_ = 0;
+	snapshot_.clear();
+	snapshot_size_ = 0;
+	snapshot_requested_ = false;
+}
+
+void game::record_snapshot(const config& snapshot)
+{
+	snapshot_ = snapshot;
+
+	//as with the scenario data when the game starts, all sides are shown as
+	//taken to the players joining the game
+	config::child_itors sides = snapshot_.child_range("side");
+	for(; sides.first != sides.second; ++sides.first) {
+		if((**sides.first)["controller"] != "null") {
+			(**sides.first)["controller"] = "human";
+		}
+	}
+
+	snapshot_size_ = data_size(snapshot_);
+	history_.clear();
+	history_size_ = 0;
+	snapshot_requested_ = false;
 }
 
 bool game::level_init() const
@@ -596,6 +676,11 @@ config& game::level()
 	return level_;
 }
 
+const config& game::current_level() const
+{
+	return snapshot_.empty() ? level_ : snapshot_;
+}
+
 bool game::empty() const
 {
 	return players_.empty();
@@ -611,9 +696,10 @@ void game::disconnect()
 	players_.clear();
 }
 
-void game::set_description(config* desc)
+void game::set_description(config* desc, config_journal& journal)
 {
 	description_ = desc;
+	journal_ = &journal;
 }
 
 config* game::description()
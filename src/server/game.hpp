@@ -73,15 +73,27 @@ public:
 	void record_data(const config& data);
 	void reset_history();
 
+	//replaces the history of the game with a snapshot of the game, sent by
+	//one of its players at the start of their turn. The data recorded from
+	//then on is sent after the snapshot to players joining the game.
+	void record_snapshot(const config& snapshot);
+
+	//the size in bytes of the history sent to players joining the game
+	size_t history_size() const { return snapshot_size_ + history_size_; }
+
 	//the full scenario data
 	bool level_init() const;
 	config& level();
+
+	//the scenario data sent to players joining the game: the latest snapshot
+	//of the game if there is one, and the full scenario data otherwise
+	const config& current_level() const;
 	bool empty() const;
 	void disconnect();
 
 	//functions to set/get the address of the game's summary description as
-	//sent to players in the lobby
-	void set_description(config* desc);
+	//sent to players in the lobby. The description is changed through 'journal'.
+	void set_description(config* desc, config_journal& journal);
 	config* description();
 
 	void add_players(const game& other_game);
@@ -92,8 +104,14 @@ public:
 
 	bool started() const;
 
+	//the number of commands sent by the players since the game was created
+	size_t ncommands() const { return ncommands_; }
+
 	size_t nplayers() const { return players_.size(); }
 
+	//the players and observers of the game
+	const std::vector<network::connection>& members() const { return players_; }
+
 	const std::string& termination_reason() const {
 		static const std::string aborted = "aborted";
 		return termination_.empty() ? aborted : termination_;
@@ -131,8 +149,16 @@ private:
 	config level_;
 
 	config history_;
+	size_t history_size_;
+
+	config snapshot_;
+	size_t snapshot_size_;
+	bool snapshot_requested_;
+
+	size_t ncommands_;
 
 	config* description_;
+	config_journal* journal_;
 
 	int end_turn_;
 
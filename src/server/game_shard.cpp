@@ -0,0 +1,125 @@
+/* $Id$ */
+/*
+   Copyright (C) 2003-5 by David White <davidnwhite@verizon.net>
+   Part of the Battle for Wesnoth Project http://www.wesnoth.org/
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License.
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY.
+
+   See the COPYING file for more details.
+*/
+
+#include "../global.hpp"
+
+#include "game_shard.hpp"
+
+#include <iostream>
+
+game_shard::game_shard(handler& h) : handler_(h), handling_(false), paused_(false), stopping_(false),
+                                     thread_(run,this)
+{}
+
+game_shard::~game_shard()
+{
+	{
+		const threading::lock lock(mutex_);
+		stopping_ = true;
+		cond_.notify_all();
+	}
+
+	thread_.join();
+}
+
+void game_shard::queue_data(int game_id, network::connection sock, const config& data)
+{
+	const threading::lock lock(mutex_);
+	jobs_.push_back(job(game_id,sock));
+	jobs_.back().data = data;
+	cond_.notify_all();
+}
+
+void game_shard::wait_until_done()
+{
+	const threading::lock lock(mutex_);
+	while(jobs_.empty() == false) {
+		cond_.wait(mutex_);
+	}
+}
+
+bool game_shard::busy()
+{
+	const threading::lock lock(mutex_);
+	return jobs_.empty() == false;
+}
+
+void game_shard::pause()
+{
+	const threading::lock lock(mutex_);
+	paused_ = true;
+	while(handling_) {
+		cond_.wait(mutex_);
+	}
+}
+
+void game_shard::resume()
+{
+	const threading::lock lock(mutex_);
+	paused_ = false;
+	cond_.notify_all();
+}
+
+game_shard::pause_all::pause_all(const std::vector<game_shard*>& shards) : shards_(shards)
+{
+	for(std::vector<game_shard*>::const_iterator s = shards_.begin(); s != shards_.end(); ++s) {
+		(*s)->pause();
+	}
+}
+
+game_shard::pause_all::~pause_all()
+{
+	for(std::vector<game_shard*>::const_iterator s = shards_.begin(); s != shards_.end(); ++s) {
+		(*s)->resume();
+	}
+}
+
+int game_shard::run(void* shard)
+{
+	static_cast<game_shard*>(shard)->handle_queue();
+	return 0;
+}
+
+void game_shard::handle_queue()
+{
+	for(;;) {
+		job* j;
+		{
+			const threading::lock lock(mutex_);
+			while(!stopping_ && (paused_ || jobs_.empty())) {
+				cond_.wait(mutex_);
+			}
+
+			if(stopping_) {
+				return;
+			}
+
+			//jobs are only added at the back, which leaves the front where it is
+			j = &jobs_.front();
+			handling_ = true;
+		}
+
+		try {
+			handler_.handle_game_data(j->game_id,j->sock,j->data);
+		} catch(network::error& e) {
+			std::cerr << "network error while handling the data of game " << j->game_id << ": " << e.message << "\n";
+		} catch(config::error& e) {
+			std::cerr << "error in the data of game " << j->game_id << ": " << e.message << "\n";
+		}
+
+		const threading::lock lock(mutex_);
+		jobs_.pop_front();
+		handling_ = false;
+		cond_.notify_all();
+	}
+}
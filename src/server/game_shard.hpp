@@ -0,0 +1,104 @@
+/* $Id$ */
+/*
+   Copyright (C) 2003-5 by David White <davidnwhite@verizon.net>
+   Part of the Battle for Wesnoth Project http://www.wesnoth.org/
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License.
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY.
+
+   See the COPYING file for more details.
+*/
+
+#ifndef GAME_SHARD_HPP_INCLUDED
+#define GAME_SHARD_HPP_INCLUDED
+
+#include "../config.hpp"
+#include "../network.hpp"
+#include "../thread.hpp"
+
+#include <deque>
+#include <vector>
+
+//a thread which handles the data sent by the players of some of the games,
+//so that a game with a lot of traffic doesn't hold up the lobby and the
+//other games.
+//
+//the data is handled on the shard's thread by its handler. The thread which
+//queues the data pauses the shards before it changes anything they use.
+class game_shard
+{
+public:
+	class handler
+	{
+	public:
+		virtual ~handler() {}
+
+		//handles 'data', sent by 'sock' to the game 'game_id'
+		virtual void handle_game_data(int game_id, network::connection sock, config& data) = 0;
+	};
+
+	explicit game_shard(handler& h);
+	~game_shard();
+
+	//queues data to be handled on the shard's thread
+	void queue_data(int game_id, network::connection sock, const config& data);
+
+	//waits until all the queued data has been handled. The shard must not
+	//be paused.
+	void wait_until_done();
+
+	//returns true if there is queued data which hasn't been handled yet
+	bool busy();
+
+	//stops the shard from handling data once it has handled the data it is
+	//handling now, until resume() is called
+	void pause();
+	void resume();
+
+	//pauses the shards for as long as it exists
+	class pause_all
+	{
+	public:
+		explicit pause_all(const std::vector<game_shard*>& shards);
+		~pause_all();
+
+	private:
+		pause_all(const pause_all&);
+		void operator=(const pause_all&);
+
+		const std::vector<game_shard*>& shards_;
+	};
+
+private:
+	game_shard(const game_shard&);
+	void operator=(const game_shard&);
+
+	static int run(void* shard);
+	void handle_queue();
+
+	struct job
+	{
+		job(int game_id, network::connection sock) : game_id(game_id), sock(sock) {}
+		int game_id;
+		network::connection sock;
+		config data;
+	};
+
+	handler& handler_;
+
+	//all the members below are guarded by 'mutex_'. 'cond_' is signalled
+	//whenever any of them changes.
+	threading::mutex mutex_;
+	threading::condition cond_;
+
+	//the data to be handled. The job at the front stays in the queue while
+	//it is handled.
+	std::deque<job> jobs_;
+	bool handling_, paused_, stopping_;
+
+	threading::thread thread_;
+};
+
+#endif
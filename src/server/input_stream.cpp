@@ -38,7 +38,9 @@ input_stream::input_stream(const std::string& path) : fd_(-1), path_(path)
 		std::cerr << "could not make fifo at '" << path << "'\n";
 	}
 
-	fd_ = open(path.c_str(),O_RDONLY|O_NONBLOCK);
+	//the fifo is also opened for writing, so that it doesn't keep signalling
+	//end of file once a writer has closed it
+	fd_ = open(path.c_str(),O_RDWR|O_NONBLOCK);
 
 	if(fd_ == -1) {
 		std::cerr << "failed to open fifo at '" << path << "'\n";
@@ -68,8 +70,10 @@ bool input_stream::read_line(std::string& str)
 	const size_t block_size = 4096;
 	char block[block_size];
 
-	const size_t nbytes = read(fd_,block,block_size);
-	std::copy(block,block+nbytes,std::back_inserter(data_));
+	const int nbytes = read(fd_,block,block_size);
+	if(nbytes > 0) {
+		std::copy(block,block+nbytes,std::back_inserter(data_));
+	}
 
 	const std::deque<char>::iterator itor = std::find(data_.begin(),data_.end(),'\n');
 	if(itor != data_.end()) {
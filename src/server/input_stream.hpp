@@ -25,6 +25,9 @@ public:
 
 	bool read_line(std::string& str);
 
+	//the file descriptor which input is read from, or -1 if there is none
+	int fd() const { return fd_; }
+
 private:
 	input_stream(const input_stream&);
 	void operator=(const input_stream&);
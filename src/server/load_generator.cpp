@@ -0,0 +1,260 @@
+/* $Id$ */
+/*
+   Copyright (C) 2003-5 by David White <davidnwhite@verizon.net>
+   Part of the Battle for Wesnoth Project http://www.wesnoth.org/
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License.
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY.
+
+   See the COPYING file for more details.
+*/
+
+//a tool which connects many clients to a server and has them chat in the
+//lobby, to measure how long the server takes to deliver the messages
+
+#include "../global.hpp"
+
+#include "../config.hpp"
+#include "../game_config.hpp"
+#include "../log.hpp"
+#include "../network.hpp"
+#include "../util.hpp"
+#include "../serialization/binary_wml.hpp"
+#include "../serialization/deflate.hpp"
+
+#include "SDL.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct client
+{
+	explicit client(const std::string& name) : name(name), in_lobby(false)
+	{}
+
+	std::string name;
+	bool in_lobby;
+};
+
+typedef std::map<network::connection,client> client_map;
+
+const std::string message_prefix = "load test ";
+
+//handles data received by a client. Returns false if the client was refused.
+bool process_data(client& c, network::connection sock, const config& data, std::vector<int>& latencies)
+{
+	if(const config* const version = data.child("version")) {
+		config response;
+		config& reply = response.add_child("version");
+		reply["version"] = game_config::version;
+		const bool dictionary = (*version)["dictionary"] == shared_dictionary_version;
+		if(dictionary) {
+			reply["dictionary"] = shared_dictionary_version;
+		}
+
+		const bool deflate = (*version)["compression"] == "deflate" && deflate_available();
+		if(deflate) {
+			reply["compression"] = "deflate";
+		}
+
+		network::send_data(response,sock);
+		if(dictionary) {
+			network::use_shared_dictionary(sock);
+		}
+
+		if(deflate) {
+			network::use_deflate(sock);
+		}
+	} else if(data.child("mustlogin") != NULL) {
+		config response;
+		response.add_child("login")["username"] = c.name;
+		network::send_data(response,sock);
+	} else if(data.child("join_lobby") != NULL) {
+		c.in_lobby = true;
+	} else if(const config* const error = data.child("error")) {
+		std::cerr << "client '" << c.name << "' refused: " << (*error)["message"] << "\n";
+		return false;
+	} else if(const config* const message = data.child("message")) {
+		//messages sent by the load test carry the time they were sent at
+		const std::string& text = (*message)["message"];
+		if(text.compare(0,message_prefix.size(),message_prefix) == 0) {
+			const int sent_at = atoi(text.c_str() + message_prefix.size());
+			latencies.push_back(int(SDL_GetTicks()) - sent_at);
+		}
+	}
+
+	return true;
+}
+
+//receives all the data waiting for the clients. Returns false if a client
+//was refused.
+bool receive_data(client_map& clients, std::vector<int>& latencies)
+{
+	config data;
+	network::connection sock;
+	while((sock = network::receive_data(data)) != network::null_connection) {
+		const client_map::iterator c = clients.find(sock);
+		if(c != clients.end() && !process_data(c->second,sock,data,latencies)) {
+			return false;
+		}
+
+		data.clear();
+	}
+
+	return true;
+}
+
+int percentile(const std::vector<int>& sorted, int n)
+{
+	if(sorted.empty()) {
+		return 0;
+	}
+
+	return sorted[minimum<size_t>(sorted.size()-1,sorted.size()*n/100)];
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	std::string host = "localhost";
+	int port = 15000;
+	size_t nclients = 200;
+	int rate = 20;
+	int duration = 30;
+	size_t nthreads = 5;
+
+	for(int arg = 1; arg != argc; ++arg) {
+		const std::string val(argv[arg]);
+		if(val.empty()) {
+			continue;
+		}
+
+		if((val == "--host" || val == "-s") && arg+1 != argc) {
+			host = argv[++arg];
+		} else if((val == "--port" || val == "-p") && arg+1 != argc) {
+			port = atoi(argv[++arg]);
+		} else if((val == "--clients" || val == "-c") && arg+1 != argc) {
+			nclients = maximum<int>(2,atoi(argv[++arg]));
+		} else if((val == "--rate" || val == "-r") && arg+1 != argc) {
+			rate = maximum<int>(1,atoi(argv[++arg]));
+		} else if((val == "--duration" || val == "-d") && arg+1 != argc) {
+			duration = maximum<int>(1,atoi(argv[++arg]));
+		} else if((val == "--threads" || val == "-t") && arg+1 != argc) {
+			nthreads = minimum<int>(30,maximum<int>(1,atoi(argv[++arg])));
+		} else if(val == "--verbose" || val == "-v") {
+			lg::set_log_domain_severity("all",2);
+		} else if(val == "--help" || val == "-h") {
+			std::cout << "usage: " << argv[0]
+				<< " [options]\n"
+				<< "  -s, --host host            Connects to the server on the given host (default: localhost)\n"
+				<< "  -p, --port port            Connects to the server on the given port (default: 15000)\n"
+				<< "  -c, --clients n            Connects n clients to the lobby (default: 200)\n"
+				<< "  -r, --rate n               Sends n lobby messages per second (default: 20)\n"
+				<< "  -d, --duration n           Sends messages for n seconds (default: 30)\n"
+				<< "  -t, --threads n            Uses n worker threads for network I/O (default: 5)\n";
+			return 0;
+		} else {
+			std::cerr << "unknown option: " << val << "\n";
+			return 0;
+		}
+	}
+
+	try {
+		const network::manager net_manager(nthreads);
+
+		client_map clients;
+		std::vector<network::connection> socks;
+		std::vector<int> latencies;
+
+		std::cout << "connecting " << nclients << " clients to " << host << ":" << port << "...\n";
+		for(size_t n = 0; n != nclients; ++n) {
+			const network::connection sock = network::connect(host,port);
+			clients.insert(std::pair<network::connection,client>(sock,client("load" + lexical_cast<std::string>(n))));
+			socks.push_back(sock);
+
+			if(!receive_data(clients,latencies)) {
+				return -1;
+			}
+		}
+
+		//wait for all the clients to be logged in
+		const int login_started = SDL_GetTicks();
+		size_t nlogged_in = 0;
+		while(nlogged_in != nclients) {
+			network::wait_for_activity(100);
+			if(!receive_data(clients,latencies)) {
+				return -1;
+			}
+
+			nlogged_in = 0;
+			for(client_map::const_iterator c = clients.begin(); c != clients.end(); ++c) {
+				if(c->second.in_lobby) {
+					++nlogged_in;
+				}
+			}
+		}
+
+		std::cout << "logged in " << nclients << " clients in " << (int(SDL_GetTicks()) - login_started) << " ms\n";
+
+		//send messages at the given rate, from each client in turn. Each
+		//message is delivered to all the other clients.
+		latencies.clear();
+		const int interval = maximum<int>(1,1000/rate);
+		const int started = SDL_GetTicks();
+		int next_message = started;
+		size_t nmessages = 0;
+		for(;;) {
+			const int ticks = SDL_GetTicks();
+			if(ticks - started >= duration*1000) {
+				break;
+			}
+
+			if(ticks >= next_message) {
+				config msg;
+				config& message = msg.add_child("message");
+				message["sender"] = clients.find(socks[nmessages%nclients])->second.name;
+				message["message"] = message_prefix + lexical_cast<std::string>(ticks);
+				network::send_data(msg,socks[nmessages%nclients]);
+				++nmessages;
+				next_message += interval;
+			}
+
+			if(!receive_data(clients,latencies)) {
+				return -1;
+			}
+
+			network::wait_for_activity(maximum<int>(0,next_message - int(SDL_GetTicks())));
+		}
+
+		//wait a while for the messages still in flight
+		const size_t expected = nmessages*(nclients-1);
+		const int drain_started = SDL_GetTicks();
+		while(latencies.size() < expected && int(SDL_GetTicks()) - drain_started < 5000) {
+			network::wait_for_activity(100);
+			if(!receive_data(clients,latencies)) {
+				return -1;
+			}
+		}
+
+		std::sort(latencies.begin(),latencies.end());
+		std::cout << "sent " << nmessages << " messages, " << latencies.size() << " of "
+		          << expected << " deliveries received\n"
+		          << "delivery latency: 50% " << percentile(latencies,50) << " ms, 90% "
+		          << percentile(latencies,90) << " ms, 99% " << percentile(latencies,99)
+		          << " ms, max " << (latencies.empty() ? 0 : latencies.back()) << " ms\n";
+	} catch(network::error& e) {
+		std::cerr << "network error: " << e.message << "\n";
+		return -1;
+	}
+
+	return 0;
+}
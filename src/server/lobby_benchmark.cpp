@@ -0,0 +1,189 @@
+/* $Id$ */
+/*
+   Copyright (C) 2003-5 by David White <davidnwhite@verizon.net>
+   Part of the Battle for Wesnoth Project http://www.wesnoth.org/
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License.
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY.
+
+   See the COPYING file for more details.
+*/
+
+//a tool which simulates the changes made to the lobby of a busy server, and
+//compares the cost of making the diffs sent to the lobby from the journal of
+//the changes with the cost of comparing the whole lobby with a copy of it.
+//It also measures the cost of making the responses the diffs are sent in.
+
+#include "../global.hpp"
+
+#include "../config.hpp"
+#include "../util.hpp"
+
+#include "SDL.h"
+
+#include "config_journal.hpp"
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+//a lobby of users and games, as wesnothd keeps it
+class lobby
+{
+public:
+	lobby() : journal_(cfg_), gamelist_(journal_.add_child(cfg_,"gamelist")), next_id_(0)
+	{}
+
+	void add_user()
+	{
+		config& user = journal_.add_child(cfg_,"user");
+		journal_.set_value(user,"name","user" + lexical_cast<std::string>(next_id_++));
+		journal_.set_value(user,"available","yes");
+		users_.push_back(&user);
+	}
+
+	void add_game()
+	{
+		//a game's description is a summary of its scenario, including its map
+		config level;
+		level["id"] = lexical_cast<std::string>(next_id_++);
+		level["name"] = "game " + level["id"];
+		level["map_data"] = std::string(2000,'G');
+		level["mp_village_gold"] = "2";
+		level["experience_modifier"] = "100";
+
+		config& game = journal_.add_child(gamelist_,"game",level);
+		journal_.set_value(game,"slots","2");
+		games_.push_back(&game);
+	}
+
+	void random_change()
+	{
+		switch(rand()%6) {
+		case 0:
+			add_user();
+			break;
+		case 1:
+			if(!users_.empty()) {
+				const size_t n = rand()%users_.size();
+				journal_.remove_child(cfg_,"user",*users_[n]);
+				users_.erase(users_.begin() + n);
+			}
+			break;
+		case 2:
+			if(!users_.empty()) {
+				config& user = *users_[rand()%users_.size()];
+				journal_.set_value(user,"available",user["available"] == "yes" ? "no" : "yes");
+			}
+			break;
+		case 3:
+			add_game();
+			break;
+		case 4:
+			if(!games_.empty()) {
+				const size_t n = rand()%games_.size();
+				journal_.remove_child(gamelist_,"game",*games_[n]);
+				games_.erase(games_.begin() + n);
+			}
+			break;
+		default:
+			if(!games_.empty()) {
+				config& game = *games_[rand()%games_.size()];
+				journal_.set_value(game,rand()%2 ? "slots" : "turn",lexical_cast<std::string>(rand()%10));
+			}
+			break;
+		}
+	}
+
+	const config& cfg() const { return cfg_; }
+	config_journal& journal() { return journal_; }
+
+private:
+	config cfg_;
+	config_journal journal_;
+	config& gamelist_;
+	std::vector<config*> users_, games_;
+	int next_id_;
+};
+
+}
+
+int main(int argc, char** argv)
+{
+	size_t nusers = 2000;
+	size_t ngames = 500;
+	size_t nchanges = 2000;
+
+	for(int arg = 1; arg != argc; ++arg) {
+		const std::string val(argv[arg]);
+		if((val == "--users" || val == "-u") && arg+1 != argc) {
+			nusers = atoi(argv[++arg]);
+		} else if((val == "--games" || val == "-g") && arg+1 != argc) {
+			ngames = atoi(argv[++arg]);
+		} else if((val == "--changes" || val == "-c") && arg+1 != argc) {
+			nchanges = atoi(argv[++arg]);
+		} else {
+			std::cout << "usage: " << argv[0]
+				<< " [options]\n"
+				<< "  -u, --users n              Starts with n users in the lobby (default: 2000)\n"
+				<< "  -g, --games n              Starts with n games in the lobby (default: 500)\n"
+				<< "  -c, --changes n            Makes n changes, each sent as a diff (default: 2000)\n";
+			return 0;
+		}
+	}
+
+	lobby l;
+	for(size_t n = 0; n != nusers; ++n) {
+		l.add_user();
+	}
+
+	for(size_t n = 0; n != ngames; ++n) {
+		l.add_game();
+	}
+
+	l.journal().clear();
+
+	//'client' is the lobby as a client sees it, kept up to date with the
+	//diffs from the journal. 'old' is the copy the lobby used to be compared with.
+	config client = l.cfg();
+	config old = l.cfg();
+	int journal_ticks = 0, copy_ticks = 0, response_ticks = 0;
+
+	for(size_t n = 0; n != nchanges; ++n) {
+		l.random_change();
+
+		int ticks = SDL_GetTicks();
+		const config diff = l.journal().get_diff();
+		journal_ticks += SDL_GetTicks() - ticks;
+
+		//as server::sync_initial_response makes them
+		ticks = SDL_GetTicks();
+		config response;
+		response.add_child("gamelist_diff",diff);
+		response_ticks += SDL_GetTicks() - ticks;
+
+		ticks = SDL_GetTicks();
+		const config old_diff = l.cfg().get_diff(old);
+		old = l.cfg();
+		copy_ticks += SDL_GetTicks() - ticks;
+
+		client.apply_diff(diff);
+	}
+
+	if(client != l.cfg()) {
+		std::cerr << "the lobby as seen by clients differs from the server's\n";
+		return -1;
+	}
+
+	std::cout << nchanges << " changes to a lobby of " << nusers << " users and " << ngames << " games:\n"
+	          << "  diffs from the journal:          " << journal_ticks << " ms\n"
+	          << "  diffs from a copy of the lobby:  " << copy_ticks << " ms\n"
+	          << "  responses with the diffs:        " << response_ticks << " ms\n";
+
+	return 0;
+}
@@ -16,12 +16,68 @@
 #include "metrics.hpp"
 
 #include <time.h>
+#include <algorithm>
 #include <iostream>
 
+#ifdef _WIN32
+#include "SDL.h"
+#else
+#include <sys/time.h>
+#endif
+
+namespace {
+
+//the upper bounds of the buckets of the request times, in microseconds
+const unsigned long bucket_bounds[] = { 50, 100, 250, 500, 1000, 2500, 5000, 10000,
+                                        25000, 50000, 100000, 250000, 500000, 1000000 };
+
+const char* const request_names[] = { "proxy", "login", "query", "lobby", "game" };
+const char* const connection_names[] = { "proxy", "login", "lobby", "player", "observer" };
+
+unsigned long current_usecs()
+{
+#ifdef _WIN32
+	return SDL_GetTicks()*1000;
+#else
+	struct timeval tv;
+	gettimeofday(&tv,NULL);
+	//only differences between times are used, so wrapping around is fine
+	return static_cast<unsigned long>(tv.tv_sec)*1000000 + tv.tv_usec;
+#endif
+}
+
+//escapes a label value as the text format requires
+std::string label_value(const std::string& value)
+{
+	std::string res;
+	for(std::string::const_iterator c = value.begin(); c != value.end(); ++c) {
+		if(*c == '\\' || *c == '"') {
+			res += '\\';
+			res += *c;
+		} else if(*c == '\n') {
+			res += "\\n";
+		} else {
+			res += *c;
+		}
+	}
+
+	return res;
+}
+
+}
+
+metrics::histogram::histogram() : count(0), sum(0.0)
+{
+	std::fill(buckets,buckets+NBUCKETS,0);
+}
+
 metrics::metrics() : most_consecutive_requests_(0),
                      current_requests_(0), nrequests_(0),
                      nrequests_waited_(0), started_at_(time(NULL))
-{}
+{
+	std::fill(bytes_sent_,bytes_sent_+NCONNECTION_TYPES,0.0);
+	std::fill(bytes_received_,bytes_received_+NCONNECTION_TYPES,0.0);
+}
 
 void metrics::service_request()
 {
@@ -46,6 +102,86 @@ void metrics::game_terminated(const std::string& reason)
 	terminations_[reason]++;
 }
 
+void metrics::request_handled(REQUEST_TYPE type, unsigned long usecs)
+{
+	const threading::lock lock(times_mutex_);
+	histogram& h = request_times_[type];
+	for(int n = 0; n != histogram::NBUCKETS; ++n) {
+		if(usecs <= bucket_bounds[n]) {
+			++h.buckets[n];
+		}
+	}
+
+	++h.count;
+	h.sum += usecs/1000000.0;
+}
+
+void metrics::traffic(CONNECTION_TYPE type, size_t sent, size_t received)
+{
+	bytes_sent_[type] += sent;
+	bytes_received_[type] += received;
+}
+
+metrics::request_timer::request_timer(metrics& met, REQUEST_TYPE type)
+	: metrics_(met), type_(type), started_at_(current_usecs())
+{}
+
+metrics::request_timer::~request_timer()
+{
+	metrics_.request_handled(type_,current_usecs() - started_at_);
+}
+
+void metrics::write_samples(std::ostream& out, const std::string& prefix) const
+{
+	//byte counts are kept as doubles so that they don't wrap around, but must
+	//still be written in full
+	const std::streamsize precision = out.precision(15);
+
+	out << "# HELP " << prefix << "requests_total Requests handled.\n"
+	    << "# TYPE " << prefix << "requests_total counter\n"
+	    << prefix << "requests_total " << nrequests_ << "\n";
+
+	histogram times[NREQUEST_TYPES];
+	{
+		const threading::lock lock(times_mutex_);
+		std::copy(request_times_,request_times_ + NREQUEST_TYPES,times);
+	}
+
+	out << "# HELP " << prefix << "request_duration_seconds Time taken to handle requests, by kind of request.\n"
+	    << "# TYPE " << prefix << "request_duration_seconds histogram\n";
+	for(int type = 0; type != NREQUEST_TYPES; ++type) {
+		const histogram& h = times[type];
+		for(int n = 0; n != histogram::NBUCKETS; ++n) {
+			out << prefix << "request_duration_seconds_bucket{type=\"" << request_names[type]
+			    << "\",le=\"" << bucket_bounds[n]/1000000.0 << "\"} " << h.buckets[n] << "\n";
+		}
+
+		out << prefix << "request_duration_seconds_bucket{type=\"" << request_names[type] << "\",le=\"+Inf\"} " << h.count << "\n"
+		    << prefix << "request_duration_seconds_sum{type=\"" << request_names[type] << "\"} " << h.sum << "\n"
+		    << prefix << "request_duration_seconds_count{type=\"" << request_names[type] << "\"} " << h.count << "\n";
+	}
+
+	out << "# HELP " << prefix << "sent_bytes_total Bytes sent, by kind of connection.\n"
+	    << "# TYPE " << prefix << "sent_bytes_total counter\n";
+	for(int type = 0; type != NCONNECTION_TYPES; ++type) {
+		out << prefix << "sent_bytes_total{connection=\"" << connection_names[type] << "\"} " << bytes_sent_[type] << "\n";
+	}
+
+	out << "# HELP " << prefix << "received_bytes_total Bytes received, by kind of connection.\n"
+	    << "# TYPE " << prefix << "received_bytes_total counter\n";
+	for(int type = 0; type != NCONNECTION_TYPES; ++type) {
+		out << prefix << "received_bytes_total{connection=\"" << connection_names[type] << "\"} " << bytes_received_[type] << "\n";
+	}
+
+	out << "# HELP " << prefix << "games_terminated_total Games which have ended, by the way they ended.\n"
+	    << "# TYPE " << prefix << "games_terminated_total counter\n";
+	for(std::map<std::string,int>::const_iterator i = terminations_.begin(); i != terminations_.end(); ++i) {
+		out << prefix << "games_terminated_total{reason=\"" << label_value(i->first) << "\"} " << i->second << "\n";
+	}
+
+	out.precision(precision);
+}
+
 std::ostream& operator<<(std::ostream& out, metrics& met)
 {
 	const time_t time_up = time(NULL) - met.started_at_;
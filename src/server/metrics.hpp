@@ -14,6 +14,8 @@
 #ifndef METRICS_HPP_INCLUDED
 #define METRICS_HPP_INCLUDED
 
+#include "../thread.hpp"
+
 #include <iosfwd>
 
 #include <map>
@@ -29,6 +31,37 @@ public:
 
 	void game_terminated(const std::string& reason);
 
+	//the kinds of requests, whose handling is timed separately
+	enum REQUEST_TYPE { PROXY_REQUEST, LOGIN_REQUEST, QUERY_REQUEST, LOBBY_REQUEST, GAME_REQUEST, NREQUEST_TYPES };
+
+	//the kinds of connections, whose traffic is counted separately
+	enum CONNECTION_TYPE { PROXY_CONNECTION, LOGIN_CONNECTION, LOBBY_CONNECTION, PLAYER_CONNECTION, OBSERVER_CONNECTION, NCONNECTION_TYPES };
+
+	//records the time a request took to handle, in microseconds
+	void request_handled(REQUEST_TYPE type, unsigned long usecs);
+
+	void traffic(CONNECTION_TYPE type, size_t sent, size_t received);
+
+	//times the handling of a request, for as long as it exists
+	class request_timer
+	{
+	public:
+		request_timer(metrics& met, REQUEST_TYPE type);
+		~request_timer();
+
+	private:
+		request_timer(const request_timer&);
+		void operator=(const request_timer&);
+
+		metrics& metrics_;
+		REQUEST_TYPE type_;
+		unsigned long started_at_;
+	};
+
+	//writes the metrics in the text format read by Prometheus, with the
+	//name of each metric starting with 'prefix'
+	void write_samples(std::ostream& out, const std::string& prefix) const;
+
 	friend std::ostream& operator<<(std::ostream& out, metrics& met);
 
 private:
@@ -38,6 +71,26 @@ private:
 	int nrequests_waited_;
 	const time_t started_at_;
 	std::map<std::string,int> terminations_;
+
+	//the number of requests of a kind which took up to each bucket's time
+	//to handle, along with the total number of requests and time
+	struct histogram
+	{
+		histogram();
+
+		enum { NBUCKETS = 14 };
+		unsigned long buckets[NBUCKETS];
+		unsigned long count;
+		double sum;
+	};
+
+	//requests for games may be handled on the threads of the games, so the
+	//request times are guarded by 'times_mutex_'
+	histogram request_times_[NREQUEST_TYPES];
+	mutable threading::mutex times_mutex_;
+
+	double bytes_sent_[NCONNECTION_TYPES];
+	double bytes_received_[NCONNECTION_TYPES];
 };
 
 std::ostream& operator<<(std::ostream& out, metrics& met);
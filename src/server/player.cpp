@@ -15,15 +15,16 @@
 
 #include "player.hpp"
 
-player::player(const std::string& n, config& cfg) : name_(n), cfg_(cfg)
+player::player(const std::string& n, config& cfg, config_journal& journal)
+	: name_(n), cfg_(cfg), journal_(&journal)
 {
-	cfg_["name"] = n;
+	journal_->set_value(cfg_,"name",n);
 	mark_available(true);
 }
 
 void player::mark_available(bool val)
 {
-	cfg_.values["available"] = (val ? "yes" : "no");
+	journal_->set_value(cfg_,"available",val ? "yes" : "no");
 }
 
 const std::string& player::name() const
@@ -16,12 +16,16 @@
 
 #include "../config.hpp"
 
+#include "config_journal.hpp"
+
 #include <string>
 
 class player
 {
 public:
-	player(const std::string& n, config& cfg);
+	//'cfg' is the player's description in the lobby, which is changed
+	//through 'journal'
+	player(const std::string& n, config& cfg, config_journal& journal);
 
 	void mark_available(bool val);
 
@@ -32,6 +36,7 @@ public:
 private:
 	std::string name_;
 	config& cfg_;
+	config_journal* journal_;
 };
 
 #endif
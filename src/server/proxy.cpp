@@ -1,6 +1,8 @@
 #include "global.hpp"
 
 #include "proxy.hpp"
+#include "serialization/binary_wml.hpp"
+#include "serialization/deflate.hpp"
 
 #include <map>
 
@@ -68,7 +70,31 @@ void received_data(network::connection sock, const config& data)
 		return;
 	}
 
+	const config* const version = data.child("version");
+	const bool from_client = clients_to_servers.count(sock) != 0;
+
+	//the client can only use zlib with the server behind the proxy if it
+	//can use it with the proxy too
+	if(version != NULL && !from_client && !deflate_available() && (*version)["compression"].empty() == false) {
+		config query = data;
+		query.child("version")->values.erase("compression");
+		network::send_data(query,peer);
+		return;
+	}
+
 	network::send_data(data,peer);
+
+	//a client which agrees to use the shared dictionary or zlib with the
+	//server behind the proxy uses them on the proxied connection from then on
+	if(version != NULL && from_client) {
+		if((*version)["dictionary"] == shared_dictionary_version) {
+			network::use_shared_dictionary(peer);
+		}
+
+		if((*version)["compression"] == "deflate") {
+			network::use_deflate(peer);
+		}
+	}
 }
 
 }
@@ -17,22 +17,30 @@
 #include "../game_config.hpp"
 #include "../log.hpp"
 #include "../network.hpp"
+#include "../network_worker.hpp"
+#include "../thread.hpp"
 #include "../util.hpp"
 #include "../wassert.hpp"
 #include "serialization/string_utils.hpp"
 
 #include "SDL.h"
 
+#include "config_journal.hpp"
 #include "game.hpp"
+#include "game_shard.hpp"
 #include "filesystem.hpp"
 #include "input_stream.hpp"
 #include "metrics.hpp"
+#include "serialization/binary_wml.hpp"
+#include "serialization/deflate.hpp"
 #include "serialization/parser.hpp"
 #include "player.hpp"
 #include "proxy.hpp"
 
 #include <algorithm>
 #include <cstdlib>
+#include <cstdio>
+#include <fstream>
 #include <iostream>
 #include <map>
 #include <sstream>
@@ -73,6 +81,13 @@ config construct_server_message(const std::string& message, const game& g)
 	return turn;
 }
 
+//how often the metrics file is written, in seconds
+const time_t metrics_interval = 15;
+
+//how often the lobby is checked for changes made by the shards while they
+//are busy, in milliseconds
+const int shard_poll_interval = 10;
+
 void truncate_message(t_string& str)
 {
 	const size_t max_message_length = 240;
@@ -83,14 +98,31 @@ void truncate_message(t_string& str)
 
 }
 
-class server
+class server : public game_shard::handler
 {
 public:
-	server(int port, input_stream& input, const config& cfg, size_t nthreads);
+	server(int port, input_stream& input, const config& cfg, size_t nthreads, size_t nshards);
+	~server();
 	void run();
 private:
 	void process_data(network::connection sock, config& data, config& gamelist);
 
+	//queues data from a player in a game to be handled by the game's shard,
+	//if it is data which only concerns the game. Returns false if the data
+	//must be handled by process_data, once the game's shard has handled the
+	//data queued before it.
+	bool queue_game_data(network::connection sock, const config& data);
+
+	//handles data queued by queue_game_data, on the thread of a shard
+	void handle_game_data(int game_id, network::connection sock, config& data);
+
+	//handles the commands sent by a player in a game, and forwards them to
+	//the other players
+	void process_game_data(game& g, network::connection sock, config& data);
+
+	//returns true if the shards have changed the lobby since the last call
+	bool take_lobby_changes();
+
 	void process_login(network::connection sock, const config& data, config& gamelist);
 	void process_query(network::connection sock, const config& query, config& gamelist);
 	void process_data_from_player_in_lobby(network::connection sock, config& data, config& gamelist);
@@ -102,6 +134,20 @@ private:
 
 	void dump_stats();
 
+	//the kind of a connection, by what its user is doing
+	metrics::CONNECTION_TYPE connection_type(network::connection sock) const;
+
+	//adds the bytes sent to and received from a connection since it was last
+	//counted to the traffic of connections of its kind. Connections are only
+	//counted when the metrics are written and when they close, as finding
+	//what each one is costs a pass over the games, so the traffic of a
+	//connection which changed kind in between is counted to its new kind.
+	void count_traffic(network::connection sock, metrics::CONNECTION_TYPE type);
+
+	//writes the metrics of the server in the text format read by Prometheus
+	void write_metrics(std::ostream& out);
+	void write_metrics_file();
+
 	const network::manager net_manager_;
 	const network::server_manager server_;
 
@@ -110,7 +156,10 @@ private:
 	config join_lobby_response_;
 
 	config initial_response_;
-	config old_initial_response_;
+
+	//all changes to the lobby's list of users and games in initial_response_
+	//are made through the journal, which makes the diffs sent to the lobby
+	config_journal lobby_journal_;
 
 	config sync_initial_response();
 
@@ -126,6 +175,24 @@ private:
 
 	metrics metrics_;
 
+	//the bytes sent to and received from each connection when it was last
+	//counted
+	std::map<network::connection,std::pair<size_t,size_t> > counted_traffic_;
+
+	//the file the metrics are written to, for a collector to read
+	const std::string metrics_file_;
+	time_t last_metrics_;
+
+	//the started games are shared out between the shards by their id. While
+	//the shards are running, the thread running the server only reads the
+	//list of games and who is in them; it pauses the shards to change anything.
+	std::vector<game_shard*> shards_;
+
+	//guards the changes the shards make to the lobby, as the turn of a game
+	//is shown there. 'lobby_changed_' is set when they make one.
+	threading::mutex lobby_mutex_;
+	bool lobby_changed_;
+
 	const config& cfg_;
 
 	std::set<std::string> accepted_versions_;
@@ -140,10 +207,21 @@ private:
 	std::set<network::connection> admins_;
 };
 
-server::server(int port, input_stream& input, const config& cfg, size_t nthreads) : net_manager_(nthreads), server_(port),
-    not_logged_in_(players_), lobby_players_(players_), last_stats_(time(NULL)), input_(input), cfg_(cfg), admin_passwd_(cfg["passwd"])
+server::server(int port, input_stream& input, const config& cfg, size_t nthreads, size_t nshards) : net_manager_(nthreads), server_(port),
+    lobby_journal_(initial_response_), not_logged_in_(players_), lobby_players_(players_), last_stats_(time(NULL)), input_(input), metrics_file_(cfg["metrics_file"]), last_metrics_(0), lobby_changed_(false), cfg_(cfg), admin_passwd_(cfg["passwd"])
 {
-	version_query_response_.add_child("version");
+	for(size_t n = 0; n != nshards; ++n) {
+		shards_.push_back(new game_shard(*this));
+	}
+
+	//clients which know the same shared dictionary reply with its version,
+	//and use it from then on. Clients which can use zlib reply with the
+	//same compression.
+	config& version_query = version_query_response_.add_child("version");
+	version_query["dictionary"] = shared_dictionary_version;
+	if(deflate_available()) {
+		version_query["compression"] = "deflate";
+	}
 
 	login_response_.add_child("mustlogin");
 
@@ -176,6 +254,13 @@ server::server(int port, input_stream& input, const config& cfg, size_t nthreads
 	join_lobby_response_.add_child("join_lobby");
 }
 
+server::~server()
+{
+	for(std::vector<game_shard*>::iterator s = shards_.begin(); s != shards_.end(); ++s) {
+		delete *s;
+	}
+}
+
 bool server::is_ip_banned(const std::string& ip)
 {
 	for(std::vector<std::string>::const_iterator i = bans_.begin(); i != bans_.end(); ++i) {
@@ -207,8 +292,7 @@ std::string server::ban_ip(const std::string& mask)
 config server::sync_initial_response()
 {
 	config res;
-	res.add_child("gamelist_diff",initial_response_.get_diff(old_initial_response_));
-	old_initial_response_ = initial_response_;
+	res.add_child("gamelist_diff",lobby_journal_.get_diff());
 	return res;
 }
 
@@ -222,7 +306,129 @@ void server::dump_stats()
 		"\tnum_players = " << players_.size() << "\n"
 		"\tlobby_players = " << lobby_players_.nplayers() << "\n"
 		"\tstart_interval = " << old_stats << "\n"
-		"\tend_interval = " << last_stats_ << std::endl;
+		"\tend_interval = " << last_stats_ << "\n";
+
+	//the bytes sent to players joining each game
+	size_t history_bytes = 0;
+	for(std::vector<game>::const_iterator g = games_.begin(); g != games_.end(); ++g) {
+		std::cout << "\tgame " << g->id() << " history_bytes = " << g->history_size() << "\n";
+		history_bytes += g->history_size();
+	}
+
+	std::cout << "\thistory_bytes = " << history_bytes << std::endl;
+}
+
+metrics::CONNECTION_TYPE server::connection_type(network::connection sock) const
+{
+	if(proxy::is_proxy(sock)) {
+		return metrics::PROXY_CONNECTION;
+	} else if(not_logged_in_.is_member(sock)) {
+		return metrics::LOGIN_CONNECTION;
+	}
+
+	for(std::vector<game>::const_iterator g = games_.begin(); g != games_.end(); ++g) {
+		if(g->is_member(sock)) {
+			return g->is_observer(sock) ? metrics::OBSERVER_CONNECTION : metrics::PLAYER_CONNECTION;
+		}
+	}
+
+	return metrics::LOBBY_CONNECTION;
+}
+
+void server::count_traffic(network::connection sock, metrics::CONNECTION_TYPE type)
+{
+	try {
+		const network::connection_stats& stats = network::get_connection_stats(sock);
+		std::pair<size_t,size_t>& counted = counted_traffic_[sock];
+		metrics_.traffic(type,stats.bytes_sent - counted.first,stats.bytes_received - counted.second);
+		counted.first = stats.bytes_sent;
+		counted.second = stats.bytes_received;
+	} catch(network::error&) {
+		//the connection has already been closed
+	}
+}
+
+void server::write_metrics(std::ostream& out)
+{
+	//bring the traffic up to date, counting each connection as what it is now
+	for(std::vector<network::connection>::const_iterator p = not_logged_in_.members().begin(); p != not_logged_in_.members().end(); ++p) {
+		count_traffic(*p,metrics::LOGIN_CONNECTION);
+	}
+
+	for(std::vector<network::connection>::const_iterator l = lobby_players_.members().begin(); l != lobby_players_.members().end(); ++l) {
+		count_traffic(*l,metrics::LOBBY_CONNECTION);
+	}
+
+	for(std::vector<game>::const_iterator g = games_.begin(); g != games_.end(); ++g) {
+		for(std::vector<network::connection>::const_iterator p = g->members().begin(); p != g->members().end(); ++p) {
+			count_traffic(*p,g->is_observer(*p) ? metrics::OBSERVER_CONNECTION : metrics::PLAYER_CONNECTION);
+		}
+	}
+
+	const std::string prefix = "wesnothd_";
+	metrics_.write_samples(out,prefix);
+
+	out << "# HELP " << prefix << "players Players logged on.\n"
+	    << "# TYPE " << prefix << "players gauge\n"
+	    << prefix << "players " << players_.size() << "\n"
+	    << "# HELP " << prefix << "lobby_players Players in the lobby.\n"
+	    << "# TYPE " << prefix << "lobby_players gauge\n"
+	    << prefix << "lobby_players " << lobby_players_.nplayers() << "\n"
+	    << "# HELP " << prefix << "games Games, started or not.\n"
+	    << "# TYPE " << prefix << "games gauge\n"
+	    << prefix << "games " << games_.size() << "\n";
+
+	const network_worker_pool::pool_stats& pool = network_worker_pool::get_pool_stats();
+	out << "# HELP " << prefix << "sockets Sockets handled by the network threads.\n"
+	    << "# TYPE " << prefix << "sockets gauge\n"
+	    << prefix << "sockets " << pool.sockets << "\n"
+	    << "# HELP " << prefix << "ready_sockets Sockets waiting for a network thread.\n"
+	    << "# TYPE " << prefix << "ready_sockets gauge\n"
+	    << prefix << "ready_sockets " << pool.ready_sockets << "\n"
+	    << "# HELP " << prefix << "pending_sends Messages waiting to be sent.\n"
+	    << "# TYPE " << prefix << "pending_sends gauge\n"
+	    << prefix << "pending_sends " << pool.pending_sends << "\n"
+	    << "# HELP " << prefix << "pending_send_bytes Bytes waiting to be sent.\n"
+	    << "# TYPE " << prefix << "pending_send_bytes gauge\n"
+	    << prefix << "pending_send_bytes " << pool.pending_send_bytes << "\n"
+	    << "# HELP " << prefix << "received_messages Messages received but not yet handled.\n"
+	    << "# TYPE " << prefix << "received_messages gauge\n"
+	    << prefix << "received_messages " << pool.received_messages << "\n"
+	    << "# HELP " << prefix << "errored_sockets Sockets with an error not yet handled.\n"
+	    << "# TYPE " << prefix << "errored_sockets gauge\n"
+	    << prefix << "errored_sockets " << pool.errored_sockets << "\n";
+
+	out << "# HELP " << prefix << "game_history_bytes Bytes sent to players joining each game.\n"
+	    << "# TYPE " << prefix << "game_history_bytes gauge\n";
+	for(std::vector<game>::const_iterator g = games_.begin(); g != games_.end(); ++g) {
+		out << prefix << "game_history_bytes{game=\"" << g->id() << "\"} " << g->history_size() << "\n";
+	}
+
+	out << "# HELP " << prefix << "game_commands_total Commands sent by the players of each game.\n"
+	    << "# TYPE " << prefix << "game_commands_total counter\n";
+	for(std::vector<game>::const_iterator g = games_.begin(); g != games_.end(); ++g) {
+		out << prefix << "game_commands_total{game=\"" << g->id() << "\"} " << g->ncommands() << "\n";
+	}
+}
+
+void server::write_metrics_file()
+{
+	last_metrics_ = time(NULL);
+
+	//the file is replaced at once, so that it is never read half written
+	const std::string tmp_file = metrics_file_ + ".tmp";
+	{
+		std::ofstream out(tmp_file.c_str());
+		write_metrics(out);
+		if(!out) {
+			std::cerr << "could not write the metrics to '" << tmp_file << "'\n";
+			return;
+		}
+	}
+
+	if(rename(tmp_file.c_str(),metrics_file_.c_str()) != 0) {
+		std::cerr << "could not replace '" << metrics_file_ << "' with the new metrics\n";
+	}
 }
 
 std::string server::process_command(const std::string& cmd)
@@ -255,6 +461,8 @@ std::string server::process_command(const std::string& cmd)
 		out << "---";
 	} else if(command == "metrics") {
 		out << metrics_;
+	} else if(command == "prometheus") {
+		write_metrics(out);
 	} else if(command == "ban") {
 
 		if(i == cmd.end()) {
@@ -301,7 +509,7 @@ std::string server::process_command(const std::string& cmd)
 		}
 	} else {
 		out << "command '" << command << "' is not recognized";
-		out << "available commands are: msg <message>, status, metrics, ban [<nick>], unban <nick>, kick <nick>";
+		out << "available commands are: msg <message>, status, metrics, prometheus, ban [<nick>], unban <nick>, kick <nick>";
 	}
 
 	return out.str();
@@ -309,30 +517,41 @@ std::string server::process_command(const std::string& cmd)
 
 void server::run()
 {
-	config& gamelist = initial_response_.add_child("gamelist");
-	old_initial_response_ = initial_response_;
+	config& gamelist = lobby_journal_.add_child(initial_response_,"gamelist");
+
+	//players are sent the whole lobby when they join it, so the diffs start
+	//from here
+	lobby_journal_.clear();
 
 	bool sync_scheduled = false;
-	for(int loop = 0;; ++loop) {
+	for(;;) {
 		try {
-			if(sync_scheduled) {
+			if(take_lobby_changes() || sync_scheduled) {
 				//send all players the information that a player has logged
-				//out of the system
+				//out of the system, or that a game has changed
+				const game_shard::pause_all pause(shards_);
 				lobby_players_.send_data(sync_initial_response());
 				sync_scheduled = false;
 			}
 
 			//process admin commands
 			std::string admin_cmd;
-			if(input_.read_line(admin_cmd)) {
+			while(input_.read_line(admin_cmd)) {
+				const game_shard::pause_all pause(shards_);
 				std::cout << process_command(admin_cmd) << std::endl;
 			}
 
 			//make sure we log stats every 5 minutes
-			if((loop%100) == 0 && last_stats_+5*60 < time(NULL)) {
+			if(last_stats_+5*60 < time(NULL)) {
+				const game_shard::pause_all pause(shards_);
 				dump_stats();
 			}
 
+			if(metrics_file_.empty() == false && last_metrics_+metrics_interval <= time(NULL)) {
+				const game_shard::pause_all pause(shards_);
+				write_metrics_file();
+			}
+
 			network::process_send_queue();
 
 			network::connection sock = network::accept_connection();
@@ -348,7 +567,10 @@ void server::run()
 			config data;
 			while((sock = network::receive_data(data)) != network::null_connection) {
 				metrics_.service_request();
-				process_data(sock,data,gamelist);
+				if(queue_game_data(sock,data) == false) {
+					const game_shard::pause_all pause(shards_);
+					process_data(sock,data,gamelist);
+				}
 			}
 
 			metrics_.no_requests();
@@ -360,13 +582,23 @@ void server::run()
 			} else {
 				std::cerr << "socket closed: " << e.message << "\n";
 
+				//let the shard of the player's game handle what they sent
+				//before they left
+				for(std::vector<game>::const_iterator g = games_.begin(); g != games_.end(); ++g) {
+					if(!shards_.empty() && g->is_member(e.socket)) {
+						shards_[g->id()%shards_.size()]->wait_until_done();
+						break;
+					}
+				}
+
+				const game_shard::pause_all pause(shards_);
+
+				count_traffic(e.socket,connection_type(e.socket));
+				counted_traffic_.erase(e.socket);
+
 				const std::map<network::connection,player>::iterator pl_it = players_.find(e.socket);
 				if(pl_it != players_.end()) {
-					const config::child_list& users = initial_response_.get_children("user");
-					const size_t index = std::find(users.begin(),users.end(),pl_it->second.config_address()) - users.begin();
-					if(index < users.size())
-						initial_response_.remove_child("user",index);
-
+					lobby_journal_.remove_child(initial_response_,"user",*pl_it->second.config_address());
 					players_.erase(pl_it);
 				}
 
@@ -400,28 +632,122 @@ void server::run()
 			continue;
 		}
 
-		SDL_Delay(20);
+		//sleep until there is something to do, or it is time to log stats or
+		//write the metrics
+		time_t due = minimum<time_t>(last_stats_+5*60+1 - time(NULL),60);
+		if(metrics_file_.empty() == false) {
+			due = minimum<time_t>(due,last_metrics_+metrics_interval - time(NULL));
+		}
+
+		int timeout = maximum<time_t>(0,due)*1000;
+
+		//the lobby is synced from here when the shards change it
+		for(std::vector<game_shard*>::iterator sh = shards_.begin(); sh != shards_.end(); ++sh) {
+			if((*sh)->busy()) {
+				timeout = minimum<int>(timeout,shard_poll_interval);
+				break;
+			}
+		}
+
+		{
+			const threading::lock lock(lobby_mutex_);
+			if(lobby_changed_) {
+				timeout = 0;
+			}
+		}
+
+		network::wait_for_activity(timeout,input_.fd());
 	}
 }
 
 void server::process_data(const network::connection sock, config& data, config& gamelist)
 {
 	if(proxy::is_proxy(sock)) {
+		const metrics::request_timer timer(metrics_,metrics::PROXY_REQUEST);
 		proxy::received_data(sock,data);
 	}
 	//if someone who is not yet logged in is sending
 	//login details
 	else if(not_logged_in_.is_member(sock)) {
+		const metrics::request_timer timer(metrics_,metrics::LOGIN_REQUEST);
 		process_login(sock,data,gamelist);
 	} else if(const config* query = data.child("query")) {
+		const metrics::request_timer timer(metrics_,metrics::QUERY_REQUEST);
 		process_query(sock,*query,gamelist);
 	} else if(lobby_players_.is_member(sock)) {
+		const metrics::request_timer timer(metrics_,metrics::LOBBY_REQUEST);
 		process_data_from_player_in_lobby(sock,data,gamelist);
 	} else {
+		const metrics::request_timer timer(metrics_,metrics::GAME_REQUEST);
 		process_data_from_player_in_game(sock,data,gamelist);
 	}
 }
 
+bool server::queue_game_data(const network::connection sock, const config& data)
+{
+	if(shards_.empty()) {
+		return false;
+	}
+
+	std::vector<game>::const_iterator g;
+	for(g = games_.begin(); g != games_.end(); ++g) {
+		if(g->is_member(sock)) {
+			break;
+		}
+	}
+
+	if(g == games_.end()) {
+		return false;
+	}
+
+	game_shard& shard = *shards_[g->id()%shards_.size()];
+
+	//only the commands and the snapshots sent during a game are handled by
+	//the shards, as anything else may change the lobby
+	if(g->started() && data.values.empty() && data.all_children().size() == 1 &&
+	   (data.child("turn") != NULL || data.child("snapshot") != NULL)) {
+		shard.queue_data(g->id(),sock,data);
+		return true;
+	}
+
+	//the data queued before must be handled first
+	shard.wait_until_done();
+	return false;
+}
+
+void server::handle_game_data(int game_id, const network::connection sock, config& data)
+{
+	const metrics::request_timer timer(metrics_,metrics::GAME_REQUEST);
+
+	std::vector<game>::iterator g;
+	for(g = games_.begin(); g != games_.end(); ++g) {
+		if(g->id() == game_id) {
+			break;
+		}
+	}
+
+	//the game may have ended, or the player left it, since the data was queued
+	if(g == games_.end() || !g->is_member(sock)) {
+		return;
+	}
+
+	if(data.child("snapshot") != NULL) {
+		if(!g->is_observer(sock)) {
+			g->record_snapshot(*data.child("snapshot"));
+		}
+	} else {
+		process_game_data(*g,sock,data);
+	}
+}
+
+bool server::take_lobby_changes()
+{
+	const threading::lock lock(lobby_mutex_);
+	const bool res = lobby_changed_;
+	lobby_changed_ = false;
+	return res;
+}
+
 void server::process_login(const network::connection sock, const config& data, config& gamelist)
 {
 	//see if client is sending their version number
@@ -429,6 +755,16 @@ void server::process_login(const network::connection sock, const config& data, c
 	if(version != NULL) {
 		const std::string& version_str = (*version)["version"];
 
+		//the client uses the dictionary from the data after its reply,
+		//whatever the server answers
+		if((*version)["dictionary"] == shared_dictionary_version) {
+			network::use_shared_dictionary(sock);
+		}
+
+		if((*version)["compression"] == "deflate" && deflate_available()) {
+			network::use_deflate(sock);
+		}
+
 		if(accepted_versions_.count(version_str)) {
 			std::cerr << "player joined using accepted version " << version_str << ": telling them to log in\n";
 			network::send_data(login_response_,sock);
@@ -517,9 +853,9 @@ void server::process_login(const network::connection sock, const config& data, c
 
 	network::send_data(join_lobby_response_, sock);
 
-	config* const player_cfg = &initial_response_.add_child("user");
+	config* const player_cfg = &lobby_journal_.add_child(initial_response_,"user");
 
-	const player new_player(username,*player_cfg);
+	const player new_player(username,*player_cfg,lobby_journal_);
 
 	players_.insert(std::pair<network::connection,player>(sock,new_player));
 
@@ -618,7 +954,7 @@ void server::process_data_from_player_in_lobby(const network::connection sock, c
 		lobby_players_.remove_player(sock);
 
 		//send them the game data
-		network::send_data(it->level(),sock);
+		network::send_data(it->current_level(),sock);
 
 		it->add_player(sock);
 
@@ -739,6 +1075,17 @@ void server::process_data_from_player_in_game(const network::connection sock, co
 		network::send_data(response,sock);
 	}
 
+	//if this is a snapshot of the game, which the game asked its players for
+	//to shrink its history. Observers can't send one, as it replaces the
+	//commands sent by the players.
+	else if(data.child("snapshot") != NULL) {
+		if(g->started() && !g->is_observer(sock)) {
+			g->record_snapshot(*data.child("snapshot"));
+		}
+
+		return;
+	}
+
 	//if this is data describing changes to a game.
 	else if(g->is_owner(sock) && data.child("scenario_diff")) {
 		g->level().apply_diff(*data.child("scenario_diff"));
@@ -777,8 +1124,8 @@ void server::process_data_from_player_in_game(const network::connection sock, co
 			//update our config object which describes the
 			//open games, and notifies the game of where its description
 			//is located at
-			config& desc = gamelist.add_child("game",g->level());
-			g->set_description(&desc);
+			config& desc = lobby_journal_.add_child(gamelist,"game",g->level());
+			g->set_description(&desc,lobby_journal_);
 
 			//record the full description of the scenario in g->level()
 			g->level() = data;
@@ -816,7 +1163,7 @@ void server::process_data_from_player_in_game(const network::connection sock, co
 		}
 	}
 
-	const string_map::const_iterator side = data.values.find("side");
+	const config::attribute_map::const_iterator side = data.values.find("side");
 	if(side != data.values.end()) {
 		const bool res = g->take_side(sock,data);
 		config response;
@@ -858,13 +1205,8 @@ void server::process_data_from_player_in_game(const network::connection sock, co
 			g->send_data(cfg);
 
 			//delete the game's description
-			config* const gamelist = initial_response_.child("gamelist");
-			wassert(gamelist != NULL);
-			const config::child_itors vg = gamelist->child_range("game");
-
-			const config::child_iterator desc = std::find(vg.first,vg.second,g->description());
-			if(desc != vg.second) {
-				gamelist->remove_child("game",desc - vg.first);
+			if(g->description() != NULL) {
+				lobby_journal_.remove_child(gamelist,"game",*g->description());
 			}
 
 			//update the state of the lobby to players in it.
@@ -917,16 +1259,24 @@ void server::process_data_from_player_in_game(const network::connection sock, co
 		return;
 	}
 
+	process_game_data(*g,sock,data);
+}
+
+void server::process_game_data(game& g, const network::connection sock, config& data)
+{
 	config* const turn = data.child("turn");
 	if(turn != NULL) {
-		g->filter_commands(sock,*turn);
+		g.filter_commands(sock,*turn);
 
 		//notify the game of the commands, and if it changes
 		//the description, then sync the new description
-		//to players in the lobby
-		const bool res = g->process_commands(*turn);
-		if(res) {
-			lobby_players_.send_data(sync_initial_response());
+		//to players in the lobby. This may be on the thread
+		//of a shard, so the lobby is synced by run().
+		{
+			const threading::lock lock(lobby_mutex_);
+			if(g.process_commands(*turn)) {
+				lobby_changed_ = true;
+			}
 		}
 
 		//any private 'speak' commands must be repackaged separate
@@ -961,7 +1311,7 @@ void server::process_data_from_player_in_game(const network::connection sock, co
 		//if all there are are messages and they're all private, then
 		//just forward them on to the client that should receive them.
 		if(nprivate > 0 && npublic == 0 && nother == 0) {
-			g->send_data_team(data,team_name,sock);
+			g.send_data_team(data,team_name,sock);
 			return;
 		}
 
@@ -973,10 +1323,10 @@ void server::process_data_from_player_in_game(const network::connection sock, co
 
 	//forward data to all players who are in the game,
 	//except for the original data sender
-	g->send_data(data,sock);
+	g.send_data(data,sock);
 
-	if(g->started()) {
-		g->record_data(data);
+	if(g.started()) {
+		g.record_data(data);
 	}
 }
 
@@ -987,11 +1337,8 @@ void server::delete_game(std::vector<game>::iterator i)
 	//delete the game's configuration
 	config* const gamelist = initial_response_.child("gamelist");
 	wassert(gamelist != NULL);
-	const config::child_itors vg = gamelist->child_range("game");
-	const config::child_list::iterator g = std::find(vg.first,vg.second,i->description());
-	if(g != vg.second) {
-		const size_t index = g - vg.first;
-		gamelist->remove_child("game",index);
+	if(i->description() != NULL) {
+		lobby_journal_.remove_child(*gamelist,"game",*i->description());
 	}
 
 	i->disconnect();
@@ -1002,6 +1349,7 @@ int main(int argc, char** argv)
 {
 	int port = 15000;
 	size_t nthreads = 5;
+	size_t nshards = 0;
 
 	network::set_default_send_size(4096);
 
@@ -1041,6 +1389,7 @@ int main(int argc, char** argv)
 			std::cout << "usage: " << argv[0]
 				<< " [options]\n"
 				<< "  -d  --daemon               Runs wesnothd as a daemon\n"
+				<< "  -g, --game_threads n       Handles the data of the games on n threads (default: 0)\n"
 				<< "  -m, --max_packet_size n    Sets the maximal packet size to n\n"
 				<< "  -p, --port                 Binds the server to the specified port\n"
 				<< "  -V, --version              Returns the server version\n"
@@ -1066,6 +1415,11 @@ int main(int argc, char** argv)
 
 			setsid();
 #endif
+		} else if((val == "--game_threads" || val == "-g") && arg+1 != argc) {
+			nshards = atoi(argv[++arg]);
+			if(nshards > 30) {
+				nshards = 30;
+			}
 		} else if((val == "--threads" || val == "-t") && arg+1 != argc) {
 			nthreads = atoi(argv[++arg]);
 			if(nthreads > 30) {
@@ -1082,7 +1436,7 @@ int main(int argc, char** argv)
 	input_stream input(fifo_path);
 
 	try {
-		server(port,input,configuration,nthreads).run();
+		server(port,input,configuration,nthreads,nshards).run();
 	} catch(network::error& e) {
 		std::cerr << "caught network error while server was running. aborting.: " << e.message << "\n";
 		return -1;
@@ -94,7 +94,7 @@ config write_str_int_map(const stats::str_int_map& m)
 stats::str_int_map read_str_int_map(const config& cfg)
 {
 	stats::str_int_map m;
-	for(string_map::const_iterator i = cfg.values.begin(); i != cfg.values.end(); ++i) {
+	for(config::attribute_map::const_iterator i = cfg.values.begin(); i != cfg.values.end(); ++i) {
 		m[i->first] = atoi(i->second.c_str());
 	}
 
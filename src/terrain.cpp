@@ -127,12 +127,12 @@ bool terrain_type::is_keep() const
 	return keep_;
 }
 
-void create_terrain_maps(const std::vector<config*>& cfgs,
+void create_terrain_maps(const std::vector<const config*>& cfgs,
                          std::vector<char>& terrain_list,
                          std::map<char,terrain_type>& letter_to_terrain,
                          std::map<std::string,terrain_type>& str_to_terrain)
 {
-	for(std::vector<config*>::const_iterator i = cfgs.begin();
+	for(std::vector<const config*>::const_iterator i = cfgs.begin();
 	    i != cfgs.end(); ++i) {
 		terrain_type terrain(**i);
 		terrain_list.push_back(terrain.letter());
@@ -68,7 +68,7 @@ private:
 	bool heals_, village_, castle_, keep_;
 };
 
-void create_terrain_maps(const std::vector<config*>& cfgs,
+void create_terrain_maps(const std::vector<const config*>& cfgs,
                          std::vector<char>& terrain_precedence,
                          std::map<char,terrain_type>& letter_to_terrain,
 			 std::map<std::string,terrain_type>& str_to_terrain);
@@ -111,8 +111,9 @@ namespace {
 	config& find_ref(const std::string& id, config& cfg, bool remove = false) {
 		for(config::child_map::const_iterator i = cfg.all_children().begin();
 		    i != cfg.all_children().end(); i++) {
-			for (config::child_list::const_iterator j = i->second.begin();
-			     j != i->second.end(); j++) {
+			const config::child_itors children = cfg.child_range(i->first);
+			for (config::child_iterator j = children.first;
+			     j != children.second; j++) {
 				if ((**j)["id"] == id) {
 					//std::cerr << "Found a " << *(*i).first << "\n";
 					if (remove) {
@@ -166,7 +167,7 @@ namespace {
 			res_cfgs_.push_back(*parent);
 			while(!parent_stack.empty()) {
 				//override attributes
-				for(string_map::const_iterator j = parent_stack.back()->values.begin(); j != parent_stack.back()->values.end(); ++j) {
+				for(config::attribute_map::const_iterator j = parent_stack.back()->values.begin(); j != parent_stack.back()->values.end(); ++j) {
 					res_cfgs_.back().values[j->first] = j->second;
 				}
 
@@ -180,7 +181,7 @@ namespace {
 					const config::child_list& c = parent_stack.back()->get_children("change");
 					for(config::child_list::const_iterator j = c.begin(); j != c.end(); ++j) {
 						config& target = find_ref ((**j)["id"], res_cfgs_.back());
-						for(string_map::iterator k = (**j).values.begin();
+						for(config::attribute_map::const_iterator k = (**j).values.begin();
 								k != (**j).values.end(); ++k) {
 							target.values[k->first] = k->second;
 						}
@@ -228,7 +229,7 @@ namespace {
 		}
 
 		// copy all key/values
-		for(string_map::const_iterator j = cfg.values.begin(); j != cfg.values.end(); ++j) {
+		for(config::attribute_map::const_iterator j = cfg.values.begin(); j != cfg.values.end(); ++j) {
 			resolved_config.values[j->first] = j->second;
 		}
 
@@ -88,6 +88,28 @@ void thread::detach()
 	thread_ = NULL;
 }
 
+thread_pool::thread_pool(bool& aborted, mutex& m) : aborted_(aborted), mutex_(m)
+{}
+
+thread_pool::~thread_pool()
+{
+	{
+		const lock l(mutex_);
+		aborted_ = true;
+	}
+
+	for(std::vector<thread*>::iterator i = threads_.begin(); i != threads_.end(); ++i) {
+		delete *i;
+	}
+}
+
+void thread_pool::add_thread(int (*f)(void*), void* data)
+{
+	//make room first, so that a running thread can't fail to be kept
+	threads_.reserve(threads_.size() + 1);
+	threads_.push_back(new thread(f,data));
+}
+
 mutex::mutex() : m_(SDL_CreateMutex())
 {}
 
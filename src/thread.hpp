@@ -17,6 +17,8 @@
 #include "SDL.h"
 #include "SDL_thread.h"
 
+#include <vector>
+
 // Threading primitives wrapper for SDL_Thread.
 //
 // This module defines primitives for wrapping C++ around SDL's threading
@@ -70,6 +72,36 @@ private:
 	SDL_Thread* thread_;
 };
 
+class mutex;
+
+// Thread pool.
+//
+// Owns the threads working on a job shared with the calling thread, such as
+// a list of items which each thread takes from until it is empty. The job
+// has a flag, guarded by a mutex, which its threads check before taking more
+// work. When the pool is destroyed, normally or through an exception, it sets
+// the flag and joins its threads.
+class thread_pool
+{
+public:
+	// \param aborted the flag which tells the threads of the job to stop
+	// \param m the mutex which guards the flag
+	thread_pool(bool& aborted, mutex& m);
+
+	// Set the flag and join all the threads of the pool.
+	~thread_pool();
+
+	// Start a new thread of the pool, which executes f(data).
+	void add_thread(int (*f)(void*), void* data);
+private:
+	thread_pool(const thread_pool&);
+	void operator=(const thread_pool&);
+
+	std::vector<thread*> threads_;
+	bool& aborted_;
+	mutex& mutex_;
+};
+
 // Binary mutexes.
 //
 // Implements an interface to binary mutexes. This class only defines the
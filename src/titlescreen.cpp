@@ -103,7 +103,7 @@ bool fade_logo(display& screen, int xpos, int ypos)
 const std::string& get_tip_of_day(const config& tips,int* ntip)
 {
 	static const std::string empty_string;
-	string_map::const_iterator it;
+	config::attribute_map::const_iterator it;
 
 	if(preferences::show_tip_of_day() == false) {
 		return empty_string;
@@ -0,0 +1,332 @@
+/* $Id$ */
+/*
+   Copyright (C) 2003-5 by David White <davidnwhite@verizon.net>
+   Part of the Battle for Wesnoth Project http://www.wesnoth.org/
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License.
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY.
+
+   See the COPYING file for more details.
+*/
+
+//a tool which measures how long the reachable hexes of units take to find,
+//as they are at the start of each turn. Units of random types are put on
+//random hexes of the given maps, for two sides, and the routes of each unit
+//are found with the search pathfind.cpp uses, and with the recursive search
+//it used to use, which is kept here to compare them. The routes found by both
+//are checked to reach the same hexes with the same movement left.
+
+#include "../global.hpp"
+
+#include "../config.hpp"
+#include "../filesystem.hpp"
+#include "../gamestatus.hpp"
+#include "../map.hpp"
+#include "../pathfind.hpp"
+#include "../team.hpp"
+#include "../unit.hpp"
+#include "../unit_types.hpp"
+#include "../util.hpp"
+#include "../serialization/parser.hpp"
+#include "../serialization/preprocessor.hpp"
+
+#include "SDL.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+//the recursive search paths::paths used before it was made iterative
+void recursive_routes(const gamemap& map, const gamestatus& status,
+                      const unit_map& units, const unit& u,
+                      const gamemap::location& loc, int move_left,
+                      paths::routes_map& routes, const std::vector<team>& teams,
+                      bool ignore_zocs, bool allow_teleport, int turns_left, bool starting_pos)
+{
+	team const &current_team = teams[u.side()-1];
+
+	std::vector<gamemap::location> locs(6);
+	get_adjacent_tiles(loc,&locs[0]);
+
+	if (allow_teleport && map.is_village(loc) &&
+	    current_team.owns_village(loc) && (starting_pos || units.count(loc) == 0)) {
+		const std::vector<gamemap::location>& villages = map.villages();
+		for(std::vector<gamemap::location>::const_iterator t = villages.begin();
+		    t != villages.end(); ++t) {
+			if (!current_team.owns_village(*t) || units.count(*t))
+				continue;
+
+			locs.push_back(*t);
+		}
+	}
+
+	for(size_t i = 0; i != locs.size(); ++i) {
+		const gamemap::location& currentloc = locs[i];
+
+		if (currentloc.x < 0 || currentloc.y < 0 ||
+		    currentloc.x >= map.x() || currentloc.y >= map.y())
+			continue;
+
+		const unit_map::const_iterator unit_it =
+			find_visible_unit(units, locs[i], map,
+			                  status.get_time_of_day().lawful_bonus,
+			                  teams, current_team);
+
+		if (unit_it != units.end() &&
+		    current_team.is_enemy(unit_it->second.side()))
+			continue;
+
+		const gamemap::TERRAIN terrain = map[currentloc.x][currentloc.y];
+		const int move_cost = u.movement_cost(map,terrain);
+		if (move_cost <= move_left ||
+		    (turns_left > 0 && move_cost <= u.total_movement())) {
+			int new_move_left = move_left - move_cost;
+			int new_turns_left = turns_left;
+			if (new_move_left < 0) {
+				--new_turns_left;
+				new_move_left = u.total_movement() - move_cost;
+			}
+
+			const int total_movement = new_turns_left * u.total_movement() + new_move_left;
+
+			const paths::routes_map::const_iterator rtit = routes.find(currentloc);
+			if(rtit != routes.end() && rtit->second.move_left >= total_movement)
+				continue;
+
+			const bool zoc = !ignore_zocs && enemy_zoc(map,status,units,teams,currentloc,
+						current_team,u.side());
+			paths::route new_route = routes[loc];
+			new_route.steps.push_back(loc);
+
+			const int zoc_move_left = zoc ? 0 : new_move_left;
+			new_route.move_left = u.total_movement() * new_turns_left + zoc_move_left;
+			routes[currentloc] = new_route;
+
+			if (new_route.move_left > 0) {
+				recursive_routes(map, status, units, u, currentloc,
+				                 zoc_move_left, routes, teams, ignore_zocs,
+				                 allow_teleport, new_turns_left, false);
+			}
+		}
+	}
+}
+
+paths::routes_map find_recursive_routes(const gamemap& map, const gamestatus& status,
+                                        const unit_map& units, const gamemap::location& loc,
+                                        const std::vector<team>& teams, int additional_turns)
+{
+	const unit& u = units.find(loc)->second;
+	paths::routes_map routes;
+	routes[loc].move_left = u.movement_left();
+	recursive_routes(map, status, units, u, loc, u.movement_left(), routes, teams,
+	                 u.type().is_skirmisher(), u.type().teleports(), additional_turns, true);
+	return routes;
+}
+
+//returns true if both searches reached the same hexes with the same movement
+//left. The unit's own hex is left out when planning several turns ahead: the
+//recursive search could lower its movement left by going back and forth.
+bool same_routes(const paths::routes_map& a, const paths::routes_map& b,
+                 const gamemap::location& start, int additional_turns)
+{
+	if(a.size() != b.size()) {
+		return false;
+	}
+
+	for(paths::routes_map::const_iterator i = a.begin(), j = b.begin(); i != a.end(); ++i, ++j) {
+		if(i->first != j->first) {
+			return false;
+		}
+
+		if(i->second.move_left != j->second.move_left &&
+		   (additional_turns == 0 || i->first != start)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+//puts 'count' units of random types on random hexes they can stand on,
+//alternating between the two sides
+void place_units(const gamemap& map, const game_data& info, size_t count, unit_map& units)
+{
+	std::vector<const unit_type*> types;
+	for(game_data::unit_type_map::const_iterator t = info.unit_types.begin(); t != info.unit_types.end(); ++t) {
+		if(t->second.movement() > 0) {
+			types.push_back(&t->second);
+		}
+	}
+
+	if(types.empty() || map.x() == 0 || map.y() == 0) {
+		return;
+	}
+
+	for(size_t n = 0, tries = 0; n != count && tries != count*100; ++tries) {
+		const gamemap::location loc(rand()%map.x(), rand()%map.y());
+		unit u(types[rand()%types.size()], int(n%2) + 1);
+		u.new_turn();
+		if(units.count(loc) || u.movement_cost(map, map[loc.x][loc.y]) > u.total_movement()) {
+			continue;
+		}
+
+		units.insert(std::make_pair(loc, u));
+		++n;
+	}
+}
+
+//the time taken by each search, in milliseconds
+struct timings
+{
+	timings() : iterative(0), recursive(0), hexes(0) {}
+	int iterative, recursive;
+	size_t hexes;
+};
+
+//finds the routes of every unit on the map 'rounds' times with each search.
+//Returns false if the searches disagree.
+bool benchmark_map(const std::string& fname, const config& game_cfg, const game_data& info,
+                   size_t nunits, size_t rounds, int additional_turns, timings& t)
+{
+	const gamemap map(game_cfg, read_file(fname));
+	const config time_cfg;
+	const gamestatus status(time_cfg, 50);
+
+	//each side owns the villages of its half of the map, so that teleporting
+	//units have somewhere to go
+	config sides[2];
+	sides[0]["team_name"] = "1";
+	sides[1]["team_name"] = "2";
+	const std::vector<gamemap::location>& villages = map.villages();
+	for(std::vector<gamemap::location>::const_iterator v = villages.begin(); v != villages.end(); ++v) {
+		v->write(sides[v->x < map.x()/2 ? 0 : 1].add_child("village"));
+	}
+
+	std::vector<team> teams;
+	teams.push_back(team(sides[0]));
+	teams.push_back(team(sides[1]));
+	const teams_manager manager(teams);
+
+	unit_map units;
+	place_units(map, info, nunits, units);
+
+	bool same = true;
+	for(unit_map::const_iterator u = units.begin(); u != units.end(); ++u) {
+		const paths iterative(map, status, info, units, u->first, teams,
+		                      u->second.type().is_skirmisher(), u->second.type().teleports(),
+		                      additional_turns);
+		const paths::routes_map recursive = find_recursive_routes(map, status, units, u->first,
+		                                                          teams, additional_turns);
+		if(!same_routes(iterative.routes, recursive, u->first, additional_turns)) {
+			std::cerr << fname << ": the routes of the " << u->second.type().id() << " at ("
+			          << u->first.x + 1 << ',' << u->first.y + 1 << ") differ\n";
+			same = false;
+		}
+
+		t.hexes += iterative.routes.size() * rounds;
+	}
+
+	int ticks = SDL_GetTicks();
+	for(size_t n = 0; n != rounds; ++n) {
+		for(unit_map::const_iterator u = units.begin(); u != units.end(); ++u) {
+			const paths res(map, status, info, units, u->first, teams,
+			                u->second.type().is_skirmisher(), u->second.type().teleports(),
+			                additional_turns);
+		}
+	}
+
+	t.iterative += SDL_GetTicks() - ticks;
+
+	ticks = SDL_GetTicks();
+	for(size_t n = 0; n != rounds; ++n) {
+		for(unit_map::const_iterator u = units.begin(); u != units.end(); ++u) {
+			find_recursive_routes(map, status, units, u->first, teams, additional_turns);
+		}
+	}
+
+	t.recursive += SDL_GetTicks() - ticks;
+	return same;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	size_t rounds = 10, nunits = 40;
+	int turns = 0;
+	std::vector<std::string> files;
+
+	for(int arg = 1; arg != argc; ++arg) {
+		const std::string val(argv[arg]);
+		if((val == "--rounds" || val == "-r") && arg+1 != argc) {
+			rounds = maximum<int>(1,atoi(argv[++arg]));
+		} else if((val == "--units" || val == "-u") && arg+1 != argc) {
+			nunits = maximum<int>(1,atoi(argv[++arg]));
+		} else if((val == "--turns" || val == "-t") && arg+1 != argc) {
+			turns = maximum<int>(0,atoi(argv[++arg]));
+		} else if(val.empty() || val[0] == '-') {
+			files.clear();
+			break;
+		} else {
+			files.push_back(val);
+		}
+	}
+
+	if(files.empty()) {
+		std::cout << "usage: " << argv[0]
+			<< " [options] map...\n"
+			<< "  Finds the routes of random units on the maps, such as data/maps/multiplayer/*,\n"
+			<< "  which must be run from the directory data/game.cfg is in\n"
+			<< "  -r, --rounds n             Finds the routes of each unit n times (default: 10)\n"
+			<< "  -t, --turns n              Finds the routes n turns ahead (default: 0)\n"
+			<< "  -u, --units n              Puts n units on each map (default: 40)\n";
+		return 0;
+	}
+
+	config game_cfg;
+	try {
+		preproc_map defines;
+		defines["MULTIPLAYER"] = preproc_define();
+		scoped_istream stream = preprocess_file("data/game.cfg", &defines);
+		read(game_cfg, *stream);
+	} catch(config::error& e) {
+		std::cerr << "could not read data/game.cfg: " << e.message << "\n";
+		return -1;
+	}
+
+	const config* const units_cfg = game_cfg.child("units");
+	if(units_cfg == NULL) {
+		std::cerr << "data/game.cfg has no [units]\n";
+		return -1;
+	}
+
+	const game_data info(*units_cfg);
+
+	srand(1);
+	timings t;
+	bool same = true;
+	for(std::vector<std::string>::const_iterator f = files.begin(); f != files.end(); ++f) {
+		try {
+			same = benchmark_map(*f, game_cfg, info, nunits, rounds, turns, t) && same;
+		} catch(gamemap::incorrect_format_exception& e) {
+			std::cerr << "could not read the map '" << *f << "': " << e.msg_ << "\n";
+			return -1;
+		}
+	}
+
+	std::cout << files.size() << " maps, " << nunits << " units each, " << rounds << " rounds, "
+	          << t.hexes << " reachable hexes:\n"
+	          << "  iterative search: " << t.iterative << " ms\n"
+	          << "  recursive search: " << t.recursive << " ms\n";
+	if(!same) {
+		std::cout << "the searches found different routes\n";
+		return 1;
+	}
+
+	return 0;
+}
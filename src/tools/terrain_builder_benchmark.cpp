@@ -0,0 +1,128 @@
+/* $Id$ */
+/*
+   Copyright (C) 2003-5 by David White <davidnwhite@verizon.net>
+   Part of the Battle for Wesnoth Project http://www.wesnoth.org/
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License.
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY.
+
+   See the COPYING file for more details.
+*/
+
+//a tool which measures how long the terrain graphics of the given maps take
+//to build with the [terrain_graphics] rules of data/game.cfg, as when a level
+//starts, and how long the rules take to parse.
+
+#include "../global.hpp"
+
+#include "../builder.hpp"
+#include "../config.hpp"
+#include "../filesystem.hpp"
+#include "../map.hpp"
+#include "../util.hpp"
+#include "../serialization/parser.hpp"
+#include "../serialization/preprocessor.hpp"
+
+#include "SDL.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+int main(int argc, char** argv)
+{
+	size_t rounds = 10;
+	std::vector<std::string> files;
+
+	for(int arg = 1; arg != argc; ++arg) {
+		const std::string val(argv[arg]);
+		if((val == "--rounds" || val == "-r") && arg+1 != argc) {
+			rounds = maximum<int>(1,atoi(argv[++arg]));
+		} else if(val.empty() || val[0] == '-') {
+			files.clear();
+			break;
+		} else {
+			files.push_back(val);
+		}
+	}
+
+	if(files.empty()) {
+		std::cout << "usage: " << argv[0]
+			<< " [options] map...\n"
+			<< "  Builds the terrain graphics of the maps, such as data/maps/multiplayer/*,\n"
+			<< "  which must be run from the directory data/game.cfg is in\n"
+			<< "  -r, --rounds n             Builds the terrain of each map n times (default: 10)\n";
+		return 0;
+	}
+
+	config game_cfg;
+	try {
+		preproc_map defines;
+		defines["MULTIPLAYER"] = preproc_define();
+		scoped_istream stream = preprocess_file("data/game.cfg", &defines);
+		read(game_cfg, *stream);
+	} catch(config::error& e) {
+		std::cerr << "could not read data/game.cfg: " << e.message << "\n";
+		return -1;
+	}
+
+	std::vector<gamemap*> maps;
+	for(std::vector<std::string>::const_iterator f = files.begin(); f != files.end(); ++f) {
+		try {
+			maps.push_back(new gamemap(game_cfg, read_file(*f)));
+		} catch(gamemap::incorrect_format_exception& e) {
+			std::cerr << "could not read the map '" << *f << "': " << e.msg_ << "\n";
+			return -1;
+		}
+	}
+
+	const config level;
+
+	const gamemap empty(game_cfg, "");
+
+	//the first build finds which images exist, which is left out
+	{
+		const terrain_builder builder(game_cfg, level, empty);
+	}
+
+	int ticks = SDL_GetTicks();
+	for(size_t n = 0; n != rounds; ++n) {
+		const terrain_builder builder(game_cfg, level, empty);
+	}
+
+	const int parse_time = SDL_GetTicks() - ticks;
+
+	//the whole terrain of a map is rebuilt when all its hexes got a quick
+	//rebuild, as the editor does, without parsing the rules again
+	size_t hexes = 0;
+	int build_time = 0;
+	for(std::vector<gamemap*>::const_iterator m = maps.begin(); m != maps.end(); ++m) {
+		terrain_builder builder(game_cfg, level, **m);
+		for(size_t n = 0; n != rounds; ++n) {
+			for(int x = 0; x != (*m)->x(); ++x) {
+				for(int y = 0; y != (*m)->y(); ++y) {
+					builder.rebuild_terrain(gamemap::location(x,y));
+				}
+			}
+
+			ticks = SDL_GetTicks();
+			builder.rebuild_all();
+			build_time += SDL_GetTicks() - ticks;
+		}
+
+		hexes += (*m)->x() * (*m)->y() * rounds;
+	}
+
+	std::cout << maps.size() << " maps, " << rounds << " rounds, " << hexes << " hexes:\n"
+	          << "  parsing the rules: " << parse_time << " ms\n"
+	          << "  building the maps: " << build_time << " ms\n";
+
+	for(std::vector<gamemap*>::iterator m = maps.begin(); m != maps.end(); ++m) {
+		delete *m;
+	}
+
+	return 0;
+}
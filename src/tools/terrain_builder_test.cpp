@@ -0,0 +1,203 @@
+/* $Id$ */
+/*
+   Copyright (C) 2003-5 by David White <davidnwhite@verizon.net>
+   Part of the Battle for Wesnoth Project http://www.wesnoth.org/
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License.
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY.
+
+   See the COPYING file for more details.
+*/
+
+//a tool which checks that the terrain graphics rebuilt after the terrain of
+//some hexes changed are those a complete build gives. Random hexes of the
+//given maps get random terrains, as the editor changes them, the terrain
+//builder of the map rebuilds them, and its images are compared with those of
+//a new terrain builder, for every hex and time of day. How long the rebuilds
+//and the complete builds take is shown.
+
+#include "../global.hpp"
+
+#include "../builder.hpp"
+#include "../config.hpp"
+#include "../filesystem.hpp"
+#include "../map.hpp"
+#include "../util.hpp"
+#include "../serialization/parser.hpp"
+#include "../serialization/preprocessor.hpp"
+
+#include "SDL.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+//the time taken by each build, in milliseconds
+struct timings
+{
+	timings() : rebuild(0), build(0), rebuilds(0) {}
+	int rebuild, build;
+	size_t rebuilds;
+};
+
+//returns true if both lists have the same images
+bool same_images(const terrain_builder::imagelist* a, const terrain_builder::imagelist* b)
+{
+	if(a == NULL || b == NULL) {
+		return a == b;
+	}
+
+	if(a->size() != b->size()) {
+		return false;
+	}
+
+	for(size_t n = 0; n != a->size(); ++n) {
+		if((*a)[n].get_current_frame() != (*b)[n].get_current_frame()) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+//returns true if both builders give the same images for every hex, at the
+//given times of day
+bool same_terrain(const terrain_builder& a, const terrain_builder& b, const gamemap& map,
+                  const std::vector<std::string>& tods)
+{
+	for(std::vector<std::string>::const_iterator tod = tods.begin(); tod != tods.end(); ++tod) {
+		for(int x = -1; x <= map.x(); ++x) {
+			for(int y = -1; y <= map.y(); ++y) {
+				const gamemap::location loc(x,y);
+				if(!same_images(a.get_terrain_at(loc, *tod, terrain_builder::ADJACENT_BACKGROUND),
+				                b.get_terrain_at(loc, *tod, terrain_builder::ADJACENT_BACKGROUND)) ||
+				   !same_images(a.get_terrain_at(loc, *tod, terrain_builder::ADJACENT_FOREGROUND),
+				                b.get_terrain_at(loc, *tod, terrain_builder::ADJACENT_FOREGROUND))) {
+					std::cerr << "the images of " << loc << " differ\n";
+					return false;
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+//changes 'nchanges' random hexes of the map 'rounds' times, each time
+//rebuilding the terrain and comparing it with a complete build. Returns false
+//if they differ.
+bool test_map(const std::string& fname, const config& game_cfg, const std::vector<std::string>& tods,
+              size_t nchanges, size_t rounds, timings& t)
+{
+	gamemap map(game_cfg, read_file(fname));
+	if(map.empty()) {
+		return true;
+	}
+
+	const config level;
+	terrain_builder builder(game_cfg, level, map);
+
+	const std::vector<gamemap::TERRAIN>& terrains = map.get_terrain_list();
+
+	for(size_t n = 0; n != rounds; ++n) {
+		for(size_t c = 0; c != nchanges; ++c) {
+			const gamemap::location loc(rand()%map.x(), rand()%map.y());
+			map.set_terrain(loc, terrains[rand()%terrains.size()]);
+			builder.rebuild_terrain(loc);
+		}
+
+		int ticks = SDL_GetTicks();
+		builder.rebuild_all();
+		t.rebuild += SDL_GetTicks() - ticks;
+		++t.rebuilds;
+
+		ticks = SDL_GetTicks();
+		const terrain_builder complete(game_cfg, level, map);
+		t.build += SDL_GetTicks() - ticks;
+
+		if(!same_terrain(builder, complete, map, tods)) {
+			std::cerr << fname << ": the rebuilt terrain differs from the built one after "
+			          << n + 1 << " rounds\n";
+			return false;
+		}
+	}
+
+	return true;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	size_t rounds = 10, nchanges = 5;
+	std::vector<std::string> files;
+
+	for(int arg = 1; arg != argc; ++arg) {
+		const std::string val(argv[arg]);
+		if((val == "--rounds" || val == "-r") && arg+1 != argc) {
+			rounds = maximum<int>(1,atoi(argv[++arg]));
+		} else if((val == "--changes" || val == "-c") && arg+1 != argc) {
+			nchanges = maximum<int>(1,atoi(argv[++arg]));
+		} else if(val.empty() || val[0] == '-') {
+			files.clear();
+			break;
+		} else {
+			files.push_back(val);
+		}
+	}
+
+	if(files.empty()) {
+		std::cout << "usage: " << argv[0]
+			<< " [options] map...\n"
+			<< "  Changes random hexes of the maps, such as data/maps/multiplayer/*, and checks\n"
+			<< "  the rebuilt terrain graphics against a complete build. Must be run from the\n"
+			<< "  directory data/game.cfg is in\n"
+			<< "  -c, --changes n            Changes n hexes before each rebuild (default: 5)\n"
+			<< "  -r, --rounds n             Rebuilds the terrain of each map n times (default: 10)\n";
+		return 0;
+	}
+
+	config game_cfg;
+	try {
+		preproc_map defines;
+		defines["MULTIPLAYER"] = preproc_define();
+		scoped_istream stream = preprocess_file("data/game.cfg", &defines);
+		read(game_cfg, *stream);
+	} catch(config::error& e) {
+		std::cerr << "could not read data/game.cfg: " << e.message << "\n";
+		return -1;
+	}
+
+	//the times of day of the default schedule, which the images of some
+	//terrains depend on
+	static const char* const times[] = { "", "dawn", "morning", "afternoon", "dusk",
+	                                     "first_watch", "second_watch" };
+	const std::vector<std::string> tods(times, times + sizeof(times)/sizeof(*times));
+
+	srand(1);
+	timings t;
+	bool same = true;
+	for(std::vector<std::string>::const_iterator f = files.begin(); f != files.end(); ++f) {
+		try {
+			same = test_map(*f, game_cfg, tods, nchanges, rounds, t) && same;
+		} catch(gamemap::incorrect_format_exception& e) {
+			std::cerr << "could not read the map '" << *f << "': " << e.msg_ << "\n";
+			return -1;
+		}
+	}
+
+	std::cout << files.size() << " maps, " << nchanges << " changed hexes, " << t.rebuilds << " rebuilds:\n"
+	          << "  rebuilds:        " << t.rebuild << " ms\n"
+	          << "  complete builds: " << t.build << " ms\n";
+	if(!same) {
+		std::cout << "the rebuilt terrain differs from the complete builds\n";
+		return 1;
+	}
+
+	return 0;
+}
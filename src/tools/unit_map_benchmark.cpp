@@ -0,0 +1,200 @@
+/* $Id$ */
+/*
+   Copyright (C) 2003-5 by David White <davidnwhite@verizon.net>
+   Part of the Battle for Wesnoth Project http://www.wesnoth.org/
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License.
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY.
+
+   See the COPYING file for more details.
+*/
+
+//a tool which measures how fast units are looked up, iterated over and moved
+//in a unit_map, compared with the std::map it replaced. Units are put on
+//random hexes of a map of the given size, and both containers go through the
+//same lookups and moves.
+
+#include "../global.hpp"
+
+#include "../config.hpp"
+#include "../filesystem.hpp"
+#include "../map.hpp"
+#include "../pathutils.hpp"
+#include "../unit.hpp"
+#include "../unit_types.hpp"
+#include "../util.hpp"
+#include "../serialization/parser.hpp"
+#include "../serialization/preprocessor.hpp"
+
+#include "SDL.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace {
+
+//the time taken by each operation, in milliseconds
+struct timings
+{
+	timings() : lookup(0), iterate(0), move(0), checksum(0) {}
+	int lookup, iterate, move;
+
+	//depends on what was found, so that both containers can be checked to
+	//have found the same units
+	size_t checksum;
+};
+
+//the moves of the benchmark: the unit on 'from' goes to 'to'
+typedef std::vector<std::pair<gamemap::location,gamemap::location> > move_list;
+
+template<typename Units>
+void benchmark(Units& units, int width, int height, size_t rounds, const move_list& moves, timings& t)
+{
+	int ticks = SDL_GetTicks();
+	for(size_t n = 0; n != rounds; ++n) {
+		for(int x = 0; x != width; ++x) {
+			for(int y = 0; y != height; ++y) {
+				const typename Units::const_iterator u = units.find(gamemap::location(x,y));
+				if(u != units.end()) {
+					t.checksum += x*height + y;
+				}
+			}
+		}
+	}
+
+	t.lookup += SDL_GetTicks() - ticks;
+
+	ticks = SDL_GetTicks();
+	for(size_t n = 0; n != rounds; ++n) {
+		for(typename Units::const_iterator u = units.begin(); u != units.end(); ++u) {
+			t.checksum += u->second.hitpoints();
+		}
+	}
+
+	t.iterate += SDL_GetTicks() - ticks;
+
+	//moves a unit as actions.cpp does: the unit is copied, removed from its
+	//hex and put on the other
+	ticks = SDL_GetTicks();
+	for(move_list::const_iterator m = moves.begin(); m != moves.end(); ++m) {
+		const typename Units::iterator u = units.find(m->first);
+		if(u == units.end()) {
+			continue;
+		}
+
+		const unit moved = u->second;
+		units.erase(u);
+		units.insert(std::make_pair(m->second, moved));
+		t.checksum += m->second.x + m->second.y;
+	}
+
+	t.move += SDL_GetTicks() - ticks;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	size_t rounds = 1000, nunits = 60;
+	int width = 40, height = 40;
+
+	for(int arg = 1; arg != argc; ++arg) {
+		const std::string val(argv[arg]);
+		if((val == "--rounds" || val == "-r") && arg+1 != argc) {
+			rounds = maximum<int>(1,atoi(argv[++arg]));
+		} else if((val == "--units" || val == "-u") && arg+1 != argc) {
+			nunits = maximum<int>(1,atoi(argv[++arg]));
+		} else if((val == "--size" || val == "-s") && arg+2 < argc) {
+			width = maximum<int>(1,atoi(argv[++arg]));
+			height = maximum<int>(1,atoi(argv[++arg]));
+		} else {
+			std::cout << "usage: " << argv[0]
+				<< " [options]\n"
+				<< "  Must be run from the directory data/game.cfg is in\n"
+				<< "  -r, --rounds n             Looks up every hex and iterates over the units n times,\n"
+				<< "                             and moves units n times (default: 1000)\n"
+				<< "  -s, --size w h             Puts the units on a map of w by h hexes (default: 40 40)\n"
+				<< "  -u, --units n              Puts n units on the map (default: 60)\n";
+			return 0;
+		}
+	}
+
+	nunits = minimum<size_t>(nunits, size_t(width*height));
+
+	config game_cfg;
+	try {
+		preproc_map defines;
+		defines["MULTIPLAYER"] = preproc_define();
+		scoped_istream stream = preprocess_file("data/game.cfg", &defines);
+		read(game_cfg, *stream);
+	} catch(config::error& e) {
+		std::cerr << "could not read data/game.cfg: " << e.message << "\n";
+		return -1;
+	}
+
+	const config* const units_cfg = game_cfg.child("units");
+	if(units_cfg == NULL || units_cfg->get_children("unit").empty()) {
+		std::cerr << "data/game.cfg has no units\n";
+		return -1;
+	}
+
+	const game_data info(*units_cfg);
+
+	std::vector<const unit_type*> types;
+	for(game_data::unit_type_map::const_iterator i = info.unit_types.begin(); i != info.unit_types.end(); ++i) {
+		types.push_back(&i->second);
+	}
+
+	//both containers start with the same units, and go through the same moves
+	srand(1);
+	std::map<gamemap::location,unit> old_units;
+	unit_map new_units;
+	while(old_units.size() != nunits) {
+		const gamemap::location loc(rand()%width, rand()%height);
+		if(old_units.count(loc) == 0) {
+			const unit u(types[rand()%types.size()], int(old_units.size()%2) + 1);
+			old_units.insert(std::make_pair(loc, u));
+			new_units.insert(std::make_pair(loc, u));
+		}
+	}
+
+	move_list moves;
+	std::map<gamemap::location,bool> occupied;
+	for(std::map<gamemap::location,unit>::const_iterator u = old_units.begin(); u != old_units.end(); ++u) {
+		occupied[u->first] = true;
+	}
+
+	while(moves.size() != rounds*nunits) {
+		std::map<gamemap::location,bool>::iterator from = occupied.begin();
+		std::advance(from, rand()%occupied.size());
+		gamemap::location adj[6];
+		get_adjacent_tiles(from->first, adj);
+		const gamemap::location& to = adj[rand()%6];
+		if(to.x >= 0 && to.y >= 0 && to.x < width && to.y < height && occupied.count(to) == 0) {
+			moves.push_back(std::make_pair(from->first, to));
+			occupied.erase(from);
+			occupied[to] = true;
+		}
+	}
+
+	timings old_t, new_t;
+	benchmark(old_units, width, height, rounds, moves, old_t);
+	benchmark(new_units, width, height, rounds, moves, new_t);
+
+	std::cout << nunits << " units on " << width << "x" << height << " hexes, " << rounds << " rounds:\n"
+	          << "  lookups:    std::map " << old_t.lookup << " ms, unit_map " << new_t.lookup << " ms\n"
+	          << "  iterations: std::map " << old_t.iterate << " ms, unit_map " << new_t.iterate << " ms\n"
+	          << "  moves:      std::map " << old_t.move << " ms, unit_map " << new_t.move << " ms\n";
+	if(old_t.checksum != new_t.checksum) {
+		std::cout << "the containers found different units\n";
+		return 1;
+	}
+
+	return 0;
+}
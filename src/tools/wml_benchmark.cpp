@@ -0,0 +1,541 @@
+/* $Id$ */
+/*
+   Copyright (C) 2003-5 by David White <davidnwhite@verizon.net>
+   Part of the Battle for Wesnoth Project http://www.wesnoth.org/
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License.
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY.
+
+   See the COPYING file for more details.
+*/
+
+//a tool which measures how fast the data of network games is compressed and
+//decompressed. The traffic is made from saved games: the game without its
+//replay is sent as a game starts, and each command of the replay is sent in
+//a [turn], as it is during a game.
+//
+//it also measures how long the saved games take to copy, as they are when a
+//game is saved, and how long their traffic takes to record, as wesnothd
+//records the history of a game.
+//
+//it also measures how long a config file such as data/game.cfg takes to
+//read, how much memory it takes once read, and how fast its attributes and
+//children are looked up.
+//
+//it also measures how fast text WML, such as a saved game or a replay, is
+//parsed, from memory and from a stream.
+
+#include "../global.hpp"
+
+#include "../config.hpp"
+#include "../filesystem.hpp"
+#include "../util.hpp"
+#include "../serialization/binary_or_text.hpp"
+#include "../serialization/binary_wml.hpp"
+#include "../serialization/deflate.hpp"
+#include "../serialization/parser.hpp"
+#include "../serialization/preprocessor.hpp"
+
+#include "SDL.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <iterator>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+//the memory allocated with new and not deleted yet
+size_t allocated_bytes = 0, allocated_blocks = 0;
+
+}
+
+//all memory is allocated through these, so that the memory a config takes
+//can be measured. Each block starts with its size.
+void* operator new(size_t size) throw(std::bad_alloc)
+{
+	size_t* const block = static_cast<size_t*>(malloc(size + sizeof(size_t)*2));
+	if(block == NULL) {
+		throw std::bad_alloc();
+	}
+
+	*block = size;
+	allocated_bytes += size;
+	++allocated_blocks;
+	return block + 2;
+}
+
+void operator delete(void* p) throw()
+{
+	if(p != NULL) {
+		size_t* const block = static_cast<size_t*>(p) - 2;
+		allocated_bytes -= *block;
+		--allocated_blocks;
+		free(block);
+	}
+}
+
+namespace {
+
+void add_traffic(const config& game, std::vector<config>& messages)
+{
+	config level = game;
+	level.clear_children("replay");
+	messages.push_back(level);
+
+	const config::child_list& replays = game.get_children("replay");
+	for(config::child_list::const_iterator r = replays.begin(); r != replays.end(); ++r) {
+		const config::child_list& commands = (*r)->get_children("command");
+		for(config::child_list::const_iterator c = commands.begin(); c != commands.end(); ++c) {
+			config turn;
+			turn.add_child("turn").add_child("command",**c);
+			messages.push_back(turn);
+		}
+	}
+}
+
+//the time taken by each step, in milliseconds
+struct timings
+{
+	timings() : encode(0), decode(0) {}
+	int encode, decode;
+};
+
+//compresses and decompresses the messages as a connection does, with streams
+//as the network code used to. Returns the number of bytes sent.
+size_t run_streams(const std::vector<config>& messages, timings& t)
+{
+	std::vector<std::vector<char> > bufs(messages.size());
+
+	int ticks = SDL_GetTicks();
+	compression_schema outgoing;
+	for(size_t n = 0; n != messages.size(); ++n) {
+		std::ostringstream compressor;
+		write_compressed(compressor, messages[n], outgoing);
+		const std::string& value = compressor.str();
+		bufs[n].assign(value.begin(),value.end());
+	}
+
+	t.encode += SDL_GetTicks() - ticks;
+
+	ticks = SDL_GetTicks();
+	compression_schema incoming;
+	size_t bytes = 0;
+	config cfg;
+	for(size_t n = 0; n != bufs.size(); ++n) {
+		const std::string buffer(bufs[n].begin(),bufs[n].end());
+		std::istringstream stream(buffer);
+		read_compressed(cfg, stream, incoming);
+		bytes += bufs[n].size();
+	}
+
+	t.decode += SDL_GetTicks() - ticks;
+	return bytes;
+}
+
+//whether a message has been read as it was written. Empty attributes are not
+//sent, so the messages are compared through the data they are sent as.
+bool same_message(const config& a, const config& b)
+{
+	std::vector<char> data_a, data_b;
+	write_compressed_literal(data_a, a);
+	write_compressed_literal(data_b, b);
+	return data_a == data_b;
+}
+
+//the same, with the data written to and read from buffers. Returns false if
+//the messages read differ from those written.
+bool run_buffers(const std::vector<config>& messages, timings& t, bool check)
+{
+	std::vector<std::vector<char> > bufs(messages.size());
+
+	int ticks = SDL_GetTicks();
+	compression_schema outgoing;
+	for(size_t n = 0; n != messages.size(); ++n) {
+		write_compressed(bufs[n], messages[n], outgoing);
+	}
+
+	t.encode += SDL_GetTicks() - ticks;
+
+	ticks = SDL_GetTicks();
+	compression_schema incoming;
+	config cfg;
+	for(size_t n = 0; n != bufs.size(); ++n) {
+		const char* const data = bufs[n].empty() ? NULL : &bufs[n][0];
+		read_compressed(cfg, data, data + bufs[n].size(), incoming);
+		if(check && !same_message(cfg,messages[n])) {
+			return false;
+		}
+	}
+
+	t.decode += SDL_GetTicks() - ticks;
+	return true;
+}
+
+//the number of bytes the messages are sent as, with or without the shared
+//dictionary added to the schemas first. Returns 0 if the messages read differ
+//from those written.
+size_t sent_bytes(const std::vector<config>& messages, bool dictionary)
+{
+	compression_schema outgoing, incoming;
+	if(dictionary) {
+		add_shared_dictionary(outgoing);
+		add_shared_dictionary(incoming);
+	}
+
+	size_t bytes = 0;
+	config cfg;
+	for(size_t n = 0; n != messages.size(); ++n) {
+		std::vector<char> buf;
+		write_compressed(buf, messages[n], outgoing);
+		const char* const data = buf.empty() ? NULL : &buf[0];
+		read_compressed(cfg, data, data + buf.size(), incoming);
+		if(!same_message(cfg,messages[n])) {
+			return 0;
+		}
+
+		bytes += buf.size();
+	}
+
+	return bytes;
+}
+
+//the size of the saved games written as text, compressed, and compressed
+//with zlib as saved games are, if it is available. Returns false if the
+//saved games read back differ from those written.
+bool save_sizes(const std::vector<config>& games, size_t& text, size_t& compressed, size_t& deflated)
+{
+	text = compressed = deflated = 0;
+	for(std::vector<config>::const_iterator g = games.begin(); g != games.end(); ++g) {
+		config game = *g;
+		std::ostringstream text_out, compressed_out, deflated_out;
+		write_possibly_compressed(text_out, game, false);
+		write_compressed(compressed_out, game);
+		write_possibly_compressed(deflated_out, game, true);
+
+		text += text_out.str().size();
+		compressed += compressed_out.str().size();
+		deflated += deflated_out.str().size();
+
+		std::istringstream in(deflated_out.str());
+		config read;
+		detect_format_and_read(read, in);
+		if(!same_message(read, game)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+//the messages as wesnothd receives them, read from the network
+std::vector<config> received_messages(const std::vector<config>& messages)
+{
+	std::vector<config> res(messages.size());
+	for(size_t n = 0; n != messages.size(); ++n) {
+		std::vector<char> buf;
+		write_compressed_literal(buf, messages[n]);
+		compression_schema schema;
+		const char* const data = buf.empty() ? NULL : &buf[0];
+		read_compressed(res[n], data, data + buf.size(), schema);
+	}
+
+	return res;
+}
+
+//the time taken by each kind of copy, in milliseconds, and the memory taken
+//by a copy of the saved games
+struct copy_timings
+{
+	copy_timings() : copy(0), change(0), record(0), bytes(0) {}
+	int copy, change, record;
+	size_t bytes;
+};
+
+//copies the saved games, once as they are and once changing the gold of the
+//sides of their snapshots afterwards, and records the messages as wesnothd
+//records the history of a game: each message is copied for the thread of
+//the game, and appended to the history.
+void copy_games(const std::vector<config>& games, const std::vector<config>& messages, size_t rounds, copy_timings& t)
+{
+	int ticks = SDL_GetTicks();
+	for(size_t n = 0; n != rounds; ++n) {
+		for(std::vector<config>::const_iterator g = games.begin(); g != games.end(); ++g) {
+			const config copy(*g);
+		}
+	}
+
+	t.copy += SDL_GetTicks() - ticks;
+
+	ticks = SDL_GetTicks();
+	for(size_t n = 0; n != rounds; ++n) {
+		for(std::vector<config>::const_iterator g = games.begin(); g != games.end(); ++g) {
+			config copy(*g);
+			config* const snapshot = copy.child("snapshot");
+			if(snapshot != NULL) {
+				for(config::child_itors s = snapshot->child_range("side"); s.first != s.second; ++s.first) {
+					(**s.first)["gold"] = "0";
+				}
+			}
+		}
+	}
+
+	t.change += SDL_GetTicks() - ticks;
+
+	ticks = SDL_GetTicks();
+	for(size_t n = 0; n != rounds; ++n) {
+		config history;
+		for(std::vector<config>::const_iterator m = messages.begin(); m != messages.end(); ++m) {
+			const config data(*m);
+			history.append(data);
+		}
+	}
+
+	t.record += SDL_GetTicks() - ticks;
+
+	const size_t bytes_before = allocated_bytes;
+	const std::vector<config> copies(games);
+	t.bytes = allocated_bytes - bytes_before;
+}
+
+//megabytes per second
+double rate(size_t bytes, int ms)
+{
+	return ms == 0 ? 0.0 : (double(bytes)/(1024*1024)) / (double(ms)/1000);
+}
+
+void find_nodes(const config& cfg, std::vector<const config*>& nodes)
+{
+	nodes.push_back(&cfg);
+	for(config::all_children_iterator i = cfg.ordered_begin(); i != cfg.ordered_end(); ++i) {
+		find_nodes(*(*i).second, nodes);
+	}
+}
+
+//reads the config file 'fname' and looks up its attributes and children
+//'rounds' times. The preprocessed text of its files is cached in 'cache_dir',
+//if it isn't empty.
+int benchmark_config(const std::string& fname, size_t rounds, const std::string& cache_dir)
+{
+	int ticks = SDL_GetTicks();
+	std::string text;
+	{
+		preproc_map defines;
+		scoped_istream stream = preprocess_file(fname, &defines, cache_dir);
+		text.assign(std::istreambuf_iterator<char>(*stream), std::istreambuf_iterator<char>());
+	}
+
+	const int preprocess_ticks = SDL_GetTicks() - ticks;
+
+	config cfg;
+	const size_t bytes_before = allocated_bytes, blocks_before = allocated_blocks;
+	ticks = SDL_GetTicks();
+	try {
+		std::istringstream stream(text);
+		read(cfg, stream);
+	} catch(config::error& e) {
+		std::cerr << "could not read '" << fname << "': " << e.message << "\n";
+		return -1;
+	}
+
+	const int read_ticks = SDL_GetTicks() - ticks;
+	const size_t bytes = allocated_bytes - bytes_before, blocks = allocated_blocks - blocks_before;
+
+	//every node is looked up by each of its own attribute and child keys, and
+	//by a key most of them don't have
+	std::vector<const config*> nodes;
+	find_nodes(cfg, nodes);
+
+	std::vector<std::pair<const config*,std::string> > attributes, children;
+	for(std::vector<const config*>::const_iterator n = nodes.begin(); n != nodes.end(); ++n) {
+		for(config::attribute_map::const_iterator i = (*n)->values.begin(); i != (*n)->values.end(); ++i) {
+			attributes.push_back(std::make_pair(*n, i->first));
+		}
+
+		attributes.push_back(std::make_pair(*n, std::string("id")));
+
+		const config::child_map& map = (*n)->all_children();
+		for(config::child_map::const_iterator i = map.begin(); i != map.end(); ++i) {
+			children.push_back(std::make_pair(*n, i->first));
+		}
+	}
+
+	size_t found = 0;
+	ticks = SDL_GetTicks();
+	for(size_t round = 0; round != rounds; ++round) {
+		for(std::vector<std::pair<const config*,std::string> >::const_iterator a = attributes.begin(); a != attributes.end(); ++a) {
+			found += (*a->first)[a->second].empty() ? 0 : 1;
+		}
+	}
+
+	const int attribute_ticks = SDL_GetTicks() - ticks;
+
+	ticks = SDL_GetTicks();
+	for(size_t round = 0; round != rounds; ++round) {
+		for(std::vector<std::pair<const config*,std::string> >::const_iterator c = children.begin(); c != children.end(); ++c) {
+			found += (c->first->child(c->second) != NULL ? 1 : 0) + c->first->get_children(c->second).size();
+		}
+	}
+
+	const int child_ticks = SDL_GetTicks() - ticks;
+
+	ticks = SDL_GetTicks();
+	cfg.clear();
+	const int clear_ticks = SDL_GetTicks() - ticks;
+
+	std::cout << fname << ": " << nodes.size() << " nodes, " << attributes.size() - nodes.size() << " attributes\n"
+	          << "  preprocessed in " << preprocess_ticks << " ms, read in " << read_ticks << " ms ("
+	          << rate(text.size(), read_ticks) << " MB/s)\n"
+	          << "  " << bytes << " bytes in " << blocks << " blocks once read, freed in " << clear_ticks << " ms\n"
+	          << "  " << rounds << " rounds of " << attributes.size() << " attribute lookups: " << attribute_ticks << " ms\n"
+	          << "  " << rounds << " rounds of " << children.size() << " child lookups: " << child_ticks << " ms\n";
+
+	//keeps the lookups from being optimized away
+	return found == 0 ? -1 : 0;
+}
+
+//parses the text WML file 'fname' 'rounds' times, from memory and through a
+//stream
+int benchmark_parse(const std::string& fname, size_t rounds)
+{
+	const std::string text = read_file(fname);
+	if(text.empty()) {
+		std::cerr << "could not read '" << fname << "'\n";
+		return -1;
+	}
+
+	int buffer_ticks = 0, stream_ticks = 0;
+	try {
+		for(size_t n = 0; n != rounds; ++n) {
+			config from_buffer, from_stream;
+			int ticks = SDL_GetTicks();
+			read(from_buffer, text.data(), text.data() + text.size());
+			buffer_ticks += SDL_GetTicks() - ticks;
+
+			ticks = SDL_GetTicks();
+			std::istringstream stream(text);
+			read(from_stream, stream);
+			stream_ticks += SDL_GetTicks() - ticks;
+		}
+	} catch(config::error& e) {
+		std::cerr << "could not read '" << fname << "': " << e.message << "\n";
+		return -1;
+	}
+
+	const size_t bytes = text.size() * rounds;
+	std::cout << fname << ": " << rounds << " rounds of " << text.size() << " bytes\n"
+	          << "  from memory:     " << buffer_ticks << " ms (" << rate(bytes,buffer_ticks) << " MB/s)\n"
+	          << "  through streams: " << stream_ticks << " ms (" << rate(bytes,stream_ticks) << " MB/s)\n";
+	return 0;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	size_t rounds = 20;
+	std::vector<std::string> files;
+	std::string config_file, parse_file, cache_dir;
+
+	for(int arg = 1; arg != argc; ++arg) {
+		const std::string val(argv[arg]);
+		if((val == "--rounds" || val == "-r") && arg+1 != argc) {
+			rounds = maximum<int>(1,atoi(argv[++arg]));
+		} else if((val == "--config" || val == "-c") && arg+1 != argc) {
+			config_file = argv[++arg];
+		} else if(val == "--cache-dir" && arg+1 != argc) {
+			cache_dir = get_dir(argv[++arg]);
+		} else if((val == "--parse" || val == "-p") && arg+1 != argc) {
+			parse_file = argv[++arg];
+		} else if(val.empty() || val[0] == '-') {
+			files.clear();
+			break;
+		} else {
+			files.push_back(val);
+		}
+	}
+
+	if(config_file.empty() == false) {
+		return benchmark_config(config_file, rounds, cache_dir);
+	}
+
+	if(parse_file.empty() == false) {
+		return benchmark_parse(parse_file, rounds);
+	}
+
+	if(files.empty()) {
+		std::cout << "usage: " << argv[0]
+			<< " [options] savegame...\n"
+			<< "  -c, --config file          Reads a config file, such as data/game.cfg, and looks up its\n"
+			<< "                             attributes and children n times instead\n"
+			<< "      --cache-dir dir        Caches the preprocessed text of the files read with --config\n"
+			<< "                             in dir\n"
+			<< "  -p, --parse file           Parses a text WML file, such as a saved game, n times instead\n"
+			<< "  -r, --rounds n             Sends the traffic of the saved games, and copies them,\n"
+			<< "                             n times (default: 20)\n";
+		return 0;
+	}
+
+	std::vector<config> games, messages;
+	try {
+		for(std::vector<std::string>::const_iterator f = files.begin(); f != files.end(); ++f) {
+			games.push_back(config());
+			scoped_istream stream = istream_file(*f);
+			detect_format_and_read(games.back(), *stream);
+			add_traffic(games.back(), messages);
+		}
+	} catch(config::error& e) {
+		std::cerr << "could not read the saved games: " << e.message << "\n";
+		return -1;
+	} catch(io_exception& e) {
+		std::cerr << "could not read the saved games: " << e.what() << "\n";
+		return -1;
+	}
+
+	timings streams, buffers;
+	copy_timings copies;
+	size_t bytes = 0, plain_bytes = 0, dictionary_bytes = 0;
+	size_t text_bytes, compressed_bytes, deflated_bytes;
+	try {
+		plain_bytes = sent_bytes(messages, false);
+		dictionary_bytes = sent_bytes(messages, true);
+		if(plain_bytes == 0 || dictionary_bytes == 0 || !save_sizes(games, text_bytes, compressed_bytes, deflated_bytes)) {
+			std::cerr << "the data read differs from the data written\n";
+			return -1;
+		}
+
+		for(size_t n = 0; n != rounds; ++n) {
+			bytes += run_streams(messages, streams);
+			if(!run_buffers(messages, buffers, n == 0)) {
+				std::cerr << "the data read differs from the data written\n";
+				return -1;
+			}
+		}
+
+		copy_games(games, received_messages(messages), rounds, copies);
+	} catch(config::error& e) {
+		std::cerr << "error in the compressed data: " << e.message << "\n";
+		return -1;
+	}
+
+	std::cout << rounds << " rounds of " << messages.size() << " messages, "
+	          << bytes/rounds << " bytes each round:\n"
+	          << "  through streams:  write " << streams.encode << " ms (" << rate(bytes,streams.encode)
+	          << " MB/s), read " << streams.decode << " ms (" << rate(bytes,streams.decode) << " MB/s)\n"
+	          << "  through buffers:  write " << buffers.encode << " ms (" << rate(bytes,buffers.encode)
+	          << " MB/s), read " << buffers.decode << " ms (" << rate(bytes,buffers.decode) << " MB/s)\n"
+	          << "  shared dictionary " << shared_dictionary_version << ": " << dictionary_bytes
+	          << " bytes instead of " << plain_bytes << "\n"
+	          << "  saved games: " << text_bytes << " bytes as text, " << compressed_bytes << " compressed, "
+	          << deflated_bytes << (deflate_available() ? " with zlib\n" : " without zlib\n")
+	          << "  copies of the saved games: " << copies.copy << " ms, " << copies.change
+	          << " ms changing the gold of the sides, " << copies.bytes << " bytes each\n"
+	          << "  history of the messages as wesnothd records it: " << copies.record << " ms\n";
+
+	return 0;
+}
@@ -219,6 +219,11 @@ t_string::t_string(const char* string) :
 
 t_string t_string::from_serialized(const std::string& string)
 {
+	//most strings, such as those of network data, have nothing to translate
+	if(string.empty() || (string[0] != TRANSLATABLE_PART && string[0] != UNTRANSLATABLE_PART)) {
+		return t_string(string);
+	}
+
 	t_string orig(string);
 
 	if(!string.empty() && (string[0] == TRANSLATABLE_PART || string[0] == UNTRANSLATABLE_PART)) {
@@ -244,6 +249,10 @@ t_string t_string::from_serialized(const std::string& string)
 
 std::string t_string::to_serialized() const
 {
+	if(!translatable_) {
+		return value_;
+	}
+
 	t_string res;
 
 	for(walker w(*this); !w.eos(); w.next()) {
@@ -41,6 +41,18 @@ namespace {
 	const std::string ModificationTypes[] = { "object", "trait", "advance" };
 	const size_t NumModificationTypes = sizeof(ModificationTypes)/
 	                                    sizeof(*ModificationTypes);
+
+	size_t state_generation = 0;
+
+	void state_changed()
+	{
+		++state_generation;
+	}
+}
+
+size_t unit_state_generation()
+{
+	return state_generation;
 }
 
 static bool compare_unit_values(unit const &a, unit const &b)
@@ -156,8 +168,8 @@ void unit::generate_traits()
 		return;
 
 	//calculate the unit's traits
-	std::vector<config*> candidate_traits = type().possible_traits();
-	std::vector<config*> traits;
+	config::child_list candidate_traits = type().possible_traits();
+	config::child_list traits;
 
 	const size_t num_traits = type().num_traits();
 	for(size_t n = 0; n != num_traits && candidate_traits.empty() == false; ++n) {
@@ -166,7 +178,7 @@ void unit::generate_traits()
 		candidate_traits.erase(candidate_traits.begin()+num);
 	}
 
-	for(std::vector<config*>::const_iterator j = traits.begin(); j != traits.end(); ++j) {
+	for(config::child_list::const_iterator j = traits.begin(); j != traits.end(); ++j) {
 		modifications_.add_child("trait",**j);
 	}
 
@@ -225,6 +237,7 @@ unit_race::GENDER unit::gender() const
 void unit::set_side(int new_side)
 {
 	side_ = new_side;
+	state_changed();
 }
 
 bool unit::unrenamable() const
@@ -366,6 +379,7 @@ void unit::new_level()
 
 	heal_all();
 	statusFlags_.clear();
+	state_changed();
 }
 
 void unit::set_resting(bool resting)
@@ -611,11 +625,13 @@ bool unit::matches_filter(const config& cfg) const
 void unit::set_flag(const std::string& flag)
 {
 	statusFlags_.insert(flag);
+	state_changed();
 }
 
 void unit::remove_flag(const std::string& flag)
 {
 	statusFlags_.erase(flag);
+	state_changed();
 }
 
 bool unit::has_flag(const std::string& flag) const
@@ -640,6 +656,8 @@ const std::vector<std::string>& unit::overlays() const
 
 void unit::read(const game_data& data, const config& cfg)
 {
+	state_changed();
+
 	std::map<std::string,unit_type>::const_iterator i = data.unit_types.find(cfg["type"]);
 	if(i != data.unit_types.end()) {
 		type_ = &i->second;
@@ -692,7 +710,7 @@ void unit::read(const game_data& data, const config& cfg)
 	custom_unit_description_ = cfg["unit_description"];
 
 	traitsDescription_ = cfg["traits_description"];
-	const string_map::const_iterator recruit_itor = cfg.values.find("canrecruit");
+	const config::attribute_map::const_iterator recruit_itor = cfg.values.find("canrecruit");
 	if(recruit_itor != cfg.values.end() && recruit_itor->second == "1") {
 		recruit_ = true;
 	}
@@ -722,7 +740,7 @@ void unit::read(const game_data& data, const config& cfg)
 	statusFlags_.clear();
 	const config* const status_flags = cfg.child("status");
 	if(status_flags != NULL) {
-		for(string_map::const_iterator i = status_flags->values.begin(); i != status_flags->values.end(); ++i) {
+		for(config::attribute_map::const_iterator i = status_flags->values.begin(); i != status_flags->values.end(); ++i) {
 			if(i->second == "on") {
 				statusFlags_.insert(i->first);
 			}
@@ -1028,6 +1046,8 @@ size_t unit::modification_count(const std::string& type, const std::string& id)
 void unit::add_modification(const std::string& type,
                             const config& mod, bool no_add)
 {
+	state_changed();
+
 	if(no_add == false) {
 		modifications_.add_child(type,mod);
 	}
@@ -1401,6 +1421,122 @@ std::string get_team_name(int side, const unit_map& units)
 	return "-";
 }
 
+unit_map::unit_map(const unit_map& o) : base(o), width_(0), height_(0)
+{
+	rebuild_grid();
+
+	//the copy may be made where a map whose results were kept used to be
+	state_changed();
+}
+
+unit_map& unit_map::operator=(const unit_map& o)
+{
+	if(&o != this) {
+		base::operator=(o);
+		rebuild_grid();
+		state_changed();
+	}
+
+	return *this;
+}
+
+unit_map::iterator unit_map::find(const gamemap::location& loc)
+{
+	if(in_grid(loc)) {
+		return grid_[loc.x + loc.y*width_];
+	}
+
+	return base::find(loc);
+}
+
+unit_map::const_iterator unit_map::find(const gamemap::location& loc) const
+{
+	if(in_grid(loc)) {
+		return grid_[loc.x + loc.y*width_];
+	}
+
+	return base::find(loc);
+}
+
+std::pair<unit_map::iterator,bool> unit_map::insert(const value_type& val)
+{
+	const std::pair<iterator,bool> res = base::insert(val);
+	if(res.second && val.first.valid()) {
+		reserve(val.first);
+		grid_[val.first.x + val.first.y*width_] = res.first;
+	}
+
+	if(res.second) {
+		state_changed();
+	}
+
+	return res;
+}
+
+void unit_map::erase(iterator it)
+{
+	if(in_grid(it->first)) {
+		grid_[it->first.x + it->first.y*width_] = base::end();
+	}
+
+	base::erase(it);
+	state_changed();
+}
+
+unit_map::size_type unit_map::erase(const gamemap::location& loc)
+{
+	const iterator it = find(loc);
+	if(it == end()) {
+		return 0;
+	}
+
+	erase(it);
+	return 1;
+}
+
+void unit_map::clear()
+{
+	base::clear();
+	std::fill(grid_.begin(), grid_.end(), base::end());
+	state_changed();
+}
+
+void unit_map::swap(unit_map& o)
+{
+	base::swap(o);
+	rebuild_grid();
+	o.rebuild_grid();
+	state_changed();
+}
+
+void unit_map::reserve(const gamemap::location& loc)
+{
+	if(in_grid(loc)) {
+		return;
+	}
+
+	//grow by at least half of the current size, so that filling a map
+	//from its top left corner doesn't rebuild the grid for every row
+	width_ = maximum<int>(loc.x + 1, width_ + width_/2);
+	height_ = maximum<int>(loc.y + 1, height_ + height_/2);
+	rebuild_grid();
+}
+
+void unit_map::rebuild_grid()
+{
+	for(const_iterator i = base::begin(); i != base::end(); ++i) {
+		width_ = maximum<int>(width_, i->first.x + 1);
+		height_ = maximum<int>(height_, i->first.y + 1);
+	}
+
+	grid_.assign(width_*height_, base::end());
+	for(iterator i = base::begin(); i != base::end(); ++i) {
+		if(i->first.valid()) {
+			grid_[i->first.x + i->first.y*width_] = i;
+		}
+	}
+}
+
 temporary_unit_placer::temporary_unit_placer(unit_map& m, const gamemap::location& loc, const unit& u)
   : m_(m), loc_(loc), temp_(m.count(loc) == 1 ? m.find(loc)->second : u), use_temp_(m.count(loc) == 1)
 {
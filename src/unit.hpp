@@ -19,13 +19,13 @@
 #include "team.hpp"
 #include "unit_types.hpp"
 
+#include <map>
 #include <set>
 #include <string>
 #include <vector>
 
 class unit;
-
-typedef std::map<gamemap::location,unit> unit_map;
+class unit_map;
 
 class unit
 {
@@ -241,6 +241,56 @@ private:
 	void generate_traits_description();
 };
 
+//the container of all units on the map. It keeps the units ordered by
+//location like a std::map, and its iterators are std::map iterators, but it
+//also keeps a grid, as large as the furthest location used, which indexes
+//each occupied hex to its unit so that find() and count() don't need to walk
+//the tree. Since the grid must follow every insertion and removal, the
+//underlying map is not accessible directly.
+class unit_map : private std::map<gamemap::location,unit>
+{
+	typedef std::map<gamemap::location,unit> base;
+public:
+	typedef base::key_type key_type;
+	typedef base::mapped_type mapped_type;
+	typedef base::value_type value_type;
+	typedef base::size_type size_type;
+	typedef base::iterator iterator;
+	typedef base::const_iterator const_iterator;
+
+	unit_map() : width_(0), height_(0) {}
+	unit_map(const unit_map& o);
+	unit_map& operator=(const unit_map& o);
+
+	using base::begin;
+	using base::end;
+	using base::size;
+	using base::empty;
+
+	iterator find(const gamemap::location& loc);
+	const_iterator find(const gamemap::location& loc) const;
+	size_type count(const gamemap::location& loc) const { return find(loc) != end() ? 1 : 0; }
+
+	std::pair<iterator,bool> insert(const value_type& val);
+
+	void erase(iterator it);
+	size_type erase(const gamemap::location& loc);
+	void clear();
+	void swap(unit_map& o);
+
+private:
+	bool in_grid(const gamemap::location& loc) const
+	{ return loc.x >= 0 && loc.y >= 0 && loc.x < width_ && loc.y < height_; }
+
+	//grows the grid so that it covers loc
+	void reserve(const gamemap::location& loc);
+	void rebuild_grid();
+
+	//the iterator of the unit on each hex, or end() for vacant hexes
+	std::vector<iterator> grid_;
+	int width_, height_;
+};
+
 //object which temporarily resets a unit's movement
 struct unit_movement_resetter
 {
@@ -263,6 +313,12 @@ private:
 
 void sort_units(std::vector< unit > &);
 
+//returns a number which changes whenever the side, flags or modifications of
+//a unit change, a unit is added to or removed from a unit_map, or a unit_map is
+//copied. Results computed from the state of units may be kept for as long as
+//it stays the same.
+size_t unit_state_generation();
+
 int team_units(const unit_map& units, int team_num);
 int team_upkeep(const unit_map& units, int team_num);
 unit_map::const_iterator team_leader(int side, const unit_map& units);
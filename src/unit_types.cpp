@@ -516,7 +516,7 @@ string_map unit_movement_type::damage_table() const
 
 	const config* const resistance = cfg_.child("resistance");
 	if(resistance != NULL) {
-		for(string_map::const_iterator i = resistance->values.begin(); i != resistance->values.end(); ++i) {
+		for(config::attribute_map::const_iterator i = resistance->values.begin(); i != resistance->values.end(); ++i) {
 			res[i->first] = i->second;
 		}
 	}
@@ -560,7 +560,7 @@ unit_type::unit_type(const unit_type& o)
 }
 
 unit_type::unit_type(const config& cfg, const movement_type_map& mv_types,
-                     const race_map& races, const std::vector<config*>& traits)
+                     const race_map& races, const config::child_list& traits)
 	: cfg_(cfg), alpha_(ftofxp(1.0)), movementType_(cfg), possibleTraits_(traits)
 {
 	const config::child_list& variations = cfg.get_children("variation");
@@ -1035,7 +1035,7 @@ bool unit_type::has_ability(const std::string& ability) const
 	return std::find(abilities_.begin(),abilities_.end(),ability) != abilities_.end();
 }
 
-const std::vector<config*>& unit_type::possible_traits() const
+const config::child_list& unit_type::possible_traits() const
 {
 	return possibleTraits_;
 }
@@ -1200,12 +1200,16 @@ game_data::game_data(const config& cfg)
 
 void game_data::set_config(const config& cfg, bool allow_advancefrom)
 {
-	static const std::vector<config*> dummy_traits;
+	static const config::child_list dummy_traits;
 
 	const config::child_list& unit_traits = cfg.get_children("trait");
 
+	//the movement types and unit types keep referring to their configs,
+	//which the AI reads from several threads, so the children of those
+	//which are read lazily from the game config cache are read now
 	for(config::const_child_itors i = cfg.child_range("movetype");
 	    i.first != i.second; ++i.first) {
+		(**i.first).load_all_children();
 		const unit_movement_type move_type(**i.first);
 		movement_types.insert(
 				std::pair<std::string,unit_movement_type>(move_type.name(),
@@ -1220,6 +1224,7 @@ void game_data::set_config(const config& cfg, bool allow_advancefrom)
 
 	for(config::const_child_itors j = cfg.child_range("unit");
 	    j.first != j.second; ++j.first) {
+		(**j.first).load_all_children();
 		const unit_type u_type(**j.first,movement_types,races,unit_traits);
 		unit_types.insert(std::pair<std::string,unit_type>(u_type.id(),u_type));
 	}
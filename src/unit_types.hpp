@@ -160,7 +160,7 @@ public:
 	//this class assumes that the passed in references will remain valid
 	//for at least as long as the class instance
 	unit_type(const config& cfg, const movement_type_map& movement_types,
-	          const race_map& races, const std::vector<config*>& traits);
+	          const race_map& races, const config::child_list& traits);
 	unit_type(const unit_type& o);
 
 	~unit_type();
@@ -248,7 +248,7 @@ public:
 
 	bool has_ability(const std::string& ability) const;
 
-	const std::vector<config*>& possible_traits() const;
+	const config::child_list& possible_traits() const;
 
 	const std::vector<unit_race::GENDER>& genders() const;
 
@@ -292,7 +292,7 @@ private:
 
 	unit_movement_type movementType_;
 
-	std::vector<config*> possibleTraits_;
+	config::child_list possibleTraits_;
 
 	std::vector<unit_race::GENDER> genders_;
 
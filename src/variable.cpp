@@ -63,7 +63,7 @@ const config vconfig::get_parsed_config() const
 {
 	config res;
 
-	for(string_map::const_iterator itor = cfg_->values.begin();
+	for(config::attribute_map::const_iterator itor = cfg_->values.begin();
 			itor != cfg_->values.end(); ++itor) {
 
 		res[itor->first] = expand(itor->first);
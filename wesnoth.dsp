@@ -121,6 +121,14 @@ SOURCE=.\src\astarnode.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\src\attack_prediction.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\src\serialization\binary_cache.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\src\serialization\binary_or_text.cpp
 # End Source File
 # Begin Source File
@@ -129,6 +137,10 @@ SOURCE=.\src\serialization\binary_wml.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\src\serialization\deflate.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\src\builder.cpp
 # End Source File
 # Begin Source File
@@ -513,6 +525,14 @@ SOURCE=.\src\astarnode.hpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\src\attack_prediction.hpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\src\serialization\binary_cache.hpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\src\serialization\binary_or_text.hpp
 # End Source File
 # Begin Source File
@@ -521,6 +541,10 @@ SOURCE=.\src\serialization\binary_wml.hpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\src\serialization\deflate.hpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\src\builder.hpp
 # End Source File
 # Begin Source File